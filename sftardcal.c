@@ -55,6 +55,10 @@
 
 
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for 'splice()', see 'console_bridge()' */
+#endif // __linux__
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -77,21 +81,52 @@
 #include <sys/ioctl.h> // linux needs this instead
 //#endif // __FreeBSD__
 #include <sys/socket.h>
+#include <sys/uio.h> // writev
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
+#include <pthread.h>
 #include <sys/types.h>
 //#include <netinet6/in6.h> // sockaddr_in6 and ipv6-related stuff
 #include <netinet/in.h> // sockaddr_in
 #endif // WIN32
 
+#ifdef __SSE2__
+#include <emmintrin.h> // CR/LF scan in 'console_loop'
+#endif // __SSE2__
+
 #include "sftardcal.h"
 
+#ifndef WIN32
+#include "sftcapture.h"
+#include "sfttelemetry.h"
+#endif // WIN32
+#include "sftmetrics.h" // no-op macros on WIN32
+#include "sftprobes.h"  // USDT, when <sys/sdt.h> is there
+
 #ifdef WITH_XMODEM
 #define SFTARDCAL
+#define XMODEM_METRIC(X) metrics_add(METRIC_XMODEM_##X, 1)
+#define XMODEM_PROBE1(X,A) SFT_PROBE1(X,A)
+#define XMODEM_PROBE2(X,A,B) SFT_PROBE2(X,A,B)
 #include "xmodem.c"
 #endif // WITH_XMODEM
 
+#ifndef WIN32
+#include "sftframe.c" // '-f', the same code the device builds
+#include "sftmux.c"   // '-V'
+#include "sftbaud.h"  // '-A' (the device's half is 'sftbaud.c')
+#endif // WIN32
+
 #define DEFAULT_RESET_WAIT 5
+#define DEFAULT_SERIAL_RING_PAGES 16 /* 64k with 4k pages */
+#define CACHE_LINE_SIZE 64 /* keeps the producer and consumer side of a ring apart */
+#define QUESTION_FORMAT_RAW  0 /* the reply, as is (one question only, the original '-q') */
+#define QUESTION_FORMAT_JSON 1 /* {"question":..,"reply":..,"msecs":..,"timeout":..} per line */
+#define QUESTION_FORMAT_NUL  2 /* question, NUL, reply, NUL */
+#define QUESTION_MAX_DEPTH 64 /* for '-p' */
+#define REPLY_END_MAX 16 /* '-E' prompts and lines */
+#define REPLY_END_MAX_LENGTH 64 /* characters in one of them */
 //#define LINUX_SPECIAL_HANDLING
 
 // DEFAULT SERIAL CONFIGURATION:  9600 baud, n, 8, 1 using argv[1] or /dev/ttyU0 as the input
@@ -113,6 +148,8 @@ HANDLE iStdOut; // note that for non-WIN32 I define 'HANDLE' as 'int'
 #ifdef WIN32
 
 #define pAltConsole FALSE
+#define bCaptureActive 0 /* no '-C' */
+#define capture_command(X)
 
 #define COMM_RW_EV EV_ERR | EV_RXCHAR | EV_TXEMPTY
 #define COMM_RO_EV EV_ERR | EV_RXCHAR
@@ -125,12 +162,34 @@ char *pAltConsole = NULL;
 static char szBaud[256]="9600,n,8,1"; // baud rate expression, default is 9600,n,8,1
 #ifdef WITH_XMODEM
 static char szXModemFile[512]="";
+#ifndef WIN32
+static char *pszFleetPorts = NULL; // '-P' list of serial devices for a fleet XMODEM send
+#endif // WIN32
 #endif // WITH_XMODEM
 
 static int iExperimental = 0;
 static int iVerbosity = 0, bFactoryReset = 0, bLocalEcho = 0, bSerialDebug=0, bListenMode=0, bIsTCP=0,
            iResetWait=0, iFlowControl=0, bQuietFlag = 0;
 static int iTerminator = 0; // CRLF [default]
+#ifndef WIN32
+static int iMultiClient = 0; // '-M' - 1 drops data for slow clients, 2 disconnects them
+static int iSerialRingPages = DEFAULT_SERIAL_RING_PAGES; // '-Z' - serial input ring size, 0 to read the port directly
+static char *pszCaptureFile = NULL; // '-C' - binary session capture
+static int bCaptureDeflate = 0;
+static char *pszMetricsSocket = NULL; // '-S' - counters on a Unix socket
+static char *pszTelemetryFile = NULL; // '-T' - parsed samples from a device that streams them
+static int bTelemetryDeflate = 0;
+static char *pszTelemetryFields = NULL; // '-Y' - field names, "V,I"
+static int iTelemetryWindow = 0; // '-D' - samples per row, min/max/mean
+static char *pszShmName = NULL; // '-G' - the '-Y' samples in shared memory, "/name"
+static int iShmRing = 0; // samples in its ring, 0 for the default
+static int bLatencyReport = 0; // '-H' - command latency table at exit
+static char *pszPollSchedule = NULL; // '-s' - commands to send periodically
+static int bFrameFlag = 0; // '-f' - '-q' in binary frames, if the device knows them
+static int bMuxFlag = 0; // '-V' - console, telemetry and a file at the same time, in virtual channels
+static char *pszMuxFile = NULL; // '-U' - the file to send on the file channel
+static unsigned long ulBaudMax = 0; // '-A' - step the baud rate up, as far as this
+#endif // WIN32
 #ifdef WITH_XMODEM
 static int bXModemFlag=0;
 #endif // WITH_XMODEM
@@ -139,6 +198,8 @@ static int bCommandRepeatOnTimeoutFlag = 1; // default is to repeat a command ev
 
 static char *pszQuestion = NULL; // not null to ask a question, get reply, and exit
 static int iQuestionWait=5000; // default question wait time
+static int iQuestionFormat = -1; // '-j' or '-0' - QUESTION_FORMAT_xxx, -1 for the default
+static int iQuestionDepth = 1; // '-p' - questions sent before their replies come back
 
 // other internal (semi-global) flags
 
@@ -149,9 +210,24 @@ static int bMyGetsEchoFlag = 1;
 //   sftardcal -c /var/run/unix_socket /dev/ttyU0
 
 static void ttyconfigSTR(HANDLE iFile, char *szBaud);
+static int reply_end_add(const char *pszSpec); // '-E'
+static int reply_line_ending(char *pOut);
 #ifdef WITH_XMODEM
 static void do_xmodem(HANDLE iFile, HANDLE iConsole); // internal XMODEM functionality
+#ifndef WIN32
+static int do_xmodem_fleet(void); // same file sent to every port in 'pszFleetPorts', concurrently
+#endif // WIN32
 #endif // WITH_XMODEM
+#ifndef WIN32
+static int serial_ring_start(HANDLE iFile, int nPages); // serial input thread and ring
+static void serial_ring_stop(void);
+static void telemetry_loop(HANDLE iFile); // '-T' and '-G'
+static void poll_loop(HANDLE iFile, HANDLE iConsole); // '-s'
+static void mux_loop(HANDLE iFile, HANDLE iConsole); // '-V'
+static void baud_negotiate(HANDLE iFile); // '-A'
+static void baud_watch(HANDLE iFile);
+static void baud_restore(HANDLE iFile);
+#endif // WIN32
 
 // console restore and 'alt console' - non-WIN32 only
 #ifndef WIN32
@@ -168,6 +244,7 @@ int do_main(int argc, char *argv[], char *envp[], HANDLE *piFile, HANDLE *piCons
 HANDLE iGlobalFileHandle = -1; // global because FBSD will need to unlock it
 #endif // WIN32
 
+#ifndef SFTARDCAL_LIBRARY /* 'sftbench.c' includes this file and supplies its own 'main' */
 int main(int argc, char *argv[], char *envp[])
 {
 #ifdef WIN32
@@ -220,6 +297,7 @@ int iRval;
 
   return iRval;
 }
+#endif // SFTARDCAL_LIBRARY
 
 
 void usage()
@@ -255,6 +333,11 @@ void usage()
         "\t   The command 'XSfilename' or 'XRfilename' (followed by \\r) is sent\n"
         "\t   to the remote device, followed by the file transfer itself.\n"
         "\t   This option may not be used with '-q', '-r', or '-R'\n"
+#ifndef WIN32
+        " and\t-P dev1,dev2[,...] sends the '-XS' file to ALL of the listed\n"
+            "\t   serial devices at the same time (fleet distribution).  Use\n"
+            "\t   '-P @filename' to read the device list from a file, one per line\n"
+#endif // WIN32
 #endif // WITH_XMODEM
 #ifndef WIN32
         " and\t-c specifies an alternate console for stdin,stdout\n"
@@ -263,10 +346,79 @@ void usage()
         " and\t-l is a special case version of '-c' that allows you to LISTEN for\n"
             "\t   a TCP connection on a specific TCP port, optionally specifying\n"
             "\t   the 'bind' address (default is all available IPs).\n"
+        " and\t-M drop|close lets '-l' accept many clients at the same time\n"
+            "\t   (requires '-r').  Serial output goes to every client, and one\n"
+            "\t   that can't keep up loses data ('drop') or is disconnected\n"
+            "\t   ('close').  Input from clients is sent one line at a time.\n"
+        " and\t-C file[,z] captures all serial I/O, modem line changes, and\n"
+            "\t   commands to a binary file, with timestamps (',z' compresses\n"
+            "\t   it).  Use 'sftcapdump' to read it\n"
+        " and\t-S path serves I/O and protocol counters in Prometheus text\n"
+            "\t   format on a Unix socket.  SIGUSR1 writes them to stderr\n"
+        " and\t-H prints a table of command latency percentiles at exit, one\n"
+            "\t   line for each command (by its first word), slowest total first\n"
+        " and\t-T file[,z] records the measurements a device streams, one line\n"
+            "\t   at a time, in a binary file of columns (',z' compresses it)\n"
+            "\t   until ^C.  Use 'sfttelem' to read it (CSV)\n"
+        " and\t-Y name[,name...] the fields for '-T', from 'name=value' (or\n"
+            "\t   'name:value') in each line, i.e. '-Y V,I' for 'V=1.2 I=0.02'\n"
+        " and\t-D n records the min, max, and mean of each '-T' field over\n"
+            "\t   every 'n' samples, instead of each sample\n"
+        " and\t-G /name[,n] publishes each '-Y' sample in POSIX shared memory\n"
+            "\t   (with or without '-T'), the newest value of each field and a\n"
+            "\t   ring of the last 'n' samples (default 4096), for other programs\n"
+            "\t   to read while the port is open.  See 'sftshm.h' and 'sftpeek'\n"
+        " and\t-Z pages sets the size of the serial input ring (default 16,\n"
+            "\t   rounded up to a power of 2).  A separate thread reads the port\n"
+            "\t   into it, so slow output can't cause an overrun.  0 disables it\n"
         " and\t-q specifies a 'question' to send.  response returned on stdout\n"
             "\t   implies '-N' to disable serial port auto-reset.\n"
             "\t   This option may not be used with '-r', '-R', or '-X'\n"
         " and\t-w specifies a wait time (for use with '-q'), default 5 seconds\n"
+            "\t   A reply ends when the device has been quiet this long\n"
+        " and\t-q @file (or '-q -' for stdin) sends the questions in 'file', one\n"
+            "\t   per line, in order over the same connection ('#' starts a\n"
+            "\t   comment).  Each reply is written as a JSON line as soon as it\n"
+            "\t   ends:  {\"question\":..,\"reply\":..,\"msecs\":..,\"timeout\":..}\n"
+        " and\t-j writes '-q' replies (and '-s' polls) as JSON lines (the\n"
+            "\t   default for '@file')\n"
+        " and\t-0 writes '-q' question, NUL, reply, NUL instead of JSON\n"
+        " and\t-p depth sends up to 'depth' questions ahead of their replies\n"
+            "\t   (default 1).  A reply then ends where the device echoes the\n"
+            "\t   next question, so only the last one waits for '-w'.  The\n"
+            "\t   device must echo its input, and have room to buffer it\n"
+        " and\t-E end ends a '-q' reply as soon as 'end' arrives, instead of\n"
+            "\t   waiting for '-w' of quiet.  'end' is a whole line (i.e. 'OK'),\n"
+            "\t   'prompt:text' (anywhere, and left out of the reply),\n"
+            "\t   'lines:n' or 'bytes:n'.  Give it more than once for 'OK' or\n"
+            "\t   'ERROR'.  '-w' still applies when none of them arrive.  With\n"
+            "\t   '-s' it ends console and bulk replies (otherwise one line)\n"
+        " and\t-f sends '-q' questions in binary frames (COBS with a CRC, see\n"
+            "\t   'sftframe.h'), if the device answers 'FRAME' with one (text\n"
+            "\t   lines if it doesn't).  A reply can be binary, and it ends with\n"
+            "\t   the device's END frame, not '-w' of quiet or '-E'\n"
+        " and\t-s schedule polls the device until ^C.  Each line of 'schedule'\n"
+            "\t   (or stdin for '-') is 'period priority command', i.e. '50ms 0 V'\n"
+            "\t   or '1s 1 T', and each command is sent once every 'period', the\n"
+            "\t   one whose period ends first first (then by priority, 0 first).\n"
+            "\t   Replies are written as 'time<TAB>late<TAB>command<TAB>reply',\n"
+            "\t   or JSON lines with '-j'.  Overruns and missed periods are\n"
+            "\t   reported on stderr.  '-w' limits the wait for a reply.\n"
+            "\t   'period bulk[:priority] cmd;cmd..' runs the commands one at a\n"
+            "\t   time when no poll is due.  Lines typed on the console are sent\n"
+            "\t   before the next poll, and wait for one command at most\n"
+        " and\t-V runs the console, the device's telemetry ('-T' and '-G'),\n"
+            "\t   and a file ('-U') at the same time, in virtual channels over\n"
+            "\t   binary frames (see 'sftmux.h'), until ^C.  Without '-T' or\n"
+            "\t   '-G', it ends '-w' after the console input and file are done\n"
+        " and\t-U file sends 'file' to the device on the '-V' file channel, while\n"
+            "\t   the console and telemetry go on.  The device's answer is on\n"
+            "\t   stderr.  It takes the place of '-XS' for a device that knows it\n"
+        " and\t-A rate steps the baud rate up after connecting, through the\n"
+            "\t   device's rates up to 'rate' (see 'sftbaud.h').  Each one is\n"
+            "\t   tried with a CRC-checked loopback burst, and the highest that\n"
+            "\t   passes is kept.  With '-f' or '-V', frame errors later step it\n"
+            "\t   down again.  It goes back to the '-B' rate at exit\n"
 #endif // WIN32
         "\n"
         "-and-\t-h prints this message\n\n", stderr);
@@ -289,6 +441,7 @@ static const char szMsg[]="\nError - exit on signal (console settings restored)\
   }
 
   conrestore();
+  sftardcal_debug_flush(); // the log sink thread still has to write what's queued
   write(2, szMsg, sizeof(szMsg) - 1);
 
   _exit(iSig);  // bye [must call THIS version of 'exit()']
@@ -310,8 +463,11 @@ const char *p1;
   signal(SIGINT, signalproc);
   signal(SIGTSTP, signalproc);
   signal(SIGTERM, signalproc);
-  signal(SIGUSR1, signalproc);
   signal(SIGUSR2, signalproc);
+
+  // SIGUSR1 writes the counters to stderr instead.  it's blocked in every thread
+  // but one, so it doesn't interrupt any I/O
+  metrics_signal(SIGUSR1);
 #endif // WIN32
 
   // stdout handle - for POSIX it's always '1', for Windows you need 'GetStdHandle()'
@@ -379,6 +535,19 @@ const char *p1;
     conconfig(*piConsole); // configure the console (for windows it starts a thread)
   }
 
+#if defined(WITH_XMODEM) && !defined(WIN32)
+  if(pszFleetPorts) // fleet distribution opens its own ports, one process per port
+  {
+    i1 = do_xmodem_fleet();
+
+    conrestore();
+    close(*piConsole);
+    *piConsole = -1;
+
+    return i1;
+  }
+#endif // WITH_XMODEM, !WIN32
+
 #ifdef WIN32
 
   *piFile = CreateFile(pIn, GENERIC_READ | GENERIC_WRITE, 0,
@@ -428,6 +597,42 @@ const char *p1;
 
   ttyconfigSTR(*piFile, szBaud); // POOBAH
 
+#ifndef WIN32
+  if(pszCaptureFile && capture_open(pszCaptureFile, bCaptureDeflate, pIn, *piFile))
+  {
+    close(*piFile);
+    close(*piConsole);
+    *piFile = *piConsole = -1;
+    return -1;
+  }
+
+  if(pszMetricsSocket && metrics_serve(pszMetricsSocket))
+  {
+    capture_close();
+    close(*piFile);
+    close(*piConsole);
+    *piFile = *piConsole = -1;
+    return -1;
+  }
+
+  if((pszTelemetryFile || pszShmName) &&
+     telemetry_open(pszTelemetryFile, bTelemetryDeflate, pIn, pszTelemetryFields, iTelemetryWindow,
+                    pszShmName, iShmRing))
+  {
+    metrics_stop();
+    capture_close();
+    close(*piFile);
+    close(*piConsole);
+    *piFile = *piConsole = -1;
+    return -1;
+  }
+
+  if(iSerialRingPages > 0)
+  {
+    serial_ring_start(*piFile, iSerialRingPages); // if it fails, the port is read directly
+  }
+#endif // WIN32
+
   if(iExperimental)
   {
     // perform experiments here
@@ -475,10 +680,31 @@ const char *p1;
     fflush(stdout);
   }
 
+#ifndef WIN32
+  if(ulBaudMax)
+  {
+    baud_negotiate(*piFile);
+  }
+#endif // WIN32
+
   if(pszQuestion)
   {
     question_loop(*piFile, *piConsole);
   }
+#ifndef WIN32
+  else if(bMuxFlag) // before '-T', which it does too
+  {
+    mux_loop(*piFile, *piConsole);
+  }
+  else if(pszTelemetryFile || pszShmName)
+  {
+    telemetry_loop(*piFile);
+  }
+  else if(pszPollSchedule)
+  {
+    poll_loop(*piFile, *piConsole);
+  }
+#endif // WIN32
   else if(bRawFlag)
   {
     console_loop(*piFile, *piConsole);
@@ -495,6 +721,10 @@ const char *p1;
     calibrate_loop(*piFile, *piConsole);
   }
 
+#ifndef WIN32
+  baud_restore(*piFile);
+#endif // WIN32
+
   if(iResetWait >= 0 || iFlowControl > 0)
   {
     set_rts_dtr(*piFile, 0); // NOTE:  avrdude does this, setting RTS and DTR _LOW_ at this point - should I?
@@ -515,9 +745,18 @@ exit_point:
   signal(SIGINT, SIG_DFL);  // SIG_IGN);
   signal(SIGTSTP, SIG_DFL); // SIG_IGN);
   signal(SIGTERM, SIG_DFL); // SIG_IGN);
-  signal(SIGUSR1, SIG_DFL); // SIG_IGN);
   signal(SIGUSR2, SIG_DFL); // SIG_IGN);
 
+  serial_ring_stop(); // before the port is closed
+  capture_close();    // after the ring, which may still be capturing
+  telemetry_close();
+  metrics_stop();
+
+  if(bLatencyReport)
+  {
+    metrics_latency_report();
+  }
+
 #ifdef __FreeBSD__
   flock(*piFile, LOCK_UN);
 #endif // __FreeBSD__
@@ -715,9 +954,9 @@ int i1, optind;
 int i1;
 
   while((i1 = getopt(argc, argv,
-                     "xhrmndeFRvNQW:l:B:c:q:w:"
+                     "xhrmndeFRvNQHj0fVW:l:B:c:q:w:p:E:M:Z:C:S:T:Y:D:G:s:U:A:"
 #ifdef WITH_XMODEM
-                     "X:"
+                     "X:P:"
 #endif // WITH_XMODEM
                      )) != -1)
   {
@@ -817,6 +1056,105 @@ int i1;
         pAltConsole = malloc(strlen(optarg) + 1);
         strcpy(pAltConsole, optarg);
         break;
+      case 'M': // multi-client 'listen' mode
+        if(!strcmp(optarg, "drop"))
+        {
+          iMultiClient = 1;
+        }
+        else if(!strcmp(optarg, "close"))
+        {
+          iMultiClient = 2;
+        }
+        else
+        {
+          fprintf(stderr, "The '-M' option must be 'drop' or 'close'\n");
+          return 1;
+        }
+        break;
+      case 'C': // binary session capture
+        pszCaptureFile = malloc(strlen(optarg) + 1);
+        strcpy(pszCaptureFile, optarg);
+
+        if(strlen(pszCaptureFile) > 2 && !strcmp(pszCaptureFile + strlen(pszCaptureFile) - 2, ",z"))
+        {
+          pszCaptureFile[strlen(pszCaptureFile) - 2] = 0;
+          bCaptureDeflate = 1;
+        }
+        break;
+      case 'S': // metrics socket
+        pszMetricsSocket = optarg;
+        break;
+      case 'T': // telemetry file
+        pszTelemetryFile = malloc(strlen(optarg) + 1);
+        strcpy(pszTelemetryFile, optarg);
+
+        if(strlen(pszTelemetryFile) > 2 && !strcmp(pszTelemetryFile + strlen(pszTelemetryFile) - 2, ",z"))
+        {
+          pszTelemetryFile[strlen(pszTelemetryFile) - 2] = 0;
+          bTelemetryDeflate = 1;
+        }
+        break;
+      case 'Y': // telemetry fields
+        pszTelemetryFields = optarg;
+        break;
+      case 'D': // telemetry decimation
+        iTelemetryWindow = atoi(optarg);
+
+        if(iTelemetryWindow < 1)
+        {
+          fputs("The '-D' option must be 1 or more (samples)\n", stderr);
+          return 1;
+        }
+        break;
+      case 'G': // telemetry in shared memory
+        pszShmName = malloc(strlen(optarg) + 1);
+        strcpy(pszShmName, optarg);
+
+        if(strchr(pszShmName, ','))
+        {
+          iShmRing = atoi(strchr(pszShmName, ',') + 1);
+          *strchr(pszShmName, ',') = 0;
+
+          if(iShmRing < 1)
+          {
+            fputs("The '-G' ring size must be 1 or more (samples)\n", stderr);
+            return 1;
+          }
+        }
+        break;
+      case 's': // poll schedule
+        pszPollSchedule = optarg;
+        break;
+      case 'f': // binary frames
+        bFrameFlag = 1;
+        break;
+      case 'V': // virtual channels
+        bMuxFlag = 1;
+        break;
+      case 'U': // a file on the file channel
+        pszMuxFile = optarg;
+        break;
+      case 'A': // baud rate upshift
+        ulBaudMax = strtoul(optarg, NULL, 10);
+
+        if(!ulBaudMax)
+        {
+          fputs("The '-A' option needs the highest baud rate to try, i.e. '-A 2000000'\n", stderr);
+          return 1;
+        }
+        break;
+      case 'H': // latency table
+        bLatencyReport = 1;
+        break;
+      case 'Z': // serial input ring size
+        iSerialRingPages = atoi(optarg);
+
+        if(iSerialRingPages < 0 || iSerialRingPages > 65536)
+        {
+          fputs("The '-Z' option must be 0 to 65536 (pages)\n", stderr);
+          return 1;
+        }
+        break;
       case 'B': // specify a console
 //        if(!optarg || *optarg == ':')
 //        {
@@ -845,6 +1183,24 @@ int i1;
         bXModemFlag = 1;
 
         break;
+
+      case 'P': // fleet distribution, list of ports (used with '-XS')
+        if(bRawFlag || bFactoryReset || pszQuestion != NULL ||
+           !optarg || !*optarg)
+        {
+          usage();
+          return 1;
+        }
+
+        pszFleetPorts = malloc(strlen(optarg) + 1);
+        if(!pszFleetPorts)
+        {
+          fprintf(stderr, "Unable to allocate memory for arg!\n");
+          return 1;
+        }
+
+        strcpy(pszFleetPorts, optarg);
+        break;
 #endif // WITH_XMODEM
 
       case 'Q': // quiet mode
@@ -877,6 +1233,31 @@ int i1;
 
         break;
 
+      case 'j': // '-q' replies as JSON lines
+        iQuestionFormat = QUESTION_FORMAT_JSON;
+        break;
+
+      case '0': // '-q' replies NUL separated
+        iQuestionFormat = QUESTION_FORMAT_NUL;
+        break;
+
+      case 'p': // '-q' pipeline depth
+        iQuestionDepth = atoi(optarg);
+
+        if(iQuestionDepth < 1 || iQuestionDepth > QUESTION_MAX_DEPTH)
+        {
+          fprintf(stderr, "The '-p' option must be 1 to %d\n", QUESTION_MAX_DEPTH);
+          return 1;
+        }
+        break;
+
+      case 'E': // '-q' reply end condition
+        if(reply_end_add(optarg))
+        {
+          return 1;
+        }
+        break;
+
       case 'w': // wait time
 
         iQuestionWait = atoi(optarg);
@@ -895,6 +1276,68 @@ int i1;
         return 1;
     }
   }
+
+  if(iMultiClient && (!bListenMode || !bRawFlag))
+  {
+    fputs("The '-M' option requires '-l' and '-r'\n", stderr);
+    return 1;
+  }
+
+  if(!(pszTelemetryFile || pszShmName) != !pszTelemetryFields || (!pszTelemetryFile && iTelemetryWindow))
+  {
+    fputs("The '-T' and '-G' options require '-Y' (and '-Y' requires one of them, '-D' requires '-T')\n", stderr);
+    return 1;
+  }
+
+  if((pszTelemetryFile || pszShmName) && (bRawFlag || pszQuestion || bFactoryReset
+#ifdef WITH_XMODEM
+                          || bXModemFlag
+#endif // WITH_XMODEM
+                          ))
+  {
+    fputs("The '-T' and '-G' options may not be used with '-r', '-q', '-R', or '-X'\n", stderr);
+    return 1;
+  }
+
+  if(pszPollSchedule && (bRawFlag || pszQuestion || bFactoryReset || pszTelemetryFile || pszShmName
+#ifdef WITH_XMODEM
+                         || bXModemFlag
+#endif // WITH_XMODEM
+                         ))
+  {
+    fputs("The '-s' option may not be used with '-r', '-q', '-R', '-X', '-T', or '-G'\n", stderr);
+    return 1;
+  }
+
+  if(bFrameFlag && !pszQuestion)
+  {
+    fputs("The '-f' option requires '-q'\n", stderr);
+    return 1;
+  }
+
+  if(bMuxFlag && (bRawFlag || pszQuestion || bFactoryReset || pszPollSchedule
+#ifdef WITH_XMODEM
+                  || bXModemFlag
+#endif // WITH_XMODEM
+                  ))
+  {
+    fputs("The '-V' option may not be used with '-r', '-q', '-R', '-X', or '-s'\n", stderr);
+    return 1;
+  }
+
+  if(pszMuxFile && !bMuxFlag)
+  {
+    fputs("The '-U' option requires '-V'\n", stderr);
+    return 1;
+  }
+
+#ifdef WITH_XMODEM
+  if(pszFleetPorts && (!bXModemFlag || szXModemFile[0] != 'S'))
+  {
+    fputs("The '-P' option requires '-XS' (fleet distribution only sends files)\n", stderr);
+    return 1;
+  }
+#endif // WITH_XMODEM
 #endif // HAVE_GETOPT
 
   argc -= optind;
@@ -1190,6 +1633,18 @@ int configure_alt_console(HANDLE *piConsole)
               return -9;
             }
 
+            if(iMultiClient) // no 'fork', 'console_fanout()' accepts every client itself
+            {
+              if(!bQuietFlag)
+              {
+                fputs("listening for TCP connects (multi-client)\n", stderr);
+                fflush(stderr);
+              }
+
+              *piConsole = iTemp; // the listen socket
+              return 0;
+            }
+
             // wait for a connect and FORK if I get one, wait for process to end, and loop back
             // if I get a signal on THIS process, I'll terminate
 
@@ -1416,101 +1871,401 @@ int configure_alt_console(HANDLE *piConsole)
 // DEBUG FUNCTIONS //
 // *************** //
 
-void sftardcal_debug_dump_buffer(int iDir, const void *pBuf, int cbBuf)
+// hex dump.  Each row is built with table lookups into a buffer and written in one piece.
+// 'aDumpHex' has ", xx" for each byte value (the first byte in a row only uses the 'xx')
+// and 'aDumpText' has the character for the text column.
+
+#define DEBUG_DUMP_ROW   96 /* longest possible row */
+#define DEBUG_DUMP_CHUNK (DEBUG_DUMP_ROW * 32)
+
+static char aDumpHex[256][4];
+static char aDumpText[256];
+static int bDumpTables = 0;
+
+static void debug_dump_tables(void)
 {
-int i1, i2;
-const unsigned char *p1, *p2;
+static const char szHex[] = "0123456789abcdef";
+int i1;
 
-  if(cbBuf <= 0)
+  for(i1=0; i1 < 256; i1++)
   {
-    return;
+    aDumpHex[i1][0] = ',';
+    aDumpHex[i1][1] = ' ';
+    aDumpHex[i1][2] = szHex[i1 >> 4];
+    aDumpHex[i1][3] = szHex[i1 & 15];
+
+    aDumpText[i1] = (i1 >= 32 && i1 <= 127) ? i1 : '.';
   }
 
-  if(Verbosity() >= VERBOSITY_GEEKY)
+  bDumpTables = 1;
+}
+
+// one row of 1 to 16 bytes, returns its length
+static int debug_dump_row(char *pOut, const char *pszPrefix, int iOffset, const unsigned char *pBuf, int cbBuf)
+{
+char *p1 = pOut;
+int i1;
+
+  memcpy(p1, pszPrefix, 4);
+  p1 += 4;
+
+  if(iOffset < 256)
   {
-    fprintf(stderr, "[%u]\n", MyGetTickCount());
+    memcpy(p1, aDumpHex[iOffset] + 2, 2);
+    p1 += 2;
+  }
+  else
+  {
+    p1 += sprintf(p1, "%02x", iOffset);
   }
 
-  p1 = p2 = (const unsigned char *)pBuf;
+  memcpy(p1, ": ", 2);
+  memcpy(p1 + 2, aDumpHex[pBuf[0]] + 2, 2);
+  p1 += 4;
 
-  for(i1=0, i2=0; i1 <= cbBuf; i1++, p1++)
+  for(i1=1; i1 < cbBuf; i1++, p1 += 4)
   {
-    if(!i1 || i2 >= 16 || i1 == cbBuf)
-    {
-      if(i1)
-      {
-        while(i2 < 16)
-        {
-          fputs("    ", stderr); // fill up spaces where data would be
-          i2++;
-        }
+    memcpy(p1, aDumpHex[pBuf[i1]], 4);
+  }
 
-        fputs(" : ", stderr);
+  memset(p1, ' ', (16 - cbBuf) * 4); // fill up spaces where data would be
+  p1 += (16 - cbBuf) * 4;
 
-        while(p2 < p1)
-        {
-          if(*p2 >= 32 && *p2 <= 127)
-          {
-            fputc(*p2, stderr);
-          }
-          else
-          {
-            fputc('.', stderr);
-          }
+  memcpy(p1, " : ", 3);
+  p1 += 3;
 
-          p2++;
-        }
+  for(i1=0; i1 < cbBuf; i1++)
+  {
+    *(p1++) = aDumpText[pBuf[i1]];
+  }
 
-        fputc('\n', stderr);
-      }
+  *(p1++) = '\n';
 
-      if(!i1 && iDir > 0)
-      {
-        fputs("--> ", stderr);
-      }
-      else if(!i1 && iDir < 0)
-      {
-        fputs("<-- ", stderr);
-      }
-      else
-      {
-        fputs("    ", stderr);
-      }
+  return p1 - pOut;
+}
 
-      i2 = 0;
-      p2 = p1; // make sure
-    }
+// formats the whole dump, passing it to 'pfnOut' a chunk at a time
+static void debug_dump_format(int iDir, const void *pBuf, int cbBuf,
+                              void (*pfnOut)(void *pCtx, const char *pData, int cbData), void *pCtx)
+{
+char aOut[DEBUG_DUMP_CHUNK + 8];
+const unsigned char *p1 = (const unsigned char *)pBuf;
+int i1, cbOut = 0;
 
-    if(i1 < cbBuf)
-    {
-      if(!i2)
-      {
-        fprintf(stderr, "%02x: %02x", i1, *p1);
-      }
-      else
-      {
-        fprintf(stderr, ", %02x", *p1);
-      }
+  if(!bDumpTables)
+  {
+    debug_dump_tables();
+  }
 
-      i2++;
+  for(i1=0; i1 < cbBuf; i1 += 16)
+  {
+    if(cbOut > DEBUG_DUMP_CHUNK - DEBUG_DUMP_ROW)
+    {
+      pfnOut(pCtx, aOut, cbOut);
+      cbOut = 0;
     }
+
+    cbOut += debug_dump_row(aOut + cbOut,
+                            i1 ? "    " : iDir > 0 ? "--> " : iDir < 0 ? "<-- " : "    ",
+                            i1, p1 + i1, cbBuf - i1 < 16 ? cbBuf - i1 : 16);
   }
 
-  fputc('\n', stderr);
-  fflush(stderr);
+  memcpy(aOut + cbOut, "    \n", 5); // blank line after each dump
+  pfnOut(pCtx, aOut, cbOut + 5);
 }
 
-static char clddBufI[32], clddBufO[32];
-static unsigned int clddCountI = 0, clddCountO = 0, clddTickI = 0, clddTickO = 0;
-int clddDir = 0;
-void console_loop_debug_dump(int iDir, const void *pBuf0, int cbBuf)
+static void debug_dump_to_file(void *pCtx, const char *pData, int cbData)
 {
-const unsigned char *pBuf = (const unsigned char *)pBuf0;
+  fwrite(pData, 1, cbData, (FILE *)pCtx);
+}
 
-// dump I/O every 100 msecs or if buffer fills up
-  if((clddDir && iDir && clddDir != iDir) ||
-     (clddCountI > 0 /*&& clddDir < 0*/ && (MyGetTickCount() - clddTickI) >= 100) ||
-     clddCountI >= sizeof(clddBufI) ||
+void sftardcal_debug_dump_file(FILE *pOut, int iDir, const void *pBuf, int cbBuf)
+{
+  if(cbBuf <= 0)
+  {
+    return;
+  }
+
+  debug_dump_format(iDir, pBuf, cbBuf, debug_dump_to_file, pOut);
+}
+
+#ifndef WIN32
+
+// debug log sink - the output from 'sftardcal_debug_dump_buffer()' goes into a single-producer,
+// single-consumer ring (same arrangement as the serial input ring) and a thread writes it to
+// stderr, so the I/O thread only formats and copies and '-vvv' hardly changes the timing.  Only
+// the thread doing the serial I/O may produce.  Nothing is dropped; if the ring fills up, the
+// producer waits for room.  Other messages still go straight to stderr, so one of those can come
+// out ahead of a dump that is still in the ring.
+
+#define LOG_SINK_SIZE (256 * 1024) /* power of 2 */
+
+typedef struct _LOG_SINK_
+{
+  // producer
+  unsigned int dwHead __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  // sink thread
+  unsigned int dwTail __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  // assigned before the thread starts
+  char *pBuf __attribute__((aligned(CACHE_LINE_SIZE)));
+  int aBell[2];  // pipe, readable when there's (probably) data
+  int bStop;
+  int iState;    // 0 not started, 1 running, -1 unable to start (write directly)
+  pthread_t hThread;
+} LOG_SINK;
+
+static LOG_SINK sLogSink;
+
+static void *log_sink_thread(void *pParam)
+{
+LOG_SINK *pS = (LOG_SINK *)pParam;
+struct pollfd sFD;
+char aDrain[64];
+unsigned int dwTail = pS->dwTail, cb1;
+int i1;
+
+  while(1)
+  {
+    cb1 = __atomic_load_n(&pS->dwHead, __ATOMIC_ACQUIRE) - dwTail;
+
+    if(!cb1)
+    {
+      while(read(pS->aBell[0], aDrain, sizeof(aDrain)) > 0)
+      { } // nothing to wake up for (yet)
+
+      if(__atomic_load_n(&pS->dwHead, __ATOMIC_SEQ_CST) != dwTail) // in case it JUST arrived
+      {
+        continue;
+      }
+
+      if(__atomic_load_n(&pS->bStop, __ATOMIC_ACQUIRE))
+      {
+        break; // only once it's empty
+      }
+
+      sFD.fd = pS->aBell[0];
+      sFD.events = POLLIN;
+      sFD.revents = 0;
+
+      poll(&sFD, 1, 100);
+      continue;
+    }
+
+    if(cb1 > LOG_SINK_SIZE - (dwTail & (LOG_SINK_SIZE - 1)))
+    {
+      cb1 = LOG_SINK_SIZE - (dwTail & (LOG_SINK_SIZE - 1)); // contiguous, up to the end
+    }
+
+    i1 = write(2, pS->pBuf + (dwTail & (LOG_SINK_SIZE - 1)), cb1);
+
+    if(i1 < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+      sFD.fd = 2;
+      sFD.events = POLLOUT;
+      sFD.revents = 0;
+
+      poll(&sFD, 1, 100);
+      continue;
+    }
+
+    dwTail += i1 > 0 ? (unsigned int)i1 : cb1; // on an error it's discarded, or the producer would wait forever
+
+    __atomic_store_n(&pS->dwTail, dwTail, __ATOMIC_SEQ_CST);
+  }
+
+  return NULL;
+}
+
+static void log_sink_stop(void)
+{
+LOG_SINK *pS = &sLogSink;
+
+  if(pS->iState != 1)
+  {
+    return;
+  }
+
+  __atomic_store_n(&pS->bStop, 1, __ATOMIC_RELEASE);
+  write(pS->aBell[1], "", 1);
+
+  pthread_join(pS->hThread, NULL); // it empties the ring first
+
+  close(pS->aBell[0]);
+  close(pS->aBell[1]);
+  munmap(pS->pBuf, LOG_SINK_SIZE);
+
+  memset(pS, 0, sizeof(*pS));
+}
+
+// a forked child gets the ring but not the thread - it starts over with its own
+static void log_sink_atfork_child(void)
+{
+  if(sLogSink.iState == 1)
+  {
+    close(sLogSink.aBell[0]);
+    close(sLogSink.aBell[1]);
+    munmap(sLogSink.pBuf, LOG_SINK_SIZE);
+
+    memset(&sLogSink, 0, sizeof(sLogSink));
+  }
+}
+
+static void log_sink_start(void)
+{
+LOG_SINK *pS = &sLogSink;
+static int bRegistered = 0;
+
+  memset(pS, 0, sizeof(*pS));
+  pS->iState = -1;
+
+  pS->pBuf = mmap(NULL, LOG_SINK_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+
+  if(pS->pBuf == MAP_FAILED)
+  {
+    pS->pBuf = NULL;
+    return;
+  }
+
+  if(pipe(pS->aBell))
+  {
+    munmap(pS->pBuf, LOG_SINK_SIZE);
+    return;
+  }
+
+  fcntl(pS->aBell[0], F_SETFL, fcntl(pS->aBell[0], F_GETFL) | O_NONBLOCK);
+  fcntl(pS->aBell[1], F_SETFL, fcntl(pS->aBell[1], F_GETFL) | O_NONBLOCK);
+
+  if(pthread_create(&(pS->hThread), NULL, log_sink_thread, pS))
+  {
+    close(pS->aBell[0]);
+    close(pS->aBell[1]);
+    munmap(pS->pBuf, LOG_SINK_SIZE);
+    return;
+  }
+
+  pS->iState = 1;
+
+  if(!bRegistered)
+  {
+    atexit(log_sink_stop); // so that 'exit()' doesn't lose what's still in the ring
+    pthread_atfork(NULL, NULL, log_sink_atfork_child);
+    bRegistered = 1;
+  }
+}
+
+static void log_sink_write(void *pCtx, const char *pData, int cbData)
+{
+LOG_SINK *pS = &sLogSink;
+unsigned int dwHead = pS->dwHead, cbFree, cb1;
+
+  if(pS->iState != 1)
+  {
+    fflush(stderr);
+    write(2, pData, cbData); // no sink thread
+    return;
+  }
+
+  while(cbData > 0)
+  {
+    cbFree = LOG_SINK_SIZE - (dwHead - __atomic_load_n(&pS->dwTail, __ATOMIC_ACQUIRE));
+
+    if(!cbFree)
+    {
+      usleep(100); // stderr can't keep up.  wait for room rather than lose any of it
+      continue;
+    }
+
+    cb1 = LOG_SINK_SIZE - (dwHead & (LOG_SINK_SIZE - 1)); // contiguous space, up to the end
+
+    if(cb1 > cbFree)
+    {
+      cb1 = cbFree;
+    }
+
+    if(cb1 > (unsigned int)cbData)
+    {
+      cb1 = cbData;
+    }
+
+    memcpy(pS->pBuf + (dwHead & (LOG_SINK_SIZE - 1)), pData, cb1);
+
+    __atomic_store_n(&pS->dwHead, dwHead + cb1, __ATOMIC_SEQ_CST);
+
+    // same as the serial input ring - if the sink thread might be about to sleep, wake it up
+    if(__atomic_load_n(&pS->dwTail, __ATOMIC_SEQ_CST) == dwHead)
+    {
+      write(pS->aBell[1], "", 1);
+    }
+
+    dwHead += cb1;
+    pData += cb1;
+    cbData -= cb1;
+  }
+}
+
+// waits up to a second.  only uses what's safe in a signal handler (see 'signalproc')
+void sftardcal_debug_flush(void)
+{
+int i1;
+
+  for(i1=0; i1 < 10000 && sLogSink.iState == 1 &&
+            __atomic_load_n(&sLogSink.dwTail, __ATOMIC_ACQUIRE) != sLogSink.dwHead; i1++)
+  {
+    usleep(100);
+  }
+}
+
+#else // WIN32
+
+static void log_sink_write(void *pCtx, const char *pData, int cbData)
+{
+  fwrite(pData, 1, cbData, stderr);
+  fflush(stderr);
+}
+
+void sftardcal_debug_flush(void)
+{
+}
+
+#endif // WIN32
+
+void sftardcal_debug_dump_buffer(int iDir, const void *pBuf, int cbBuf)
+{
+char tbuf[32];
+
+  if(cbBuf <= 0)
+  {
+    return;
+  }
+
+#ifndef WIN32
+  if(!sLogSink.iState)
+  {
+    log_sink_start();
+  }
+#endif // WIN32
+
+  if(Verbosity() >= VERBOSITY_GEEKY)
+  {
+    log_sink_write(NULL, tbuf, snprintf(tbuf, sizeof(tbuf), "[%u]\n", MyGetTickCount()));
+  }
+
+  debug_dump_format(iDir, pBuf, cbBuf, log_sink_write, NULL);
+}
+
+static char clddBufI[32], clddBufO[32];
+static unsigned int clddCountI = 0, clddCountO = 0, clddTickI = 0, clddTickO = 0;
+int clddDir = 0;
+void console_loop_debug_dump(int iDir, const void *pBuf0, int cbBuf)
+{
+const unsigned char *pBuf = (const unsigned char *)pBuf0;
+
+// dump I/O every 100 msecs or if buffer fills up
+  if((clddDir && iDir && clddDir != iDir) ||
+     (clddCountI > 0 /*&& clddDir < 0*/ && (MyGetTickCount() - clddTickI) >= 100) ||
+     clddCountI >= sizeof(clddBufI) ||
      (clddCountO > 0 /*&& clddDir > 0*/ && (MyGetTickCount() - clddTickO) >= 100) ||
      clddCountO >= sizeof(clddBufO))
   {
@@ -1600,284 +2355,3941 @@ const unsigned char *pBuf = (const unsigned char *)pBuf0;
 
 // direct console access
 
-void console_loop(HANDLE iFile, HANDLE iConsole)
+#define CONSOLE_LOOP_BUFSIZE 4096 /* bulk read size for 'console_loop' */
+
+// find the next CR or LF in 'p1' up to 'pEnd', or 'pEnd' if there isn't one
+static const char * console_loop_find_crlf(const char *p1, const char *pEnd)
+{
+#ifdef __SSE2__
+const __m128i vCR = _mm_set1_epi8('\r'), vLF = _mm_set1_epi8('\n');
+__m128i v1;
+int iMask;
+
+  while(pEnd - p1 >= 16) // 16 bytes at a time
+  {
+    v1 = _mm_loadu_si128((const __m128i *)p1);
+    iMask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v1, vCR), _mm_cmpeq_epi8(v1, vLF)));
+
+    if(iMask)
+    {
+      return p1 + __builtin_ctz(iMask);
+    }
+
+    p1 += 16;
+  }
+#endif // __SSE2__
+
+  while(p1 < pEnd && *p1 != '\r' && *p1 != '\n')
+  {
+    p1++;
+  }
+
+  return p1;
+}
+
+// device to console translation for 'console_loop' - CR and LF are shown as "[CR]" and "[LF]".
+// a CR that isn't followed by LF is also passed through, which may be in the next buffer, so
+// '*piWasCR' is kept by the caller.  'pOut' must hold 5 bytes for each input byte.
+static int console_loop_translate(const char *pIn, int cbIn, char *pOut, int *piWasCR)
+{
+const char *p1, *p2, *pEnd;
+char *pO;
+
+  p1 = pIn;
+  pEnd = pIn + cbIn;
+  pO = pOut;
+
+  while(p1 < pEnd)
+  {
+    if(*p1 == '\r')
+    {
+      memcpy(pO, "[CR]", 4);
+      pO += 4;
+
+      if(iTerminator == '\r')
+      {
+        *(pO++) = '\n';
+      }
+      else
+      {
+        *piWasCR = 1;
+      }
+
+      p1++;
+      continue;
+    }
+
+    if(*piWasCR)
+    {
+      if(*p1 != '\n')
+      {
+        *(pO++) = '\r';
+      }
+
+      *piWasCR = 0;
+    }
+
+    if(*p1 == '\n') // regardless of 'iTerminator' settings
+    {
+      memcpy(pO, "[LF]\n", 5);
+      pO += 5;
+      p1++;
+    }
+    else // everything up to the next CR or LF goes out unchanged
+    {
+      p2 = console_loop_find_crlf(p1, pEnd);
+
+      memcpy(pO, p1, p2 - p1);
+      pO += p2 - p1;
+      p1 = p2;
+    }
+  }
+
+  return pO - pOut;
+}
+
+#ifndef WIN32
+// the serial port is non-blocking, so wait for room when a write can't complete
+static int console_loop_wait_output(HANDLE iFile)
+{
+struct pollfd sFD;
+
+  if(errno != EAGAIN && errno != EWOULDBLOCK)
+  {
+    return -1;
+  }
+
+  sFD.fd = iFile;
+  sFD.events = POLLOUT;
+  sFD.revents = 0;
+
+  return poll(&sFD, 1, 100) < 0 || QuitFlag() ? -1 : 0;
+}
+#endif // WIN32
+
+static void console_loop_write(HANDLE iFile, const char *pBuf, int cbBuf)
 {
+int i1;
+
+  while(cbBuf > 0)
+  {
+    i1 = my_write(iFile, pBuf, cbBuf);
+
+    if(i1 <= 0)
+    {
 #ifndef WIN32
-struct pollfd aFD[2];
+      if(i1 < 0 && !console_loop_wait_output(iFile))
+      {
+        continue;
+      }
 #endif // WIN32
+
+      break; // TODO:  report this?
+    }
+
+    pBuf += i1;
+    cbBuf -= i1;
+  }
+}
+
+#ifndef WIN32
+// 'alternate console' bridge - when nothing is being dumped, data goes between the serial
+// port and the alternate console without being looked at.  On Linux, 'splice()' moves it
+// through a pipe without copying it to user space.  Anything that doesn't support 'splice()'
+// (and everything that isn't Linux) uses large 'read()' and 'write()' calls instead.
+
+#define CONSOLE_BRIDGE_BUFSIZE 65536
+
+typedef struct _CONSOLE_BRIDGE_
+{
+  HANDLE iFrom, iTo;
+  int aPipe[2];  // for 'splice()', -1 if not using it
+} CONSOLE_BRIDGE;
+
+// copy what remains in the pipe the hard way, after 'splice()' to the output failed
+static void console_bridge_unsplice(CONSOLE_BRIDGE *pB, char *pBuf)
+{
 int i1;
-int iWasCR = 0;
 
-  do
+  fcntl(pB->aPipe[0], F_SETFL, fcntl(pB->aPipe[0], F_GETFL) | O_NONBLOCK);
+
+  while((i1 = read(pB->aPipe[0], pBuf, CONSOLE_BRIDGE_BUFSIZE)) > 0)
+  {
+    console_loop_write(pB->iTo, pBuf, i1);
+  }
+
+  close(pB->aPipe[0]);
+  close(pB->aPipe[1]);
+  pB->aPipe[0] = pB->aPipe[1] = -1;
+}
+
+// move whatever is waiting on 'iFrom' to 'iTo'.  returns the byte count, which is <= 0 at EOF or error
+static int console_bridge_move(CONSOLE_BRIDGE *pB, char *pBuf)
+{
+int i1, i2;
+
+#ifdef SPLICE_F_MOVE
+  if(pB->aPipe[0] >= 0)
+  {
+    i1 = splice(pB->iFrom, NULL, pB->aPipe[1], NULL, CONSOLE_BRIDGE_BUFSIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if(pB->iFrom == iGlobalFileHandle)
+    {
+      metrics_add(METRIC_SERIAL_RX_SYSCALLS, 1);
+      metrics_add(METRIC_SERIAL_RX_BYTES, i1 > 0 ? i1 : 0);
+    }
+
+    if(i1 < 0 && (errno == EINVAL || errno == ENOSYS)) // not supported for this input
+    {
+      close(pB->aPipe[0]);
+      close(pB->aPipe[1]);
+      pB->aPipe[0] = pB->aPipe[1] = -1;
+    }
+    else
+    {
+      if(i1 < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        return 1; // not an error, there's just nothing there now
+      }
+
+      for(i2=i1; i2 > 0; ) // all of it goes out before anything else comes in
+      {
+        int i3 = splice(pB->aPipe[0], NULL, pB->iTo, NULL, i2, SPLICE_F_MOVE);
+
+        if(pB->iTo == iGlobalFileHandle)
+        {
+          metrics_add(METRIC_SERIAL_TX_SYSCALLS, 1);
+          metrics_add(METRIC_SERIAL_TX_BYTES, i3 > 0 ? i3 : 0);
+        }
+
+        if(i3 > 0)
+        {
+          i2 -= i3;
+        }
+        else if(i3 < 0 && !console_loop_wait_output(pB->iTo))
+        {
+          continue;
+        }
+        else
+        {
+          console_bridge_unsplice(pB, pBuf); // also for 'EINVAL' - output doesn't do 'splice()'
+          break;
+        }
+      }
+
+      return i1;
+    }
+  }
+#endif // SPLICE_F_MOVE
+
+  i1 = my_read(pB->iFrom, pBuf, CONSOLE_BRIDGE_BUFSIZE);
+
+  if(i1 < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+  {
+    return 1;
+  }
+
+  if(i1 > 0)
+  {
+    console_loop_write(pB->iTo, pBuf, i1);
+  }
+
+  return i1;
+}
+
+static void console_bridge(HANDLE iFile, HANDLE iConsole)
+{
+struct pollfd aFD[2];
+CONSOLE_BRIDGE sToDev, sToCon;
+static char aBuf[CONSOLE_BRIDGE_BUFSIZE];
+int i1;
+
+  sToDev.iFrom = iConsole;
+  sToDev.iTo = iFile;
+  sToCon.iFrom = iFile;
+  sToCon.iTo = iStdOut; // same as 'iConsole' for an alternate console
+
+  sToDev.aPipe[0] = sToDev.aPipe[1] = sToCon.aPipe[0] = sToCon.aPipe[1] = -1;
+
+#ifdef SPLICE_F_MOVE
+  if(!bCaptureActive && // the capture needs to see the data
+     (pipe(sToDev.aPipe) ||
+      (my_poll_handle(iFile) == iFile && pipe(sToCon.aPipe)))) // not from the serial input ring
+  {
+    fprintf(stderr, "Warning:  no pipe for 'splice', errno=%d\n", errno); // still works, just not as well
+  }
+#endif // SPLICE_F_MOVE
+
+  do
+  {
+    aFD[0].fd = my_poll_handle(iFile);
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+    aFD[1].fd = iConsole;
+    aFD[1].events = POLLIN;
+    aFD[1].revents = 0;
+
+    i1 = poll(aFD, 2, 100);
+
+    if(!i1)
+    {
+      continue;
+    }
+
+    metrics_add(METRIC_POLL_WAKEUPS, 1);
+
+    if(i1 < 0 || (aFD[0].revents & POLLERR) || (aFD[1].revents & POLLERR))
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(aFD[1].revents & (POLLIN | POLLHUP))
+    {
+      if(console_bridge_move(&sToDev, aBuf) <= 0 && bIsTCP)
+      {
+        SetQuitFlag(); // read error when the poll event said there WAS something indicates CLOSED SOCKET
+      }
+    }
+
+    if(aFD[0].revents & POLLIN)
+    {
+      console_bridge_move(&sToCon, aBuf);
+    }
+  } while(!QuitFlag());
+
+  for(i1=0; i1 < 2; i1++)
+  {
+    if(sToDev.aPipe[i1] >= 0)
+    {
+      close(sToDev.aPipe[i1]);
+    }
+
+    if(sToCon.aPipe[i1] >= 0)
+    {
+      close(sToCon.aPipe[i1]);
+    }
+  }
+}
+#endif // WIN32
+
+#ifndef WIN32
+// '-M' multi-client listen mode.  One thread polls the serial port, the listen socket, and
+// every client.  Serial output is copied into each client's ring buffer.  A client that can't
+// keep up loses data (or is disconnected) so it never holds up the serial port or the other
+// clients.  Client input goes to the device one line at a time, so that two people typing at
+// once can't interleave inside a command.  The first client with input owns the port until it
+// sends CR or LF, or until it has been idle for FANOUT_OWNER_TIMEOUT msecs.
+
+#define FANOUT_MAX_CLIENTS 16
+#define FANOUT_RING_SIZE 65536 /* must be a power of 2 */
+#define FANOUT_INBUF_SIZE 1024
+#define FANOUT_OWNER_TIMEOUT 1000
+
+typedef struct _FANOUT_CLIENT_
+{
+  int iSocket;                  // -1 if not in use
+  char *pRing;                  // serial output that's waiting to be sent
+  unsigned int dwHead, dwTail;  // 'dwHead - dwTail' bytes are in 'pRing'
+  unsigned long ulDropped;      // not yet reported with a marker
+  char aIn[FANOUT_INBUF_SIZE];  // input that's waiting to be sent to the device
+  int cbIn;
+} FANOUT_CLIENT;
+
+static void fanout_close(FANOUT_CLIENT *pC, const char *szWhy)
+{
+  if(!bQuietFlag)
+  {
+    fprintf(stderr, "client %d %s\n", pC->iSocket, szWhy);
+  }
+
+  close(pC->iSocket);
+  free(pC->pRing);
+
+  pC->iSocket = -1;
+  pC->pRing = NULL;
+}
+
+static void fanout_accept(int iListen, FANOUT_CLIENT *pClients)
+{
+struct sockaddr_storage sa;
+socklen_t cbSA;
+int i1, i2, sAccept;
+
+  while(1)
+  {
+    cbSA = sizeof(sa);
+    sAccept = accept(iListen, (struct sockaddr *)&sa, &cbSA);
+
+    if(sAccept < 0)
+    {
+      return; // normally EWOULDBLOCK
+    }
+
+    for(i1=0; i1 < FANOUT_MAX_CLIENTS && pClients[i1].iSocket >= 0; i1++)
+    { } // find an empty slot
+
+    i2 = 1;
+    ioctl(sAccept, FIONBIO, &i2); // never block on a client
+
+    i2 = FANOUT_RING_SIZE; // keep the kernel from buffering megabytes for a slow client
+    setsockopt(sAccept, SOL_SOCKET, SO_SNDBUF, &i2, sizeof(i2));
+
+    if(i1 >= FANOUT_MAX_CLIENTS ||
+       !(pClients[i1].pRing = malloc(FANOUT_RING_SIZE)))
+    {
+      write(sAccept, "too many clients\r\n", 18);
+      close(sAccept);
+
+      fputs("WARNING - too many clients, connection refused\n", stderr);
+      continue;
+    }
+
+    pClients[i1].iSocket = sAccept;
+    pClients[i1].dwHead = pClients[i1].dwTail = 0;
+    pClients[i1].ulDropped = 0;
+    pClients[i1].cbIn = 0;
+
+    if(!bQuietFlag)
+    {
+      fprintf(stderr, "client %d connected\n", sAccept);
+    }
+  }
+}
+
+// send as much of the ring as the socket will take without blocking
+static void fanout_flush(FANOUT_CLIENT *pC)
+{
+struct iovec aIOV[2];
+unsigned int dwTail;
+int i1, nIOV;
+
+  while(pC->dwHead != pC->dwTail)
+  {
+    dwTail = pC->dwTail & (FANOUT_RING_SIZE - 1);
+
+    aIOV[0].iov_base = pC->pRing + dwTail;
+
+    if(dwTail + (pC->dwHead - pC->dwTail) <= FANOUT_RING_SIZE)
+    {
+      aIOV[0].iov_len = pC->dwHead - pC->dwTail;
+      nIOV = 1;
+    }
+    else // wraps around
+    {
+      aIOV[0].iov_len = FANOUT_RING_SIZE - dwTail;
+      aIOV[1].iov_base = pC->pRing;
+      aIOV[1].iov_len = (pC->dwHead - pC->dwTail) - aIOV[0].iov_len;
+      nIOV = 2;
+    }
+
+    i1 = writev(pC->iSocket, aIOV, nIOV);
+
+    if(i1 < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return; // try again on POLLOUT
+    }
+
+    if(i1 <= 0)
+    {
+      fanout_close(pC, "disconnected (write error)");
+      return;
+    }
+
+    pC->dwTail += i1;
+  }
+}
+
+static void fanout_ring_put(FANOUT_CLIENT *pC, const char *pBuf, int cbBuf)
+{
+unsigned int dwHead = pC->dwHead & (FANOUT_RING_SIZE - 1);
+int cb1 = FANOUT_RING_SIZE - dwHead;
+
+  if(cb1 > cbBuf)
+  {
+    cb1 = cbBuf;
+  }
+
+  memcpy(pC->pRing + dwHead, pBuf, cb1);
+  memcpy(pC->pRing, pBuf + cb1, cbBuf - cb1); // the part that wraps around, if any
+
+  pC->dwHead += cbBuf;
+}
+
+// queue serial output for one client, dropping it (or the client) if there's no room
+static void fanout_queue(FANOUT_CLIENT *pC, const char *pBuf, int cbBuf)
+{
+char tbuf[64];
+int cbMarker = 0;
+
+  if(pC->ulDropped)
+  {
+    cbMarker = snprintf(tbuf, sizeof(tbuf), "\r\n[%lu bytes dropped]\r\n", pC->ulDropped);
+  }
+
+  if(FANOUT_RING_SIZE - (pC->dwHead - pC->dwTail) < (unsigned int)(cbBuf + cbMarker))
+  {
+    if(iMultiClient > 1) // '-M close'
+    {
+      fanout_close(pC, "disconnected (too slow)");
+    }
+    else
+    {
+      pC->ulDropped += cbBuf;
+      metrics_add(METRIC_DROPPED_FANOUT, cbBuf);
+    }
+
+    return;
+  }
+
+  if(cbMarker)
+  {
+    fanout_ring_put(pC, tbuf, cbMarker);
+    pC->ulDropped = 0;
+  }
+
+  fanout_ring_put(pC, pBuf, cbBuf);
+}
+
+// send the owner's input to the device up to the end of a line.  returns non-zero once the line is complete.
+static int fanout_to_device(HANDLE iFile, FANOUT_CLIENT *pC)
+{
+int i1, cb1, bEOL;
+
+  for(cb1=0; cb1 < pC->cbIn && pC->aIn[cb1] != '\r' && pC->aIn[cb1] != '\n'; cb1++)
+  { }
+
+  bEOL = cb1 < pC->cbIn;
+
+  if(bEOL)
+  {
+    cb1++; // include the CR or LF
+  }
+
+  i1 = my_write(iFile, pC->aIn, cb1);
+
+  if(i1 <= 0)
+  {
+    return 0; // non-blocking serial port is full, try again on POLLOUT
+  }
+
+  if(Verbosity() >= VERBOSITY_CHATTY)
+  {
+    console_loop_debug_dump(1, pC->aIn, i1);
+  }
+
+  pC->cbIn -= i1;
+  memmove(pC->aIn, pC->aIn + i1, pC->cbIn);
+
+  return bEOL && i1 == cb1;
+}
+
+static void console_fanout(HANDLE iFile, int iListen)
+{
+struct pollfd aFD[FANOUT_MAX_CLIENTS + 3];
+FANOUT_CLIENT aClients[FANOUT_MAX_CLIENTS];
+static char aBuf[CONSOLE_LOOP_BUFSIZE];
+int aIndex[FANOUT_MAX_CLIENTS + 3]; // client for each 'aFD' entry
+int i1, i2, nFD, iOwner = -1, iLastOwner = -1, bInput;
+unsigned int dwOwnerTick = 0;
+
+  for(i1=0; i1 < FANOUT_MAX_CLIENTS; i1++)
+  {
+    aClients[i1].iSocket = -1;
+    aClients[i1].pRing = NULL;
+  }
+
+  do
+  {
+    // the serial port is always read, regardless of what the clients are doing
+
+    aFD[0].fd = my_poll_handle(iFile); // the input ring's bell pipe, when it's running
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+    aFD[1].fd = iListen;
+    aFD[1].events = POLLIN;
+    aFD[1].revents = 0;
+
+    for(i1=0, nFD=3, bInput=0; i1 < FANOUT_MAX_CLIENTS; i1++)
+    {
+      if(aClients[i1].iSocket < 0)
+      {
+        continue;
+      }
+
+      if(aClients[i1].cbIn > 0 && (iOwner < 0 || iOwner == i1))
+      {
+        bInput = 1; // for the device, as soon as there's room
+      }
+
+      aFD[nFD].fd = aClients[i1].iSocket;
+      aFD[nFD].events = (aClients[i1].cbIn < FANOUT_INBUF_SIZE ? POLLIN : 0) // else TCP pushes back
+                      | (aClients[i1].dwHead != aClients[i1].dwTail ? POLLOUT : 0);
+      aFD[nFD].revents = 0;
+      aIndex[nFD++] = i1;
+    }
+
+    // room to write on the port itself (a pipe's read end is never writable).  poll() skips a -1
+    aFD[2].fd = bInput ? iFile : -1;
+    aFD[2].events = POLLOUT;
+    aFD[2].revents = 0;
+
+    i1 = poll(aFD, nFD, 100);
+
+    if(i1 > 0)
+    {
+      metrics_add(METRIC_POLL_WAKEUPS, 1);
+    }
+
+    if(i1 < 0 || (aFD[0].revents & POLLERR))
+    {
+      if(errno == EINTR && !(aFD[0].revents & POLLERR))
+      {
+        continue;
+      }
+
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(aFD[0].revents & POLLIN) // serial output goes to everyone
+    {
+      i1 = my_read(iFile, aBuf, sizeof(aBuf));
+
+      if(i1 > 0)
+      {
+        if(Verbosity() >= VERBOSITY_CHATTY)
+        {
+          console_loop_debug_dump(-1, aBuf, i1);
+        }
+
+        for(i2=0; i2 < FANOUT_MAX_CLIENTS; i2++)
+        {
+          if(aClients[i2].iSocket >= 0)
+          {
+            fanout_queue(aClients + i2, aBuf, i1);
+          }
+
+          if(aClients[i2].iSocket >= 0) // may have been closed
+          {
+            fanout_flush(aClients + i2); // no waiting for the next POLLOUT
+          }
+        }
+      }
+    }
+
+    if(aFD[1].revents & POLLIN)
+    {
+      fanout_accept(iListen, aClients);
+    }
+
+    for(i1=3; i1 < nFD; i1++)
+    {
+      FANOUT_CLIENT *pC = aClients + aIndex[i1];
+
+      if(pC->iSocket < 0)
+      {
+        continue;
+      }
+
+      if(aFD[i1].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        i2 = read(pC->iSocket, pC->aIn + pC->cbIn, FANOUT_INBUF_SIZE - pC->cbIn);
+
+        if(i2 > 0)
+        {
+          pC->cbIn += i2;
+        }
+        else if(i2 == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+          fanout_close(pC, "disconnected");
+          continue;
+        }
+      }
+
+      if(aFD[i1].revents & POLLOUT)
+      {
+        fanout_flush(pC);
+      }
+    }
+
+    // write arbitration - one line at a time, clients take turns
+
+    if(iOwner >= 0 &&
+       (aClients[iOwner].iSocket < 0 ||
+        (!aClients[iOwner].cbIn && TimeIntervalExceeds(dwOwnerTick, FANOUT_OWNER_TIMEOUT))))
+    {
+      iOwner = -1; // gone, or left a partial line and stopped typing
+    }
+
+    if(iOwner < 0)
+    {
+      for(i1=1; i1 <= FANOUT_MAX_CLIENTS; i1++)
+      {
+        i2 = (iLastOwner + i1) % FANOUT_MAX_CLIENTS;
+
+        if(i2 >= 0 && aClients[i2].iSocket >= 0 && aClients[i2].cbIn > 0)
+        {
+          iOwner = iLastOwner = i2;
+          dwOwnerTick = MyGetTickCount();
+          break;
+        }
+      }
+    }
+
+    if(iOwner >= 0 && aClients[iOwner].cbIn > 0)
+    {
+      dwOwnerTick = MyGetTickCount();
+
+      if(fanout_to_device(iFile, aClients + iOwner))
+      {
+        iOwner = -1; // line is complete, next client's turn
+      }
+    }
+
+    if(Verbosity() >= VERBOSITY_CHATTY)
+    {
+      console_loop_debug_dump(0, NULL, 0);
+    }
+  } while(!QuitFlag());
+
+  for(i1=0; i1 < FANOUT_MAX_CLIENTS; i1++)
+  {
+    if(aClients[i1].iSocket >= 0)
+    {
+      fanout_close(aClients + i1, "closed");
+    }
+  }
+}
+#endif // WIN32
+
+void console_loop(HANDLE iFile, HANDLE iConsole)
+{
+#ifndef WIN32
+struct pollfd aFD[2];
+#endif // WIN32
+int i1, i2, cbOut, cbEcho;
+int iWasCR = 0;
+static char aIn[CONSOLE_LOOP_BUFSIZE], aOut[CONSOLE_LOOP_BUFSIZE * 5], aEcho[CONSOLE_LOOP_BUFSIZE * 2];
+
+#ifndef WIN32
+  if(iMultiClient) // 'iConsole' is the listen socket
+  {
+    console_fanout(iFile, iConsole);
+    return;
+  }
+
+  if(pAltConsole && Verbosity() < VERBOSITY_CHATTY) // nothing to translate or dump, so just move the data
+  {
+    console_bridge(iFile, iConsole);
+    return;
+  }
+#endif // WIN32
+
+  do
+  {
+#ifndef WIN32
+    aFD[0].fd = my_poll_handle(iFile);
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+    aFD[1].fd = iConsole; // stdin
+    aFD[1].events = POLLIN;
+    aFD[1].revents = 0;
+
+    i1 = poll(aFD, 2, 100);
+    if(!i1)
+    {
+      goto end_of_loop;
+//      continue;
+    }
+
+    metrics_add(METRIC_POLL_WAKEUPS, 1);
+
+    if(i1 < 0 || (aFD[0].revents & POLLERR) || (aFD[1].revents & POLLERR))
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      return;
+    }
+#endif // WIN32
+
+#ifdef WIN32
+    if(my_pollin(iConsole) > 0)
+#else // WIN32
+    if(aFD[1].revents & POLLIN)
+#endif // WIN32
+    {
+#ifndef WIN32
+      if(pAltConsole) // no translation or 'local echo' if 'alt console'
+      {
+        char c1;
+        i1 = my_read(iConsole, &c1, 1);
+
+        if(i1 > 0)
+        {
+          if(Verbosity() >= VERBOSITY_CHATTY)
+          {
+            console_loop_debug_dump(1, &c1, 1);
+          }
+
+          my_write(iFile, &c1, 1);
+        }
+        else if(i1 <= 0 && bIsTCP)
+        {
+          SetQuitFlag(); // read error when the poll event said there WAS something indicates CLOSED SOCKET
+        }
+      }
+      else
+#endif // WIN32
+      {
+        // everything that's waiting, translated into one write to the device (and one for local echo)
+
+        i1 = my_read(iConsole, aIn, CONSOLE_LOOP_BUFSIZE);
+
+        for(i2=0, cbOut=0, cbEcho=0; i2 < i1; i2++)
+        {
+          if(aIn[i2] == 13 || aIn[i2] == 10) // either on input, translates into 'iTerminator' or CRLF
+          {
+            aEcho[cbEcho++] = '\r';
+            aEcho[cbEcho++] = '\n';
+
+            if(!iTerminator)
+            {
+              aOut[cbOut++] = '\r';
+              aOut[cbOut++] = '\n';
+            }
+            else
+            {
+              aOut[cbOut++] = (char)iTerminator;
+            }
+          }
+          else if(aIn[i2] == 4 || aIn[i2] == 26) // ctrl+d or ctrl+z
+          {
+            SetQuitFlag();
+            break; // ignore anything after it, but send what came before
+          }
+          else
+          {
+            aEcho[cbEcho++] = aIn[i2];
+            aOut[cbOut++] = aIn[i2];
+          }
+        }
+
+        if(bLocalEcho && cbEcho > 0)
+        {
+          fwrite(aEcho, 1, cbEcho, stdout);
+          fflush(stdout);
+        }
+
+        if(cbOut > 0)
+        {
+          console_loop_write(iFile, aOut, cbOut);
+
+          if(Verbosity() >= VERBOSITY_CHATTY)
+          {
+            console_loop_debug_dump(1, aOut, cbOut);
+          }
+        }
+        else if(i1 <= 0 && bIsTCP)
+        {
+          SetQuitFlag(); // read error when the poll event said there WAS something indicates CLOSED SOCKET
+        }
+      }
+    }
+
+#ifdef WIN32
+    if(my_pollin(iFile) > 0)
+#else // WIN32
+    if(aFD[0].revents & POLLIN)
+#endif // WIN32
+    {
+      if(pAltConsole) // unmodified
+      {
+        char c1;
+        i1 = my_read(iFile, &c1, 1);
+
+        if(i1 > 0)
+        {
+          if(Verbosity() >= VERBOSITY_CHATTY)
+          {
+            console_loop_debug_dump(-1, &c1, 1);
+          }
+
+          my_write(iStdOut, &c1, 1); // output to stdout, always
+        }
+      }
+      else
+      {
+        // read everything that's waiting, and write it to stdout with ONE call
+
+        i1 = my_read(iFile, aIn, CONSOLE_LOOP_BUFSIZE);
+
+        if(i1 > 0)
+        {
+          cbOut = console_loop_translate(aIn, i1, aOut, &iWasCR);
+
+          console_loop_write(iStdOut, aOut, cbOut); // output to stdout, always
+
+          if(Verbosity() >= VERBOSITY_CHATTY)
+          {
+            console_loop_debug_dump(-1, aIn, i1);
+          }
+        }
+      }
+    }
+
+#ifndef WIN32
+end_of_loop: // necessary since 'continue' won't perform this properly for some reason
+#endif // WIN32
+
+    if(/*pAltConsole &&*/ Verbosity() >= VERBOSITY_CHATTY)
+    {
+      console_loop_debug_dump(0, NULL, 0); // allows timeouts to work to display data after 'no activity'
+    }
+
+  } while(!QuitFlag());
+}
+
+
+#ifndef WIN32
+// telemetry ('-T' and '-G').  Every line from the device goes to 'telemetry_line()' with the time
+// that the read which finished it returned, until ^C or the device goes away.
+
+// ^C and SIGTERM only set the quit flag for the loops that run until then ('-T' and '-s'),
+// so that they can finish up (write the last block, print the totals)
+static void quit_signal(int iSig)
+{
+  bQuitFlag = 1;
+}
+
+static void telemetry_loop(HANDLE iFile)
+{
+char aIn[4096], aLine[MY_GETS_BUFSIZE];
+int i1, i2, cbLine = 0;
+uint64_t qwNow;
+
+
+  signal(SIGINT, quit_signal);
+  signal(SIGTERM, quit_signal);
+
+  while(!QuitFlag())
+  {
+    i1 = my_pollin(iFile);
+
+    if(i1 < 0 && errno != EINTR)
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(i1 <= 0)
+    {
+      telemetry_idle(); // keeps the file current when there's a gap
+      continue;
+    }
+
+    i1 = my_read(iFile, aIn, sizeof(aIn));
+
+    if(i1 < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      continue;
+    }
+
+    if(i1 <= 0) // the device went away
+    {
+      fprintf(stderr, "read error %d\n", errno);
+      break;
+    }
+
+    qwNow = telemetry_now();
+
+    for(i2=0; i2 < i1; i2++)
+    {
+      if(aIn[i2] == '\r' || aIn[i2] == '\n')
+      {
+        if(cbLine)
+        {
+          aLine[cbLine] = 0;
+          telemetry_line(aLine, qwNow);
+          cbLine = 0;
+        }
+      }
+      else if(cbLine < (int)sizeof(aLine) - 1) // a line that long isn't telemetry anyway
+      {
+        aLine[cbLine++] = aIn[i2];
+      }
+    }
+  }
+
+  signal(SIGINT, signalproc);
+  signal(SIGTERM, signalproc);
+}
+#endif // WIN32
+
+
+// reply end conditions ('-E').  Every prompt and terminating line goes into one Aho-Corasick
+// automaton, and each byte of a '-q' reply moves it one state as 'my_gets2' reads it, so the
+// reply ends on the byte that completes any of them instead of after 'iQuestionWait' msecs of
+// quiet.  CR, LF and CRLF are all '\n' to the matcher, a terminating line is '\n' + text + '\n',
+// and a reply starts with an implied '\n'.
+
+typedef struct _REPLY_END_
+{
+  int bActive;                        // there is something to match
+  int nPatterns;
+  char *apszPattern[REPLY_END_MAX];   // as matched, with the '\n' for a line
+  int abPrompt[REPLY_END_MAX];        // a prompt is left out of the reply, a line is kept
+  int nLines, cbBytes;                // 'lines:n' and 'bytes:n', 0 for none
+  unsigned short (*paGoto)[256];      // the automaton, every edge filled in
+  signed char *pOut;                  // pattern that ends in each state, -1 for none
+  // the reply so far
+  int iState, bWasCR, nLinesSeen, cbSeen;
+  int iMatch;                         // pattern that ended it, REPLY_END_MAX for a count, -1 for none
+  int iSkipEOL;                       // the rest of the line it ended on:  1 for a CR or LF, 2 for an LF
+} REPLY_END;
+
+static REPLY_END sReplyEnd;
+
+static int reply_end_add(const char *pszSpec)
+{
+REPLY_END *pR = &sReplyEnd;
+char *p1;
+int i1, bPrompt = 0;
+
+  if(!strncmp(pszSpec, "lines:", 6) || !strncmp(pszSpec, "bytes:", 6))
+  {
+    i1 = atoi(pszSpec + 6);
+
+    if(i1 <= 0)
+    {
+      fprintf(stderr, "The count for '-E %s' must be more than 0\n", pszSpec);
+      return 1;
+    }
+
+    if(*pszSpec == 'l')
+    {
+      pR->nLines = i1;
+    }
+    else
+    {
+      pR->cbBytes = i1;
+    }
+
+    return 0;
+  }
+
+  if(!strncmp(pszSpec, "prompt:", 7))
+  {
+    bPrompt = 1;
+    pszSpec += 7;
+  }
+  else if(!strncmp(pszSpec, "line:", 5)) // for a line that starts with 'prompt:' etc.
+  {
+    pszSpec += 5;
+  }
+
+  i1 = strlen(pszSpec);
+
+  if(!i1 || i1 > REPLY_END_MAX_LENGTH || pR->nPatterns >= REPLY_END_MAX)
+  {
+    fprintf(stderr, "The '-E' option allows up to %d prompts or lines of 1 to %d characters\n",
+            REPLY_END_MAX, REPLY_END_MAX_LENGTH);
+    return 1;
+  }
+
+  p1 = malloc(i1 + 3);
+  if(!p1)
+  {
+    fprintf(stderr, "Unable to allocate memory for arg!\n");
+    return 1;
+  }
+
+  if(bPrompt)
+  {
+    memcpy(p1, pszSpec, i1 + 1);
+  }
+  else
+  {
+    sprintf(p1, "\n%s\n", pszSpec);
+  }
+
+  pR->apszPattern[pR->nPatterns] = p1;
+  pR->abPrompt[pR->nPatterns++] = bPrompt;
+
+  return 0;
+}
+
+// the goto/failure automaton, with the failure edges folded into a full table.  0 on success
+static int reply_end_build(void)
+{
+REPLY_END *pR = &sReplyEnd;
+int i1, i2, iState, nStates, iHead, iTail, *pFail, *pQueue;
+const unsigned char *p1;
+
+
+  pR->bActive = pR->nPatterns || pR->nLines || pR->cbBytes;
+
+  if(!pR->nPatterns)
+  {
+    return 0;
+  }
+
+  for(i1=0, nStates=1; i1 < pR->nPatterns; i1++)
+  {
+    nStates += strlen(pR->apszPattern[i1]);
+  }
+
+  pR->paGoto = calloc(nStates, sizeof(*pR->paGoto));
+  pR->pOut = malloc(nStates);
+  pFail = calloc(nStates, sizeof(*pFail));
+  pQueue = malloc(nStates * sizeof(*pQueue));
+
+  if(!pR->paGoto || !pR->pOut || !pFail || !pQueue)
+  {
+    fprintf(stderr, "Not enough memory to continue\n");
+
+    free(pFail);
+    free(pQueue);
+    return -1;
+  }
+
+  memset(pR->pOut, -1, nStates);
+
+  // the trie.  an edge of 0 is 'none yet', since no edge of the trie goes to the root
+  for(i1=0, nStates=1; i1 < pR->nPatterns; i1++)
+  {
+    for(p1=(const unsigned char *)pR->apszPattern[i1], iState=0; *p1; p1++)
+    {
+      if(!pR->paGoto[iState][*p1])
+      {
+        pR->paGoto[iState][*p1] = nStates++;
+      }
+
+      iState = pR->paGoto[iState][*p1];
+    }
+
+    if(pR->pOut[iState] < 0)
+    {
+      pR->pOut[iState] = i1;
+    }
+  }
+
+  // breadth first, so the failure state's row is already complete.  a missing edge
+  // becomes the failure state's edge, and a state ends whatever its failure state ends
+  iHead = iTail = 0;
+
+  for(i2=0; i2 < 256; i2++)
+  {
+    if(pR->paGoto[0][i2])
+    {
+      pQueue[iTail++] = pR->paGoto[0][i2]; // failure state is the root
+    }
+  }
+
+  while(iHead < iTail)
+  {
+    iState = pQueue[iHead++];
+
+    if(pR->pOut[iState] < 0)
+    {
+      pR->pOut[iState] = pR->pOut[pFail[iState]];
+    }
+
+    for(i2=0; i2 < 256; i2++)
+    {
+      i1 = pR->paGoto[iState][i2];
+
+      if(i1)
+      {
+        pFail[i1] = pR->paGoto[pFail[iState]][i2];
+        pQueue[iTail++] = i1;
+      }
+      else
+      {
+        pR->paGoto[iState][i2] = pR->paGoto[pFail[iState]][i2];
+      }
+    }
+  }
+
+  free(pFail);
+  free(pQueue);
+
+  return 0;
+}
+
+static void reply_end_free(void)
+{
+REPLY_END *pR = &sReplyEnd;
+
+  while(pR->nPatterns > 0)
+  {
+    free(pR->apszPattern[--(pR->nPatterns)]);
+  }
+
+  free(pR->paGoto);
+  free(pR->pOut);
+
+  memset(pR, 0, sizeof(*pR));
+}
+
+// a new reply is on its way
+static void reply_end_reset(void)
+{
+REPLY_END *pR = &sReplyEnd;
+
+  pR->iState = pR->paGoto ? pR->paGoto[0]['\n'] : 0; // the reply starts on a new line
+  pR->bWasCR = 0;
+  pR->nLinesSeen = 0;
+  pR->cbSeen = 0;
+  pR->iMatch = -1;
+}
+
+// one byte of the reply (from 'my_gets2').  non-zero when it ends the reply
+static int reply_end_byte(unsigned char c1)
+{
+REPLY_END *pR = &sReplyEnd;
+int bCRLF;
+
+  pR->cbSeen++;
+
+  bCRLF = c1 == '\n' && pR->bWasCR;
+  pR->bWasCR = c1 == '\r';
+
+  if(!bCRLF) // the LF of a CRLF was already counted with its CR
+  {
+    if(c1 == '\r' || c1 == '\n')
+    {
+      c1 = '\n';
+      pR->nLinesSeen++;
+    }
+
+    if(pR->paGoto)
+    {
+      pR->iState = pR->paGoto[pR->iState][c1];
+
+      if(pR->pOut[pR->iState] >= 0)
+      {
+        pR->iMatch = pR->pOut[pR->iState];
+        return 1;
+      }
+    }
+  }
+
+  if((pR->nLines && pR->nLinesSeen >= pR->nLines) ||
+     (pR->cbBytes && pR->cbSeen >= pR->cbBytes))
+  {
+    pR->iMatch = REPLY_END_MAX;
+    return 1;
+  }
+
+  return 0;
+}
+
+// did the line from 'my_gets2' end the reply?  A prompt that ended it is removed from 'pLine'
+static int reply_end_line(char *pLine)
+{
+REPLY_END *pR = &sReplyEnd;
+int i1, i2;
+
+  if(!pR->bActive || pR->iMatch < 0)
+  {
+    return 0;
+  }
+
+  if(pR->iMatch < REPLY_END_MAX && pR->abPrompt[pR->iMatch])
+  {
+    i1 = strlen(pLine);
+    i2 = strlen(pR->apszPattern[pR->iMatch]);
+
+    if(i1 >= i2)
+    {
+      pLine[i1 - i2] = 0;
+    }
+  }
+
+  return 1;
+}
+
+
+// batch questions ('-q @file' or '-q -', or '-j' or '-0' with one question).  Each question
+// is sent with the usual line ending, and its reply is every line that comes back until the
+// device is quiet for 'iQuestionWait' msecs, or one of the '-E' conditions ends it.  With
+// '-p depth' several questions are sent before the replies come back, and a reply also ends
+// when the device echoes the next question, so only the last one waits out the quiet time.
+
+typedef struct _QUESTION_
+{
+  char *pszText;                // as sent, without the line ending
+  char *pReply;                 // lines that came back, with the line ending from '-T'
+  int cbReply, cbMax;
+  unsigned long long qwSent, qwFirst, qwLast; // 'metrics_usecs()', 0 for nothing yet
+} QUESTION;
+
+// next question from the file, skipping blank lines and '#' comments.  NULL at the end
+static char *question_next(FILE *pIn)
+{
+char tbuf[MY_GETS_BUFSIZE], *p1;
+
+  while(fgets(tbuf, sizeof(tbuf), pIn))
+  {
+    p1 = tbuf + strlen(tbuf);
+
+    while(p1 > tbuf && (*(p1 - 1) == '\n' || *(p1 - 1) == '\r'))
+    {
+      *(--p1) = 0;
+    }
+
+    p1 = (char *)my_ltrim(tbuf);
+
+    if(*p1 && *p1 != '#')
+    {
+      return strdup(p1);
+    }
+  }
+
+  return NULL;
+}
+
+static void question_send(HANDLE iFile, QUESTION *pQ)
+{
+  metrics_add(METRIC_COMMANDS, 1);
+
+  if(bCaptureActive)
+  {
+    capture_command(pQ->pszText);
+  }
+
+  my_write(iFile, pQ->pszText, strlen(pQ->pszText));
+  my_write(iFile, "\n", 1);  // same as 'send_command_get_multiline_reply_with_timeout'
+
+  pQ->qwSent = metrics_usecs();
+
+  SFT_PROBE2(command__send, pQ->pszText, 0);
+}
+
+// is 'pLine' the device echoing 'pszQuestion' back?
+static int question_is_echo(const char *pLine, const char *pszQuestion)
+{
+int i1 = strlen(pszQuestion);
+
+  pLine = my_ltrim(pLine);
+
+  if(strncmp(pLine, pszQuestion, i1))
+  {
+    return 0;
+  }
+
+  return !*my_ltrim(pLine + i1);
+}
+
+// more of the reply, as is ('cbExtra' leaves room for a line ending)
+static int question_append_bytes(QUESTION *pQ, const void *pData, int cbData, int cbExtra)
+{
+char *p1;
+
+  if(pQ->cbReply + cbData + cbExtra + 1 > pQ->cbMax)
+  {
+    p1 = realloc(pQ->pReply, pQ->cbMax + cbData + cbExtra + MY_GETS_BUFSIZE);
+
+    if(!p1)
+    {
+      return -1;
+    }
+
+    pQ->pReply = p1;
+    pQ->cbMax += cbData + cbExtra + MY_GETS_BUFSIZE;
+  }
+
+  memcpy(pQ->pReply + pQ->cbReply, pData, cbData);
+  pQ->cbReply += cbData;
+  pQ->pReply[pQ->cbReply] = 0;
+
+  if(!pQ->qwFirst)
+  {
+    pQ->qwFirst = metrics_usecs();
+  }
+
+  pQ->qwLast = metrics_usecs();
+
+  return 0;
+}
+
+static int question_append(QUESTION *pQ, const char *pLine)
+{
+  if(question_append_bytes(pQ, pLine, strlen(pLine), 2))
+  {
+    return -1;
+  }
+
+  if(iTerminator) // same line endings as 'get_reply'
+  {
+    pQ->pReply[pQ->cbReply++] = iTerminator;
+  }
+  else
+  {
+    pQ->pReply[pQ->cbReply++] = '\r';
+    pQ->pReply[pQ->cbReply++] = '\n';
+  }
+
+  pQ->pReply[pQ->cbReply] = 0;
+
+  return 0;
+}
+
+static void question_json_string(const char *pStr, int cbStr)
+{
+const unsigned char *p1 = (const unsigned char *)pStr;
+
+  putchar('"');
+
+  for(; cbStr > 0; p1++, cbStr--)
+  {
+    if(*p1 == '"' || *p1 == '\\')
+    {
+      putchar('\\');
+      putchar(*p1);
+    }
+    else if(*p1 == '\n')
+    {
+      fputs("\\n", stdout);
+    }
+    else if(*p1 == '\r')
+    {
+      fputs("\\r", stdout);
+    }
+    else if(*p1 == '\t')
+    {
+      fputs("\\t", stdout);
+    }
+    else if(*p1 < 32 || *p1 == 127)
+    {
+      printf("\\u%04x", *p1);
+    }
+    else
+    {
+      putchar(*p1);
+    }
+  }
+
+  putchar('"');
+}
+
+// the question has its reply (or never got one) - write it out, and free it
+static void question_done(QUESTION *pQ)
+{
+unsigned long long qwReply = pQ->qwLast ? pQ->qwLast - pQ->qwSent : METRICS_NO_TIME;
+
+  metrics_latency(pQ->pszText, pQ->qwFirst ? pQ->qwFirst - pQ->qwSent : METRICS_NO_TIME, qwReply, 0);
+
+  if(pQ->cbReply)
+  {
+    SFT_PROBE4(command__reply, pQ->pszText, pQ->pReply, qwReply, 0);
+  }
+  else
+  {
+    metrics_add(METRIC_COMMAND_TIMEOUTS, 1);
+    SFT_PROBE3(command__timeout, pQ->pszText, metrics_usecs() - pQ->qwSent, 0);
+  }
+
+  if(iQuestionFormat == QUESTION_FORMAT_NUL)
+  {
+    fwrite(pQ->pszText, 1, strlen(pQ->pszText) + 1, stdout);
+    fwrite(pQ->pReply ? pQ->pReply : "", 1, pQ->cbReply + 1, stdout);
+  }
+  else if(iQuestionFormat == QUESTION_FORMAT_JSON)
+  {
+    fputs("{\"question\":", stdout);
+    question_json_string(pQ->pszText, strlen(pQ->pszText));
+    fputs(",\"reply\":", stdout);
+    question_json_string(pQ->pReply, pQ->cbReply);
+    printf(",\"msecs\":%llu,\"timeout\":%s}\n",
+           pQ->cbReply ? qwReply / 1000 : 0ULL, pQ->cbReply ? "false" : "true");
+  }
+  else if(pQ->cbReply)
+  {
+    fwrite(pQ->pReply, 1, pQ->cbReply, stdout);
+  }
+
+  fflush(stdout); // a script reading the other end of a pipe sees each one as soon as it's done
+
+  free(pQ->pszText);
+
+  if(pQ->pReply)
+  {
+    free(pQ->pReply);
+  }
+
+  memset(pQ, 0, sizeof(*pQ));
+}
+
+// where the questions come from:  '*ppIn' is NULL for the one in 'pszQuestion'.  Non-zero on error
+static int question_input(FILE **ppIn)
+{
+  *ppIn = NULL;
+
+  if(!strcmp(pszQuestion, "-"))
+  {
+    *ppIn = stdin;
+  }
+  else if(*pszQuestion == '@')
+  {
+    *ppIn = fopen(pszQuestion + 1, "r");
+
+    if(!*ppIn)
+    {
+      fprintf(stderr, "Unable to open question file \"%s\", errno=%d\n", pszQuestion + 1, errno);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void question_batch(HANDLE iFile)
+{
+QUESTION aQ[QUESTION_MAX_DEPTH];
+FILE *pIn;
+char *p1;
+int iHead = 0, nOut = 0, bEnd = 0, bEnded;
+unsigned int dwStart = 0;
+
+
+  memset(aQ, 0, sizeof(aQ));
+  reply_end_reset();
+
+  if(question_input(&pIn))
+  {
+    return;
+  }
+
+  do
+  {
+    // keep 'iQuestionDepth' questions on their way
+    while(nOut < iQuestionDepth && !bEnd)
+    {
+      if(pIn)
+      {
+        p1 = question_next(pIn);
+      }
+      else // just the one from '-q'
+      {
+        p1 = strdup(pszQuestion);
+        bEnd = 1;
+      }
+
+      if(!p1)
+      {
+        bEnd = 1;
+        break;
+      }
+
+      aQ[(iHead + nOut) % QUESTION_MAX_DEPTH].pszText = p1;
+      question_send(iFile, aQ + (iHead + nOut) % QUESTION_MAX_DEPTH);
+
+      if(!nOut++)
+      {
+        dwStart = MyGetTickCount();
+      }
+    }
+
+    if(!nOut)
+    {
+      break;
+    }
+
+    if(!my_pollin(iFile)) // quiet for 'iQuestionWait' ends the reply
+    {
+      if(TimeIntervalExceeds(dwStart, iQuestionWait))
+      {
+        question_done(aQ + iHead);
+        iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+        nOut--;
+        dwStart = MyGetTickCount();
+        reply_end_reset();
+      }
+
+      continue;
+    }
+
+    bMyGetsEchoFlag = 0; // never to stdout, it's the reply
+    p1 = my_gets2(iFile, iQuestionWait);
+
+    if(!p1)
+    {
+      fprintf(stderr, "Not enough memory to continue\n");
+      break;
+    }
+
+    bEnded = reply_end_line(p1);
+
+    if(!bEnded && nOut > 1 && question_is_echo(p1, aQ[(iHead + 1) % QUESTION_MAX_DEPTH].pszText))
+    {
+      question_done(aQ + iHead); // the next one has started
+      iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+      nOut--;
+      reply_end_reset();
+    }
+
+    if((*p1 || !bEnded) && question_append(aQ + iHead, p1)) // nothing left of a prompt line
+    {
+      fprintf(stderr, "Not enough memory to continue\n");
+      free(p1);
+      break;
+    }
+
+    free(p1);
+    dwStart = MyGetTickCount();
+
+    if(bEnded)
+    {
+      question_done(aQ + iHead);
+      iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+      nOut--;
+      reply_end_reset();
+    }
+
+  } while(!QuitFlag());
+
+  while(nOut > 0) // only if something went wrong
+  {
+    question_done(aQ + iHead);
+    iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+    nOut--;
+  }
+
+  if(pIn && pIn != stdin)
+  {
+    fclose(pIn);
+  }
+
+  bMyGetsEchoFlag = 1;
+}
+
+#ifndef WIN32
+// '-q' in binary frames ('-f', see 'sftframe.h').  A reply is every REPLY frame with the
+// question's sequence number, up to its END frame, so it can be binary, and the end of it
+// is known without '-E' or waiting for the device to be quiet.  With '-p', a reply frame
+// for a later question also ends the ones before it (their END frames were lost)
+
+static FRAME_READER sFrameReader;
+static int cbFrameMax = FRAME_MAX_DATA; // what the device takes, from its HELLO frame
+static int bFrameHelloFlags = 0; // FRAME_HELLO_xxx
+
+static void frame_send(HANDLE iFile, uint8_t bType, uint8_t bSeq, const void *pData, int cbData)
+{
+uint8_t aBuf[FRAME_ENCODED_MAX(FRAME_MAX_DATA)];
+int i1;
+
+  i1 = frame_encode(aBuf, sizeof(aBuf), bType, bSeq, pData, cbData);
+
+  if(i1 > 0)
+  {
+    my_write(iFile, aBuf, i1);
+    metrics_add(METRIC_FRAMES_SENT, 1);
+  }
+}
+
+// the next frame, waiting up to 'iMsec' for it.  1 for a frame, 0 for none, -1 on error
+static int frame_get(HANDLE iFile, FRAME_VIEW *pV, int iMsec)
+{
+uint32_t dwErrors = sFrameReader.dwErrors;
+unsigned int dwStart;
+uint8_t *p1;
+int i1, cb1;
+
+  dwStart = MyGetTickCount();
+
+  while(!(i1 = frame_reader_next(&sFrameReader, pV)) && !TimeIntervalExceeds(dwStart, iMsec))
+  {
+    i1 = my_pollin_msec(iFile, iMsec);
+
+    if(i1 < 0)
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(!i1)
+    {
+      break;
+    }
+
+    p1 = frame_reader_space(&sFrameReader, &cb1);
+    i1 = my_read(iFile, p1, cb1);
+
+    if(i1 < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      fprintf(stderr, "read error %d\n", errno);
+      break;
+    }
+
+    frame_reader_fill(&sFrameReader, i1);
+  }
+
+  metrics_add(METRIC_FRAME_ERRORS, sFrameReader.dwErrors - dwErrors);
+
+  if(i1 > 0)
+  {
+    metrics_add(METRIC_FRAMES_RECEIVED, 1);
+  }
+
+  return i1;
+}
+
+// asks the device for frames.  Non-zero if it didn't answer with a HELLO frame
+static int frame_session_open(HANDLE iFile)
+{
+FRAME_VIEW sV;
+unsigned int dwStart;
+int i1;
+
+  frame_reader_init(&sFrameReader);
+
+  my_write(iFile, FRAME_HELLO_COMMAND, strlen(FRAME_HELLO_COMMAND));
+  my_write(iFile, "\n", 1);  // same as 'question_send'
+
+  dwStart = MyGetTickCount();
+
+  while(!TimeIntervalExceeds(dwStart, iQuestionWait))
+  {
+    i1 = frame_get(iFile, &sV, 100);
+
+    if(i1 < 0)
+    {
+      return -1;
+    }
+
+    if(i1 > 0 && sV.bType == FRAME_TYPE_HELLO && sV.cbData >= 3 && sV.pData[0] >= FRAME_VERSION)
+    {
+      cbFrameMax = (sV.pData[1] << 8) | sV.pData[2];
+      bFrameHelloFlags = sV.cbData >= 4 ? sV.pData[3] : 0;
+
+      if(cbFrameMax > FRAME_MAX_DATA)
+      {
+        cbFrameMax = FRAME_MAX_DATA;
+      }
+
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// returns non-zero if the device doesn't know frames, and the questions weren't asked
+static int question_framed(HANDLE iFile)
+{
+QUESTION aQ[QUESTION_MAX_DEPTH], *pQ;
+uint8_t abSeq[QUESTION_MAX_DEPTH], bSeq = 0;
+FRAME_VIEW sV;
+FILE *pIn;
+char *p1;
+int iHead = 0, nOut = 0, bEnd = 0, i1, i2;
+unsigned int dwStart = 0;
+
+
+  if(frame_session_open(iFile))
+  {
+    return 1;
+  }
+
+  memset(aQ, 0, sizeof(aQ));
+
+  if(question_input(&pIn))
+  {
+    frame_send(iFile, FRAME_TYPE_TEXT, 0, NULL, 0);
+    return 0;
+  }
+
+  do
+  {
+    if(!nOut) // between questions
+    {
+      baud_watch(iFile);
+    }
+
+    // keep 'iQuestionDepth' questions on their way
+    while(nOut < iQuestionDepth && !bEnd)
+    {
+      p1 = pIn ? question_next(pIn) : strdup(pszQuestion);
+      bEnd = !pIn || !p1;
+
+      if(!p1)
+      {
+        break;
+      }
+
+      pQ = aQ + (iHead + nOut) % QUESTION_MAX_DEPTH;
+      pQ->pszText = p1;
+
+      if((int)strlen(p1) > cbFrameMax)
+      {
+        fprintf(stderr, "\"%s\" is too long for a frame (%d bytes at most)\n", p1, cbFrameMax);
+        question_done(pQ);
+        continue;
+      }
+
+      metrics_add(METRIC_COMMANDS, 1);
+
+      if(bCaptureActive)
+      {
+        capture_command(p1);
+      }
+
+      abSeq[(iHead + nOut) % QUESTION_MAX_DEPTH] = ++bSeq;
+      frame_send(iFile, FRAME_TYPE_COMMAND, bSeq, p1, strlen(p1));
+
+      pQ->qwSent = metrics_usecs();
+      SFT_PROBE2(command__send, p1, 0);
+
+      if(!nOut++)
+      {
+        dwStart = MyGetTickCount();
+      }
+    }
+
+    if(!nOut)
+    {
+      break;
+    }
+
+    i1 = frame_get(iFile, &sV, 100);
+
+    if(i1 < 0)
+    {
+      break;
+    }
+
+    if(!i1)
+    {
+      if(TimeIntervalExceeds(dwStart, iQuestionWait)) // no END frame
+      {
+        question_done(aQ + iHead);
+        iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+        nOut--;
+        dwStart = MyGetTickCount();
+      }
+
+      continue;
+    }
+
+    if(sV.bType != FRAME_TYPE_REPLY && sV.bType != FRAME_TYPE_END)
+    {
+      continue; // DATA frames aren't for '-q'
+    }
+
+    for(i2=0; i2 < nOut && abSeq[(iHead + i2) % QUESTION_MAX_DEPTH] != sV.bSeq; i2++)
+    { }
+
+    if(i2 == nOut) // a question that already timed out
+    {
+      metrics_add(METRIC_FRAME_STALE, 1);
+      continue;
+    }
+
+    while(i2-- > 0)
+    {
+      question_done(aQ + iHead);
+      iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+      nOut--;
+    }
+
+    if(question_append_bytes(aQ + iHead, sV.pData, sV.cbData, 0))
+    {
+      fprintf(stderr, "Not enough memory to continue\n");
+      break;
+    }
+
+    dwStart = MyGetTickCount();
+
+    if(sV.bType == FRAME_TYPE_END)
+    {
+      question_done(aQ + iHead);
+      iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+      nOut--;
+    }
+
+  } while(!QuitFlag());
+
+  while(nOut > 0) // only if something went wrong
+  {
+    question_done(aQ + iHead);
+    iHead = (iHead + 1) % QUESTION_MAX_DEPTH;
+    nOut--;
+  }
+
+  if(pIn && pIn != stdin)
+  {
+    fclose(pIn);
+  }
+
+  frame_send(iFile, FRAME_TYPE_TEXT, 0, NULL, 0); // the next one to open the port gets text lines
+
+  if(sFrameReader.dwErrors && !bQuietFlag)
+  {
+    fprintf(stderr, "%lu bad frames were thrown away\n", (unsigned long)sFrameReader.dwErrors);
+  }
+
+  return 0;
+}
+#endif // WIN32
+
+#ifndef WIN32
+// virtual channels ('-V', see 'sftmux.h').  The console, the device's telemetry and a file
+// ('-U') share the port in frames, so a file transfer no longer stops the other two.  What's
+// typed goes to the device as it's typed, and its console output is written as it arrives.
+// Telemetry lines go to '-T' and '-G' (or are only counted).  The file goes out as fast as
+// the device grants credit for it, and the device's answer ('OK bytes', or why not) goes to
+// stderr.  A lost frame isn't sent again:  the receiver counts it, and a file with one
+// missing is reported as an error by the device.
+
+#define MUX_REFRESH_MSEC 500 /* everyone's credit again, in case a CREDIT frame was lost */
+
+static MUX sMux;
+static char aMuxLine[MY_GETS_BUFSIZE];
+static int cbMuxLine, bMuxFileDone;
+static unsigned int dwMuxReply; // the console or file channel's last data, for '-w'
+static unsigned long ulMuxLines;
+static unsigned long long qwMuxFileSent, qwMuxFileStart, qwMuxFileEnd;
+
+static void mux_data(void *pCtx, int iChannel, const uint8_t *pData, int cbData, int bEnd)
+{
+int i1;
+
+  switch(iChannel)
+  {
+    case MUX_CHANNEL_CONSOLE:
+      dwMuxReply = MyGetTickCount();
+      console_loop_write(iStdOut, (const char *)pData, cbData); // same as 'console_loop()'
+      break;
+
+    case MUX_CHANNEL_TELEMETRY:
+      for(i1=0; i1 < cbData; i1++)
+      {
+        if(pData[i1] == '\r' || pData[i1] == '\n')
+        {
+          if(cbMuxLine)
+          {
+            aMuxLine[cbMuxLine] = 0;
+            ulMuxLines++;
+
+            if(pszTelemetryFile || pszShmName)
+            {
+              telemetry_line(aMuxLine, telemetry_now());
+            }
+
+            cbMuxLine = 0;
+          }
+        }
+        else if(cbMuxLine < (int)sizeof(aMuxLine) - 1)
+        {
+          aMuxLine[cbMuxLine++] = pData[i1];
+        }
+      }
+      break;
+
+    case MUX_CHANNEL_FILE: // the device's answer
+      dwMuxReply = MyGetTickCount();
+      write(2, pData, cbData);
+
+      if(bEnd)
+      {
+        bMuxFileDone = 1;
+        qwMuxFileEnd = metrics_usecs();
+      }
+      break;
+
+    default: // nothing uses the control channel yet
+      break;
+  }
+}
+
+static void mux_loop(HANDLE iFile, HANDLE iConsole)
+{
+struct pollfd aFD[2];
+FRAME_VIEW sV;
+uint8_t aOut[FRAME_ENCODED_MAX(FRAME_MAX_DATA)], *p1;
+char aIn[MUX_QUEUE_SIZE];
+FILE *pFile = NULL;
+unsigned int dwRefresh;
+uint32_t dwErrors;
+int i1, cb1, nFD, bConsoleOpen = 1;
+
+
+  if(pszMuxFile && !(pFile = fopen(pszMuxFile, "rb")))
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d\n", pszMuxFile, errno);
+    return;
+  }
+
+  i1 = frame_session_open(iFile);
+
+  if(i1 || !(bFrameHelloFlags & FRAME_HELLO_CHANNELS) || cbFrameMax < FRAME_MAX_DATA)
+  {
+    if(!i1)
+    {
+      frame_send(iFile, FRAME_TYPE_TEXT, 0, NULL, 0);
+    }
+
+    fputs("The device does not know virtual channels ('-V')\n", stderr);
+
+    if(pFile)
+    {
+      fclose(pFile);
+    }
+
+    return;
+  }
+
+  cbMuxLine = bMuxFileDone = 0;
+  ulMuxLines = 0;
+  qwMuxFileSent = qwMuxFileEnd = 0;
+
+  mux_init(&sMux, mux_data, NULL);
+  mux_weight(&sMux, MUX_CHANNEL_CONSOLE, 2); // a line typed waits for one file frame at most
+  mux_weight(&sMux, MUX_CHANNEL_CONTROL, 2);
+  mux_weight(&sMux, MUX_CHANNEL_FILE, 1);
+  mux_refresh(&sMux);
+
+  if(pFile) // the file channel starts with the name
+  {
+    p1 = (uint8_t *)strrchr(pszMuxFile, '/');
+    p1 = p1 ? p1 + 1 : (uint8_t *)pszMuxFile;
+
+    mux_write(&sMux, MUX_CHANNEL_FILE, p1, strlen((char *)p1));
+    mux_write(&sMux, MUX_CHANNEL_FILE, "\n", 1);
+  }
+
+  signal(SIGINT, quit_signal);
+  signal(SIGTERM, quit_signal);
+
+  qwMuxFileStart = metrics_usecs();
+  dwRefresh = dwMuxReply = MyGetTickCount();
+
+  while(!QuitFlag())
+  {
+    // as much of the file as the channel's queue takes
+    while(pFile && (cb1 = mux_space(&sMux, MUX_CHANNEL_FILE)) > 0)
+    {
+      i1 = fread(aIn, 1, cb1 < (int)sizeof(aIn) ? cb1 : (int)sizeof(aIn), pFile);
+
+      if(i1 <= 0)
+      {
+        fclose(pFile);
+        pFile = NULL;
+
+        mux_close(&sMux, MUX_CHANNEL_FILE);
+        break;
+      }
+
+      mux_write(&sMux, MUX_CHANNEL_FILE, aIn, i1);
+      qwMuxFileSent += i1;
+    }
+
+    if(TimeIntervalExceeds(dwRefresh, MUX_REFRESH_MSEC))
+    {
+      mux_refresh(&sMux);
+      dwRefresh = MyGetTickCount();
+    }
+
+    // everything the device has credit for, in turn
+    while((cb1 = mux_output(&sMux, aOut, sizeof(aOut))) > 0)
+    {
+      console_loop_write(iFile, (const char *)aOut, cb1);
+      metrics_add(METRIC_FRAMES_SENT, 1);
+    }
+
+    // console input, everything sent (or at least waiting its turn), and no reply for '-w'
+    if(!bConsoleOpen && !pFile && (!pszMuxFile || bMuxFileDone) && !pszTelemetryFile && !pszShmName &&
+       !mux_pending(&sMux, MUX_CHANNEL_CONSOLE) && TimeIntervalExceeds(dwMuxReply, iQuestionWait))
+    {
+      break;
+    }
+
+    aFD[0].fd = my_poll_handle(iFile);
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+    aFD[1].fd = iConsole;
+    aFD[1].events = POLLIN;
+    aFD[1].revents = 0;
+
+    // the console waits while its queue is full
+    nFD = bConsoleOpen && mux_space(&sMux, MUX_CHANNEL_CONSOLE) > 0 ? 2 : 1;
+
+    i1 = poll(aFD, nFD, 100);
+
+    if(i1 < 0 && errno != EINTR)
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(i1 <= 0)
+    {
+      if(pszTelemetryFile || pszShmName)
+      {
+        telemetry_idle();
+      }
+
+      continue;
+    }
+
+    metrics_add(METRIC_POLL_WAKEUPS, 1);
+
+    if(aFD[0].revents & POLLERR)
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      break;
+    }
+
+    if(nFD > 1 && (aFD[1].revents & (POLLIN | POLLHUP)))
+    {
+      i1 = read(iConsole, aIn, mux_space(&sMux, MUX_CHANNEL_CONSOLE));
+
+      if(i1 > 0)
+      {
+        mux_write(&sMux, MUX_CHANNEL_CONSOLE, aIn, i1);
+      }
+      else if(!i1 || (errno != EAGAIN && errno != EINTR)) // the rest goes on without it
+      {
+        bConsoleOpen = 0;
+      }
+    }
+
+    if(aFD[0].revents & POLLIN)
+    {
+      p1 = frame_reader_space(&sFrameReader, &cb1);
+      i1 = my_read(iFile, p1, cb1);
+
+      if(i1 < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+        continue;
+      }
+
+      if(i1 <= 0) // the device went away
+      {
+        fprintf(stderr, "read error %d\n", errno);
+        break;
+      }
+
+      frame_reader_fill(&sFrameReader, i1);
+      dwErrors = sFrameReader.dwErrors;
+
+      while(frame_reader_next(&sFrameReader, &sV) > 0)
+      {
+        metrics_add(METRIC_FRAMES_RECEIVED, 1);
+        mux_input(&sMux, &sV); // anything else is for '-q'
+      }
+
+      metrics_add(METRIC_FRAME_ERRORS, sFrameReader.dwErrors - dwErrors);
+
+      baud_watch(iFile);
+    }
+  }
+
+  signal(SIGINT, signalproc);
+  signal(SIGTERM, signalproc);
+
+  if(pFile)
+  {
+    fclose(pFile);
+  }
+
+  frame_send(iFile, FRAME_TYPE_TEXT, 0, NULL, 0); // text lines again, for whoever's next
+
+  if(!bQuietFlag)
+  {
+    fprintf(stderr, "\nconsole %lu frames, telemetry %lu frames (%lu lines), file %lu frames received\n",
+            (unsigned long)sMux.aCh[MUX_CHANNEL_CONSOLE].dwFrames,
+            (unsigned long)sMux.aCh[MUX_CHANNEL_TELEMETRY].dwFrames, ulMuxLines,
+            (unsigned long)sMux.aCh[MUX_CHANNEL_FILE].dwFrames);
+
+    for(i1=0; i1 < MUX_CHANNELS; i1++)
+    {
+      if(sMux.aCh[i1].dwLost)
+      {
+        fprintf(stderr, "channel %d:  %lu frames were lost\n", i1, (unsigned long)sMux.aCh[i1].dwLost);
+      }
+    }
+
+    if(sFrameReader.dwErrors)
+    {
+      fprintf(stderr, "%lu bad frames were thrown away\n", (unsigned long)sFrameReader.dwErrors);
+    }
+
+    if(pszMuxFile && bMuxFileDone)
+    {
+      fprintf(stderr, "\"%s\":  %llu bytes in %.3f secs\n", pszMuxFile, qwMuxFileSent,
+              (qwMuxFileEnd - qwMuxFileStart) / 1e6);
+    }
+    else if(pszMuxFile)
+    {
+      fprintf(stderr, "\"%s\" was not finished (%llu bytes sent)\n", pszMuxFile, qwMuxFileSent);
+    }
+  }
+}
+#endif // WIN32
+
+#ifndef WIN32
+// baud rate upshift ('-A', see 'sftbaud.h').  After the port is open, the rate goes up one step
+// at a time through what the device can do, and each step is tried with a short burst of
+// frames that the device sends back.  The first step that doesn't pass (not every frame came
+// back, as it was sent) ends it, and the rate before it is kept.  Later, in framed mode ('-f',
+// '-V'), BAUD_WATCH_ERRORS bad frames in BAUD_WATCH_FRAMES go one step down the same way.
+// At the end it goes back to the '-B' rate, in case the next one to open the port uses it.
+
+#define BAUD_PROBE_FRAMES 8   /* in the burst, each one full size */
+#define BAUD_PROBE_WAIT   250 /* msecs for each one to come back, plus its time on the wire */
+#define BAUD_SETTLE_MSEC  20  /* for the device to switch after its reply */
+#define BAUD_REPLY_MSEC   1000
+#define BAUD_WATCH_FRAMES 64
+#define BAUD_WATCH_ERRORS 4
+
+static unsigned long aulBaudRates[BAUD_MAX_RATES]; // the device's, lowest first
+static int nBaudRates = 0;
+static unsigned long ulBaudBase, ulBaudNow;  // the '-B' rate, and the one now
+static uint32_t dwBaudWatchFrames, dwBaudWatchErrors; // the frame reader's counts when the window started
+static uint8_t bBaudSeq = 0x80; // COMMAND frames, apart from '-q'
+
+// the host's end of the cable
+static int baud_set(HANDLE iFile, unsigned long ulRate)
+{
+struct termios sIOS;
+
+  tcdrain(iFile); // the command goes out at the old rate
+
+  if(tcgetattr(iFile, &sIOS) || cfsetspeed(&sIOS, ulRate) || tcsetattr(iFile, TCSANOW, &sIOS))
+  {
+    fprintf(stderr, "error %d setting %lu baud\n", errno, ulRate);
+    return -1;
+  }
+
+  ulBaudNow = ulRate;
+
+  return 0;
+}
+
+// throws away what arrives for 'iMsec' (garbage from either end switching)
+static void baud_drain(HANDLE iFile, int iMsec)
+{
+char tbuf[256];
+unsigned int dwStart = MyGetTickCount();
+
+  while(iMsec > 0 && !TimeIntervalExceeds(dwStart, iMsec))
+  {
+    if(my_pollin_msec(iFile, 10) > 0)
+    {
+      my_read(iFile, tbuf, sizeof(tbuf));
+    }
+  }
+}
+
+// sends 'pszCommand' and gets the reply line that starts with its first word and ':'.
+// In framed mode, it's a COMMAND frame, and frames for the '-V' channels still go to them
+static int baud_request(HANDLE iFile, const char *pszCommand, int bFramed, char *pszReply, int cbReply)
+{
+char szWant[16];
+FRAME_VIEW sV;
+unsigned int dwStart;
+int i1, cbLine = 0, cbWant;
+
+  cbWant = strcspn(pszCommand, " ");
+  snprintf(szWant, sizeof(szWant), "%.*s:", cbWant, pszCommand);
+  cbWant++;
+
+  if(bFramed)
+  {
+    frame_send(iFile, FRAME_TYPE_COMMAND, ++bBaudSeq, pszCommand, strlen(pszCommand));
+  }
+  else
+  {
+    my_write(iFile, pszCommand, strlen(pszCommand));
+    my_write(iFile, "\n", 1); // same as 'question_send'
+  }
+
+  *pszReply = 0;
+  dwStart = MyGetTickCount();
+
+  while(!TimeIntervalExceeds(dwStart, BAUD_REPLY_MSEC))
+  {
+    if(bFramed)
+    {
+      i1 = frame_get(iFile, &sV, 100);
+
+      if(i1 < 0)
+      {
+        return -1;
+      }
+
+      if(i1 > 0 && bMuxFlag && mux_input(&sMux, &sV))
+      {
+        continue;
+      }
+
+      if(i1 > 0 && sV.bSeq == bBaudSeq && (sV.bType == FRAME_TYPE_REPLY || sV.bType == FRAME_TYPE_END))
+      {
+        for(i1=0; i1 < sV.cbData && cbLine < cbReply - 1; i1++)
+        {
+          if(sV.pData[i1] != '\r' && sV.pData[i1] != '\n')
+          {
+            pszReply[cbLine++] = sV.pData[i1];
+          }
+        }
+
+        pszReply[cbLine] = 0;
+
+        if(sV.bType == FRAME_TYPE_END)
+        {
+          return strncmp(pszReply, szWant, cbWant) ? 1 : 0;
+        }
+      }
+
+      continue;
+    }
+
+    // text lines, one byte at a time so that nothing after the reply is read
+    i1 = my_pollin_msec(iFile, 100);
+
+    if(i1 < 0)
+    {
+      return -1;
+    }
+
+    if(!i1 || my_read(iFile, pszReply + cbLine, 1) != 1)
+    {
+      continue;
+    }
+
+    if(pszReply[cbLine] != '\r' && pszReply[cbLine] != '\n')
+    {
+      if(cbLine < cbReply - 1)
+      {
+        cbLine++;
+      }
+
+      continue;
+    }
+
+    pszReply[cbLine] = 0;
+
+    if(!strncmp(pszReply, szWant, cbWant)) // not the echo, or anything else
+    {
+      return 0;
+    }
+
+    cbLine = 0;
+  }
+
+  return 1;
+}
+
+// the burst.  0 if it all came back and the device has the new rate, -1 if not, 1 if the
+// device didn't say whether it has it
+static int baud_probe(HANDLE iFile)
+{
+uint8_t aData[FRAME_MAX_DATA];
+uint32_t dw1;
+FRAME_VIEW sV;
+unsigned int dwStart;
+int i1, i2, iWait;
+
+  frame_reader_init(&sFrameReader); // whatever was in it is from the old rate
+
+  // the wire time both ways, at 10 bits per byte
+  iWait = BAUD_PROBE_WAIT + (int)(2ULL * FRAME_ENCODED_MAX(cbFrameMax) * 10000ULL / ulBaudNow);
+
+  for(i1=0; i1 < BAUD_PROBE_FRAMES; i1++)
+  {
+    // the same for every rate, with long runs of 0 and 1 bits, and random bytes
+    for(i2=0, dw1=0x9e3779b9U * (i1 + 1); i2 < cbFrameMax; i2++)
+    {
+      dw1 ^= dw1 << 13;
+      dw1 ^= dw1 >> 17;
+      dw1 ^= dw1 << 5;
+
+      aData[i2] = i2 < 16 ? (uint8_t)(i2 & 4 ? 0xff : 0x00) : i2 < 32 ? (uint8_t)(i2 & 1 ? 0x55 : 0xaa) : (uint8_t)dw1;
+    }
+
+    frame_send(iFile, FRAME_TYPE_PROBE, (uint8_t)i1, aData, cbFrameMax);
+
+    dwStart = MyGetTickCount();
+
+    do
+    {
+      i2 = frame_get(iFile, &sV, iWait);
+
+      if(i2 > 0 && sV.bType == FRAME_TYPE_PROBE && sV.bSeq == i1)
+      {
+        break;
+      }
+
+    } while(i2 >= 0 && !TimeIntervalExceeds(dwStart, iWait));
+
+    if(i2 <= 0 || sV.cbData != cbFrameMax || memcmp(sV.pData, aData, cbFrameMax))
+    {
+      return -1;
+    }
+  }
+
+  frame_send(iFile, FRAME_TYPE_CONFIRM, 0, NULL, 0);
+
+  dwStart = MyGetTickCount();
+
+  do
+  {
+    i2 = frame_get(iFile, &sV, iWait);
+
+    if(i2 > 0 && sV.bType == FRAME_TYPE_CONFIRM && sV.cbData >= 4)
+    {
+      dw1 = ((uint32_t)sV.pData[0] << 24) | ((uint32_t)sV.pData[1] << 16) | (sV.pData[2] << 8) | sV.pData[3];
+
+      return dw1 == ulBaudNow ? 0 : -1;
+    }
+
+  } while(i2 >= 0 && !TimeIntervalExceeds(dwStart, iWait));
+
+  return 1;
+}
+
+// both ends to 'ulRate'.  0 if they're there, 1 if they're back at the rate they had, -1 if
+// the device doesn't answer at either one
+static int baud_step(HANDLE iFile, unsigned long ulRate, int bFramed)
+{
+char szCmd[32], szReply[64];
+unsigned long ulOld = ulBaudNow;
+unsigned int dwSwitch;
+int i1;
+
+  snprintf(szCmd, sizeof(szCmd), BAUD_COMMAND " %lu", ulRate);
+
+  if(baud_request(iFile, szCmd, bFramed, szReply, sizeof(szReply)) ||
+     strtoul(szReply + sizeof(BAUD_COMMAND), NULL, 10) != ulRate)
+  {
+    return 1; // it said no
+  }
+
+  if(baud_set(iFile, ulRate))
+  {
+    return -1;
+  }
+
+  dwSwitch = MyGetTickCount();
+
+  baud_drain(iFile, BAUD_SETTLE_MSEC);
+
+  i1 = baud_probe(iFile);
+
+  if(i1 > 0) // the CONFIRM frame that came back was lost, or the one that went
+  {
+    i1 = baud_request(iFile, BAUD_LIST_COMMAND, bFramed, szReply, sizeof(szReply)) ? -1 : 0;
+  }
+
+  if(!i1)
+  {
+    return 0;
+  }
+
+  // the device goes back on its own when its time is up
+  baud_drain(iFile, BAUD_PROBE_MSEC + 100 - (int)(MyGetTickCount() - dwSwitch));
+
+  if(baud_set(iFile, ulOld))
+  {
+    return -1;
+  }
+
+  baud_drain(iFile, BAUD_SETTLE_MSEC);
+
+  if(bFramed)
+  {
+    frame_reader_init(&sFrameReader);
+  }
+
+  if(baud_request(iFile, BAUD_LIST_COMMAND, bFramed, szReply, sizeof(szReply)))
+  {
+    fprintf(stderr, "The device does not answer at %lu or %lu baud\n", ulRate, ulOld);
+    return -1;
+  }
+
+  return 1;
+}
+
+static void baud_negotiate(HANDLE iFile)
+{
+char szReply[256], *p1, *p2;
+unsigned long ul1;
+int i1, i2;
+
+  ulBaudBase = ulBaudNow = strtoul(szBaud, NULL, 10) ? strtoul(szBaud, NULL, 10) : 9600; // the first part of '-B'
+
+  if(baud_request(iFile, BAUD_LIST_COMMAND, 0, szReply, sizeof(szReply)))
+  {
+    fputs("The device does not change its baud rate ('-A')\n", stderr);
+    return;
+  }
+
+  // the list, lowest first
+  for(p1=szReply + sizeof(BAUD_LIST_COMMAND), nBaudRates=0; nBaudRates < BAUD_MAX_RATES; p1=p2)
+  {
+    ul1 = strtoul(p1, &p2, 10);
+
+    if(p2 == p1)
+    {
+      break;
+    }
+
+    for(i1=nBaudRates; i1 > 0 && aulBaudRates[i1 - 1] > ul1; i1--)
+    {
+      aulBaudRates[i1] = aulBaudRates[i1 - 1];
+    }
+
+    aulBaudRates[i1] = ul1;
+    nBaudRates++;
+  }
+
+  for(i1=0, i2=1; i1 < nBaudRates && i2 >= 0; i1++)
+  {
+    if(aulBaudRates[i1] <= ulBaudNow || aulBaudRates[i1] > ulBaudMax)
+    {
+      continue;
+    }
+
+    i2 = baud_step(iFile, aulBaudRates[i1], 0);
+
+    if(!i2)
+    {
+      metrics_add(METRIC_BAUD_UP, 1);
+    }
+    else // the cable can't, and a faster one won't either
+    {
+      if(!bQuietFlag)
+      {
+        fprintf(stderr, "%lu baud did not pass\n", aulBaudRates[i1]);
+      }
+
+      break;
+    }
+  }
+
+  if(!bQuietFlag)
+  {
+    fprintf(stderr, "Baud rate is now %lu\n", ulBaudNow);
+  }
+
+  dwBaudWatchFrames = sFrameReader.dwFrames;
+  dwBaudWatchErrors = sFrameReader.dwErrors;
+}
+
+// in framed mode, after frames were read.  Too many bad ones go one rate down
+static void baud_watch(HANDLE iFile)
+{
+uint32_t dwFrames = sFrameReader.dwFrames - dwBaudWatchFrames;
+uint32_t dwErrors = sFrameReader.dwErrors - dwBaudWatchErrors;
+int i1;
+
+  if(!ulBaudMax || ulBaudNow <= ulBaudBase)
+  {
+    return;
+  }
+
+  if(sFrameReader.dwFrames < dwBaudWatchFrames || sFrameReader.dwErrors < dwBaudWatchErrors)
+  {
+    // the reader started over (a new session, or a probe), and so does the window
+  }
+  else if(dwErrors >= BAUD_WATCH_ERRORS)
+  {
+    for(i1=nBaudRates - 1; i1 > 0 && aulBaudRates[i1] >= ulBaudNow; i1--)
+    { }
+
+    if(aulBaudRates[i1] < ulBaudBase)
+    {
+      return;
+    }
+
+    if(!bQuietFlag)
+    {
+      fprintf(stderr, "%lu bad frames in %lu at %lu baud, going down to %lu\n",
+              (unsigned long)dwErrors, (unsigned long)(dwFrames + dwErrors), ulBaudNow, aulBaudRates[i1]);
+    }
+
+    if(!baud_step(iFile, aulBaudRates[i1], 1))
+    {
+      metrics_add(METRIC_BAUD_DOWN, 1);
+    }
+  }
+  else if(dwFrames + dwErrors < BAUD_WATCH_FRAMES)
+  {
+    return;
+  }
+
+  dwBaudWatchFrames = sFrameReader.dwFrames; // the next window
+  dwBaudWatchErrors = sFrameReader.dwErrors;
+}
+
+// at the end, what the next one to open the port expects
+static void baud_restore(HANDLE iFile)
+{
+  if(ulBaudMax && ulBaudNow != ulBaudBase && !baud_step(iFile, ulBaudBase, 0))
+  {
+    metrics_add(METRIC_BAUD_DOWN, 1);
+  }
+}
+#endif // WIN32
+
+// one line of a single '-q' reply, to stdout as soon as it arrives
+static int question_stream_line(void *pCtx, const char *pszLine)
+{
+char tbuf[2];
+int i1;
+
+  i1 = reply_line_ending(tbuf);
+
+#ifndef WIN32
+  write(iStdOut, pszLine, strlen(pszLine));
+  write(iStdOut, tbuf, i1);
+#endif // WIN32
+
+  return 0;
+}
+
+void question_loop(HANDLE iFile, HANDLE iConsole)
+{
+  if(reply_end_build())
+  {
+    reply_end_free();
+    return;
+  }
+
+#ifndef WIN32
+  if(bFrameFlag)
+  {
+    if(iQuestionFormat < 0)
+    {
+      iQuestionFormat = (!strcmp(pszQuestion, "-") || *pszQuestion == '@')
+                      ? QUESTION_FORMAT_JSON : QUESTION_FORMAT_RAW;
+    }
+
+    if(!question_framed(iFile))
+    {
+      reply_end_free();
+      return;
+    }
+
+    fputs("The device does not know binary frames ('-f'), using text lines\n", stderr);
+    my_flush(iFile); // whatever it said to the FRAME command
+  }
+#endif // WIN32
+
+  if(!strcmp(pszQuestion, "-") || *pszQuestion == '@' || iQuestionFormat >= 0)
+  {
+    if(iQuestionFormat < 0) // several replies need to be told apart
+    {
+      iQuestionFormat = (!strcmp(pszQuestion, "-") || *pszQuestion == '@')
+                      ? QUESTION_FORMAT_JSON : QUESTION_FORMAT_RAW;
+    }
+
+    question_batch(iFile);
+    reply_end_free();
+    return;
+  }
+
+  reply_end_reset();
+
+  bMyGetsEchoFlag = 0;
+  send_command_stream_reply_with_timeout(iFile, pszQuestion, iQuestionWait, 0, question_stream_line, NULL);
+
+  reply_end_free();
+
+  return;
+}
+
+
+#ifndef WIN32
+// periodic polling ('-s schedule'), and an operator's commands in between.  Each line of the
+// schedule is one of
+//
+//   period priority command                      i.e. "50ms 0 V" or "1s 1 T"
+//   period bulk[:priority] command[;command...]  i.e. "10s bulk D 0;D 1;D 2"
+//
+// and the command is sent once every 'period' (msecs, or with 'ms' or 's'), on a fixed grid
+// that starts when polling does, so the time each poll takes doesn't add up to drift.  A
+// period that is over before its command could be sent is skipped ('missed'), and one that
+// is over before the reply arrived is an 'overrun'.  Both are reported, and the next poll
+// stays on the grid.
+//
+// The device does one thing at a time and a reply can't be interrupted, so the next command
+// is chosen each time a reply is done, by class:
+//
+//   interactive  a line from the console (typed, or piped to stdin), in the order they came
+//   control      the 'priority' lines, earliest deadline first (then 'priority', 0 first)
+//   bulk         the 'bulk' lines, one command of the sequence at a time, and only when no
+//                control poll is due before it could finish (the longest one of its commands
+//                has taken so far), unless the bulk period ends first.  The rest of the
+//                sequence waits for the next gap
+//
+// So an interactive command waits for the one command in progress at most:  a control poll
+// (its period or '-w', whichever is shorter, and the quiet wait below if it timed out), or a
+// single command of a bulk job.  That bound is printed at the start, and how long each class
+// waited, at the end.
+//
+// A reply is the first line that isn't the echo.  With '-E', interactive and bulk replies are
+// every line until one of its conditions instead (without it, the end of a longer reply is
+// '-w' of quiet, and that long the port would be held).  When polling starts, and after a reply
+// that didn't come in time (or, with '-E', ran out of time before one of its conditions), the
+// next command waits until the port has been quiet for a moment, so a late line isn't taken for
+// its reply.  What came before a command is sent is never part of its reply.
+// Each reply is written as soon as it's done, as "time<TAB>late<TAB>command<TAB>reply" (once for
+// each line of the reply), or as a JSON line with '-j'.  'time' is when the command was sent
+// (seconds since 1970), and 'late' is how long it waited for the port, in msecs.
+
+#define POLL_MAX_TASKS  64
+#define POLL_MAX_QUEUED 64 /* interactive commands waiting */
+#define POLL_QUIET_MSEC 100 /* quiet on the port before the next command, after a timeout */
+#define POLL_START_MSEC 250 /* and before the first one, the device may have just been opened */
+
+#define CMD_CLASS_INTERACTIVE 0
+#define CMD_CLASS_CONTROL     1
+#define CMD_CLASS_BULK        2
+#define CMD_CLASSES           3
+
+static const char * const aszCmdClass[CMD_CLASSES] = { "interactive", "control", "bulk" };
+
+typedef struct _POLL_TASK_
+{
+  char *pszCommand;               // a bulk job's commands are separated by ';'
+  int iClass;                     // CMD_CLASS_xxx
+  unsigned long long qwPeriod;    // usecs, 0 for an interactive command
+  int iPriority;                  // 0 is the most important
+  unsigned long long qwRelease;   // 'metrics_usecs()' when the current period started (or it was typed)
+  const char *pStep;              // next command of a bulk job that has started, NULL if it hasn't
+  unsigned long long qwLongest;   // longest one command has held the port, usecs
+  unsigned long long nPolls, nOverruns, nMissed, nTimeouts, nMissedNow;
+  unsigned long long qwLateTotal, qwLateMax; // usecs
+} POLL_TASK;
+
+typedef struct _CMD_CLASS_STATS_
+{
+  unsigned long long nCommands, qwWaitTotal, qwWaitMax, qwHoldMax; // usecs
+} CMD_CLASS_STATS;
+
+static POLL_TASK aPollTask[POLL_MAX_TASKS];
+static int nPollTasks = 0;
+static POLL_TASK aPollQueued[POLL_MAX_QUEUED]; // interactive commands, a ring
+static int iPollQueued = 0, nPollQueued = 0;
+static CMD_CLASS_STATS aCmdClassStats[CMD_CLASSES];
+static unsigned long long qwPollRealtime; // add to 'metrics_usecs()' for the wall clock
+static HANDLE iPollConsole = -1;          // -1 when there's no console (or it's done)
+static int bPollConsoleEcho = 0, bPollReplyEnd = 0;
+static char aPollLine[MY_GETS_BUFSIZE];   // what's been typed so far
+static int cbPollLine = 0;
+
+static int poll_schedule_read(void)
+{
+FILE *pIn;
+char *p1, *p2, *p3, *p4;
+double dPeriod;
+long lPriority;
+int iRval = 0, iClass, bBad;
+
+
+  pIn = strcmp(pszPollSchedule, "-") ? fopen(pszPollSchedule, "r") : stdin;
+
+  if(!pIn)
+  {
+    fprintf(stderr, "Unable to open poll schedule \"%s\", errno=%d\n", pszPollSchedule, errno);
+    return -1;
+  }
+
+  nPollTasks = 0;
+
+  while(!iRval && (p1 = question_next(pIn))) // blank lines and '#' comments, same as '-q @file'
+  {
+    dPeriod = strtod(p1, &p2);
+
+    if(!strncmp(p2, "ms", 2))
+    {
+      p2 += 2;
+    }
+    else if(*p2 == 's')
+    {
+      dPeriod *= 1000.0;
+      p2++;
+    }
+
+    // 'priority', 'bulk' or 'bulk:priority'
+    iClass = CMD_CLASS_CONTROL;
+    p3 = (char *)my_ltrim(p2);
+    p4 = p3;
+    bBad = 0;
+
+    if(!strncmp(p3, "bulk", 4) && (p3[4] == ':' || p3[4] == ' ' || p3[4] == '\t'))
+    {
+      iClass = CMD_CLASS_BULK;
+      p3 += 4;
+      p4 = p3;
+      lPriority = 0;
+
+      if(*p3 == ':')
+      {
+        p3++;
+        lPriority = strtol(p3, &p4, 10);
+        bBad = p4 == p3;
+      }
+    }
+    else
+    {
+      lPriority = strtol(p3, &p4, 10);
+      bBad = p4 == p3;
+    }
+
+    if(dPeriod < 1.0 || dPeriod > 86400000.0 || (*p2 != ' ' && *p2 != '\t') ||
+       bBad || lPriority < 0 || (*p4 != ' ' && *p4 != '\t') || !*my_ltrim(p4))
+    {
+      fprintf(stderr, "Poll schedule line \"%s\" must be 'period priority command', i.e. \"50ms 0 V\",\n"
+                      "or 'period bulk[:priority] command[;command...]'\n", p1);
+      iRval = -1;
+    }
+    else if(nPollTasks >= POLL_MAX_TASKS)
+    {
+      fprintf(stderr, "A poll schedule can have up to %d commands\n", POLL_MAX_TASKS);
+      iRval = -1;
+    }
+    else
+    {
+      memset(aPollTask + nPollTasks, 0, sizeof(aPollTask[0]));
+      aPollTask[nPollTasks].pszCommand = strdup(my_ltrim(p4));
+      aPollTask[nPollTasks].iClass = iClass;
+      aPollTask[nPollTasks].qwPeriod = (unsigned long long)(dPeriod * 1000.0);
+      aPollTask[nPollTasks].iPriority = (int)lPriority;
+      nPollTasks++;
+    }
+
+    free(p1);
+  }
+
+  if(pIn != stdin)
+  {
+    fclose(pIn);
+  }
+
+  if(!iRval && !nPollTasks)
+  {
+    fputs("The poll schedule has no commands in it\n", stderr);
+    iRval = -1;
+  }
+
+  return iRval;
+}
+
+// what arrived after the last reply isn't this one's.  Unlike 'my_flush()', this doesn't wait for more
+static void poll_drain(HANDLE iFile)
+{
+char aBuf[256];
+
+  while(my_pollin_msec(iFile, 0) > 0 && my_read(iFile, aBuf, sizeof(aBuf)) > 0)
+  { }
+}
+
+// reads what's been typed and queues each line.  This also runs while a reply is arriving,
+// so the time a command waits starts when it was typed
+static void poll_console(void)
+{
+char aBuf[256];
+int i1, i2;
+
+  while(iPollConsole >= 0 && my_pollin_msec(iPollConsole, 0) > 0)
+  {
+    i1 = read(iPollConsole, aBuf, sizeof(aBuf));
+
+    if(i1 < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      break;
+    }
+
+    if(i1 <= 0) // end of input - the schedule goes on
+    {
+      iPollConsole = -1;
+      break;
+    }
+
+    for(i2=0; i2 < i1; i2++)
+    {
+      if(aBuf[i2] == '\r' || aBuf[i2] == '\n')
+      {
+        if(bPollConsoleEcho)
+        {
+          write(2, "\r\n", 2);
+        }
+
+        aPollLine[cbPollLine] = 0;
+
+        if(!*my_ltrim(aPollLine))
+        {
+          // nothing to send
+        }
+        else if(nPollQueued >= POLL_MAX_QUEUED)
+        {
+          fprintf(stderr, "Too many commands waiting, \"%s\" was not sent\n", aPollLine);
+        }
+        else
+        {
+          POLL_TASK *pQ = aPollQueued + (iPollQueued + nPollQueued++) % POLL_MAX_QUEUED;
+
+          memset(pQ, 0, sizeof(*pQ));
+          pQ->pszCommand = strdup(my_ltrim(aPollLine));
+          pQ->iClass = CMD_CLASS_INTERACTIVE;
+          pQ->qwRelease = metrics_usecs();
+        }
+
+        cbPollLine = 0;
+      }
+      else if(aBuf[i2] == '\b' || aBuf[i2] == 127)
+      {
+        if(cbPollLine)
+        {
+          cbPollLine--;
+
+          if(bPollConsoleEcho)
+          {
+            write(2, "\b \b", 3);
+          }
+        }
+      }
+      else if(cbPollLine < (int)sizeof(aPollLine) - 1)
+      {
+        aPollLine[cbPollLine++] = aBuf[i2];
+
+        if(bPollConsoleEcho)
+        {
+          write(2, aBuf + i2, 1);
+        }
+      }
+    }
+  }
+}
+
+// a reply that didn't come in time may still be on its way, and so may the banner when polling
+// starts.  Whatever arrives is thrown away until the port has been quiet for 'iMsec' (or '-w'
+// has gone by), so the next command can't take it for its own.  Like 'my_flush()', but nothing
+// is echoed - stdout has the replies.  Returns how many bytes there were
+static int poll_quiet(HANDLE iFile, int iMsec)
+{
+char aBuf[256];
+unsigned int dwStart;
+int i1, cbTotal = 0;
+
+  dwStart = MyGetTickCount();
+
+  while(!QuitFlag() && !TimeIntervalExceeds(dwStart, iQuestionWait))
+  {
+    poll_console();
+
+    if(my_pollin_msec(iFile, iMsec) <= 0)
+    {
+      break;
+    }
+
+    i1 = my_read(iFile, aBuf, sizeof(aBuf));
+
+    if(i1 <= 0)
+    {
+      break;
+    }
+
+    cbTotal += i1;
+  }
+
+  return cbTotal;
+}
+
+// an interactive or bulk reply, the lines separated by '\n'
+typedef struct _POLL_REPLY_
+{
+  char *pBuf;
+  int cbBuf, cbMax;
+  const char *pszCommand; // until the first line, which may be its echo
+} POLL_REPLY;
+
+static int poll_reply_line(void *pCtx, const char *pszLine)
+{
+POLL_REPLY *pR = (POLL_REPLY *)pCtx;
+int i1 = strlen(pszLine);
+char *p1;
+
+  poll_console();
+
+  if(pR->pszCommand && question_is_echo(pszLine, pR->pszCommand))
+  {
+    pR->pszCommand = NULL;
+    return 0;
+  }
+
+  pR->pszCommand = NULL;
+
+  if(pR->cbBuf + i1 + 2 > pR->cbMax)
+  {
+    p1 = realloc(pR->pBuf, pR->cbMax + i1 + MY_GETS_BUFSIZE);
+
+    if(!p1)
+    {
+      return 1; // that's all of it, then
+    }
+
+    pR->pBuf = p1;
+    pR->cbMax += i1 + MY_GETS_BUFSIZE;
+  }
+
+  if(pR->cbBuf)
+  {
+    pR->pBuf[pR->cbBuf++] = '\n';
+  }
+
+  memcpy(pR->pBuf + pR->cbBuf, pszLine, i1 + 1);
+  pR->cbBuf += i1;
+
+  return 0;
+}
+
+// one command is done - count it, write it out, and report a control poll's overrun
+static void poll_done(POLL_TASK *pT, const char *pszCommand, unsigned long long qwSent,
+                      unsigned long long qwDone, const char *pszReply)
+{
+CMD_CLASS_STATS *pS = aCmdClassStats + pT->iClass;
+unsigned long long qwWall = qwPollRealtime + qwSent, qwLate = qwSent - pT->qwRelease;
+const char *p1, *p2;
+
+  pS->nCommands++;
+  pS->qwWaitTotal += qwLate;
+
+  if(qwLate > pS->qwWaitMax)
+  {
+    pS->qwWaitMax = qwLate;
+  }
+
+  if(qwDone - qwSent > pS->qwHoldMax)
+  {
+    pS->qwHoldMax = qwDone - qwSent;
+  }
+
+  pT->nPolls++;
+  pT->qwLateTotal += qwLate;
+
+  if(qwLate > pT->qwLateMax)
+  {
+    pT->qwLateMax = qwLate;
+  }
+
+  if(!pszReply)
+  {
+    pT->nTimeouts++;
+  }
+
+  if(iQuestionFormat == QUESTION_FORMAT_JSON)
+  {
+    printf("{\"time\":%llu.%06llu,\"class\":\"%s\",\"command\":", qwWall / 1000000, qwWall % 1000000,
+           aszCmdClass[pT->iClass]);
+    question_json_string(pszCommand, strlen(pszCommand));
+    fputs(",\"reply\":", stdout);
+    question_json_string(pszReply ? pszReply : "", pszReply ? strlen(pszReply) : 0);
+    printf(",\"late_msecs\":%.3f,\"msecs\":%.3f,\"missed\":%llu,\"timeout\":%s}\n",
+           qwLate / 1000.0, (qwDone - qwSent) / 1000.0, pT->nMissedNow, pszReply ? "false" : "true");
+  }
+  else
+  {
+    p1 = pszReply ? pszReply : "";
+
+    do // each line of it, so that every output line stands on its own
+    {
+      p2 = strchr(p1, '\n');
+
+      printf("%llu.%06llu\t%.3f\t%s\t%.*s\n", qwWall / 1000000, qwWall % 1000000,
+             qwLate / 1000.0, pszCommand, p2 ? (int)(p2 - p1) : (int)strlen(p1), p1);
+
+      p1 = p2 + 1;
+
+    } while(p2);
+  }
+
+  fflush(stdout);
+
+  pT->nMissedNow = 0;
+
+  if(pT->iClass == CMD_CLASS_CONTROL && qwDone > pT->qwRelease + pT->qwPeriod)
+  {
+    pT->nOverruns++;
+    metrics_add(METRIC_POLL_OVERRUNS, 1);
+
+    if(!bQuietFlag)
+    {
+      fprintf(stderr, "Poll \"%s\" overran its period by %.3f msecs\n", pszCommand,
+              (qwDone - pT->qwRelease - pT->qwPeriod) / 1000.0);
+    }
+  }
+}
+
+// sends one command and writes out its reply.  Returns the usecs it held the port
+static unsigned long long poll_send(HANDLE iFile, POLL_TASK *pT, const char *pszCommand)
+{
+POLL_REPLY sR;
+unsigned long long qwSent, qwDone;
+unsigned int dwTimeout;
+char *p1;
+int i1, bEnded;
+
+
+  dwTimeout = iQuestionWait;
+
+  if(pT->iClass == CMD_CLASS_CONTROL && pT->qwPeriod / 1000 < dwTimeout)
+  {
+    dwTimeout = pT->qwPeriod / 1000 ? (unsigned int)(pT->qwPeriod / 1000) : 1;
+  }
+
+  poll_drain(iFile); // right before it's sent, so the reply has only what came after
+
+  qwSent = metrics_usecs();
+  bMyGetsEchoFlag = 0;
+
+  // without '-E' nothing says where a longer reply ends but the timeout, and
+  // the port would be held that long - so it's the first line, as for a poll
+  if(pT->iClass == CMD_CLASS_CONTROL || !bPollReplyEnd)
+  {
+    sReplyEnd.bActive = 0; // a single line, no prompts
+
+    p1 = send_command_get_reply_with_timeout(iFile, pszCommand, dwTimeout, 0);
+    bEnded = p1 != NULL;
+  }
+  else
+  {
+    memset(&sR, 0, sizeof(sR));
+    sR.pszCommand = pszCommand;
+
+    sReplyEnd.bActive = 1;
+    reply_end_reset();
+
+    send_command_stream_reply_with_timeout(iFile, pszCommand, dwTimeout, 0, poll_reply_line, &sR);
+
+    p1 = sR.pBuf;
+    bEnded = sReplyEnd.iMatch >= 0; // not a timeout, with some of the lines still to come
+  }
+
+  qwDone = metrics_usecs();
+
+  poll_done(pT, pszCommand, qwSent, qwDone, p1);
+
+  if(p1)
+  {
+    free(p1);
+  }
+
+  if(!bEnded)
+  {
+    // the reply (or the rest of it) may just be late, and the next command would get it
+    i1 = poll_quiet(iFile, POLL_QUIET_MSEC);
+    qwDone = metrics_usecs();
+
+    if(i1 && !bQuietFlag)
+    {
+      fprintf(stderr, "Poll \"%s\" replied late, %d byte%s discarded\n", pszCommand, i1, i1 == 1 ? "" : "s");
+    }
+  }
+
+  bMyGetsEchoFlag = 1;
+
+  return qwDone - qwSent;
+}
+
+// the next command of a bulk job, then it's the next job's turn until the next gap
+static void poll_bulk_step(HANDLE iFile, POLL_TASK *pT)
+{
+char tbuf[MY_GETS_BUFSIZE];
+const char *p1;
+unsigned long long qw1;
+int i1;
+
+  if(!pT->pStep)
+  {
+    pT->pStep = pT->pszCommand;
+  }
+
+  p1 = strchr(pT->pStep, ';');
+  i1 = p1 ? (int)(p1 - pT->pStep) : (int)strlen(pT->pStep);
+
+  if(i1 > (int)sizeof(tbuf) - 1)
+  {
+    i1 = sizeof(tbuf) - 1;
+  }
+
+  memcpy(tbuf, pT->pStep, i1);
+  tbuf[i1] = 0;
+
+  while(i1 > 0 && (tbuf[i1 - 1] == ' ' || tbuf[i1 - 1] == '\t'))
+  {
+    tbuf[--i1] = 0;
+  }
+
+  pT->pStep = p1 ? p1 + 1 : NULL;
+
+  if(*my_ltrim(tbuf))
+  {
+    qw1 = poll_send(iFile, pT, my_ltrim(tbuf));
+
+    if(qw1 > pT->qwLongest)
+    {
+      pT->qwLongest = qw1;
+    }
+  }
+
+  if(pT->pStep) // more to do
+  {
+    return;
+  }
+
+  if(metrics_usecs() > pT->qwRelease + pT->qwPeriod)
+  {
+    pT->nOverruns++;
+    metrics_add(METRIC_POLL_OVERRUNS, 1);
+
+    if(!bQuietFlag)
+    {
+      fprintf(stderr, "Bulk job \"%s\" overran its period by %.3f msecs\n", pT->pszCommand,
+              (metrics_usecs() - pT->qwRelease - pT->qwPeriod) / 1000.0);
+    }
+  }
+
+  pT->qwRelease += pT->qwPeriod; // the next period, on the grid
+}
+
+static void poll_loop(HANDLE iFile, HANDLE iConsole)
+{
+POLL_TASK *pT, *pNext, *pBulk;
+struct timeval tv;
+unsigned long long qwNow, qwWake, qw1;
+int i1;
+
+
+  memset(aCmdClassStats, 0, sizeof(aCmdClassStats));
+  iPollQueued = nPollQueued = cbPollLine = 0;
+
+  if(poll_schedule_read() || reply_end_build())
+  {
+    goto the_end;
+  }
+
+  bPollReplyEnd = sReplyEnd.bActive;
+
+  // the console has operator commands, unless the schedule came from there
+  iPollConsole = strcmp(pszPollSchedule, "-") ? iConsole : -1;
+  bPollConsoleEcho = iPollConsole >= 0 && isatty(iPollConsole);
+
+  if(iPollConsole >= 0 && !bQuietFlag)
+  {
+    for(i1=0, qw1=0, pT=aPollTask; i1 < nPollTasks; i1++, pT++)
+    {
+      if(pT->iClass == CMD_CLASS_CONTROL)
+      {
+        qwNow = pT->qwPeriod < iQuestionWait * 1000ULL ? pT->qwPeriod : iQuestionWait * 1000ULL;
+
+        if(qwNow > qw1)
+        {
+          qw1 = qwNow;
+        }
+      }
+    }
+
+    fprintf(stderr, "Commands from the console wait for one command at most:  %.3f msecs for a control poll\n"
+                    "(then the port going quiet, if it timed out), or one command of a bulk job (the longest\n"
+                    "so far is in the totals at the end)\n", qw1 / 1000.0);
+  }
+
+  signal(SIGINT, quit_signal);
+  signal(SIGTERM, quit_signal);
+
+  poll_quiet(iFile, POLL_START_MSEC); // the banner, or whatever came before, isn't the first poll's reply
+
+  gettimeofday(&tv, NULL);
+  qwNow = metrics_usecs();
+  qwPollRealtime = (unsigned long long)tv.tv_sec * 1000000ULL + tv.tv_usec - qwNow;
+
+  for(i1=0; i1 < nPollTasks; i1++)
+  {
+    aPollTask[i1].qwRelease = qwNow; // all of them right away, then on their own grids
+  }
+
+  while(!QuitFlag())
+  {
+    poll_console();
+
+    qwNow = metrics_usecs();
+    qwWake = qwNow + 100000; // ^C is checked at least this often
+    pNext = pBulk = NULL;
+
+    for(i1=0, pT=aPollTask; i1 < nPollTasks; i1++, pT++)
+    {
+      // too late for this period, on to the current one (a bulk job that has started finishes first)
+      if(!pT->pStep && pT->qwRelease + pT->qwPeriod <= qwNow)
+      {
+        qw1 = (qwNow - pT->qwRelease) / pT->qwPeriod;
+
+        pT->qwRelease += qw1 * pT->qwPeriod;
+        pT->nMissed += qw1;
+        pT->nMissedNow += qw1;
+        metrics_add(METRIC_POLL_MISSED, qw1);
+
+        if(!bQuietFlag)
+        {
+          fprintf(stderr, "Poll \"%s\" missed %llu period%s\n", pT->pszCommand, qw1, qw1 == 1 ? "" : "s");
+        }
+      }
+
+      if(!pT->pStep && pT->qwRelease > qwNow) // not yet
+      {
+        if(pT->qwRelease < qwWake)
+        {
+          qwWake = pT->qwRelease;
+        }
+      }
+      else if(pT->iClass == CMD_CLASS_CONTROL)
+      {
+        if(!pNext || pT->qwRelease + pT->qwPeriod < pNext->qwRelease + pNext->qwPeriod ||
+           (pT->qwRelease + pT->qwPeriod == pNext->qwRelease + pNext->qwPeriod &&
+            pT->iPriority < pNext->iPriority))
+        {
+          pNext = pT;
+        }
+      }
+      else if(!pBulk || pT->qwRelease + pT->qwPeriod < pBulk->qwRelease + pBulk->qwPeriod ||
+              (pT->qwRelease + pT->qwPeriod == pBulk->qwRelease + pBulk->qwPeriod &&
+               pT->iPriority < pBulk->iPriority))
+      {
+        pBulk = pT;
+      }
+    }
+
+    if(nPollQueued) // interactive first
+    {
+      pT = aPollQueued + iPollQueued;
+
+      poll_send(iFile, pT, pT->pszCommand);
+
+      free(pT->pszCommand);
+      pT->pszCommand = NULL;
+      iPollQueued = (iPollQueued + 1) % POLL_MAX_QUEUED;
+      nPollQueued--;
+
+      continue;
+    }
+
+    if(pNext) // then control
+    {
+      poll_send(iFile, pNext, pNext->pszCommand);
+
+      pNext->qwRelease += pNext->qwPeriod; // the next period, on the grid
+
+      continue;
+    }
+
+    if(pBulk) // and bulk, if it won't make a control poll late (or its own period ends first)
+    {
+      for(i1=0, pT=aPollTask; i1 < nPollTasks; i1++, pT++)
+      {
+        if(pT->iClass == CMD_CLASS_CONTROL && pT->qwRelease < qwNow + pBulk->qwLongest &&
+           pT->qwRelease + pT->qwPeriod <= pBulk->qwRelease + pBulk->qwPeriod)
+        {
+          pBulk = NULL; // wait for that one to go first ('qwWake' is no later than its release)
+          break;
+        }
+      }
+
+      if(pBulk)
+      {
+        poll_bulk_step(iFile, pBulk);
+
+        continue;
+      }
+    }
+
+    // nothing is due - wait until something is, or a command is typed
+    if(iPollConsole >= 0 && qwWake - qwNow >= 1000)
+    {
+      my_pollin_msec(iPollConsole, (int)((qwWake - qwNow) / 1000));
+    }
+    else if(qwWake > qwNow)
+    {
+      usleep((useconds_t)(qwWake - qwNow));
+    }
+  }
+
+  for(i1=0, pT=aPollTask; i1 < nPollTasks; i1++, pT++)
+  {
+    fprintf(stderr, "Poll \"%s\" every %.3f msecs (%s):  %llu commands, late %.3f msecs on average (%.3f max), "
+                    "%llu overruns, %llu missed, %llu timeouts\n",
+            pT->pszCommand, pT->qwPeriod / 1000.0, aszCmdClass[pT->iClass], pT->nPolls,
+            pT->nPolls ? pT->qwLateTotal / 1000.0 / pT->nPolls : 0.0, pT->qwLateMax / 1000.0,
+            pT->nOverruns, pT->nMissed, pT->nTimeouts);
+  }
+
+  for(i1=0; i1 < CMD_CLASSES; i1++)
+  {
+    if(aCmdClassStats[i1].nCommands)
+    {
+      fprintf(stderr, "Class %s:  %llu commands, waited %.3f msecs on average (%.3f max), held the port for up to %.3f msecs\n",
+              aszCmdClass[i1], aCmdClassStats[i1].nCommands,
+              aCmdClassStats[i1].qwWaitTotal / 1000.0 / aCmdClassStats[i1].nCommands,
+              aCmdClassStats[i1].qwWaitMax / 1000.0, aCmdClassStats[i1].qwHoldMax / 1000.0);
+    }
+  }
+
+  signal(SIGINT, signalproc);
+  signal(SIGTERM, signalproc);
+
+the_end:
+  for(i1=0; i1 < nPollTasks; i1++)
+  {
+    free(aPollTask[i1].pszCommand);
+  }
+
+  while(nPollQueued > 0)
+  {
+    free(aPollQueued[iPollQueued].pszCommand);
+    iPollQueued = (iPollQueued + 1) % POLL_MAX_QUEUED;
+    nPollQueued--;
+  }
+
+  nPollTasks = 0;
+  reply_end_free();
+  bMyGetsEchoFlag = 1;
+}
+#endif // WIN32
+
+
+#ifdef WITH_XMODEM
+// XMODEM transfers - some microcontroller devices may use
+// this to transfer files reliably.  The xmodem library is
+// cross-platform so you can use the same code HERE and THERE
+void do_xmodem(HANDLE iFile, HANDLE iConsole)
+{
+int i1, i2;
+
+  // try 3 times to accomplish this.
+
+  bMyGetsEchoFlag = 0;
+
+  for(i1=0; i1 < 3; i1++)
+  {
+    metrics_add(i1 ? METRIC_COMMAND_REPEATS : METRIC_COMMANDS, 1);
+
+    if(bCaptureActive)
+    {
+      char tbuf[sizeof(szXModemFile) + 1];
+
+      snprintf(tbuf, sizeof(tbuf), "X%s", szXModemFile);
+      capture_command(tbuf);
+    }
+
+    my_write(iFile, "X", 1);
+    my_write(iFile, szXModemFile, strlen(szXModemFile));
+    my_write(iFile, "\r", 1);
+
+    if(szXModemFile[0] == 'S')
+    {
+      if(!bQuietFlag)
+      {
+        fprintf(stderr, "Sending file %s\n", &(szXModemFile[1]));
+        fflush(stdout);
+      }
+
+      if(!(i2 = XSend(iFile, &(szXModemFile[1]))))
+      {
+        if(!bQuietFlag)
+        {
+          fputs("\nComplete!\n", stderr);
+          fflush(stdout);
+        }
+        break;
+      }
+
+      if(!bQuietFlag)
+      {
+        fprintf(stderr, "\nXSend returns %d\n", i2);
+        fflush(stdout);
+      }
+    }
+    else // assume receive
+    {
+      if(!bQuietFlag)
+      {
+        fprintf(stderr, "Getting file %s\n", &(szXModemFile[1]));
+        fflush(stdout);
+      }
+
+      if(!(i2 = XReceive(iFile, &(szXModemFile[1]), 0664)))
+      {
+        if(!bQuietFlag)
+        {
+          fputs("\nComplete!\n", stderr);
+          fflush(stdout);
+        }
+        break;
+      }
+
+      if(!bQuietFlag)
+      {
+        fprintf(stderr, "\nXReceive returns %d\n", i2);
+        fflush(stdout);
+      }
+    }
+  }
+}
+
+#ifndef WIN32
+
+// FLEET DISTRIBUTION - one source file sent to many serial ports at the same time.
+// The file is mapped ONCE and shared with one forked process per port (the same
+// approach as the '-l' listener), and each process runs its own 'SendXmodem' state
+// machine.  Progress is reported through a shared (anonymous) mapping so that the
+// parent can display it, and the total time approaches that of the slowest device.
+
+#define FLEET_MAX_PORTS 256
+
+#define FLEET_STATE_WAITING  0 /* not started yet */
+#define FLEET_STATE_OPENING  1 /* open, configure, reset */
+#define FLEET_STATE_SENDING  2 /* XMODEM transfer in progress */
+#define FLEET_STATE_DONE     3 /* finished, see 'iResult' */
+
+typedef struct _FLEET_PORT_
+{
+  char szDev[256];            // serial device name
+  pid_t pid;                  // process that owns the port
+  volatile long lBlock;       // current block number
+  volatile long lFilePos;     // bytes acknowledged so far
+  volatile long lErrors;      // consecutive errors for the current block
+  volatile long lTotalErrors; // total errors (NAKs and timeouts)
+  volatile int iState;        // FLEET_STATE_xxx
+  volatile int iAttempts;     // number of 'XS' attempts (up to 3, like 'do_xmodem')
+  volatile int iResult;       // XSend return value (0 on success), or -9 if the port would not open
+  volatile unsigned int dwStart, dwEnd; // tick counts for start and end of transfer
+} FLEET_PORT;
+
+static void fleet_progress(XMODEM *pX, long block, long filepos, long filesize, int ecount, long etotal)
+{
+FLEET_PORT *pP = (FLEET_PORT *)pX->pUser;
+
+  pP->lBlock = block;
+  pP->lFilePos = filepos;
+  pP->lErrors = ecount;
+  pP->lTotalErrors = etotal;
+}
+
+static int fleet_parse_ports(FLEET_PORT *pPorts, int nMax)
+{
+char tbuf[512], *p1, *p2;
+int nPorts = 0, iLine = 0, cb1;
+FILE *pF;
+
+  if(*pszFleetPorts == '@') // read the list from a file, one device per line, '#' for comments
+  {
+    pF = fopen(pszFleetPorts + 1, "r");
+    if(!pF)
+    {
+      fprintf(stderr, "Unable to open port list \"%s\", errno=%d\n", pszFleetPorts + 1, errno);
+      return -1;
+    }
+
+    while(nPorts < nMax && fgets(tbuf, sizeof(tbuf), pF))
+    {
+      iLine++;
+
+      if(!strchr(tbuf, '\n') && !feof(pF)) // the rest of it would look like another line
+      {
+        fprintf(stderr, "Port list \"%s\" line %d is too long, skipped\n", pszFleetPorts + 1, iLine);
+
+        while(fgets(tbuf, sizeof(tbuf), pF) && !strchr(tbuf, '\n'))
+        { }
+
+        continue;
+      }
+
+      p1 = (char *)my_ltrim(tbuf);
+      p2 = p1 + strlen(p1);
+
+      while(p2 > p1 && *(p2 - 1) <= ' ')
+      {
+        *(--p2) = 0; // trim trailing white space and the line ending
+      }
+
+      if(!*p1 || *p1 == '#')
+      {
+        continue;
+      }
+
+      cb1 = p2 - p1;
+
+      if(cb1 >= (int)sizeof(pPorts[nPorts].szDev)) // a shorter name would be some other device
+      {
+        fprintf(stderr, "Port list \"%s\" line %d:  device name is too long, skipped\n", pszFleetPorts + 1, iLine);
+        continue;
+      }
+
+      memcpy(pPorts[nPorts].szDev, p1, cb1 + 1);
+      nPorts++;
+    }
+
+    fclose(pF);
+  }
+  else // comma-delimited, like the '-B' option
+  {
+    p1 = pszFleetPorts;
+
+    while(*p1 && nPorts < nMax)
+    {
+      p2 = strchr(p1, ',');
+      if(!p2)
+      {
+        p2 = p1 + strlen(p1);
+      }
+
+      cb1 = p2 - p1;
+
+      if(cb1 >= (int)sizeof(pPorts[nPorts].szDev))
+      {
+        fprintf(stderr, "Device name \"%.*s...\" is too long, skipped\n", 32, p1);
+      }
+      else if(cb1 > 0)
+      {
+        memcpy(pPorts[nPorts].szDev, p1, cb1);
+        pPorts[nPorts].szDev[cb1] = 0;
+        nPorts++;
+      }
+
+      p1 = *p2 ? p2 + 1 : p2;
+    }
+  }
+
+  return nPorts;
+}
+
+// runs in the forked process for ONE port.  Returns the process exit code.
+static int fleet_send_one(FLEET_PORT *pP, const char *pData, long cbData)
+{
+int i1, iRval;
+HANDLE iFile;
+XMODEM xx;
+char tbuf[sizeof(szBaud)];
+
+  pP->iState = FLEET_STATE_OPENING;
+
+#ifdef __FreeBSD__
+  iFile = open(pP->szDev, (O_RDWR | O_NONBLOCK), 0);
+
+  if(iFile >= 0 && flock(iFile, LOCK_EX | LOCK_NB) < 0)
+  {
+    close(iFile);
+    iFile = -1;
+  }
+#else // __FreeBSD__
+  iFile = open(pP->szDev, (O_RDWR | O_NONBLOCK), 0);
+#endif // __FreeBSD__
+
+  if(iFile < 0)
+  {
+    pP->iResult = -9;
+    pP->iState = FLEET_STATE_DONE;
+    return 1;
+  }
+
+  iGlobalFileHandle = iFile; // so that 'signalproc' can release it
+
+  // 'ttyconfigSTR' parses the string in place, so it gets a copy
+  memcpy(tbuf, szBaud, sizeof(tbuf));
+  ttyconfigSTR(iFile, tbuf);
+
+  if(iResetWait > 0)
+  {
+    reset_arduino(iFile);
+    MySleep(iResetWait * 1000); // every port resets at the same time, so this is done only once overall
+  }
+  else if(iFlowControl > 0)
+  {
+    set_rts_dtr(iFile, 1);
+  }
+
+  pP->dwStart = MyGetTickCount();
+  pP->iState = FLEET_STATE_SENDING;
+
+  iRval = -3;
+
+  for(i1=0; i1 < 3 && !QuitFlag(); i1++) // try 3 times, same as 'do_xmodem'
+  {
+    pP->iAttempts = i1 + 1;
+
+    my_write(iFile, "X", 1);
+    my_write(iFile, szXModemFile, strlen(szXModemFile));
+    my_write(iFile, "\r", 1);
+
+    memset(&xx, 0, sizeof(xx));
+    xx.ser = iFile;
+    xx.file = -1;        // not used, the data comes from 'pMem'
+    xx.pMem = pData;
+    xx.cbMem = cbData;
+    xx.pProgress = fleet_progress;
+    xx.pUser = pP;
+
+    iRval = XSendSub(&xx);
+
+    if(!iRval)
+    {
+      break;
+    }
+  }
+
+  pP->dwEnd = MyGetTickCount();
+
+  if(iResetWait >= 0 || iFlowControl > 0)
+  {
+    set_rts_dtr(iFile, 0); // same as 'do_main'
+  }
+
+#ifdef __FreeBSD__
+  flock(iFile, LOCK_UN);
+#endif // __FreeBSD__
+  close(iFile);
+  iGlobalFileHandle = -1;
+
+  pP->iResult = iRval;
+  pP->iState = FLEET_STATE_DONE;
+
+  return iRval ? 1 : 0;
+}
+
+static const char *fleet_result_text(FLEET_PORT *pP)
+{
+  if(pP->iState != FLEET_STATE_DONE)
+  {
+    return pP->iState == FLEET_STATE_SENDING ? "sending"
+           : pP->iState == FLEET_STATE_OPENING ? "reset" : "waiting";
+  }
+
+  return !pP->iResult ? "OK"
+         : pP->iResult == -9 ? "NO PORT"
+         : pP->iResult > 0 ? "CANCELED" : "FAILED";
+}
+
+static void fleet_show_progress(FLEET_PORT *pPorts, int nPorts, long cbData, int bRedraw)
+{
+int i1;
+
+  if(bRedraw) // cursor up 'nPorts' lines and overwrite them
+  {
+    fprintf(stderr, "\033[%dA", nPorts);
+  }
+
+  for(i1=0; i1 < nPorts; i1++)
+  {
+    fprintf(stderr, "%-24.24s %-8s %3ld%%  block %-6ld errors %ld/%ld\033[K\n",
+            pPorts[i1].szDev, fleet_result_text(&(pPorts[i1])),
+            cbData > 0 ? (pPorts[i1].lFilePos * 100L) / cbData
+                       : (pPorts[i1].iState == FLEET_STATE_DONE ? 100L : 0L),
+            pPorts[i1].lBlock, pPorts[i1].lErrors, pPorts[i1].lTotalErrors);
+  }
+
+  fflush(stderr);
+}
+
+static int do_xmodem_fleet(void)
+{
+FLEET_PORT *pPorts;
+int i1, i2, nPorts, nRunning, nFailed, bTTY;
+int iFile;
+struct stat st;
+const char *pData;
+long cbData;
+unsigned int dwStart, dwTick;
+
+
+  pPorts = (FLEET_PORT *)mmap(NULL, sizeof(FLEET_PORT) * FLEET_MAX_PORTS, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANON, -1, 0);
+  if(pPorts == (FLEET_PORT *)MAP_FAILED)
+  {
+    fprintf(stderr, "Unable to map shared status, errno=%d\n", errno);
+    return -1;
+  }
+
+  memset(pPorts, 0, sizeof(FLEET_PORT) * FLEET_MAX_PORTS);
+
+  nPorts = fleet_parse_ports(pPorts, FLEET_MAX_PORTS);
+  if(nPorts <= 0)
+  {
+    if(!nPorts)
+    {
+      fputs("No serial devices were specified with '-P'\n", stderr);
+    }
+
+    munmap(pPorts, sizeof(FLEET_PORT) * FLEET_MAX_PORTS);
+    return -1;
+  }
+
+  // read (map) the source file ONCE - every forked process shares these pages
+
+  iFile = open(&(szXModemFile[1]), O_RDONLY, 0);
+  if(iFile < 0 || fstat(iFile, &st) < 0)
+  {
+    fprintf(stderr, "Unable to open \"%s\", errno=%d\n", &(szXModemFile[1]), errno);
+    if(iFile >= 0)
+    {
+      close(iFile);
+    }
+    munmap(pPorts, sizeof(FLEET_PORT) * FLEET_MAX_PORTS);
+    return -9;
+  }
+
+  cbData = (long)st.st_size;
+
+  if(cbData > 0)
+  {
+    pData = (const char *)mmap(NULL, cbData, PROT_READ, MAP_SHARED, iFile, 0);
+    if(pData == (const char *)MAP_FAILED)
+    {
+      fprintf(stderr, "Unable to map \"%s\", errno=%d\n", &(szXModemFile[1]), errno);
+      close(iFile);
+      munmap(pPorts, sizeof(FLEET_PORT) * FLEET_MAX_PORTS);
+      return -9;
+    }
+  }
+  else
+  {
+    pData = ""; // zero-length file, just the EOT is sent
+  }
+
+  close(iFile); // the mapping stays valid
+
+  if(!iResetWait) // i.e. 'use default', same as 'do_main'
+  {
+    iResetWait = DEFAULT_RESET_WAIT;
+  }
+
+  if(!bQuietFlag)
+  {
+    fprintf(stderr, "Sending file %s (%ld bytes) to %d ports\n", &(szXModemFile[1]), cbData, nPorts);
+  }
+
+  fflush(stdout);
+  fflush(stderr); // so the forked processes don't inherit buffered output
+
+  dwStart = MyGetTickCount();
+
+  for(i1=0; i1 < nPorts; i1++)
   {
-#ifndef WIN32
-    aFD[0].fd = iFile;
-    aFD[0].events = POLLIN | POLLERR;
-    aFD[0].revents = 0;
-    aFD[1].fd = iConsole; // stdin
-    aFD[1].events = POLLIN;
-    aFD[1].revents = 0;
+    i2 = fork();
 
-    i1 = poll(aFD, 2, 100);
-    if(!i1)
+    if(i2 == -1)
     {
-      goto end_of_loop;
-//      continue;
+      fprintf(stderr, "Unable to 'fork' for %s (errno=%d)\n", pPorts[i1].szDev, errno);
+      pPorts[i1].iResult = -10;
+      pPorts[i1].iState = FLEET_STATE_DONE;
     }
-
-    if(i1 < 0 || (aFD[0].revents & POLLERR) || (aFD[1].revents & POLLERR))
+    else if(!i2) // this is the FORKED process
     {
-      fprintf(stderr, "poll error %d\n", errno);
-      return;
-    }
-#endif // WIN32
+      bQuietFlag = 1; // the parent displays everything
+      bSerialDebug = 0;
 
-#ifdef WIN32
-    if(my_pollin(iConsole) > 0)
-#else // WIN32
-    if(aFD[1].revents & POLLIN)
-#endif // WIN32
+      _exit(fleet_send_one(&(pPorts[i1]), pData, cbData)); // must not run 'atexit' stuff twice
+    }
+    else
     {
-      char c1;
-      i1 = my_read(iConsole, &c1, 1);
-
-      if(i1 > 0)
-      {
-#ifndef WIN32
-        if(pAltConsole) // no translation or 'local echo' if 'alt console'
-        {
-          if(Verbosity() >= VERBOSITY_CHATTY)
-          {
-            console_loop_debug_dump(1, &c1, 1);
-          }
+      pPorts[i1].pid = i2;
+    }
+  }
 
-          my_write(iFile, &c1, 1);
-        }
-        else
-#endif // WIN32
-            if(c1 == 13 || c1 == 10) // either on input, translates into 'iTerminator' or CRLF
-        {
-          if(bLocalEcho)
-          {
-            fputs("\r\n", stdout);
-            fflush(stdout);
-          }
-          if(!iTerminator)
-          {
-            my_write(iFile, "\r\n", 2);
+  bTTY = !bQuietFlag && isatty(2);
 
-            if(Verbosity() >= VERBOSITY_CHATTY)
-            {
-              console_loop_debug_dump(1, "\r\n", 2);
-            }
-          }
-          else
-          {
-            c1 = iTerminator;
-            my_write(iFile, &c1, 1);
+  if(bTTY)
+  {
+    fleet_show_progress(pPorts, nPorts, cbData, 0);
+  }
 
-            if(Verbosity() >= VERBOSITY_CHATTY)
-            {
-              console_loop_debug_dump(1, &c1, 1);
-            }
-          }
-        }
-        else if(c1 == 4 || c1 == 26) // ctrl+d or ctrl+z
-        {
-          SetQuitFlag();
-        }
-        else
-        {
-          if(bLocalEcho)
-          {
-            fwrite(&c1, 1, 1, stdout);
-            fflush(stdout);
-          }
+  dwTick = MyGetTickCount();
 
-          my_write(iFile, &c1, 1);
+  do
+  {
+    MySleep(100);
 
-          if(Verbosity() >= VERBOSITY_CHATTY)
-          {
-            console_loop_debug_dump(1, &c1, 1);
-          }
-        }
-      }
-      else if(i1 <= 0 && bIsTCP)
-      {
-        SetQuitFlag(); // read error when the poll event said there WAS something indicates CLOSED SOCKET
-      }
-    }
+    nRunning = 0;
 
-#ifdef WIN32
-    if(my_pollin(iFile) > 0)
-#else // WIN32
-    if(aFD[0].revents & POLLIN)
-#endif // WIN32
+    for(i1=0; i1 < nPorts; i1++)
     {
-      char c1;
-      i1 = my_read(iFile, &c1, 1);
-
-      if(i1 > 0)
+      if(pPorts[i1].pid > 0)
       {
-        if(pAltConsole) // unmodified
-        {
-          if(Verbosity() >= VERBOSITY_CHATTY)
-          {
-            console_loop_debug_dump(-1, &c1, 1);
-          }
+        i2 = 0;
 
-          my_write(iStdOut, &c1, 1); // output to stdout, always
-        }
-        else if(c1 == '\r')
+        if(waitpid(pPorts[i1].pid, &i2, WNOHANG) == pPorts[i1].pid)
         {
-          if(iTerminator == '\r')
-          {
-            my_write(iStdOut, "[CR]\n", 5);
-          }
-          else
-          {
-            iWasCR = 1;
-            my_write(iStdOut, "[CR]", 4);
-          }
+          pPorts[i1].pid = 0;
 
-          if(Verbosity() >= VERBOSITY_CHATTY)
+          if(pPorts[i1].iState != FLEET_STATE_DONE) // died without saying so (signal?)
           {
-            console_loop_debug_dump(-1, "\r", 1);
+            pPorts[i1].iResult = -11;
+            pPorts[i1].iState = FLEET_STATE_DONE;
+            pPorts[i1].dwEnd = MyGetTickCount();
           }
         }
         else
         {
-          if(iWasCR)
-          {
-            if(c1 != '\n')
-            {
-              my_write(iStdOut, "\r", 1);
-
-              if(Verbosity() >= VERBOSITY_CHATTY)
-              {
-                console_loop_debug_dump(-1, "\r", 1);
-              }
-            }
-
-            iWasCR = 0;
-          }
-
-          if(c1 == '\n') // regardless of 'iTerminator' settings
-          {
-            my_write(iStdOut, "[LF]", 4);
-          }
-
-          my_write(iStdOut, &c1, 1); // output to stdout, always
-
-          if(Verbosity() >= VERBOSITY_CHATTY)
-          {
-            console_loop_debug_dump(-1, &c1, 1);
-          }
+          nRunning++;
         }
       }
     }
 
-#ifndef WIN32
-end_of_loop: // necessary since 'continue' won't perform this properly for some reason
-#endif // WIN32
-
-    if(/*pAltConsole &&*/ Verbosity() >= VERBOSITY_CHATTY)
+    if(bTTY && (!nRunning || TimeIntervalExceeds(dwTick, 250)))
     {
-      console_loop_debug_dump(0, NULL, 0); // allows timeouts to work to display data after 'no activity'
+      fleet_show_progress(pPorts, nPorts, cbData, 1);
+      dwTick = MyGetTickCount();
     }
 
-  } while(!QuitFlag());
-}
-
+  } while(nRunning > 0);
 
-void question_loop(HANDLE iFile, HANDLE iConsole)
-{
-char *p1;
+  // final per-device result table
 
-  bMyGetsEchoFlag = 0;
-  p1 = send_command_get_multiline_reply_with_timeout(iFile, pszQuestion, iQuestionWait, 0);
+  nFailed = 0;
 
-  if(p1)
+  if(!bQuietFlag)
   {
-#ifndef WIN32
-    write(iStdOut, p1, strlen(p1));
-#endif // WIN32
-
-    free(p1);
+    fprintf(stderr, "\n%-24s %-8s %8s %10s %7s %8s %8s\n",
+            "Device", "Result", "Blocks", "Bytes", "Errors", "Attempts", "Seconds");
   }
 
-  return;
-}
-
-
-#ifdef WITH_XMODEM
-// XMODEM transfers - some microcontroller devices may use
-// this to transfer files reliably.  The xmodem library is
-// cross-platform so you can use the same code HERE and THERE
-void do_xmodem(HANDLE iFile, HANDLE iConsole)
-{
-int i1, i2;
-
-  // try 3 times to accomplish this.
-
-  bMyGetsEchoFlag = 0;
-
-  for(i1=0; i1 < 3; i1++)
+  for(i1=0; i1 < nPorts; i1++)
   {
-    my_write(iFile, "X", 1);
-    my_write(iFile, szXModemFile, strlen(szXModemFile));
-    my_write(iFile, "\r", 1);
-
-    if(szXModemFile[0] == 'S')
+    if(pPorts[i1].iResult)
     {
-      if(!bQuietFlag)
-      {
-        fprintf(stderr, "Sending file %s\n", &(szXModemFile[1]));
-        fflush(stdout);
-      }
-
-      if(!(i2 = XSend(iFile, &(szXModemFile[1]))))
-      {
-        if(!bQuietFlag)
-        {
-          fputs("\nComplete!\n", stderr);
-          fflush(stdout);
-        }
-        break;
-      }
-
-      if(!bQuietFlag)
-      {
-        fprintf(stderr, "\nXSend returns %d\n", i2);
-        fflush(stdout);
-      }
+      nFailed++;
     }
-    else // assume receive
+
+    if(!bQuietFlag)
     {
-      if(!bQuietFlag)
-      {
-        fprintf(stderr, "Getting file %s\n", &(szXModemFile[1]));
-        fflush(stdout);
-      }
+      fprintf(stderr, "%-24.24s %-8s %8ld %10ld %7ld %8d %8.2f\n",
+              pPorts[i1].szDev, fleet_result_text(&(pPorts[i1])),
+              pPorts[i1].lBlock, pPorts[i1].iResult ? pPorts[i1].lFilePos : cbData,
+              pPorts[i1].lTotalErrors, pPorts[i1].iAttempts,
+              pPorts[i1].dwStart ? (double)(pPorts[i1].dwEnd - pPorts[i1].dwStart) / 1000.0 : 0.0);
+    }
+  }
 
-      if(!(i2 = XReceive(iFile, &(szXModemFile[1]), 0664)))
-      {
-        if(!bQuietFlag)
-        {
-          fputs("\nComplete!\n", stderr);
-          fflush(stdout);
-        }
-        break;
-      }
+  if(!bQuietFlag)
+  {
+    fprintf(stderr, "\n%d of %d ports succeeded, %.2f seconds total\n",
+            nPorts - nFailed, nPorts, (double)(MyGetTickCount() - dwStart) / 1000.0);
+    fflush(stderr);
+  }
 
-      if(!bQuietFlag)
-      {
-        fprintf(stderr, "\nXReceive returns %d\n", i2);
-        fflush(stdout);
-      }
-    }
+  if(cbData > 0)
+  {
+    munmap((void *)pData, cbData);
   }
+
+  munmap(pPorts, sizeof(FLEET_PORT) * FLEET_MAX_PORTS);
+
+  return nFailed ? 1 : 0;
 }
+
+#endif // !WIN32
 #endif // WITH_XMODEM
 
 
@@ -2011,24 +6423,29 @@ void SetQuitFlag(void)
 // CONSOLE AND DEVICE INTERACTION
 // ******************************
 
-char * get_reply(HANDLE iFile, int iMaxDelay)
+// the line ending that 'get_reply' puts after each line ('-m' or '-n', else CRLF).  returns its length
+static int reply_line_ending(char *pOut)
 {
-unsigned int dwStart;
-int i1;
-char *pRval, *p1, *pEnd, *pLimit;
-unsigned int bOldEchoFlag;
-
-
-  pRval = malloc(MY_GETS_BUFSIZE * 2 + 1);
-  if(!pRval)
+  if(iTerminator)
   {
-    bMyGetsEchoFlag = 1;  // reset it
-    return NULL;
+    pOut[0] = (char)iTerminator;
+    return 1;
   }
 
-  pLimit = pRval + MY_GETS_BUFSIZE;
-  pEnd = pRval;
+  pOut[0] = '\r';
+  pOut[1] = '\n';
+  return 2;
+}
+
+int get_reply_stream(HANDLE iFile, int iMaxDelay, REPLY_LINE_PROC pfnLine, void *pCtx)
+{
+unsigned int dwStart;
+int nLines, bEnded, bStop;
+char *p1;
+unsigned int bOldEchoFlag;
 
+
+  nLines = 0;
   dwStart = MyGetTickCount();
 
   while(!TimeIntervalExceeds(dwStart, iMaxDelay))
@@ -2052,39 +6469,81 @@ unsigned int bOldEchoFlag;
       break;
     }
 
-    i1 = strlen(p1);
+    bEnded = reply_end_line(p1); // '-E', the rest of the reply isn't worth waiting for
+    bStop = 0;
 
-    if(i1 + 2 + pEnd >= pLimit)
+    if(*p1 || !bEnded) // nothing left of a prompt line
     {
-      free(p1);
-      break;
+      bStop = pfnLine(pCtx, p1);
+
+      if(!bStop)
+      {
+        nLines++;
+      }
     }
 
-    memcpy(pEnd, p1, i1);
-    pEnd += i1;
+    free(p1);
 
-    if(iTerminator)
-    {
-      *(pEnd++) = iTerminator;
-    }
-    else
+    if(bEnded || bStop)
     {
-      *(pEnd++) = '\r';
-      *(pEnd++) = '\n';
+      break;
     }
+  }
+
+  bMyGetsEchoFlag = 1;  // reset it
+
+  return nLines;
+}
+
+// 'get_reply' collects the lines from 'get_reply_stream' in one buffer
+typedef struct _REPLY_BUFFER_
+{
+  char *pRval, *pEnd, *pLimit;
+} REPLY_BUFFER;
+
+static int get_reply_append(void *pCtx, const char *pszLine)
+{
+REPLY_BUFFER *pB = (REPLY_BUFFER *)pCtx;
+int i1 = strlen(pszLine);
+
+  if(i1 + 2 + pB->pEnd >= pB->pLimit)
+  {
+    return 1; // full
+  }
+
+  memcpy(pB->pEnd, pszLine, i1);
+  pB->pEnd += i1;
+  pB->pEnd += reply_line_ending(pB->pEnd);
+
+  *(pB->pEnd) = 0; // always
+
+  return 0;
+}
 
-    *pEnd = 0; // always
+char * get_reply(HANDLE iFile, int iMaxDelay)
+{
+REPLY_BUFFER sB;
+
+
+  sB.pRval = malloc(MY_GETS_BUFSIZE * 2 + 1);
+  if(!sB.pRval)
+  {
+    bMyGetsEchoFlag = 1;  // reset it
+    return NULL;
   }
 
-  bMyGetsEchoFlag = 1;  // reset it
+  sB.pLimit = sB.pRval + MY_GETS_BUFSIZE;
+  sB.pEnd = sB.pRval;
 
-  if(pEnd == pRval)
+  get_reply_stream(iFile, iMaxDelay, get_reply_append, &sB);
+
+  if(sB.pEnd == sB.pRval)
   {
-    free(pRval);
-    pRval = NULL; // nothing to return
+    free(sB.pRval);
+    return NULL; // nothing to return
   }
 
-  return pRval;  // timeout
+  return sB.pRval;  // timeout
 }
 
 //
@@ -2093,13 +6552,21 @@ unsigned int bOldEchoFlag;
 //
 
 
-char * send_command_get_multiline_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout)
+int send_command_stream_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout,
+                                           REPLY_LINE_PROC pfnLine, void *pCtx)
 {
 unsigned int dwStart, dwStart2;
-char *pRval;
-int bOldMyGetsEchoFlag;
+unsigned long long qwSent, qwFirstByte, qwReply;
+int bOldMyGetsEchoFlag, nRepeats, nLines;
 
 
+  metrics_add(METRIC_COMMANDS, 1);
+
+  if(bCaptureActive)
+  {
+    capture_command(szCommand ? szCommand : "\x1b");
+  }
+
   if(szCommand)
   {
     my_write(iFile, szCommand, strlen(szCommand));
@@ -2110,20 +6577,31 @@ int bOldMyGetsEchoFlag;
     my_write(iFile, "\x1b", 1); // send an escape
   }
 
-  pRval = NULL;
   dwStart = dwStart2 = MyGetTickCount();
+  qwSent = metrics_usecs();
+  qwFirstByte = METRICS_NO_TIME;
+  nRepeats = 0;
+
+  SFT_PROBE2(command__send, szCommand, 0);
 
   while(1) // waits on 'my_pollin'
   {
     if(TimeIntervalExceeds(dwStart, dwTimeout)) // more than 'n' milliseconds?
     {
+      metrics_add(METRIC_COMMAND_TIMEOUTS, 1);
+      metrics_latency(szCommand, qwFirstByte, METRICS_NO_TIME, nRepeats);
+      SFT_PROBE3(command__timeout, szCommand, metrics_usecs() - qwSent, nRepeats);
       bMyGetsEchoFlag = 1;  // reset it
-      return NULL;
+      return 0;
     }
     else if(dwRepeatTimeout && TimeIntervalExceeds(dwStart2, dwRepeatTimeout)) // each second
     {
       if(bCommandRepeatOnTimeoutFlag)
       {
+        metrics_add(METRIC_COMMAND_REPEATS, 1);
+        nRepeats++;
+        SFT_PROBE2(command__send, szCommand, nRepeats);
+
         if(szCommand)
         {
           my_write(iFile, szCommand, strlen(szCommand));
@@ -2159,33 +6637,74 @@ int bOldMyGetsEchoFlag;
       continue;
     }
 
-    bOldMyGetsEchoFlag = bMyGetsEchoFlag; // make backup
-    pRval = get_reply(iFile, dwTimeout);  // will be something here (this resets bMyGetsEchoFlag to 1)
-    bMyGetsEchoFlag = bOldMyGetsEchoFlag; // restore it before continuing loop
-
-    if(!pRval)
+    if(qwFirstByte == METRICS_NO_TIME)
     {
-      fprintf(stderr, "Not enough memory to continue\n");
-      return NULL;
+      qwFirstByte = metrics_usecs() - qwSent;
     }
 
-    if(*pRval)
+    bOldMyGetsEchoFlag = bMyGetsEchoFlag; // make backup
+    nLines = get_reply_stream(iFile, dwTimeout, pfnLine, pCtx);  // will be something here (this resets bMyGetsEchoFlag to 1)
+    bMyGetsEchoFlag = bOldMyGetsEchoFlag; // restore it before continuing loop
+
+    if(nLines > 0)
     {
       break;
     }
   }
 
+  qwReply = metrics_usecs() - qwSent;
+
+  metrics_latency(szCommand, qwFirstByte, qwReply, nRepeats);
+
+  // only the buffered version has the whole reply for the probe
+  SFT_PROBE4(command__reply, szCommand,
+             pfnLine == get_reply_append ? ((REPLY_BUFFER *)pCtx)->pRval : NULL, qwReply, nRepeats);
+
   bMyGetsEchoFlag = 1; // reset it (make sure)
-  return pRval;
+  return nLines;
+}
+
+char * send_command_get_multiline_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout)
+{
+REPLY_BUFFER sB;
+
+
+  sB.pRval = malloc(MY_GETS_BUFSIZE * 2 + 1);
+  if(!sB.pRval)
+  {
+    fprintf(stderr, "Not enough memory to continue\n");
+    bMyGetsEchoFlag = 1;  // reset it
+    return NULL;
+  }
+
+  sB.pLimit = sB.pRval + MY_GETS_BUFSIZE;
+  sB.pEnd = sB.pRval;
+  *(sB.pRval) = 0;
+
+  if(!send_command_stream_reply_with_timeout(iFile, szCommand, dwTimeout, dwRepeatTimeout, get_reply_append, &sB))
+  {
+    free(sB.pRval);
+    return NULL; // timeout
+  }
+
+  return sB.pRval;
 }
 
 
 char * send_command_get_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout)
 {
 unsigned int dwStart, dwStart2;
+unsigned long long qwSent, qwFirstByte, qwReply;
 char *pRval;
 const char *p2;
-int bOldMyGetsEchoFlag;
+int bOldMyGetsEchoFlag, nRepeats;
+
+  metrics_add(METRIC_COMMANDS, 1);
+
+  if(bCaptureActive)
+  {
+    capture_command(szCommand ? szCommand : "\x1b");
+  }
 
   if(szCommand)
   {
@@ -2199,12 +6718,20 @@ int bOldMyGetsEchoFlag;
 
   pRval = NULL;
   dwStart = dwStart2 = MyGetTickCount();
+  qwSent = metrics_usecs();
+  qwFirstByte = METRICS_NO_TIME;
+  nRepeats = 0;
+
+  SFT_PROBE2(command__send, szCommand, 0);
 
   while(1)
   {
     if(TimeIntervalExceeds(dwStart, dwTimeout)) // more than 'n' milliseconds?
     {
       fprintf(stderr, "Unit is not responding\n");
+      metrics_add(METRIC_COMMAND_TIMEOUTS, 1);
+      metrics_latency(szCommand, qwFirstByte, METRICS_NO_TIME, nRepeats);
+      SFT_PROBE3(command__timeout, szCommand, metrics_usecs() - qwSent, nRepeats);
       bMyGetsEchoFlag = 1;  // reset it
       return NULL;
     }
@@ -2212,6 +6739,10 @@ int bOldMyGetsEchoFlag;
     {
       if(bCommandRepeatOnTimeoutFlag)
       {
+        metrics_add(METRIC_COMMAND_REPEATS, 1);
+        nRepeats++;
+        SFT_PROBE2(command__send, szCommand, nRepeats);
+
         if(szCommand)
         {
           my_write(iFile, szCommand, strlen(szCommand));
@@ -2247,6 +6778,11 @@ int bOldMyGetsEchoFlag;
       continue;
     }
 
+    if(qwFirstByte == METRICS_NO_TIME)
+    {
+      qwFirstByte = metrics_usecs() - qwSent;
+    }
+
     bOldMyGetsEchoFlag = bMyGetsEchoFlag; // make backup
     pRval = my_gets2(iFile, dwTimeout);  // will be something here (this resets bMyGetsEchoFlag to 1)
     bMyGetsEchoFlag = bOldMyGetsEchoFlag; // restore it before continuing loop
@@ -2268,6 +6804,11 @@ int bOldMyGetsEchoFlag;
     pRval = NULL;
   }
 
+  qwReply = metrics_usecs() - qwSent;
+
+  metrics_latency(szCommand, qwFirstByte, qwReply, nRepeats);
+  SFT_PROBE4(command__reply, szCommand, pRval, qwReply, nRepeats);
+
   bMyGetsEchoFlag = 1; // reset it (make sure)
   return pRval;
 }
@@ -2427,7 +6968,7 @@ void MyGetsEchoOff(void)
 
 char * my_gets2(HANDLE iFile, unsigned int dwTimeout)
 {
-int i1, iWasCR = 0;
+int i1, iWasCR = 0, bEnded;
 char c1, *pBuf, *p1, *pEnd;
 unsigned int dwStart;
 
@@ -2466,9 +7007,30 @@ unsigned int dwStart;
     {
       dwStart = MyGetTickCount(); // reset timeout counter whenever I get something
 
+      bEnded = 0;
+
+      if(sReplyEnd.bActive) // '-E'
+      {
+        if((sReplyEnd.iSkipEOL == 1 && c1 == '\r') ||
+           (sReplyEnd.iSkipEOL && c1 == '\n'))
+        {
+          sReplyEnd.iSkipEOL = c1 == '\r' ? 2 : 0;
+          continue; // the line ending after the end of the last reply
+        }
+
+        sReplyEnd.iSkipEOL = 0;
+        bEnded = reply_end_byte((unsigned char)c1);
+      }
+
       if(c1 == '\r')
       {
         iWasCR = 1;
+
+        if(bEnded) // don't wait for its LF
+        {
+          sReplyEnd.iSkipEOL = 2;
+          break;
+        }
       }
       else
       {
@@ -2527,6 +7089,12 @@ unsigned int dwStart;
         {
           *(p1++) = c1;
         }
+
+        if(bEnded) // '-E' prompt or count, in the middle of a line
+        {
+          sReplyEnd.iSkipEOL = 1;
+          break;
+        }
       }
     }
     else if(iFile == iStdOut && i1 <= 0 && bIsTCP)
@@ -2538,6 +7106,8 @@ unsigned int dwStart;
   if(pBuf && p1) // can be NULL
   {
     *p1 = 0; // make sure zero byte at end
+
+    SFT_PROBE3(line, iFile, pBuf, (int)(p1 - pBuf));
   }
 
   bMyGetsEchoFlag = 1; // reset echo flag
@@ -2705,16 +7275,306 @@ unsigned int MyGetTickCount()
   return((unsigned int)((unsigned long)tv.tv_sec * 1000L + (unsigned long)tv.tv_usec / 1000L));
 }
 
+// serial input ring - a reader thread drains the serial port into a single-producer,
+// single-consumer ring, so that a consumer blocked on a slow console (or the echo in
+// 'my_gets2') can't let the kernel's tty buffer overrun.  'dwHead' is only written by the
+// reader thread and 'dwTail' only by the consumer, each on its own cache line.  Whenever the
+// ring stops being empty, the reader writes a byte to 'aBell' so that 'poll()' still works
+// (see 'my_poll_handle()').  If the ring fills up anyway, the reader stops reading until there's
+// room again, so flow control (USB CDC, RTS/CTS) still works and the port is no worse off than
+// it would be without the ring.  Each time that happens, it's counted.
+
+typedef struct _SERIAL_RING_
+{
+  // reader thread
+  unsigned int dwHead __attribute__((aligned(CACHE_LINE_SIZE)));
+  unsigned long ulOverflow; // number of times the ring was full
+  int bError;               // the last 'read()' failed (device gone?)
+
+  // consumer
+  unsigned int dwTail __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  // assigned before the thread starts
+  char *pBuf __attribute__((aligned(CACHE_LINE_SIZE))); // NULL if there's no ring
+  unsigned int cbSize; // always a power of 2
+  HANDLE iFile;
+  int aBell[2];        // pipe, readable when there's (probably) data
+  int bStop;
+  pthread_t hThread;
+} SERIAL_RING;
+
+static SERIAL_RING sSerialRing;
+
+static void *serial_ring_thread(void *pParam)
+{
+SERIAL_RING *pR = (SERIAL_RING *)pParam;
+struct pollfd sFD;
+unsigned int dwHead = pR->dwHead, cbFree, cb1;
+int i1, bFull = 0;
+
+  while(!__atomic_load_n(&pR->bStop, __ATOMIC_ACQUIRE))
+  {
+    cbFree = pR->cbSize - (dwHead - __atomic_load_n(&pR->dwTail, __ATOMIC_ACQUIRE));
+
+    if(!cbFree) // leave it in the port until the consumer catches up
+    {
+      if(!bFull)
+      {
+        pR->ulOverflow++;
+        metrics_add(METRIC_SERIAL_RING_FULL, 1);
+        bFull = 1;
+      }
+
+      usleep(1000);
+      continue;
+    }
+
+    bFull = 0;
+
+    sFD.fd = pR->iFile;
+    sFD.events = POLLIN;
+    sFD.revents = 0;
+
+    if(poll(&sFD, 1, 100) <= 0)
+    {
+      continue; // timeout (so 'bStop' is checked) or EINTR
+    }
+
+    cb1 = pR->cbSize - (dwHead & (pR->cbSize - 1)); // contiguous space, up to the end
+
+    if(cb1 > cbFree)
+    {
+      cb1 = cbFree;
+    }
+
+    i1 = read(pR->iFile, pR->pBuf + (dwHead & (pR->cbSize - 1)), cb1);
+    metrics_add(METRIC_SERIAL_RX_SYSCALLS, 1);
+
+    if(i1 > 0)
+    {
+      metrics_add(METRIC_SERIAL_RX_BYTES, i1);
+
+      if(bCaptureActive)
+      {
+        capture_data(CAPTURE_RX, pR->pBuf + (dwHead & (pR->cbSize - 1)), i1);
+      }
+
+      __atomic_store_n(&pR->bError, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&pR->dwHead, dwHead + i1, __ATOMIC_SEQ_CST);
+
+      // store 'dwHead' then load 'dwTail', while the consumer stores 'dwTail' then loads
+      // 'dwHead' - so if the consumer is about to sleep, this sees that the ring was empty
+      if(__atomic_load_n(&pR->dwTail, __ATOMIC_SEQ_CST) == dwHead)
+      {
+        write(pR->aBell[1], "", 1); // non-blocking, and one byte is as good as many
+      }
+
+      dwHead += i1;
+      continue;
+    }
+
+    if(i1 < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      continue;
+    }
+
+    // EOF or error - let the consumer see it, and don't spin while it lasts
+    __atomic_store_n(&pR->bError, 1, __ATOMIC_SEQ_CST);
+    write(pR->aBell[1], "", 1);
+    usleep(100000);
+  }
+
+  return NULL;
+}
+
+// returns the number of bytes in the ring.  when it's empty, the bell is reset first
+static unsigned int serial_ring_count(SERIAL_RING *pR)
+{
+char aDrain[64];
+unsigned int cb1;
+
+  cb1 = __atomic_load_n(&pR->dwHead, __ATOMIC_ACQUIRE) - pR->dwTail;
+
+  if(!cb1)
+  {
+    while(read(pR->aBell[0], aDrain, sizeof(aDrain)) > 0)
+    { } // nothing to wake up for (yet)
+
+    cb1 = __atomic_load_n(&pR->dwHead, __ATOMIC_SEQ_CST) - pR->dwTail; // in case it JUST arrived
+  }
+
+  return cb1;
+}
+
+static int serial_ring_read(SERIAL_RING *pR, void *pBuf, int cbBuf)
+{
+unsigned int dwTail, cb1, cb2;
+
+  cb1 = serial_ring_count(pR);
+
+  if(!cb1)
+  {
+    errno = __atomic_load_n(&pR->bError, __ATOMIC_RELAXED) ? EIO : EAGAIN; // same as a non-blocking 'read()'
+    return -1;
+  }
+
+  if(cb1 > (unsigned int)cbBuf)
+  {
+    cb1 = cbBuf;
+  }
+
+  dwTail = pR->dwTail & (pR->cbSize - 1);
+  cb2 = pR->cbSize - dwTail; // contiguous, up to the end
+
+  if(cb2 > cb1)
+  {
+    cb2 = cb1;
+  }
+
+  memcpy(pBuf, pR->pBuf + dwTail, cb2);
+  memcpy((char *)pBuf + cb2, pR->pBuf, cb1 - cb2); // the part that wraps around, if any
+
+  __atomic_store_n(&pR->dwTail, pR->dwTail + cb1, __ATOMIC_SEQ_CST);
+
+  return cb1;
+}
+
+// same return values as 'my_pollin()'
+static int serial_ring_pollin(SERIAL_RING *pR, int iMsec)
+{
+struct pollfd sFD;
+
+  if(!serial_ring_count(pR))
+  {
+    if(__atomic_load_n(&pR->bError, __ATOMIC_RELAXED))
+    {
+      return -1;
+    }
+
+    sFD.fd = pR->aBell[0];
+    sFD.events = POLLIN;
+    sFD.revents = 0;
+
+    if(poll(&sFD, 1, iMsec) <= 0 || !serial_ring_count(pR))
+    {
+      return __atomic_load_n(&pR->bError, __ATOMIC_RELAXED) ? -1 : 0;
+    }
+  }
+
+  return 1;
+}
+
+static int serial_ring_start(HANDLE iFile, int nPages)
+{
+SERIAL_RING *pR = &sSerialRing;
+int i1;
+
+  for(i1=1; i1 < nPages; i1 <<= 1)
+  { } // round up to a power of 2
+
+  memset(pR, 0, sizeof(*pR));
+
+  pR->cbSize = (unsigned int)i1 * (unsigned int)sysconf(_SC_PAGESIZE);
+  pR->iFile = iFile;
+
+  pR->pBuf = mmap(NULL, pR->cbSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+
+  if(pR->pBuf == MAP_FAILED)
+  {
+    pR->pBuf = NULL;
+    fprintf(stderr, "Warning:  no serial input ring, errno=%d\n", errno);
+    return -1;
+  }
+
+  if(pipe(pR->aBell))
+  {
+    fprintf(stderr, "Warning:  no serial input ring, errno=%d\n", errno);
+    goto error_exit;
+  }
+
+  fcntl(pR->aBell[0], F_SETFL, fcntl(pR->aBell[0], F_GETFL) | O_NONBLOCK);
+  fcntl(pR->aBell[1], F_SETFL, fcntl(pR->aBell[1], F_GETFL) | O_NONBLOCK);
+
+  i1 = pthread_create(&(pR->hThread), NULL, serial_ring_thread, pR);
+
+  if(i1)
+  {
+    fprintf(stderr, "Warning:  no serial input thread, error %d\n", i1);
+
+    close(pR->aBell[0]);
+    close(pR->aBell[1]);
+    goto error_exit;
+  }
+
+  return 0;
+
+error_exit:
+  munmap(pR->pBuf, pR->cbSize);
+  pR->pBuf = NULL;
+
+  return -1;
+}
+
+static void serial_ring_stop(void)
+{
+SERIAL_RING *pR = &sSerialRing;
+
+  if(!pR->pBuf)
+  {
+    return;
+  }
+
+  __atomic_store_n(&pR->bStop, 1, __ATOMIC_RELEASE);
+  pthread_join(pR->hThread, NULL);
+
+  if(pR->ulOverflow)
+  {
+    fprintf(stderr, "WARNING - serial input ring was full %lu time(s), data may have been lost (see '-Z')\n",
+            pR->ulOverflow);
+  }
+
+  close(pR->aBell[0]);
+  close(pR->aBell[1]);
+  munmap(pR->pBuf, pR->cbSize);
+
+  pR->pBuf = NULL;
+}
+
+HANDLE my_poll_handle(HANDLE iFile)
+{
+  if(sSerialRing.pBuf && iFile == sSerialRing.iFile)
+  {
+    return sSerialRing.aBell[0];
+  }
+
+  return iFile;
+}
+
 int my_pollin(HANDLE iFile)
+{
+  return my_pollin_msec(iFile, 100);
+}
+
+int my_pollin_msec(HANDLE iFile, int iMsec)
 {
 struct pollfd sFD;
 int i1;
 
+  if(sSerialRing.pBuf && iFile == sSerialRing.iFile)
+  {
+    return serial_ring_pollin(&sSerialRing, iMsec);
+  }
+
   sFD.fd = iFile;
   sFD.events = POLLIN | POLLERR;
   sFD.revents = 0;
 
-  i1 = poll(&sFD, 1, 100);
+  i1 = poll(&sFD, 1, iMsec);
+
+  if(i1 > 0)
+  {
+    metrics_add(METRIC_POLL_WAKEUPS, 1);
+  }
 
   // must check for error first
   if(i1 < 0 || (sFD.revents & POLLERR))
@@ -2754,12 +7614,61 @@ char c1;
 
 int my_write(HANDLE iFile, const void *pBuf, int cbBuf)
 {
-  return write(iFile, pBuf, cbBuf);
+int i1 = write(iFile, pBuf, cbBuf);
+
+  if(iFile == iGlobalFileHandle)
+  {
+    metrics_add(METRIC_SERIAL_TX_SYSCALLS, 1);
+
+    if(i1 > 0)
+    {
+      metrics_add(METRIC_SERIAL_TX_BYTES, i1);
+
+      if(bCaptureActive)
+      {
+        capture_data(CAPTURE_TX, pBuf, i1);
+      }
+    }
+  }
+
+  SFT_PROBE3(serial__write, iFile, i1, cbBuf);
+
+  return i1;
 }
 
 int my_read(HANDLE iFile, void *pBuf, int cbBuf)
 {
-  return read(iFile, pBuf, cbBuf);
+int i1;
+
+  if(sSerialRing.pBuf && iFile == sSerialRing.iFile)
+  {
+    i1 = serial_ring_read(&sSerialRing, pBuf, cbBuf); // already captured, by the reader thread
+
+    SFT_PROBE3(serial__read, iFile, i1, cbBuf);
+
+    return i1;
+  }
+
+  i1 = read(iFile, pBuf, cbBuf);
+
+  if(iFile == iGlobalFileHandle)
+  {
+    metrics_add(METRIC_SERIAL_RX_SYSCALLS, 1);
+
+    if(i1 > 0)
+    {
+      metrics_add(METRIC_SERIAL_RX_BYTES, i1);
+
+      if(bCaptureActive)
+      {
+        capture_data(CAPTURE_RX, pBuf, i1);
+      }
+    }
+  }
+
+  SFT_PROBE3(serial__read, iFile, i1, cbBuf);
+
+  return i1;
 }
 
 void set_rts_dtr(HANDLE iFile, int bSet)
@@ -2777,14 +7686,19 @@ unsigned int sFlags;
     sFlags &= ~(TIOCM_RTS | TIOCM_DTR);
   }
 
-  ioctl(iFile, TIOCMSET, &sFlags);
+  if(!ioctl(iFile, TIOCMSET, &sFlags) && bCaptureActive)
+  {
+    capture_modem(sFlags);
+  }
 }
 
 void reset_arduino(HANDLE iFile)
 {
-unsigned int sFlags;
+unsigned int sFlags, dwStart = MyGetTickCount();
 // toggle the RTS and DTR high, low, then high - so much easier via POSIX-compatible OS!
 
+  SFT_PROBE1(reset__start, iFile);
+
   ioctl(iFile, TIOCMGET, &sFlags);
 
 //  sFlags |= TIOCM_DTR | TIOCM_RTS;
@@ -2797,6 +7711,10 @@ unsigned int sFlags;
   {
     fprintf(stderr, "WARNING:  ioctl() returns < 0, errno=%d (%xH)\n", errno, errno);
   }
+  else if(bCaptureActive)
+  {
+    capture_modem(sFlags);
+  }
 
   MySleep(250); // avrdude does this for 50 msecs, my change has it at 50msecs
 
@@ -2805,6 +7723,10 @@ unsigned int sFlags;
   {
     fprintf(stderr, "WARNING:  ioctl() returns < 0, errno=%d (%xH)\n", errno, errno);
   }
+  else if(bCaptureActive)
+  {
+    capture_modem(sFlags);
+  }
 
   MySleep(50); // avrdude does this for 50 msecs (no change)
 
@@ -2812,6 +7734,8 @@ unsigned int sFlags;
   my_flush(iFile); // avrdude does this too - flush any extraneous input
 
   MySleep(500);  // And I allow 1/2 second for device reset
+
+  SFT_PROBE2(reset__end, iFile, MyGetTickCount() - dwStart);
 }
 
 HANDLE altconconfig(HANDLE iFile)
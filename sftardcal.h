@@ -55,6 +55,10 @@ void set_rts_dtr(HANDLE iFile, int bSet); // low-level code similar to 'reset_ar
 char * my_gets(HANDLE iFile);
 char * my_gets2(HANDLE iFile, unsigned int dwTimeout); // similar to my_gets but with timeout
 int my_pollin(HANDLE iFile);
+#ifndef WIN32
+HANDLE my_poll_handle(HANDLE iFile); // what to 'poll()' for input on 'iFile' (not always 'iFile')
+int my_pollin_msec(HANDLE iFile, int iMsec); // 'my_pollin' waits up to 100 msecs for input, this waits 'iMsec' (0 only looks)
+#endif // WIN32
 void my_flush(HANDLE iFile);
 const char * my_ltrim(const char *pStr);
 
@@ -78,6 +82,12 @@ char * get_reply(HANDLE iFile, int iMaxDelay);
    // wait for reply up to time delay value. stops waiting on ANY input (blocks until I get LF) up to time limit
    // this will accept multi-line replies, and does not filter out the command if it's echoed
 
+typedef int (*REPLY_LINE_PROC)(void *pCtx, const char *pszLine); // non-zero return stops the reply
+
+int get_reply_stream(HANDLE iFile, int iMaxDelay, REPLY_LINE_PROC pfnLine, void *pCtx);
+   // same as 'get_reply', but each line goes to 'pfnLine' (without its line ending) as soon as it arrives,
+   // instead of into a buffer, so the reply can be any size.  returns the number of lines
+
 char * send_command_get_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout);
   // this function is a little more sophisticated, repeats the command every 'dwRepeatTimeout' (when non-zero), waits up to 'dwTimeout'
   // milliseconds (can be zero for 'no wait', though this would be impractical) for a response, then returns.
@@ -88,6 +98,11 @@ char * send_command_get_multiline_reply_with_timeout(HANDLE iFile, const char *s
   // milliseconds (can be zero for 'no wait', though this would be impractical) for a response, then returns.
   // calls 'get_reply' internally and does not filter out the command if that's echoed.
 
+int send_command_stream_reply_with_timeout(HANDLE iFile, const char *szCommand, unsigned int dwTimeout, unsigned int dwRepeatTimeout,
+                                           REPLY_LINE_PROC pfnLine, void *pCtx);
+  // same as 'send_command_get_multiline_reply_with_timeout', but the reply goes to 'pfnLine' one line at a time
+  // through 'get_reply_stream'.  returns the number of lines, 0 for a timeout
+
 char * send_command_get_reply(HANDLE iFile, const char *szCommand); // returns first non-echo line (calls above function internally with defaults)
 
 int send_command_get_reply_OK(HANDLE iFile, const char *szCommand); // returns non-zero if first non-echo line is 'OK' (calls above)
@@ -120,6 +135,8 @@ int my_read(HANDLE iFile, void *pBuf, int cbBuf);
 
 // debug dump - 'iDir < 0' is receive, 'iDir > 0' is send
 void sftardcal_debug_dump_buffer(int iDir, const void *pBuf, int cbBuf);
+void sftardcal_debug_dump_file(FILE *pOut, int iDir, const void *pBuf, int cbBuf); // same format, no timestamp ('sftcapdump')
+void sftardcal_debug_flush(void); // waits (up to a second) for the dumps queued by 'sftardcal_debug_dump_buffer'
 
 
 #define VERBOSITY_SILENT      0
@@ -0,0 +1,162 @@
+// sftbaud.c - baud rate upshift ('sftardcal -A'), the device's half, for ARDUINO and the host
+//
+// See 'sftbaud.h'.  The device only sends the PROBE frames back as they are;
+// the host made them, so it's the one that checks them.  No 'printf()', which
+// is big on an AVR.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdlib.h>
+#include "sftbaud.h"
+
+
+void baud_device_init(BAUD_DEVICE *pB, const uint32_t *pdwRates, int nRates, uint32_t dwRate)
+{
+  memset(pB, 0, sizeof(*pB));
+
+  pB->pdwRates = pdwRates;
+  pB->nRates = (uint8_t)(nRates < BAUD_MAX_RATES ? nRates : BAUD_MAX_RATES);
+  pB->dwRate = pB->dwNext = pB->dwPrevious = dwRate;
+}
+
+// appends "text" (or the number, if 'pszText' is NULL).  Returns the new length
+static int baud_append(char *pszOut, int cbOut, int iPos, const char *pszText, uint32_t dwNumber)
+{
+char tbuf[12];
+int i1 = sizeof(tbuf) - 1;
+
+  if(!pszText)
+  {
+    tbuf[i1] = 0;
+
+    do
+    {
+      tbuf[--i1] = (char)('0' + dwNumber % 10);
+      dwNumber /= 10;
+    } while(dwNumber);
+
+    pszText = tbuf + i1;
+  }
+
+  while(*pszText && iPos < cbOut - 1)
+  {
+    pszOut[iPos++] = *(pszText++);
+  }
+
+  pszOut[iPos] = 0;
+
+  return iPos;
+}
+
+int baud_device_command(BAUD_DEVICE *pB, const char *pszLine, char *pszReply, int cbReply)
+{
+uint32_t dwRate;
+char *p1;
+int i1, iPos;
+
+  if(!strcmp(pszLine, BAUD_LIST_COMMAND))
+  {
+    iPos = baud_append(pszReply, cbReply, 0, BAUD_LIST_COMMAND ":", 0);
+
+    for(i1=0; i1 < pB->nRates; i1++)
+    {
+      iPos = baud_append(pszReply, cbReply, iPos, " ", 0);
+      iPos = baud_append(pszReply, cbReply, iPos, NULL, pB->pdwRates[i1]);
+    }
+
+    return 1;
+  }
+
+  if(strncmp(pszLine, BAUD_COMMAND " ", sizeof(BAUD_COMMAND)))
+  {
+    return 0;
+  }
+
+  dwRate = strtoul(pszLine + sizeof(BAUD_COMMAND), &p1, 10);
+
+  for(i1=0; i1 < pB->nRates && pB->pdwRates[i1] != dwRate; i1++)
+  { }
+
+  iPos = baud_append(pszReply, cbReply, 0, BAUD_COMMAND ": ", 0);
+
+  if(*p1 || i1 == pB->nRates || pB->bState != BAUD_STATE_IDLE)
+  {
+    baud_append(pszReply, cbReply, iPos, "ERROR", 0);
+    return 1;
+  }
+
+  baud_append(pszReply, cbReply, iPos, NULL, dwRate);
+
+  pB->dwNext = dwRate;
+  pB->bState = BAUD_STATE_SWITCH; // once the reply is out
+
+  return 1;
+}
+
+int baud_device_poll(BAUD_DEVICE *pB, uint32_t dwNow)
+{
+  if(pB->bState == BAUD_STATE_SWITCH)
+  {
+    pB->bState = BAUD_STATE_PROBE;
+    pB->dwPrevious = pB->dwRate;
+    pB->dwRate = pB->dwNext;
+    pB->dwDeadline = dwNow + BAUD_PROBE_MSEC;
+    pB->wProbes = 0;
+
+    return 1;
+  }
+
+  if(pB->bState == BAUD_STATE_PROBE && (int32_t)(dwNow - pB->dwDeadline) >= 0) // no CONFIRM
+  {
+    pB->bState = BAUD_STATE_IDLE;
+    pB->dwRate = pB->dwPrevious;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+int baud_device_probing(const BAUD_DEVICE *pB)
+{
+  return pB->bState == BAUD_STATE_PROBE;
+}
+
+int baud_device_frame(BAUD_DEVICE *pB, const FRAME_VIEW *pV, uint8_t *pOut, int cbOut)
+{
+uint8_t abRate[4];
+
+  if(pB->bState != BAUD_STATE_PROBE)
+  {
+    return 0;
+  }
+
+  if(pV->bType == FRAME_TYPE_PROBE)
+  {
+    pB->wProbes++;
+
+    return frame_encode(pOut, cbOut, FRAME_TYPE_PROBE, pV->bSeq, pV->pData, pV->cbData);
+  }
+
+  if(pV->bType != FRAME_TYPE_CONFIRM)
+  {
+    return 0;
+  }
+
+  pB->bState = BAUD_STATE_IDLE; // this is the rate now
+  pB->dwPrevious = pB->dwRate;
+
+  abRate[0] = (uint8_t)(pB->dwRate >> 24);
+  abRate[1] = (uint8_t)(pB->dwRate >> 16);
+  abRate[2] = (uint8_t)(pB->dwRate >> 8);
+  abRate[3] = (uint8_t)pB->dwRate;
+
+  return frame_encode(pOut, cbOut, FRAME_TYPE_CONFIRM, pV->bSeq, abRate, sizeof(abRate));
+}
@@ -0,0 +1,108 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftbaud.h - baud rate upshift ('sftardcal -A'), the device's half
+//
+// A link starts at a rate every cable carries ('-B', 9600 by default), and
+// most of them carry a lot more.  The host asks the device what it can do,
+// then steps up through those rates, one at a time.  At each one it sends a
+// short burst of frames that the device sends right back (a loopback, CRC
+// checked both ways, see 'sftframe.h'), and keeps the highest rate where all
+// of them came back.  If frame errors go up later, it steps down the same way.
+//
+//   host                           device
+//
+//   "BAUDS"                        "BAUDS: 9600 115200 500000 1000000"
+//   "BAUD 500000"                  "BAUD: 500000", then it switches
+//   (switches)
+//   FRAME_TYPE_PROBE, each one     the same frame back
+//   FRAME_TYPE_CONFIRM             FRAME_TYPE_CONFIRM, and it keeps the rate
+//
+// A device that gets no CONFIRM frame within BAUD_PROBE_MSEC of switching goes
+// back to the rate it had, so a rate the cable can't carry costs that long and
+// no more.  The commands work as text lines or as FRAME_TYPE_COMMAND frames
+// (the reply is then in REPLY frames, and the session stays framed after the
+// switch).  A reset goes back to the rate the device starts with.
+//
+// Like 'xmodem.c' and 'sftframe.c', this builds for ARDUINO and the host, as
+// C or C++, and does no I/O.  i.e.
+//
+//   static const uint32_t adwRates[] = { 9600, 115200, 500000, 1000000 };
+//   BAUD_DEVICE sBaud;
+//
+//   baud_device_init(&sBaud, adwRates, 4, 9600);
+//   ...
+//   if(baud_device_command(&sBaud, szLine, szReply, sizeof(szReply))) // a command line
+//   {
+//     Serial.println(szReply);
+//     Serial.flush();                       // all of it, at the old rate
+//   }
+//   ...
+//   if(baud_device_poll(&sBaud, millis()))  // now and then
+//   {
+//     Serial.begin(sBaud.dwRate);
+//   }
+//   ...
+//   if(baud_device_probing(&sBaud))        // and each frame that arrives
+//   {
+//     Serial.write(aOut, baud_device_frame(&sBaud, &sV, aOut, sizeof(aOut)));
+//   }
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTBAUD_H_INCLUDED_
+#define _SFTBAUD_H_INCLUDED_
+
+#include "sftframe.h"
+
+
+#define BAUD_LIST_COMMAND "BAUDS"  /* the reply is "BAUDS: rate rate ..." */
+#define BAUD_COMMAND      "BAUD"   /* "BAUD rate", the reply is "BAUD: rate" or "BAUD: ERROR" */
+
+#define BAUD_MAX_RATES    16
+#define BAUD_PROBE_MSEC   1500     /* from the switch to the CONFIRM frame, or it goes back */
+
+#define BAUD_STATE_IDLE   0
+#define BAUD_STATE_SWITCH 1        /* the reply is on its way, the switch is next */
+#define BAUD_STATE_PROBE  2        /* at the new rate, waiting for CONFIRM */
+
+
+typedef struct _BAUD_DEVICE_
+{
+  const uint32_t *pdwRates;  // the ones it can do, lowest first
+  uint8_t nRates;
+  uint8_t bState;            // BAUD_STATE_xxx
+  uint16_t wProbes;          // PROBE frames sent back at this rate
+  uint32_t dwRate;           // what the UART is set to
+  uint32_t dwNext;           // what it switches to once the reply is out
+  uint32_t dwPrevious;       // what it goes back to without a CONFIRM frame
+  uint32_t dwDeadline;       // when (in msecs, 'millis()' or the like)
+} BAUD_DEVICE;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+void baud_device_init(BAUD_DEVICE *pB, const uint32_t *pdwRates, int nRates, uint32_t dwRate);
+
+// 1 if 'pszLine' was one of the commands, with the reply line (no line ending) in 'pszReply'
+int baud_device_command(BAUD_DEVICE *pB, const char *pszLine, char *pszReply, int cbReply);
+
+// 1 when the UART needs to be set to 'dwRate' (after the reply went out, or going back)
+int baud_device_poll(BAUD_DEVICE *pB, uint32_t dwNow);
+
+int baud_device_probing(const BAUD_DEVICE *pB);
+
+// a frame that arrived while probing.  Returns the bytes in 'pOut' to send back, 0 for none
+int baud_device_frame(BAUD_DEVICE *pB, const FRAME_VIEW *pV, uint8_t *pOut, int cbOut);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // _SFTBAUD_H_INCLUDED_
@@ -0,0 +1,772 @@
+// sftbench.c - microbenchmarks for the sftardcal hot paths ('make bench')
+//
+// Builds 'sftardcal.c' into the same translation unit (SFTARDCAL_LIBRARY leaves
+// out its 'main') and feeds synthetic serial data through:
+//
+//   my_gets2()                      byte-at-a-time line input, echo off and on
+//   get_reply()                     multi-line reply concatenation
+//   CalcCRC(), CalcCheckSum()       XMODEM block checks (from 'xmodem.c')
+//   sftardcal_debug_dump_buffer()   the '-d' hex dump
+//   console_loop()                  device->console and console->device translation
+//
+// The 'serial port' is a pipe or socket pair that is filled before each timed
+// call, so nothing ever waits on real I/O.  The link is done with '--wrap' for
+// malloc, calloc, realloc, read, write, poll, gettimeofday and usleep (see
+// Makefile.incl) which counts allocations and syscalls, and replaces the clock
+// with a virtual one.  With the virtual clock a poll() timeout or a MySleep()
+// just moves the clock forward, so the timeouts in get_reply() cost nothing.
+// Write syscalls made inside stdio are not seen by '--wrap', so on Linux the
+// syscall counts come from /proc/self/io when it's available.  The hex dump is
+// timed on the calling thread only; the log sink thread's writes happen while
+// the benchmark runs but aren't part of the time (they are in the counts).
+//
+// Results are written as JSON (stdout, or '-o file') so that runs from
+// different builds can be compared, i.e. 'make bench CFLAGS=-O3 BENCH_ARGS="-l O3"'
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#define SFTARDCAL_LIBRARY
+#include "sftardcal.c"
+
+#include <time.h>
+
+
+#define BENCH_BATCH 32768 /* bytes queued per timed call, must fit in a pipe */
+
+// counters maintained by the '--wrap' functions
+typedef struct _BENCH_COUNTS_
+{
+  unsigned long ulAllocs;
+  unsigned long ulReads;
+  unsigned long ulWrites;
+  unsigned long ulPolls;
+  unsigned long ulSysIO;  // read + write syscalls from /proc/self/io, including stdio's
+} BENCH_COUNTS;
+
+typedef struct _BENCH_RESULT_
+{
+  const char *pszName;
+  unsigned long long qwBytes;
+  unsigned long ulLines;
+  unsigned long ulCalls;
+  double dSeconds;
+  BENCH_COUNTS sCounts;
+} BENCH_RESULT;
+
+
+static BENCH_COUNTS sBenchCounts;
+static int bBenchVirtualClock = 0;       // non-zero to use the virtual clock
+static pthread_t hBenchThread;           // the only thread that uses it (not the log sink)
+static int bBenchQuitOnIdle = 0;         // non-zero to end 'console_loop' when there's no more input
+static unsigned long long qwBenchClock;  // virtual clock, microseconds
+static int bBenchProcIO = -1;            // -1 until /proc/self/io has been tried
+static unsigned int dwBenchMinMsec = 250;
+
+static char *pBenchLines = NULL;         // synthetic device output, BENCH_BATCH bytes of CRLF lines
+static int cbBenchLines = 0, nBenchLines = 0;
+static char *pBenchKeys = NULL;          // synthetic keyboard input
+static int iBenchNull = -1;              // /dev/null, for 'iStdOut' and stderr
+
+
+// ----------------------------------------------------------
+// '--wrap' functions - see the 'sftbench' rule in Makefile.incl
+// ----------------------------------------------------------
+
+void *__real_malloc(size_t cbSize);
+void *__real_calloc(size_t nItems, size_t cbSize);
+void *__real_realloc(void *pBuf, size_t cbSize);
+ssize_t __real_read(int iFile, void *pBuf, size_t cbBuf);
+ssize_t __real_write(int iFile, const void *pBuf, size_t cbBuf);
+int __real_poll(struct pollfd *pFD, nfds_t nFD, int iTimeout);
+int __real_gettimeofday(struct timeval *pTV, void *pTZ);
+int __real_usleep(useconds_t uSec);
+
+void *__wrap_malloc(size_t cbSize)
+{
+  sBenchCounts.ulAllocs++;
+  return __real_malloc(cbSize);
+}
+
+void *__wrap_calloc(size_t nItems, size_t cbSize)
+{
+  sBenchCounts.ulAllocs++;
+  return __real_calloc(nItems, cbSize);
+}
+
+void *__wrap_realloc(void *pBuf, size_t cbSize)
+{
+  sBenchCounts.ulAllocs++;
+  return __real_realloc(pBuf, cbSize);
+}
+
+ssize_t __wrap_read(int iFile, void *pBuf, size_t cbBuf)
+{
+  sBenchCounts.ulReads++;
+  return __real_read(iFile, pBuf, cbBuf);
+}
+
+ssize_t __wrap_write(int iFile, const void *pBuf, size_t cbBuf)
+{
+  sBenchCounts.ulWrites++;
+  return __real_write(iFile, pBuf, cbBuf);
+}
+
+int __wrap_poll(struct pollfd *pFD, nfds_t nFD, int iTimeout)
+{
+int iRval;
+
+  sBenchCounts.ulPolls++;
+
+  if(!bBenchVirtualClock || !pthread_equal(pthread_self(), hBenchThread))
+  {
+    return __real_poll(pFD, nFD, iTimeout);
+  }
+
+  iRval = __real_poll(pFD, nFD, 0); // all of the input is already queued up
+
+  if(!iRval && iTimeout > 0)
+  {
+    qwBenchClock += (unsigned long long)iTimeout * 1000; // as if it had waited
+
+    if(bBenchQuitOnIdle)
+    {
+      SetQuitFlag(); // ends 'console_loop'
+    }
+  }
+
+  return iRval;
+}
+
+int __wrap_gettimeofday(struct timeval *pTV, void *pTZ)
+{
+  if(!bBenchVirtualClock || !pthread_equal(pthread_self(), hBenchThread))
+  {
+    return __real_gettimeofday(pTV, pTZ);
+  }
+
+  pTV->tv_sec = (time_t)(qwBenchClock / 1000000);
+  pTV->tv_usec = (suseconds_t)(qwBenchClock % 1000000);
+
+  return 0;
+}
+
+int __wrap_usleep(useconds_t uSec)
+{
+  if(!bBenchVirtualClock || !pthread_equal(pthread_self(), hBenchThread))
+  {
+    return __real_usleep(uSec);
+  }
+
+  qwBenchClock += uSec;
+  return 0;
+}
+
+
+// -------
+// HELPERS
+// -------
+
+static double bench_now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// read + write syscalls for the whole process, 0 if not available (not Linux)
+static unsigned long bench_proc_io(void)
+{
+char tbuf[512], *p1;
+unsigned long ulRval = 0;
+int iFile, i1;
+
+  if(!bBenchProcIO)
+  {
+    return 0;
+  }
+
+  iFile = open("/proc/self/io", O_RDONLY);
+  if(iFile < 0)
+  {
+    bBenchProcIO = 0;
+    return 0;
+  }
+
+  i1 = __real_read(iFile, tbuf, sizeof(tbuf) - 1);
+  close(iFile);
+
+  if(i1 <= 0)
+  {
+    bBenchProcIO = 0;
+    return 0;
+  }
+
+  tbuf[i1] = 0;
+
+  p1 = strstr(tbuf, "syscr:");
+  if(p1)
+  {
+    ulRval += strtoul(p1 + 6, NULL, 10);
+  }
+
+  p1 = strstr(tbuf, "syscw:");
+  if(p1)
+  {
+    ulRval += strtoul(p1 + 6, NULL, 10);
+  }
+
+  bBenchProcIO = 1;
+
+  return ulRval;
+}
+
+// start and stop one timed section, adding the time and counts to 'pR'
+static double dBenchStart;
+static BENCH_COUNTS sBenchStart;
+
+static void bench_begin(void)
+{
+  sBenchStart = sBenchCounts;
+  sBenchStart.ulSysIO = bench_proc_io();
+  dBenchStart = bench_now();
+}
+
+static void bench_end(BENCH_RESULT *pR)
+{
+double dEnd = bench_now();
+unsigned long ulSysIO = bench_proc_io();
+
+  pR->dSeconds += dEnd - dBenchStart;
+  pR->sCounts.ulAllocs += sBenchCounts.ulAllocs - sBenchStart.ulAllocs;
+  pR->sCounts.ulReads += sBenchCounts.ulReads - sBenchStart.ulReads;
+  pR->sCounts.ulWrites += sBenchCounts.ulWrites - sBenchStart.ulWrites;
+  pR->sCounts.ulPolls += sBenchCounts.ulPolls - sBenchStart.ulPolls;
+
+  if(ulSysIO > sBenchStart.ulSysIO)
+  {
+    pR->sCounts.ulSysIO += ulSysIO - sBenchStart.ulSysIO - 1; // the /proc read itself
+  }
+}
+
+static int bench_done(BENCH_RESULT *pR)
+{
+  return pR->dSeconds * 1000.0 >= dwBenchMinMsec;
+}
+
+// queue 'cbBuf' bytes on 'iFile' (not timed, not counted)
+static void bench_fill(int iFile, const char *pBuf, int cbBuf)
+{
+int i1;
+
+  while(cbBuf > 0)
+  {
+    i1 = __real_write(iFile, pBuf, cbBuf);
+    if(i1 <= 0)
+    {
+      fprintf(stderr, "sftbench: write error %d\n", errno);
+      exit(2);
+    }
+
+    pBuf += i1;
+    cbBuf -= i1;
+  }
+}
+
+static void bench_drain(int iFile)
+{
+char tbuf[4096];
+struct pollfd sFD;
+
+  sFD.fd = iFile;
+  sFD.events = POLLIN;
+
+  while(__real_poll(&sFD, 1, 0) > 0 && (sFD.revents & POLLIN))
+  {
+    if(__real_read(iFile, tbuf, sizeof(tbuf)) <= 0)
+    {
+      break;
+    }
+  }
+}
+
+// reply lines that look like what a calibration device sends back
+static void bench_make_data(void)
+{
+static const char * const aszReply[] =
+  {
+    "OK", "ECHO is now OFF", "Fake Device that does not exist",
+    "V=%d.%03d I=%d.%03d T=%d.%d", "CAL %d %d %d %d", "ERROR %d"
+  };
+char tbuf[128];
+unsigned int dwSeed = 12345;
+int i1;
+
+  pBenchLines = malloc(BENCH_BATCH + sizeof(tbuf));
+  pBenchKeys = malloc(BENCH_BATCH);
+
+  if(!pBenchLines || !pBenchKeys)
+  {
+    fprintf(stderr, "sftbench: out of memory\n");
+    exit(2);
+  }
+
+  while(cbBenchLines < BENCH_BATCH - (int)sizeof(tbuf))
+  {
+    dwSeed = dwSeed * 1103515245 + 12345;
+
+    i1 = snprintf(tbuf, sizeof(tbuf), aszReply[(dwSeed >> 16) % 6],
+                  (dwSeed >> 8) & 15, dwSeed & 999, (dwSeed >> 4) & 3, (dwSeed >> 12) & 999,
+                  (dwSeed >> 20) & 63, (dwSeed >> 3) & 9);
+
+    memcpy(pBenchLines + cbBenchLines, tbuf, i1);
+    cbBenchLines += i1;
+    pBenchLines[cbBenchLines++] = '\r';
+    pBenchLines[cbBenchLines++] = '\n';
+    nBenchLines++;
+  }
+
+  // keyboard input - commands typed one line at a time, no ctrl+d or ctrl+z
+  for(i1=0; i1 < BENCH_BATCH; i1++)
+  {
+    pBenchKeys[i1] = pBenchLines[i1] == '\r' ? 'x' : pBenchLines[i1];
+  }
+}
+
+
+// ----------
+// BENCHMARKS
+// ----------
+
+static void bench_my_gets2(BENCH_RESULT *pR, int bEcho)
+{
+int aPipe[2], i1;
+char *p1;
+
+  if(pipe(aPipe))
+  {
+    return;
+  }
+
+#ifdef F_SETPIPE_SZ
+  fcntl(aPipe[1], F_SETPIPE_SZ, BENCH_BATCH * 2); // Linux only, the default is 64k anyway
+#endif // F_SETPIPE_SZ
+
+  do
+  {
+    bench_fill(aPipe[1], pBenchLines, cbBenchLines);
+
+    for(i1=0; i1 < nBenchLines; i1++)
+    {
+      bench_begin();
+
+      if(!bEcho)
+      {
+        MyGetsEchoOff();
+      }
+
+      p1 = my_gets2(aPipe[0], 1000);
+
+      bench_end(pR);
+
+      free(p1);
+    }
+
+    pR->qwBytes += cbBenchLines;
+    pR->ulLines += nBenchLines;
+    pR->ulCalls += nBenchLines;
+  } while(!bench_done(pR));
+
+  close(aPipe[0]);
+  close(aPipe[1]);
+}
+
+static void bench_get_reply(BENCH_RESULT *pR)
+{
+int aPipe[2], i1, i2, cb1, nLines;
+char *p1;
+
+  if(pipe(aPipe))
+  {
+    return;
+  }
+
+#ifdef F_SETPIPE_SZ
+  fcntl(aPipe[1], F_SETPIPE_SZ, BENCH_BATCH * 2);
+#endif // F_SETPIPE_SZ
+
+  do
+  {
+    // replies of about 2k bytes, the total has to stay below MY_GETS_BUFSIZE
+    for(i1=0; i1 < cbBenchLines; i1 += cb1)
+    {
+      for(i2=i1, nLines=0; i2 < cbBenchLines && i2 - i1 < 2048; i2++)
+      {
+        if(pBenchLines[i2] == '\n')
+        {
+          nLines++;
+        }
+      }
+
+      cb1 = i2 - i1;
+
+      bench_fill(aPipe[1], pBenchLines + i1, cb1);
+
+      bench_begin();
+
+      MyGetsEchoOff(); // same as 'question_loop'
+      p1 = get_reply(aPipe[0], 50);
+
+      bench_end(pR);
+
+      free(p1);
+
+      pR->qwBytes += cb1;
+      pR->ulLines += nLines;
+      pR->ulCalls++;
+    }
+  } while(!bench_done(pR));
+
+  close(aPipe[0]);
+  close(aPipe[1]);
+}
+
+static void bench_check(BENCH_RESULT *pR, int bCRC)
+{
+volatile unsigned int dwSink = 0;
+int i1;
+
+  do
+  {
+    bench_begin();
+
+    for(i1=0; i1 + 128 <= cbBenchLines; i1 += 128)
+    {
+      if(bCRC)
+      {
+        dwSink += CalcCRC(pBenchLines + i1, 128);
+      }
+      else
+      {
+        dwSink += CalcCheckSum(pBenchLines + i1, 128);
+      }
+
+      pR->ulCalls++;
+    }
+
+    bench_end(pR);
+
+    pR->qwBytes += i1;
+  } while(!bench_done(pR));
+}
+
+static void bench_debug_dump(BENCH_RESULT *pR)
+{
+int iStdErr, i1;
+
+  fflush(stderr);
+  iStdErr = dup(2);
+  dup2(iBenchNull, 2);
+
+  do
+  {
+    for(i1=0; i1 < cbBenchLines; i1 += 256) // 256 bytes at a time, like a burst of serial data
+    {
+      bench_begin();
+
+      sftardcal_debug_dump_buffer(-1, pBenchLines + i1, cbBenchLines - i1 < 256 ? cbBenchLines - i1 : 256);
+
+      bench_end(pR);
+
+      pR->ulCalls++;
+    }
+
+    pR->qwBytes += cbBenchLines;
+    pR->ulLines += nBenchLines;
+  } while(!bench_done(pR));
+
+  sftardcal_debug_flush(); // the log sink thread writes it, and it has to go to /dev/null too
+  fflush(stderr);
+  dup2(iStdErr, 2);
+  close(iStdErr);
+}
+
+// bRX non-zero for device->console, zero for console->device.  Every byte that
+// 'console_loop' sends to the device is a separate write, and each one takes up
+// a lot more than 1 byte of socket buffer.  So keyboard input goes in a few
+// lines at a time (about what someone would type before the device answers).
+static void bench_console_loop(BENCH_RESULT *pR, int bRX)
+{
+int aDev[2], aCon[2], i1, i2, cb1, nLines;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, aDev))
+  {
+    return;
+  }
+
+  if(pipe(aCon))
+  {
+    close(aDev[0]);
+    close(aDev[1]);
+    return;
+  }
+
+#ifdef F_SETPIPE_SZ
+  fcntl(aCon[1], F_SETPIPE_SZ, BENCH_BATCH * 2);
+#endif // F_SETPIPE_SZ
+
+  iStdOut = iBenchNull;
+  bBenchQuitOnIdle = 1;
+
+  do
+  {
+    for(i1=0; i1 < cbBenchLines; i1 += cb1)
+    {
+      if(bRX)
+      {
+        cb1 = cbBenchLines;
+        nLines = nBenchLines;
+
+        bench_fill(aDev[0], pBenchLines, cb1);
+      }
+      else
+      {
+        for(i2=i1, nLines=0; i2 < cbBenchLines && nLines < 8; i2++)
+        {
+          if(pBenchKeys[i2] == '\n')
+          {
+            nLines++;
+          }
+        }
+
+        cb1 = i2 - i1;
+
+        bench_fill(aCon[1], pBenchKeys + i1, cb1);
+      }
+
+      bQuitFlag = 0;
+
+      bench_begin();
+
+      console_loop(aDev[1], aCon[0]);
+
+      bench_end(pR);
+
+      bench_drain(aDev[0]); // what was sent to the 'device'
+
+      pR->qwBytes += cb1;
+      pR->ulLines += nLines;
+      pR->ulCalls++;
+    }
+  } while(!bench_done(pR));
+
+  bBenchQuitOnIdle = 0;
+  bQuitFlag = 0;
+  iStdOut = 1;
+
+  close(aDev[0]);
+  close(aDev[1]);
+  close(aCon[0]);
+  close(aCon[1]);
+}
+
+
+// ------
+// OUTPUT
+// ------
+
+static void bench_json(FILE *pOut, const char *pszLabel, BENCH_RESULT *pResults, int nResults)
+{
+BENCH_RESULT *pR;
+unsigned long ulSys;
+double dKB;
+int i1;
+
+  fprintf(pOut, "{\n"
+                "  \"benchmark\": \"sftbench\",\n"
+                "  \"label\": \"%s\",\n"
+                "  \"build\": \"%lld\",\n"
+                "  \"compiler\": \"%s\",\n"
+                "  \"syscall_source\": \"%s\",\n"
+                "  \"results\": [\n",
+          pszLabel ? pszLabel : "",
+#ifdef BUILD_DATE_TIME
+          (long long)BUILD_DATE_TIME,
+#else // BUILD_DATE_TIME
+          0LL,
+#endif // BUILD_DATE_TIME
+#ifdef __VERSION__
+          __VERSION__,
+#else // __VERSION__
+          "unknown",
+#endif // __VERSION__
+          bBenchProcIO > 0 ? "proc" : "wrap");
+
+  for(i1=0; i1 < nResults; i1++)
+  {
+    pR = pResults + i1;
+
+    // reads and writes from /proc when possible (includes stdio), plus polls
+    ulSys = pR->sCounts.ulPolls
+          + (bBenchProcIO > 0 ? pR->sCounts.ulSysIO : pR->sCounts.ulReads + pR->sCounts.ulWrites);
+
+    dKB = pR->qwBytes / 1024.0;
+
+    fprintf(pOut, "    { \"name\": \"%s\", \"bytes\": %llu, \"lines\": %lu, \"calls\": %lu, \"seconds\": %.6f,\n"
+                  "      \"ns_per_byte\": %.3f, \"mb_per_sec\": %.2f,",
+            pR->pszName, pR->qwBytes, pR->ulLines, pR->ulCalls, pR->dSeconds,
+            pR->qwBytes ? pR->dSeconds * 1e9 / pR->qwBytes : 0.0,
+            pR->dSeconds > 0.0 ? pR->qwBytes / pR->dSeconds / 1048576.0 : 0.0);
+
+    if(pR->ulLines)
+    {
+      fprintf(pOut, " \"allocs_per_line\": %.3f,", (double)pR->sCounts.ulAllocs / pR->ulLines);
+    }
+    else
+    {
+      fprintf(pOut, " \"allocs_per_line\": null,");
+    }
+
+    fprintf(pOut, " \"syscalls_per_kb\": %.2f,\n"
+                  "      \"allocs\": %lu, \"reads\": %lu, \"writes\": %lu, \"polls\": %lu }%s\n",
+            dKB > 0.0 ? ulSys / dKB : 0.0,
+            pR->sCounts.ulAllocs, pR->sCounts.ulReads, pR->sCounts.ulWrites, pR->sCounts.ulPolls,
+            i1 < nResults - 1 ? "," : "");
+  }
+
+  fprintf(pOut, "  ]\n}\n");
+}
+
+
+static void bench_usage(const char *pApp)
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-t msec][-l label][-o file][name[,name...]]\n"
+          " where\t'name' selects benchmarks (default is all of them):\n"
+          "\t   my_gets2 my_gets2_echo get_reply CalcCRC CalcCheckSum\n"
+          "\t   debug_dump console_loop_rx console_loop_tx\n"
+          " and\t-t is the minimum measured time for each one (default 250)\n"
+          " and\t-l is a label for this build, copied into the JSON\n"
+          " and\t-o writes the JSON to 'file' instead of stdout\n"
+          "\n"
+          "-and-\t-h prints this message\n\n", pApp, pApp);
+}
+
+int main(int argc, char *argv[])
+{
+static const char * const aszNames[] =
+  {
+    "my_gets2", "my_gets2_echo", "get_reply", "CalcCRC", "CalcCheckSum",
+    "debug_dump", "console_loop_rx", "console_loop_tx"
+  };
+#define N_BENCH (sizeof(aszNames) / sizeof(aszNames[0]))
+BENCH_RESULT aResults[N_BENCH];
+const char *pszLabel = NULL, *pszOut = NULL, *pszSelect = NULL;
+struct timeval tv;
+FILE *pOut;
+int i1, nResults;
+
+  while((i1 = getopt(argc, argv, "ht:l:o:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'h':
+        bench_usage(argv[0]);
+        return 0;
+
+      case 't':
+        dwBenchMinMsec = (unsigned int)strtoul(optarg, NULL, 0);
+        break;
+
+      case 'l':
+        pszLabel = optarg;
+        break;
+
+      case 'o':
+        pszOut = optarg;
+        break;
+
+      default:
+        bench_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if(optind < argc)
+  {
+    pszSelect = argv[optind];
+  }
+
+  iBenchNull = open("/dev/null", O_RDWR);
+  if(iBenchNull < 0)
+  {
+    fprintf(stderr, "sftbench: unable to open /dev/null, errno=%d\n", errno);
+    return 2;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  bench_make_data();
+
+  __real_gettimeofday(&tv, NULL);
+  qwBenchClock = (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+  hBenchThread = pthread_self();
+  bBenchVirtualClock = 1;
+
+  iStdOut = iBenchNull; // echo from 'my_gets2' etc.
+  bench_proc_io(); // find out whether /proc/self/io works
+
+  for(i1=0, nResults=0; i1 < (int)N_BENCH; i1++)
+  {
+    if(pszSelect && !strstr(pszSelect, aszNames[i1]))
+    {
+      continue;
+    }
+
+    memset(aResults + nResults, 0, sizeof(aResults[0]));
+    aResults[nResults].pszName = aszNames[i1];
+
+    switch(i1)
+    {
+      case 0: bench_my_gets2(aResults + nResults, 0); break;
+      case 1: bench_my_gets2(aResults + nResults, 1); break;
+      case 2: bench_get_reply(aResults + nResults); break;
+      case 3: bench_check(aResults + nResults, 1); break;
+      case 4: bench_check(aResults + nResults, 0); break;
+      case 5: bench_debug_dump(aResults + nResults); break;
+      case 6: bench_console_loop(aResults + nResults, 1); break;
+      case 7: bench_console_loop(aResults + nResults, 0); break;
+    }
+
+    nResults++;
+  }
+
+  bBenchVirtualClock = 0;
+  iStdOut = 1;
+
+  pOut = pszOut ? fopen(pszOut, "w") : stdout;
+  if(!pOut)
+  {
+    fprintf(stderr, "sftbench: unable to create \"%s\", errno=%d\n", pszOut, errno);
+    return 2;
+  }
+
+  bench_json(pOut, pszLabel, aResults, nResults);
+
+  if(pOut != stdout)
+  {
+    fclose(pOut);
+  }
+
+  return 0;
+}
+
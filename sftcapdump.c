@@ -0,0 +1,236 @@
+// sftcapdump.c - decoder for the capture files written by 'sftardcal -C file[,z]'
+//
+// The serial data is shown in the same hex dump format that sftardcal writes
+// to stderr at '-vvv', each chunk preceded by its timestamp (seconds since the
+// capture started, or the wall clock time with '-t').  Modem line changes and
+// command boundaries are shown between the chunks.
+//
+// '-s' and '-e' limit the output to part of the capture.  The block index at
+// the end of the file is used to go straight to the right block, so this is
+// fast even for a very large capture.  A capture that was not closed properly
+// (no index) is read from the beginning.
+//
+// Builds 'sftardcal.c' into the same translation unit (SFTARDCAL_LIBRARY leaves
+// out its 'main') so that the hex dump is the same code.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#define SFTARDCAL_LIBRARY
+#include "sftardcal.c"
+
+#include <time.h>
+
+
+static CAPTURE_READER sCap;
+static uint64_t qwFrom = 0, qwTo = ~0ULL; // '-s' and '-e', in nsecs
+static int bWallClock = 0;
+
+
+static void capdump_usage(void)
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-i][-t][-s seconds][-e seconds] capture_file\n"
+          " where\t'capture_file' was written by 'sftardcal -C'\n"
+          " and\t-i lists the blocks in the index instead of the data\n"
+          " and\t-t shows the time of day instead of the time since the start\n"
+          " and\t-s starts at this many seconds into the capture (i.e. 12.5)\n"
+          " and\t-e ends at this many seconds into the capture\n"
+          "\n"
+          "-and-\t-h prints this message\n\n", pApp, pApp);
+}
+
+static void capdump_time(uint64_t qwTime)
+{
+time_t tNow;
+uint64_t qw1;
+char tbuf[64];
+
+  if(bWallClock)
+  {
+    qw1 = sCap.sHdr.qwStartRealtime + qwTime;
+    tNow = (time_t)(qw1 / 1000000000ULL);
+
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tNow));
+    printf("[%s.%06u]\n", tbuf, (unsigned int)(qw1 % 1000000000ULL / 1000));
+  }
+  else
+  {
+    printf("[%u.%06u]\n", (unsigned int)(qwTime / 1000000000ULL),
+           (unsigned int)(qwTime % 1000000000ULL / 1000));
+  }
+}
+
+static void capdump_record(const CAPTURE_RECORD *pRec, const unsigned char *pData, uint64_t qwTime)
+{
+uint32_t dw1;
+int i1;
+
+  capdump_time(qwTime);
+
+  switch(pRec->bType)
+  {
+    case CAPTURE_RX:
+      sftardcal_debug_dump_file(stdout, -1, pData, pRec->wLength);
+      break;
+
+    case CAPTURE_TX:
+      sftardcal_debug_dump_file(stdout, 1, pData, pRec->wLength);
+      break;
+
+    case CAPTURE_MODEM:
+      memcpy(&dw1, pData, sizeof(dw1));
+      printf("*** modem lines:  DTR=%d RTS=%d CTS=%d DSR=%d CD=%d RI=%d\n\n",
+             !!(dw1 & TIOCM_DTR), !!(dw1 & TIOCM_RTS), !!(dw1 & TIOCM_CTS),
+             !!(dw1 & TIOCM_DSR), !!(dw1 & TIOCM_CD), !!(dw1 & TIOCM_RI));
+      break;
+
+    case CAPTURE_COMMAND:
+      fputs("*** command:  ", stdout);
+
+      for(i1=0; i1 < pRec->wLength; i1++)
+      {
+        if(pData[i1] >= 32 && pData[i1] < 127)
+        {
+          putchar(pData[i1]);
+        }
+        else
+        {
+          printf("\\x%02x", pData[i1]);
+        }
+      }
+
+      fputs("\n\n", stdout);
+      break;
+
+    case CAPTURE_LOST:
+      memcpy(&dw1, pData, sizeof(dw1));
+      printf("*** %u bytes were not captured\n\n", dw1);
+      break;
+
+    default:
+      printf("*** unknown record type %d, %d bytes\n\n", pRec->bType, pRec->wLength);
+      break;
+  }
+}
+
+static int capdump_data(void)
+{
+CAPTURE_RECORD sRec;
+const unsigned char *pData;
+uint64_t qwTime;
+int i1;
+
+  capture_reader_seek(&sCap, qwFrom);
+
+  while((i1 = capture_reader_next(&sCap, &sRec, &pData, &qwTime)) > 0)
+  {
+    if(qwTime > qwTo)
+    {
+      return 0;
+    }
+
+    if(qwTime >= qwFrom)
+    {
+      capdump_record(&sRec, pData, qwTime);
+    }
+  }
+
+  return i1 < 0 ? 1 : 0;
+}
+
+static int capdump_index(void)
+{
+CAPTURE_BLOCK_HEADER sHdr;
+int i1;
+
+  if(!sCap.nIndex)
+  {
+    fputs("ERROR:  there is no index\n", stderr);
+    return 1;
+  }
+
+  printf("%6s  %16s  %12s  %8s  %8s  %8s\n", "block", "time", "offset", "stored", "data", "records");
+
+  for(i1=0; i1 < sCap.nIndex; i1++)
+  {
+    if(pread(sCap.iFile, &sHdr, sizeof(sHdr), sCap.pIndex[i1].qwOffset) != sizeof(sHdr) ||
+       sHdr.dwMagic != CAPTURE_BLOCK_MAGIC)
+    {
+      fprintf(stderr, "ERROR:  bad block at offset %llu\n", (unsigned long long)sCap.pIndex[i1].qwOffset);
+      return 1;
+    }
+
+    printf("%6d  %9u.%06u  %12llu  %8u  %8u  %8u\n", i1,
+           (unsigned int)(sCap.pIndex[i1].qwTime / 1000000000ULL),
+           (unsigned int)(sCap.pIndex[i1].qwTime % 1000000000ULL / 1000),
+           (unsigned long long)sCap.pIndex[i1].qwOffset,
+           sHdr.cbStored, sHdr.cbData, sHdr.nRecords);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+time_t tStart;
+char tbuf[64];
+int i1, bIndex = 0;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hits:e:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'i':
+        bIndex = 1;
+        break;
+      case 't':
+        bWallClock = 1;
+        break;
+      case 's':
+        qwFrom = (uint64_t)(atof(optarg) * 1e9);
+        break;
+      case 'e':
+        qwTo = (uint64_t)(atof(optarg) * 1e9);
+        break;
+      default:
+        fprintf(stderr, "Illegal or unrecognized option\n");
+      case 'h':
+      case '?':
+        capdump_usage();
+        return 1;
+    }
+  }
+
+  if(optind != argc - 1)
+  {
+    capdump_usage();
+    return 1;
+  }
+
+  if(capture_reader_open(&sCap, argv[optind]))
+  {
+    return 1;
+  }
+
+  tStart = (time_t)(sCap.sHdr.qwStartRealtime / 1000000000ULL);
+  strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tStart));
+
+  printf("capture of %s, started %s%s\n\n", sCap.sHdr.szDevice, tbuf,
+         (sCap.sHdr.dwFlags & CAPTURE_FLAG_DEFLATE) ? " (compressed)" : "");
+
+  i1 = bIndex ? capdump_index() : capdump_data();
+
+  capture_reader_close(&sCap);
+
+  return i1;
+}
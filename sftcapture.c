@@ -0,0 +1,704 @@
+// sftcapture.c - binary session capture for sftardcal ('-C file[,z]')
+//
+// See 'sftcapture.h' for the file format.  Records are added to 'pCaptureFill'
+// while holding 'mtxCapture', which is only held long enough to copy the data.
+// When that buffer is full it becomes 'pCaptureFull' and the writer thread
+// compresses it and writes it out, without the lock.  If the writer thread is
+// still busy with the previous block when the next one fills up, the new data
+// is counted and a CAPTURE_LOST record says how much is missing.
+//
+// The writer thread also samples the modem lines (TIOCMGET) every 100 msecs,
+// and writes a partly filled block once it's a second old so that the file
+// stays current (and a crash loses very little).
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif // WITH_ZLIB
+
+#include "sftcapture.h"
+#include "sftmetrics.h"
+
+
+#define CAPTURE_FLUSH_MSEC 1000  /* a partly filled block is written when it's this old */
+#define CAPTURE_MODEM_MSEC 100   /* modem line sample interval */
+#define CAPTURE_MAX_RECORD 16384 /* larger chunks are split up */
+#define CAPTURE_MAX_DELTA  4000000000ULL /* nsecs, 'dwDelta' in usecs must fit in 32 bits */
+
+typedef struct _CAPTURE_BUFFER_
+{
+  char aData[CAPTURE_BLOCK_SIZE];
+  int cbData;
+  int nRecords;
+  uint64_t qwTime;  // time of the first record
+} CAPTURE_BUFFER;
+
+volatile int bCaptureActive = 0;
+
+static pthread_mutex_t mtxCapture = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condCapture = PTHREAD_COND_INITIALIZER;
+static pthread_t hCaptureThread;
+
+static CAPTURE_BUFFER aCaptureBuf[2];
+static CAPTURE_BUFFER *pCaptureFill = NULL; // records go here
+static CAPTURE_BUFFER *pCaptureFull = NULL; // being written by the thread, or NULL
+static unsigned long ulCaptureLost = 0;     // bytes not recorded yet with CAPTURE_LOST
+static unsigned long ulCaptureLostTotal = 0;
+static unsigned int dwCaptureModem = ~0U;   // last modem line state that was recorded
+static int bCaptureStop = 0;
+
+// these belong to the writer thread once it's running
+static int iCaptureFile = -1, iCaptureSerial = -1, bCaptureDeflate = 0, bCaptureError = 0;
+static uint64_t qwCaptureStart;   // CLOCK_MONOTONIC, nsecs
+static uint64_t qwCaptureOffset;  // where the next block goes
+static CAPTURE_INDEX_ENTRY *pCaptureIndex = NULL;
+static int nCaptureIndex = 0, nCaptureIndexMax = 0;
+static unsigned char *pCaptureZ = NULL; // compressed block
+static unsigned long cbCaptureZ = 0;
+
+
+static uint64_t capture_clock(int iClock)
+{
+struct timespec ts;
+
+  clock_gettime(iClock, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t capture_now(void)
+{
+  return capture_clock(CLOCK_MONOTONIC) - qwCaptureStart;
+}
+
+static int capture_write_all(const void *pBuf, size_t cbBuf)
+{
+const char *p1 = (const char *)pBuf;
+ssize_t i1;
+
+  while(cbBuf > 0)
+  {
+    i1 = write(iCaptureFile, p1, cbBuf);
+
+    if(i1 < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(i1 <= 0)
+    {
+      if(!bCaptureError)
+      {
+        fprintf(stderr, "WARNING - capture file write error, errno=%d (capture stopped)\n", errno);
+        bCaptureError = 1;
+      }
+
+      return -1;
+    }
+
+    p1 += i1;
+    cbBuf -= i1;
+    qwCaptureOffset += i1;
+  }
+
+  return 0;
+}
+
+// writer thread - one block, with an index entry
+static void capture_write_block(CAPTURE_BUFFER *pB)
+{
+CAPTURE_BLOCK_HEADER sHdr;
+CAPTURE_INDEX_ENTRY *pNew;
+const void *pData = pB->aData;
+
+  if(bCaptureError)
+  {
+    return;
+  }
+
+  sHdr.dwMagic = CAPTURE_BLOCK_MAGIC;
+  sHdr.cbData = sHdr.cbStored = pB->cbData;
+  sHdr.nRecords = pB->nRecords;
+  sHdr.qwTime = pB->qwTime;
+
+#ifdef WITH_ZLIB
+  if(bCaptureDeflate)
+  {
+    uLongf cbZ = cbCaptureZ;
+
+    if(compress2(pCaptureZ, &cbZ, (const Bytef *)pB->aData, pB->cbData, Z_BEST_SPEED) == Z_OK)
+    {
+      pData = pCaptureZ;
+      sHdr.cbStored = cbZ;
+    }
+    else // can't happen with a big enough buffer, but the block must still be readable
+    {
+      fputs("WARNING - capture block compression failed\n", stderr);
+      bCaptureError = 1;
+      return;
+    }
+  }
+#endif // WITH_ZLIB
+
+  if(nCaptureIndex >= nCaptureIndexMax)
+  {
+    pNew = realloc(pCaptureIndex, (nCaptureIndexMax + 256) * sizeof(*pCaptureIndex));
+
+    if(pNew) // otherwise the block is written without an index entry
+    {
+      pCaptureIndex = pNew;
+      nCaptureIndexMax += 256;
+    }
+  }
+
+  if(nCaptureIndex < nCaptureIndexMax)
+  {
+    pCaptureIndex[nCaptureIndex].qwOffset = qwCaptureOffset;
+    pCaptureIndex[nCaptureIndex].qwTime = pB->qwTime;
+    nCaptureIndex++;
+  }
+
+  if(!capture_write_all(&sHdr, sizeof(sHdr)))
+  {
+    capture_write_all(pData, sHdr.cbStored);
+  }
+}
+
+// pass 'pCaptureFill' to the writer thread.  'mtxCapture' must be locked, and 'pCaptureFull' must be NULL
+static void capture_swap(void)
+{
+  pCaptureFull = pCaptureFill;
+  pCaptureFill = pCaptureFill == aCaptureBuf ? aCaptureBuf + 1 : aCaptureBuf;
+  pCaptureFill->cbData = pCaptureFill->nRecords = 0;
+
+  pthread_cond_signal(&condCapture);
+}
+
+// 'mtxCapture' must be locked
+static void capture_append(int iType, const void *pBuf, int cbBuf)
+{
+CAPTURE_RECORD sRec;
+CAPTURE_BUFFER *pB = pCaptureFill;
+uint64_t qwNow = capture_now();
+uint32_t dwLost;
+int cbNeed;
+
+  cbNeed = sizeof(sRec) + cbBuf + (ulCaptureLost ? sizeof(sRec) + sizeof(dwLost) : 0);
+
+  if(pB->cbData && (pB->cbData + cbNeed > CAPTURE_BLOCK_SIZE || qwNow - pB->qwTime >= CAPTURE_MAX_DELTA))
+  {
+    if(pCaptureFull) // writer thread is behind, so this one is lost
+    {
+      ulCaptureLost += cbBuf;
+      ulCaptureLostTotal += cbBuf;
+      metrics_add(METRIC_DROPPED_CAPTURE, cbBuf);
+      return;
+    }
+
+    capture_swap();
+    pB = pCaptureFill;
+  }
+
+  if(!pB->cbData)
+  {
+    pB->qwTime = qwNow;
+  }
+
+  sRec.bReserved = 0;
+  sRec.dwDelta = (uint32_t)((qwNow - pB->qwTime) / 1000);
+
+  if(ulCaptureLost)
+  {
+    dwLost = ulCaptureLost > 0xffffffffUL ? 0xffffffffU : (uint32_t)ulCaptureLost;
+
+    sRec.bType = CAPTURE_LOST;
+    sRec.wLength = sizeof(dwLost);
+
+    memcpy(pB->aData + pB->cbData, &sRec, sizeof(sRec));
+    memcpy(pB->aData + pB->cbData + sizeof(sRec), &dwLost, sizeof(dwLost));
+    pB->cbData += sizeof(sRec) + sizeof(dwLost);
+    pB->nRecords++;
+
+    ulCaptureLost = 0;
+  }
+
+  sRec.bType = (uint8_t)iType;
+  sRec.wLength = (uint16_t)cbBuf;
+
+  memcpy(pB->aData + pB->cbData, &sRec, sizeof(sRec));
+  memcpy(pB->aData + pB->cbData + sizeof(sRec), pBuf, cbBuf);
+  pB->cbData += sizeof(sRec) + cbBuf;
+  pB->nRecords++;
+}
+
+static void *capture_thread(void *pParam)
+{
+CAPTURE_BUFFER *pB;
+struct timespec ts;
+int iLines, bStop;
+
+  while(1)
+  {
+    pthread_mutex_lock(&mtxCapture);
+
+    if(!pCaptureFull && !bCaptureStop)
+    {
+      clock_gettime(CLOCK_REALTIME, &ts); // what 'pthread_cond_timedwait' uses
+
+      ts.tv_nsec += CAPTURE_MODEM_MSEC * 1000000L;
+
+      if(ts.tv_nsec >= 1000000000L)
+      {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+
+      pthread_cond_timedwait(&condCapture, &mtxCapture, &ts);
+    }
+
+    if(!pCaptureFull && pCaptureFill->cbData &&
+       (bCaptureStop || capture_now() - pCaptureFill->qwTime >= CAPTURE_FLUSH_MSEC * 1000000ULL))
+    {
+      capture_swap(); // a partial block
+    }
+
+    pB = pCaptureFull;
+    bStop = bCaptureStop;
+
+    pthread_mutex_unlock(&mtxCapture);
+
+    if(pB)
+    {
+      capture_write_block(pB);
+
+      pthread_mutex_lock(&mtxCapture);
+      pCaptureFull = NULL;
+      pthread_mutex_unlock(&mtxCapture);
+
+      continue; // there may be another one
+    }
+
+    if(bStop)
+    {
+      break;
+    }
+
+    if(iCaptureSerial >= 0 && ioctl(iCaptureSerial, TIOCMGET, &iLines) >= 0) // fails on a pty
+    {
+      capture_modem((unsigned int)iLines); // only recorded if it changed
+    }
+  }
+
+  return NULL;
+}
+
+int capture_open(const char *szFile, int bDeflate, const char *szDevice, int iSerial)
+{
+CAPTURE_FILE_HEADER sHdr;
+int i1;
+
+  iCaptureFile = open(szFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if(iCaptureFile < 0)
+  {
+    fprintf(stderr, "Unable to create capture file \"%s\", errno=%d\n", szFile, errno);
+    return -1;
+  }
+
+#ifdef WITH_ZLIB
+  if(bDeflate)
+  {
+    cbCaptureZ = compressBound(CAPTURE_BLOCK_SIZE);
+    pCaptureZ = malloc(cbCaptureZ);
+
+    if(!pCaptureZ)
+    {
+      bDeflate = 0;
+    }
+  }
+#else // WITH_ZLIB
+  if(bDeflate)
+  {
+    fputs("WARNING - built without zlib, the capture file will not be compressed\n", stderr);
+    bDeflate = 0;
+  }
+#endif // WITH_ZLIB
+
+  memset(&sHdr, 0, sizeof(sHdr));
+  memcpy(sHdr.szMagic, CAPTURE_FILE_MAGIC, sizeof(sHdr.szMagic));
+  sHdr.dwFlags = bDeflate ? CAPTURE_FLAG_DEFLATE : 0;
+  sHdr.qwStartRealtime = capture_clock(CLOCK_REALTIME);
+  strncpy(sHdr.szDevice, szDevice ? szDevice : "", sizeof(sHdr.szDevice) - 1);
+
+  qwCaptureStart = capture_clock(CLOCK_MONOTONIC);
+  qwCaptureOffset = 0;
+  bCaptureDeflate = bDeflate;
+  bCaptureError = 0;
+  bCaptureStop = 0;
+  iCaptureSerial = iSerial;
+  dwCaptureModem = ~0U;
+  ulCaptureLost = ulCaptureLostTotal = 0;
+  nCaptureIndex = 0;
+
+  pCaptureFill = aCaptureBuf;
+  pCaptureFull = NULL;
+  pCaptureFill->cbData = pCaptureFill->nRecords = 0;
+
+  if(capture_write_all(&sHdr, sizeof(sHdr)))
+  {
+    goto error_exit;
+  }
+
+  i1 = pthread_create(&hCaptureThread, NULL, capture_thread, NULL);
+
+  if(i1)
+  {
+    fprintf(stderr, "Unable to start the capture thread, error %d\n", i1);
+    goto error_exit;
+  }
+
+  bCaptureActive = 1;
+
+  return 0;
+
+error_exit:
+  close(iCaptureFile);
+  iCaptureFile = -1;
+
+  free(pCaptureZ);
+  pCaptureZ = NULL;
+
+  return -1;
+}
+
+void capture_close(void)
+{
+CAPTURE_TRAILER sTrailer;
+
+  if(iCaptureFile < 0)
+  {
+    return;
+  }
+
+  bCaptureActive = 0;
+
+  pthread_mutex_lock(&mtxCapture);
+  bCaptureStop = 1;
+  pthread_cond_signal(&condCapture);
+  pthread_mutex_unlock(&mtxCapture);
+
+  pthread_join(hCaptureThread, NULL); // writes the last block
+
+  if(ulCaptureLostTotal)
+  {
+    fprintf(stderr, "WARNING - %lu bytes were not captured (capture file writes too slow)\n", ulCaptureLostTotal);
+  }
+
+  sTrailer.qwIndexOffset = qwCaptureOffset;
+  memcpy(sTrailer.szMagic, CAPTURE_TRAILER_MAGIC, sizeof(sTrailer.szMagic));
+
+  if(!capture_write_all(pCaptureIndex, nCaptureIndex * sizeof(*pCaptureIndex)))
+  {
+    capture_write_all(&sTrailer, sizeof(sTrailer));
+  }
+
+  close(iCaptureFile);
+  iCaptureFile = -1;
+
+  free(pCaptureIndex);
+  pCaptureIndex = NULL;
+  nCaptureIndex = nCaptureIndexMax = 0;
+
+  free(pCaptureZ);
+  pCaptureZ = NULL;
+}
+
+void capture_data(int iType, const void *pBuf, int cbBuf)
+{
+const char *p1 = (const char *)pBuf;
+int cb1;
+
+  if(!bCaptureActive)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&mtxCapture);
+
+  while(cbBuf > 0)
+  {
+    cb1 = cbBuf > CAPTURE_MAX_RECORD ? CAPTURE_MAX_RECORD : cbBuf;
+
+    capture_append(iType, p1, cb1);
+
+    p1 += cb1;
+    cbBuf -= cb1;
+  }
+
+  pthread_mutex_unlock(&mtxCapture);
+}
+
+void capture_modem(unsigned int dwLines)
+{
+uint32_t dw1 = dwLines;
+
+  if(!bCaptureActive)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&mtxCapture);
+
+  if(dwLines != dwCaptureModem)
+  {
+    capture_append(CAPTURE_MODEM, &dw1, sizeof(dw1));
+    dwCaptureModem = dwLines;
+  }
+
+  pthread_mutex_unlock(&mtxCapture);
+}
+
+void capture_command(const char *szCommand)
+{
+int cb1 = strlen(szCommand);
+
+  if(!bCaptureActive)
+  {
+    return;
+  }
+
+  if(cb1 > CAPTURE_MAX_RECORD)
+  {
+    cb1 = CAPTURE_MAX_RECORD;
+  }
+
+  pthread_mutex_lock(&mtxCapture);
+  capture_append(CAPTURE_COMMAND, szCommand, cb1);
+  pthread_mutex_unlock(&mtxCapture);
+}
+
+
+
+// -------
+// READING
+// -------
+
+#define CAPTURE_STORED_MAX (CAPTURE_BLOCK_SIZE + CAPTURE_BLOCK_SIZE / 8 + 64) /* compressed can be a little bigger */
+
+// the index and trailer are at the end of the file, if it was closed properly
+static void capture_reader_index(CAPTURE_READER *pR)
+{
+CAPTURE_TRAILER sTrailer;
+off_t cbFile;
+int cbIndex;
+
+  cbFile = lseek(pR->iFile, 0, SEEK_END);
+
+  if(cbFile < (off_t)(sizeof(pR->sHdr) + sizeof(sTrailer)) ||
+     pread(pR->iFile, &sTrailer, sizeof(sTrailer), cbFile - sizeof(sTrailer)) != sizeof(sTrailer) ||
+     memcmp(sTrailer.szMagic, CAPTURE_TRAILER_MAGIC, sizeof(sTrailer.szMagic)) ||
+     sTrailer.qwIndexOffset < sizeof(pR->sHdr) ||
+     sTrailer.qwIndexOffset > (uint64_t)cbFile - sizeof(sTrailer))
+  {
+    fputs("NOTE:  no index (capture was not closed properly?), reading all of it\n", stderr);
+    return;
+  }
+
+  pR->nIndex = (int)((cbFile - sizeof(sTrailer) - sTrailer.qwIndexOffset) / sizeof(*pR->pIndex));
+  cbIndex = pR->nIndex * sizeof(*pR->pIndex);
+  pR->pIndex = malloc(cbIndex + 1);
+
+  if(!pR->pIndex ||
+     pread(pR->iFile, pR->pIndex, cbIndex, sTrailer.qwIndexOffset) != cbIndex)
+  {
+    fputs("NOTE:  unable to read the index, reading all of it\n", stderr);
+
+    free(pR->pIndex);
+    pR->pIndex = NULL;
+    pR->nIndex = 0;
+    return;
+  }
+
+  pR->qwIndexOffset = sTrailer.qwIndexOffset;
+}
+
+int capture_reader_open(CAPTURE_READER *pR, const char *szFile)
+{
+  memset(pR, 0, sizeof(*pR));
+
+  pR->iFile = open(szFile, O_RDONLY);
+
+  if(pR->iFile < 0)
+  {
+    fprintf(stderr, "Unable to open %s, errno=%d\n", szFile, errno);
+    return -1;
+  }
+
+  if(read(pR->iFile, &pR->sHdr, sizeof(pR->sHdr)) != sizeof(pR->sHdr) ||
+     memcmp(pR->sHdr.szMagic, CAPTURE_FILE_MAGIC, sizeof(pR->sHdr.szMagic)))
+  {
+    fprintf(stderr, "%s is not a capture file\n", szFile);
+    capture_reader_close(pR);
+    return -1;
+  }
+
+#ifndef WITH_ZLIB
+  if(pR->sHdr.dwFlags & CAPTURE_FLAG_DEFLATE)
+  {
+    fprintf(stderr, "%s is compressed, and this was built without zlib\n", szFile);
+    capture_reader_close(pR);
+    return -1;
+  }
+#endif // WITH_ZLIB
+
+  pR->sHdr.szDevice[sizeof(pR->sHdr.szDevice) - 1] = 0;
+
+  pR->pStored = malloc(CAPTURE_STORED_MAX);
+  pR->pData = malloc(CAPTURE_BLOCK_SIZE);
+
+  if(!pR->pStored || !pR->pData)
+  {
+    fputs("Not enough memory\n", stderr);
+    capture_reader_close(pR);
+    return -1;
+  }
+
+  capture_reader_index(pR);
+
+  pR->qwNext = sizeof(pR->sHdr);
+
+  return 0;
+}
+
+void capture_reader_close(CAPTURE_READER *pR)
+{
+  if(pR->iFile >= 0)
+  {
+    close(pR->iFile);
+  }
+
+  free(pR->pIndex);
+  free(pR->pStored);
+  free(pR->pData);
+
+  memset(pR, 0, sizeof(*pR));
+  pR->iFile = -1;
+}
+
+void capture_reader_seek(CAPTURE_READER *pR, uint64_t qwTime)
+{
+int i1;
+
+  pR->qwNext = sizeof(pR->sHdr);
+  pR->sBlock.cbData = pR->dwPos = 0;
+
+  for(i1=0; i1 < pR->nIndex && pR->pIndex[i1].qwTime <= qwTime; i1++)
+  {
+    pR->qwNext = pR->pIndex[i1].qwOffset;
+  }
+}
+
+// read the block at 'qwNext' into 'pData'.  returns 1 if there is one, 0 at the end, -1 on error
+static int capture_reader_block(CAPTURE_READER *pR)
+{
+uint64_t qwOffset = pR->qwNext;
+CAPTURE_BLOCK_HEADER *pHdr = &pR->sBlock;
+
+  pR->qwNext = 0;
+  pR->dwPos = 0;
+
+  if(!qwOffset ||
+     (pR->qwIndexOffset && qwOffset >= pR->qwIndexOffset) ||
+     pread(pR->iFile, pHdr, sizeof(*pHdr), qwOffset) != sizeof(*pHdr))
+  {
+    pHdr->cbData = 0;
+    return 0; // the end
+  }
+
+  if(pHdr->dwMagic != CAPTURE_BLOCK_MAGIC ||
+     pHdr->cbStored > CAPTURE_STORED_MAX || pHdr->cbData > CAPTURE_BLOCK_SIZE)
+  {
+    fprintf(stderr, "ERROR:  bad block at offset %llu\n", (unsigned long long)qwOffset);
+    pHdr->cbData = 0;
+    return -1;
+  }
+
+  if(pread(pR->iFile, pR->pStored, pHdr->cbStored, qwOffset + sizeof(*pHdr)) != (ssize_t)pHdr->cbStored)
+  {
+    fprintf(stderr, "NOTE:  last block (offset %llu) is incomplete\n", (unsigned long long)qwOffset);
+    pHdr->cbData = 0;
+    return 0;
+  }
+
+  if(pR->sHdr.dwFlags & CAPTURE_FLAG_DEFLATE)
+  {
+#ifdef WITH_ZLIB
+    uLongf cb1 = CAPTURE_BLOCK_SIZE;
+
+    if(uncompress((Bytef *)pR->pData, &cb1, (const Bytef *)pR->pStored, pHdr->cbStored) != Z_OK ||
+       cb1 != pHdr->cbData)
+    {
+      fprintf(stderr, "ERROR:  unable to decompress block at offset %llu\n", (unsigned long long)qwOffset);
+      pHdr->cbData = 0;
+      return -1;
+    }
+#endif // WITH_ZLIB
+  }
+  else
+  {
+    memcpy(pR->pData, pR->pStored, pHdr->cbData);
+  }
+
+  pR->qwNext = qwOffset + sizeof(*pHdr) + pHdr->cbStored;
+
+  return 1;
+}
+
+int capture_reader_next(CAPTURE_READER *pR, CAPTURE_RECORD *pRec, const unsigned char **ppData, uint64_t *pqwTime)
+{
+int i1;
+
+  while(pR->dwPos + sizeof(*pRec) > pR->sBlock.cbData) // next block (there can be empty ones)
+  {
+    i1 = capture_reader_block(pR);
+
+    if(i1 <= 0)
+    {
+      return i1;
+    }
+  }
+
+  memcpy(pRec, pR->pData + pR->dwPos, sizeof(*pRec));
+
+  if(pR->dwPos + sizeof(*pRec) + pRec->wLength > pR->sBlock.cbData)
+  {
+    fputs("ERROR:  bad record in capture block\n", stderr);
+    return -1;
+  }
+
+  *ppData = pR->pData + pR->dwPos + sizeof(*pRec);
+  *pqwTime = pR->sBlock.qwTime + (uint64_t)pRec->dwDelta * 1000;
+
+  pR->dwPos += sizeof(*pRec) + pRec->wLength;
+
+  return 1;
+}
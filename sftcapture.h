@@ -0,0 +1,132 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftcapture.h - binary session capture for sftardcal ('-C file[,z]')
+//
+// Every chunk of serial data (both directions), every modem line change, and
+// every command boundary is recorded with a monotonic timestamp.  The records
+// are collected in one of two block buffers; a background thread writes the
+// full one (optionally 'deflate' compressed) while the other one fills up, so
+// the serial I/O never waits on the disk.  Use 'sftcapdump' to read the file.
+//
+// FILE FORMAT (values are in the byte order of the machine that wrote it):
+//
+//   CAPTURE_FILE_HEADER
+//   CAPTURE_BLOCK_HEADER + data   (repeated)
+//   CAPTURE_INDEX_ENTRY[n]        (one per block, written on close)
+//   CAPTURE_TRAILER               (last 16 bytes of the file)
+//
+// Each block can be decoded by itself (a compressed block is a complete zlib
+// stream) so the index can be used to seek to a point in time.  If the file
+// was not closed properly there's no index or trailer, but the blocks can
+// still be read in order.
+//
+// Within a block, each record is a CAPTURE_RECORD followed by 'wLength'
+// bytes of data.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTCAPTURE_H_INCLUDED_
+#define _SFTCAPTURE_H_INCLUDED_
+
+#include <stdint.h>
+
+
+#define CAPTURE_FILE_MAGIC    "SFTCAP01"
+#define CAPTURE_BLOCK_MAGIC   0x4b4c4253 /* 'SBLK' */
+#define CAPTURE_TRAILER_MAGIC "SFTCAPIX"
+
+#define CAPTURE_BLOCK_SIZE    65536 /* uncompressed data in one block, maximum */
+
+// record types
+#define CAPTURE_RX      1 /* data from the device */
+#define CAPTURE_TX      2 /* data to the device */
+#define CAPTURE_MODEM   3 /* modem lines, 4 bytes of TIOCM_xxx bits */
+#define CAPTURE_COMMAND 4 /* command boundary, the text of the command */
+#define CAPTURE_LOST    5 /* 4 bytes, the number of bytes that could not be captured */
+
+// flags in CAPTURE_FILE_HEADER
+#define CAPTURE_FLAG_DEFLATE 1 /* blocks are zlib streams */
+
+#pragma pack(push, 1)
+typedef struct _CAPTURE_FILE_HEADER_
+{
+  char szMagic[8];          // CAPTURE_FILE_MAGIC, not terminated
+  uint32_t dwFlags;         // CAPTURE_FLAG_xxx
+  uint32_t dwReserved;
+  uint64_t qwStartRealtime; // wall clock when the capture started, in nsecs since 1970
+  char szDevice[64];        // the serial device, terminated
+} CAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_BLOCK_HEADER_
+{
+  uint32_t dwMagic;   // CAPTURE_BLOCK_MAGIC
+  uint32_t cbStored;  // size of the data that follows
+  uint32_t cbData;    // size of the data once it's decompressed
+  uint32_t nRecords;
+  uint64_t qwTime;    // nsecs since the start of the capture, for 'dwDelta' in each record
+} CAPTURE_BLOCK_HEADER;
+
+typedef struct _CAPTURE_RECORD_
+{
+  uint8_t bType;      // CAPTURE_xxx
+  uint8_t bReserved;
+  uint16_t wLength;   // data that follows
+  uint32_t dwDelta;   // usecs since 'qwTime' in the block header
+} CAPTURE_RECORD;
+
+typedef struct _CAPTURE_INDEX_ENTRY_
+{
+  uint64_t qwOffset;  // file position of the CAPTURE_BLOCK_HEADER
+  uint64_t qwTime;    // same as the block's 'qwTime'
+} CAPTURE_INDEX_ENTRY;
+
+typedef struct _CAPTURE_TRAILER_
+{
+  uint64_t qwIndexOffset; // file position of the first CAPTURE_INDEX_ENTRY
+  char szMagic[8];        // CAPTURE_TRAILER_MAGIC, not terminated
+} CAPTURE_TRAILER;
+#pragma pack(pop)
+
+
+#ifndef WIN32
+
+// non-zero while a capture is running, so the callers can skip the function call
+extern volatile int bCaptureActive;
+
+int capture_open(const char *szFile, int bDeflate, const char *szDevice, int iSerial);
+                                   // starts the writer thread.  'iSerial' is sampled for modem line changes (-1 for none)
+void capture_close(void);          // writes what's left, the index, and the trailer
+
+void capture_data(int iType, const void *pBuf, int cbBuf); // CAPTURE_RX or CAPTURE_TX
+void capture_modem(unsigned int dwLines);                  // TIOCM_xxx bits
+void capture_command(const char *szCommand);               // command boundary
+
+
+// reading a capture file, one record at a time (sftcapdump, sftreplay)
+typedef struct _CAPTURE_READER_
+{
+  int iFile;
+  CAPTURE_FILE_HEADER sHdr;
+  CAPTURE_INDEX_ENTRY *pIndex;  // NULL if the capture was not closed properly
+  int nIndex;
+  uint64_t qwIndexOffset;       // where the blocks end, 0 if there's no index
+  uint64_t qwNext;              // file position of the next block, 0 at the end
+  CAPTURE_BLOCK_HEADER sBlock;  // the current block
+  unsigned int dwPos;           // next record in 'pData'
+  unsigned char *pStored, *pData;
+} CAPTURE_READER;
+
+int capture_reader_open(CAPTURE_READER *pR, const char *szFile); // non-zero on error (message on stderr)
+void capture_reader_close(CAPTURE_READER *pR);
+void capture_reader_seek(CAPTURE_READER *pR, uint64_t qwTime);   // to the last block that starts at or before 'qwTime'
+int capture_reader_next(CAPTURE_READER *pR, CAPTURE_RECORD *pRec, const unsigned char **ppData, uint64_t *pqwTime);
+                                   // 1 for a record, 0 at the end, -1 on error.  '*ppData' is valid until the next call
+
+#endif // WIN32
+
+#endif // _SFTCAPTURE_H_INCLUDED_
@@ -0,0 +1,1507 @@
+// sftemu.c - Scriptable device emulator for the sftardcal command protocol
+//
+// Creates a pseudo-terminal and behaves like the Arduino-based device on the
+// other end of the serial port.  The slave device name is written to stdout;
+// point sftardcal (or anything else) at it instead of /dev/ttyU0 etc.
+//
+// The device's behavior comes from a declarative script (see 'szDefaultScript'
+// below, or run 'sftemu -D' to print it) which gives the replies for each
+// command, the reset banner, echo, line endings, per-command latency, jitter,
+// and a probability of dropped bytes.  With 'xmodem <dir>' in the script (or
+// the '-x' option) the 'XSfile' and 'XRfile' commands run an XMODEM transfer,
+// using xmodem.c the same way sftardcal does, so it can act as the XMODEM peer.
+// With 'frames on', the 'FRAME' command switches to binary frames ('sftardcal
+// -f'), using sftframe.c the same way, and each command gets its reply lines
+// in REPLY frames, then an END frame.  'drop' loses bytes of the frames too.
+// Once the host uses virtual channels ('sftardcal -V', see sftmux.h), typed
+// lines are run from the console channel, 'stream' lines go out on the
+// telemetry channel, and a file that arrives on the file channel is kept in
+// the 'xmodem' directory, all at the same time.
+// With 'rates', the 'BAUDS' and 'BAUD rate' commands change the device's baud
+// rate ('sftardcal -A'), using sftbaud.c the way a device would.  A pty has no
+// baud rate of its own, so the host's setting is compared with the device's:
+// bytes are garbled both ways when they differ, or (with 'cable') when the rate
+// is more than the cable carries.
+//
+// A pty has no DTR line, so a 'reset' is emulated when the slave side is
+// opened.  After the 'reset' delay, the banner lines are sent.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#ifdef __linux__
+#define _GNU_SOURCE /* posix_openpt, grantpt, unlockpt, ptsname */
+#endif // __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+
+// the I/O functions that xmodem.c calls in SFTARDCAL mode (see 'sftardcal.h')
+int my_pollin(int iFile);
+void my_flush(int iFile);
+void MySleep(unsigned int dwMsec);
+void MyGetsEchoOff(void);
+int QuitFlag(void);
+
+#define SFTARDCAL
+#include "xmodem.c"
+#include "sftframe.c"
+#include "sftmux.c"
+#include "sftbaud.c"
+
+
+#define MAX_LINE 512
+#define MAX_REPLY_LINES 16
+
+// one 'cmd' entry from the script
+typedef struct _EMU_CMD_
+{
+  struct _EMU_CMD_ *pNext;
+  char *pszCommand;        // exact match, or prefix match if it ends in '*'
+  int cbPrefix;            // length before the '*', or -1 for exact match
+  int iDelay;              // reply latency in msec, -1 for the script's default
+  int iEcho;               // -1 leaves echo alone, 0 turns it off, 1 turns it on
+  int bReset;              // non-zero to 'reset' (send the banner again) after the reply
+  int nReply;
+  char *apszReply[MAX_REPLY_LINES];
+} EMU_CMD;
+
+// settings from the script
+typedef struct _EMU_SCRIPT_
+{
+  int nBanner;
+  char *apszBanner[MAX_REPLY_LINES];
+  int iResetDelay;         // msec between 'open' and the banner
+  int bEcho;               // initial echo state
+  const char *pszEOL;      // reply line ending
+  int iLatency;            // default reply latency, msec
+  int iJitter;             // +/- random msec added to the latency
+  double dDrop;            // probability that a reply byte is lost
+  unsigned long ulBaud;    // output pacing, 0 for none
+  char *pszXModemDir;      // NULL to disable 'XS' and 'XR'
+  int bFrames;             // the 'FRAME' command switches to binary frames
+  int iStreamPeriod;       // msec between 'stream' lines, 0 for none
+  int nRates;              // 'BAUD' and 'BAUDS' with any
+  uint32_t adwRates[BAUD_MAX_RATES];
+  unsigned long ulCable;   // the highest rate the cable carries, 0 for any
+  double dCableNoise;      // chance of a garbled byte above it
+  char *pszStream;         // a telemetry line, '%s' is the sample number
+  char *pszDefault;        // reply to unknown commands, NULL for none
+  EMU_CMD *pCmds;
+  EMU_CMD *pLastCmd;
+} EMU_SCRIPT;
+
+
+static const char szDefaultScript[] =
+  "# sftemu default script - emulates the device 'calibrate_loop()' expects\n"
+  "#\n"
+  "# banner  <text>         line sent when the port is opened (a 'reset'), may repeat\n"
+  "# reset   <msec>         delay between the 'reset' and the banner\n"
+  "# echo    on|off         echo received characters back (initial state)\n"
+  "# eol     crlf|cr|lf     line ending for replies\n"
+  "# latency <msec>         delay before each reply\n"
+  "# jitter  <msec>         random +/- added to each delay\n"
+  "# drop    <probability>  chance that each reply byte is lost, i.e. 0.001\n"
+  "# baud    <rate>         pace the output as if it were a real serial line\n"
+  "#                        (and the rate it starts at, with 'rates')\n"
+  "# rates   <rate> ...     'BAUD rate' changes to these (see sftbaud.h), the\n"
+  "#                        first is the rate it starts at without 'baud'\n"
+  "# cable   <rate> [prob]  above 'rate', each byte is garbled with 'prob'\n"
+  "#                        (default 0.02), both ways\n"
+  "# xmodem  <directory>    enable 'XSfile' and 'XRfile', files are kept here\n"
+  "# frames  on|off         'FRAME' switches to binary frames (see sftframe.h)\n"
+  "# stream  <msec> <line>  sends 'line' on the telemetry channel every 'msec'\n"
+  "#                        with virtual channels (see sftmux.h), '%s' is the\n"
+  "#                        sample number\n"
+  "# default <reply>        reply to commands that don't match any 'cmd'\n"
+  "# cmd     <command> = <reply>\n"
+  "#         a '*' at the end of <command> matches any remainder, which\n"
+  "#         replaces '%s' in the reply.  Indented lines after a 'cmd' modify it:\n"
+  "#   reply <text>         additional reply line\n"
+  "#   delay <msec>         latency for this command only\n"
+  "#   echo  on|off         change the echo state\n"
+  "#   reset                send the banner again after replying\n"
+  "\n"
+  "banner Fake Device that does not exist\n"
+  "banner Ready\n"
+  "echo on\n"
+  "eol crlf\n"
+  "latency 5\n"
+  "frames on\n"
+  "\n"
+  "cmd I = Fake Device that does not exist\n"
+  "cmd E 0 = ECHO is now OFF\n"
+  "  echo off\n"
+  "cmd E 1 = ECHO is now ON\n"
+  "  echo on\n"
+  "cmd C * = OK\n"
+  "  reply calibration step %s complete\n"
+  "cmd R = OK\n"
+  "  reset\n"
+  "default ERROR\n";
+
+
+static volatile int bQuitFlag = 0;
+static int iVerbosity = 0;
+static int bEcho = 1;
+static const char *pApp;
+static char *pszLinkName = NULL;
+static char *pszSlaveName = NULL;
+static EMU_SCRIPT sScript;
+static int bFramed = 0;          // after 'FRAME', until a TEXT frame or a reset
+static uint8_t bFrameSeq;        // the command's, for its reply frames
+static FRAME_READER sFrames;
+static int bMux = 0;             // the host uses virtual channels, until a TEXT frame or a reset
+static int iMuxReply = -1;       // replies go to this channel, not frames or lines
+static MUX sMux;
+static int iMuxPty;
+static BAUD_DEVICE sBaud;
+static FRAME_READER sProbe;      // while a new baud rate is tried
+static char szMuxLine[MAX_LINE];  // the console channel's
+static int cbMuxLine;
+static int iMuxFile = -1;
+static const char *pszMuxFileError; // why the file channel's file isn't written, NULL while it is
+static char szMuxPath[1024];
+static int cbMuxPath;            // while the name is arriving
+static unsigned long ulMuxFileBytes, ulMuxSample;
+static unsigned long long qwMuxSample, qwMuxRefresh;
+
+
+
+// ----------------------------------------------------------
+// functions that xmodem.c needs, same behavior as sftardcal.c
+// ----------------------------------------------------------
+
+int QuitFlag(void)
+{
+  return bQuitFlag;
+}
+
+void MyGetsEchoOff(void)
+{
+  // nothing is echoed here anyway
+}
+
+void MySleep(unsigned int dwMsec)
+{
+  usleep(dwMsec * 1000);
+}
+
+int my_pollin(int iFile)
+{
+struct pollfd sFD;
+int i1;
+
+  sFD.fd = iFile;
+  sFD.events = POLLIN | POLLERR;
+  sFD.revents = 0;
+
+  i1 = poll(&sFD, 1, 100);
+
+  if(i1 < 0 || (sFD.revents & POLLERR))
+  {
+    return -1;
+  }
+
+  return i1 > 0 && (sFD.revents & POLLIN) ? 1 : 0;
+}
+
+int my_poll_handle(int iFile)
+{
+  return iFile; // no serial input ring here
+}
+
+void my_flush(int iFile)
+{
+char buf[256];
+
+  while(my_pollin(iFile) > 0) // until 100 msec of silence
+  {
+    if(read(iFile, buf, sizeof(buf)) <= 0)
+    {
+      break;
+    }
+  }
+}
+
+int my_write(int iFile, const void *pBuf, int cbBuf)
+{
+  return write(iFile, pBuf, cbBuf);
+}
+
+int my_read(int iFile, void *pBuf, int cbBuf)
+{
+  return read(iFile, pBuf, cbBuf);
+}
+
+
+
+// ---------------
+// SCRIPT HANDLING
+// ---------------
+
+static char *ScriptTrim(char *pszLine)
+{
+char *p1;
+
+  while(*pszLine == ' ' || *pszLine == '\t')
+  {
+    pszLine++;
+  }
+
+  p1 = pszLine + strlen(pszLine);
+
+  while(p1 > pszLine && (p1[-1] <= ' '))
+  {
+    *(--p1) = 0;
+  }
+
+  return pszLine;
+}
+
+static int ScriptOnOff(const char *pszVal)
+{
+  return !strcmp(pszVal, "on") || !strcmp(pszVal, "1") || !strcmp(pszVal, "yes");
+}
+
+// parse one line of the script, returns non-zero on error
+static int ScriptLine(EMU_SCRIPT *pS, char *pszLine)
+{
+char *pKey, *pVal, *p1;
+EMU_CMD *pC;
+int bIndent;
+
+  bIndent = *pszLine == ' ' || *pszLine == '\t';
+
+  p1 = strchr(pszLine, '#');
+  if(p1 && (p1 == pszLine || p1[-1] == ' ' || p1[-1] == '\t')) // '#' inside a reply is allowed
+  {
+    *p1 = 0;
+  }
+
+  pKey = ScriptTrim(pszLine);
+  if(!*pKey)
+  {
+    return 0; // blank line
+  }
+
+  for(pVal = pKey; *pVal && *pVal != ' ' && *pVal != '\t'; pVal++)
+  { } // find end of keyword
+
+  if(*pVal)
+  {
+    *(pVal++) = 0;
+    pVal = ScriptTrim(pVal);
+  }
+
+  if(bIndent) // modifies the previous 'cmd'
+  {
+    pC = pS->pLastCmd;
+
+    if(!pC)
+    {
+      return 1;
+    }
+
+    if(!strcmp(pKey, "reply") && pC->nReply < MAX_REPLY_LINES)
+    {
+      pC->apszReply[pC->nReply++] = strdup(pVal);
+    }
+    else if(!strcmp(pKey, "delay"))
+    {
+      pC->iDelay = atoi(pVal);
+    }
+    else if(!strcmp(pKey, "echo"))
+    {
+      pC->iEcho = ScriptOnOff(pVal);
+    }
+    else if(!strcmp(pKey, "reset"))
+    {
+      pC->bReset = 1;
+    }
+    else
+    {
+      return 1;
+    }
+
+    return 0;
+  }
+
+  if(!strcmp(pKey, "banner") && pS->nBanner < MAX_REPLY_LINES)
+  {
+    pS->apszBanner[pS->nBanner++] = strdup(pVal);
+  }
+  else if(!strcmp(pKey, "reset"))
+  {
+    pS->iResetDelay = atoi(pVal);
+  }
+  else if(!strcmp(pKey, "echo"))
+  {
+    pS->bEcho = ScriptOnOff(pVal);
+  }
+  else if(!strcmp(pKey, "eol"))
+  {
+    pS->pszEOL = !strcmp(pVal, "cr") ? "\r" : !strcmp(pVal, "lf") ? "\n" : "\r\n";
+  }
+  else if(!strcmp(pKey, "latency"))
+  {
+    pS->iLatency = atoi(pVal);
+  }
+  else if(!strcmp(pKey, "jitter"))
+  {
+    pS->iJitter = atoi(pVal);
+  }
+  else if(!strcmp(pKey, "drop"))
+  {
+    pS->dDrop = atof(pVal);
+  }
+  else if(!strcmp(pKey, "baud"))
+  {
+    pS->ulBaud = strtoul(pVal, NULL, 0);
+  }
+  else if(!strcmp(pKey, "frames"))
+  {
+    pS->bFrames = ScriptOnOff(pVal);
+  }
+  else if(!strcmp(pKey, "rates"))
+  {
+    for(p1=pVal; *p1 && pS->nRates < BAUD_MAX_RATES; )
+    {
+      pS->adwRates[pS->nRates] = strtoul(p1, &p1, 10);
+
+      if(!pS->adwRates[pS->nRates++])
+      {
+        return 1;
+      }
+
+      p1 = ScriptTrim(p1);
+    }
+  }
+  else if(!strcmp(pKey, "cable"))
+  {
+    pS->ulCable = strtoul(pVal, &p1, 10);
+    pS->dCableNoise = *ScriptTrim(p1) ? atof(p1) : 0.02;
+  }
+  else if(!strcmp(pKey, "stream"))
+  {
+    pS->iStreamPeriod = (int)strtol(pVal, &p1, 10);
+    pS->pszStream = strdup(ScriptTrim(p1));
+
+    if(pS->iStreamPeriod <= 0 || !*(pS->pszStream))
+    {
+      return 1;
+    }
+  }
+  else if(!strcmp(pKey, "xmodem"))
+  {
+    pS->pszXModemDir = strdup(pVal);
+  }
+  else if(!strcmp(pKey, "default"))
+  {
+    pS->pszDefault = strdup(pVal);
+  }
+  else if(!strcmp(pKey, "cmd"))
+  {
+    p1 = strstr(pVal, " = ");
+    if(!p1)
+    {
+      return 1;
+    }
+
+    *p1 = 0;
+    p1 += 3;
+
+    pC = (EMU_CMD *)calloc(1, sizeof(*pC));
+    if(!pC)
+    {
+      return 1;
+    }
+
+    pC->pszCommand = strdup(ScriptTrim(pVal));
+    pC->cbPrefix = -1;
+    pC->iDelay = -1;
+    pC->iEcho = -1;
+
+    if(*(pC->pszCommand) && pC->pszCommand[strlen(pC->pszCommand) - 1] == '*')
+    {
+      pC->cbPrefix = strlen(pC->pszCommand) - 1;
+    }
+
+    pC->apszReply[pC->nReply++] = strdup(ScriptTrim(p1));
+
+    if(pS->pLastCmd)
+    {
+      pS->pLastCmd->pNext = pC;
+    }
+    else
+    {
+      pS->pCmds = pC;
+    }
+
+    pS->pLastCmd = pC;
+  }
+  else
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int ScriptLoad(EMU_SCRIPT *pS, const char *pszFile)
+{
+char tbuf[MAX_LINE];
+const char *p1, *p2;
+FILE *pF;
+int iLine, iRval = 0;
+
+  memset(pS, 0, sizeof(*pS));
+  pS->bEcho = 1;
+  pS->pszEOL = "\r\n";
+
+  if(!pszFile) // use the built-in script
+  {
+    for(p1 = szDefaultScript, iLine = 1; *p1; p1 = p2, iLine++)
+    {
+      p2 = strchr(p1, '\n');
+      if(!p2)
+      {
+        p2 = p1 + strlen(p1);
+      }
+
+      memcpy(tbuf, p1, p2 - p1);
+      tbuf[p2 - p1] = 0;
+
+      if(*p2)
+      {
+        p2++;
+      }
+
+      if(ScriptLine(pS, tbuf))
+      {
+        fprintf(stderr, "%s: error in built-in script, line %d\n", pApp, iLine);
+        iRval = 1;
+      }
+    }
+
+    return iRval;
+  }
+
+  pF = fopen(pszFile, "r");
+  if(!pF)
+  {
+    fprintf(stderr, "%s: unable to open script \"%s\", errno=%d\n", pApp, pszFile, errno);
+    return 1;
+  }
+
+  for(iLine = 1; fgets(tbuf, sizeof(tbuf), pF); iLine++)
+  {
+    if(ScriptLine(pS, tbuf))
+    {
+      fprintf(stderr, "%s: error in \"%s\", line %d\n", pApp, pszFile, iLine);
+      iRval = 1;
+    }
+  }
+
+  fclose(pF);
+
+  return iRval;
+}
+
+
+
+// -----------
+// DEVICE SIDE
+// -----------
+
+static void signalproc(int iSig)
+{
+  bQuitFlag = 1;
+}
+
+// the host's baud rate, from the pty's settings (which are the slave side's)
+static unsigned long EmuHostRate(int iPty)
+{
+static const struct { speed_t sSpeed; unsigned long ulRate; } aRates[] =
+{
+  { B1200, 1200 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+  { B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 }, { B230400, 230400 },
+#ifdef B460800
+  { B460800, 460800 }, { B500000, 500000 }, { B921600, 921600 }, { B1000000, 1000000 },
+  { B1500000, 1500000 }, { B2000000, 2000000 },
+#endif // B460800
+};
+struct termios sIOS;
+speed_t sSpeed;
+unsigned int i1;
+
+  if(tcgetattr(iPty, &sIOS))
+  {
+    return 0;
+  }
+
+  sSpeed = cfgetospeed(&sIOS);
+
+  for(i1=0; i1 < sizeof(aRates) / sizeof(aRates[0]); i1++)
+  {
+    if(aRates[i1].sSpeed == sSpeed)
+    {
+      return aRates[i1].ulRate;
+    }
+  }
+
+  return (unsigned long)sSpeed; // BSD's are the rate itself
+}
+
+// the chance that a byte is garbled on the way, either way
+static double EmuCableNoise(int iPty)
+{
+unsigned long ulHost;
+
+  if(!sScript.nRates)
+  {
+    return 0.0;
+  }
+
+  ulHost = EmuHostRate(iPty);
+
+  if(ulHost != sBaud.dwRate) // the two ends don't agree
+  {
+    return 1.0;
+  }
+
+  return sScript.ulCable && ulHost > sScript.ulCable ? sScript.dCableNoise : 0.0;
+}
+
+static void EmuGarble(char *pBuf, int cbBuf, double dNoise)
+{
+int i1;
+
+  for(i1=0; dNoise > 0.0 && i1 < cbBuf; i1++)
+  {
+    if(dNoise >= 1.0 || drand48() < dNoise)
+    {
+      pBuf[i1] ^= (char)(1 + (int)(drand48() * 255)); // never 0, so it's always different
+    }
+  }
+}
+
+// write with the script's dropped bytes, the cable, and baud rate pacing
+static void EmuWrite(int iPty, const char *pBuf, int cbBuf, int bDrop)
+{
+char tbuf[MAX_LINE * 2];
+int i1, cb1;
+
+  for(i1=0, cb1=0; i1 < cbBuf && cb1 < (int)sizeof(tbuf); i1++)
+  {
+    if(bDrop && sScript.dDrop > 0.0 && drand48() < sScript.dDrop)
+    {
+      if(iVerbosity > 1)
+      {
+        fprintf(stderr, "%s: dropped 0x%02x\n", pApp, (unsigned char)pBuf[i1]);
+      }
+
+      continue;
+    }
+
+    tbuf[cb1++] = pBuf[i1];
+  }
+
+  EmuGarble(tbuf, cb1, EmuCableNoise(iPty));
+
+  if(cb1 > 0 && write(iPty, tbuf, cb1) != cb1)
+  {
+    if(iVerbosity > 0)
+    {
+      fprintf(stderr, "%s: write error %d\n", pApp, errno);
+    }
+  }
+
+  if(sScript.ulBaud) // 10 bits per byte, like 8,n,1
+  {
+    usleep((useconds_t)((unsigned long long)cb1 * 10000000ULL / (sScript.nRates ? sBaud.dwRate : sScript.ulBaud)));
+  }
+}
+
+static void EmuFrame(int iPty, uint8_t bType, const void *pData, int cbData)
+{
+uint8_t aBuf[FRAME_ENCODED_MAX(FRAME_MAX_DATA)];
+
+  EmuWrite(iPty, (const char *)aBuf, frame_encode(aBuf, sizeof(aBuf), bType, bFrameSeq, pData, cbData), 1);
+}
+
+static void EmuWriteLine(int iPty, const char *pszLine)
+{
+char tbuf[FRAME_MAX_DATA];
+
+  if(iMuxReply >= 0) // on its channel, the way it would look on a text line
+  {
+    mux_write(&sMux, iMuxReply, pszLine, strlen(pszLine));
+    mux_write(&sMux, iMuxReply, sScript.pszEOL, strlen(sScript.pszEOL));
+    return;
+  }
+
+  if(bFramed) // the line ending is part of the reply, as it would be on a text line
+  {
+    snprintf(tbuf, sizeof(tbuf), "%s%s", pszLine, sScript.pszEOL);
+    EmuFrame(iPty, FRAME_TYPE_REPLY, tbuf, strlen(tbuf));
+    return;
+  }
+
+  EmuWrite(iPty, pszLine, strlen(pszLine), 1);
+  EmuWrite(iPty, sScript.pszEOL, strlen(sScript.pszEOL), 1);
+}
+
+static void EmuDelay(int iDelay)
+{
+  if(sScript.iJitter > 0)
+  {
+    iDelay += (int)(drand48() * (2 * sScript.iJitter + 1)) - sScript.iJitter;
+  }
+
+  if(iDelay > 0)
+  {
+    usleep(iDelay * 1000);
+  }
+}
+
+static void EmuMuxStop(void);
+
+static void EmuReset(int iPty)
+{
+int i1;
+
+  bEcho = sScript.bEcho;
+  bFramed = 0;
+
+  EmuMuxStop();
+
+  if(sScript.nRates)
+  {
+    baud_device_init(&sBaud, sScript.adwRates, sScript.nRates, sScript.ulBaud ? sScript.ulBaud : sScript.adwRates[0]);
+  }
+
+  if(sScript.iResetDelay > 0)
+  {
+    usleep(sScript.iResetDelay * 1000);
+
+    tcflush(iPty, TCIFLUSH); // a real device would not see anything sent during its reset
+  }
+
+  for(i1=0; i1 < sScript.nBanner; i1++)
+  {
+    EmuWriteLine(iPty, sScript.apszBanner[i1]);
+  }
+}
+
+static void xmodem_progress(XMODEM *pX, long block, long filepos, long filesize, int ecount, long etotal)
+{
+  if(iVerbosity > 1)
+  {
+    fprintf(stderr, "block %ld  %ld bytes  %d errors\r", block, filepos, ecount);
+  }
+}
+
+// 'XSfile' means the host sends, so I receive - and the reverse for 'XRfile'
+static void EmuXModem(int iPty, const char *pszLine)
+{
+char szPath[1024];
+const char *p1;
+XMODEM xx;
+int iRval;
+
+  p1 = strrchr(pszLine + 2, '/'); // never outside of the 'xmodem' directory
+  p1 = p1 ? p1 + 1 : pszLine + 2;
+
+  snprintf(szPath, sizeof(szPath), "%s/%s", sScript.pszXModemDir, p1);
+
+  memset(&xx, 0, sizeof(xx));
+  xx.ser = iPty;
+  xx.pProgress = xmodem_progress;
+
+  if(pszLine[1] == 'S')
+  {
+    unlink(szPath);
+    xx.file = open(szPath, O_CREAT | O_TRUNC | O_WRONLY, 0664);
+  }
+  else
+  {
+    xx.file = open(szPath, O_RDONLY, 0);
+  }
+
+  if(xx.file == -1)
+  {
+    fprintf(stderr, "%s: unable to open \"%s\", errno=%d\n", pApp, szPath, errno);
+    WriteXmodemChar(iPty, _CAN_);
+    return;
+  }
+
+  if(iVerbosity > 0)
+  {
+    fprintf(stderr, "%s: XMODEM %s \"%s\"\n", pApp, pszLine[1] == 'S' ? "receive" : "send", szPath);
+  }
+
+  iRval = pszLine[1] == 'S' ? XReceiveSub(&xx) : XSendSub(&xx);
+
+  close(xx.file);
+
+  my_flush(iPty); // extra 'C' or NAK polls that were queued up before the first block
+
+  if(iRval && pszLine[1] == 'S')
+  {
+    unlink(szPath); // delete file on error, same as 'XReceive'
+  }
+
+  if(iVerbosity > 0)
+  {
+    fprintf(stderr, "\n%s: XMODEM %s\n", pApp, iRval ? "FAILED" : "complete");
+  }
+}
+
+static void EmuMuxData(void *pCtx, int iChannel, const uint8_t *pData, int cbData, int bEnd);
+
+static unsigned long long EmuMsec(void)
+{
+struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (unsigned long long)tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
+static void EmuCommand(int iPty, const char *pszLine)
+{
+char tbuf[MAX_LINE * 2];
+const char *pszArg;
+EMU_CMD *pC;
+int i1;
+
+  if(iVerbosity > 0)
+  {
+    fprintf(stderr, "%s: command \"%s\"\n", pApp, pszLine);
+  }
+
+  if(sScript.bFrames && !bFramed && !strcmp(pszLine, FRAME_HELLO_COMMAND))
+  {
+    tbuf[0] = FRAME_VERSION;
+    tbuf[1] = (char)(FRAME_MAX_DATA >> 8);
+    tbuf[2] = (char)FRAME_MAX_DATA;
+    tbuf[3] = FRAME_HELLO_CHANNELS;
+
+    bFrameSeq = 0;
+    EmuFrame(iPty, FRAME_TYPE_HELLO, tbuf, 4);
+
+    bFramed = 1;
+    frame_reader_init(&sFrames);
+
+    // ready for channels, but quiet until the host uses them
+    mux_init(&sMux, EmuMuxData, NULL);
+    mux_window(&sMux, MUX_CHANNEL_FILE, 4); // as if the RAM were short
+    mux_refresh(&sMux);
+
+    iMuxPty = iPty;
+    cbMuxLine = cbMuxPath = 0;
+    pszMuxFileError = NULL;
+    ulMuxFileBytes = ulMuxSample = 0;
+    qwMuxSample = qwMuxRefresh = EmuMsec();
+    return;
+  }
+
+  if(sScript.nRates && baud_device_command(&sBaud, pszLine, tbuf, sizeof(tbuf))) // it switches after the reply
+  {
+    EmuDelay(sScript.iLatency);
+    EmuWriteLine(iPty, tbuf);
+    return;
+  }
+
+  if(!bFramed && sScript.pszXModemDir && pszLine[0] == 'X' && (pszLine[1] == 'S' || pszLine[1] == 'R') && pszLine[2])
+  {
+    EmuXModem(iPty, pszLine);
+    return;
+  }
+
+  pszArg = "";
+
+  for(pC = sScript.pCmds; pC; pC = pC->pNext)
+  {
+    if(pC->cbPrefix < 0 ? !strcmp(pC->pszCommand, pszLine)
+                        : !strncmp(pC->pszCommand, pszLine, pC->cbPrefix))
+    {
+      if(pC->cbPrefix >= 0)
+      {
+        pszArg = pszLine + pC->cbPrefix;
+      }
+
+      break;
+    }
+  }
+
+  EmuDelay(pC && pC->iDelay >= 0 ? pC->iDelay : sScript.iLatency);
+
+  if(!pC)
+  {
+    if(sScript.pszDefault)
+    {
+      EmuWriteLine(iPty, sScript.pszDefault);
+    }
+
+    return;
+  }
+
+  for(i1=0; i1 < pC->nReply; i1++)
+  {
+    snprintf(tbuf, sizeof(tbuf), pC->apszReply[i1], pszArg, pszArg, pszArg); // '%s' is the wildcard part
+    EmuWriteLine(iPty, tbuf);
+  }
+
+  if(pC->iEcho >= 0)
+  {
+    bEcho = pC->iEcho;
+  }
+
+  if(pC->bReset)
+  {
+    EmuReset(iPty);
+  }
+}
+
+// virtual channels ('sftardcal -V', see sftmux.h).  Whatever the channels have for the host,
+// as far as its credit goes
+static void EmuMuxFlush(int iPty)
+{
+uint8_t aBuf[FRAME_ENCODED_MAX(FRAME_MAX_DATA)];
+int cb1;
+
+  while((cb1 = mux_output(&sMux, aBuf, sizeof(aBuf))) > 0)
+  {
+    EmuWrite(iPty, (const char *)aBuf, cb1, 1);
+  }
+}
+
+// the end of the session (a TEXT frame, or a reset).  A file that didn't finish is thrown away
+static void EmuMuxStop(void)
+{
+  if(iMuxFile != -1)
+  {
+    close(iMuxFile);
+    unlink(szMuxPath);
+    iMuxFile = -1;
+
+    if(iVerbosity > 0)
+    {
+      fprintf(stderr, "%s: \"%s\" was not finished\n", pApp, szMuxPath);
+    }
+  }
+
+  bMux = 0;
+}
+
+// the file channel:  the name and '\n', then the file.  The answer is one line, after the end
+static void EmuMuxFile(const uint8_t *pData, int cbData, int bEnd)
+{
+char tbuf[sizeof(szMuxPath)];
+const char *p1;
+int i1;
+
+  for(i1=0; iMuxFile == -1 && !pszMuxFileError && i1 < cbData; i1++)
+  {
+    if(pData[i1] != '\n')
+    {
+      if(cbMuxPath < (int)sizeof(szMuxPath) - 1)
+      {
+        szMuxPath[cbMuxPath++] = pData[i1];
+      }
+      else // a shorter one would be some other file
+      {
+        pszMuxFileError = "the file name is too long";
+      }
+
+      continue;
+    }
+
+    szMuxPath[cbMuxPath] = 0;
+
+    p1 = strrchr(szMuxPath, '/'); // never outside of the 'xmodem' directory
+    p1 = p1 ? p1 + 1 : szMuxPath;
+
+    strcpy(tbuf, p1); // the same size
+
+    if(!sScript.pszXModemDir)
+    {
+      pszMuxFileError = "no 'xmodem' directory";
+      break;
+    }
+
+    if(!*tbuf)
+    {
+      pszMuxFileError = "no file name";
+      break;
+    }
+
+    if(snprintf(szMuxPath, sizeof(szMuxPath), "%s/%s", sScript.pszXModemDir, tbuf) >= (int)sizeof(szMuxPath))
+    {
+      pszMuxFileError = "the file name is too long";
+      break;
+    }
+
+    unlink(szMuxPath);
+    iMuxFile = open(szMuxPath, O_CREAT | O_TRUNC | O_WRONLY, 0664);
+
+    if(iMuxFile == -1)
+    {
+      fprintf(stderr, "%s: unable to open \"%s\", errno=%d\n", pApp, szMuxPath, errno);
+      pszMuxFileError = "unable to write the file";
+      break;
+    }
+
+    if(iVerbosity > 0)
+    {
+      fprintf(stderr, "%s: receiving \"%s\" on the file channel\n", pApp, szMuxPath);
+    }
+  }
+
+  if(iMuxFile != -1 && i1 < cbData)
+  {
+    if(write(iMuxFile, pData + i1, cbData - i1) != cbData - i1)
+    {
+      fprintf(stderr, "%s: write error %d\n", pApp, errno);
+
+      close(iMuxFile);
+      unlink(szMuxPath);
+      iMuxFile = -1;
+      pszMuxFileError = "unable to write the file";
+    }
+    else
+    {
+      ulMuxFileBytes += cbData - i1;
+    }
+  }
+
+  if(!bEnd)
+  {
+    return;
+  }
+
+  if(iMuxFile != -1)
+  {
+    close(iMuxFile);
+    iMuxFile = -1;
+
+    if(sMux.aCh[MUX_CHANNEL_FILE].dwLost) // no way to get them back
+    {
+      unlink(szMuxPath);
+      snprintf(tbuf, sizeof(tbuf), "ERROR %lu frames were lost", (unsigned long)sMux.aCh[MUX_CHANNEL_FILE].dwLost);
+    }
+    else
+    {
+      snprintf(tbuf, sizeof(tbuf), "OK %lu", ulMuxFileBytes);
+    }
+  }
+  else
+  {
+    snprintf(tbuf, sizeof(tbuf), "ERROR %s", pszMuxFileError ? pszMuxFileError :
+             sScript.pszXModemDir ? "unable to write the file" : "no 'xmodem' directory");
+  }
+
+  if(iVerbosity > 0)
+  {
+    fprintf(stderr, "%s: file channel \"%s\"\n", pApp, tbuf);
+  }
+
+  iMuxReply = MUX_CHANNEL_FILE;
+  EmuWriteLine(iMuxPty, tbuf);
+  iMuxReply = -1;
+
+  mux_close(&sMux, MUX_CHANNEL_FILE);
+}
+
+static void EmuMuxData(void *pCtx, int iChannel, const uint8_t *pData, int cbData, int bEnd)
+{
+int i1;
+
+  if(iChannel == MUX_CHANNEL_FILE)
+  {
+    EmuMuxFile(pData, cbData, bEnd);
+    return;
+  }
+
+  if(iChannel != MUX_CHANNEL_CONSOLE) // nothing else comes from the host
+  {
+    return;
+  }
+
+  for(i1=0; i1 < cbData && bMux; i1++) // the same as text lines, and the replies go back here
+  {
+    if(bEcho)
+    {
+      mux_write(&sMux, MUX_CHANNEL_CONSOLE, pData + i1, 1);
+    }
+
+    if(pData[i1] == '\r' || pData[i1] == '\n')
+    {
+      if(cbMuxLine > 0)
+      {
+        szMuxLine[cbMuxLine] = 0;
+        cbMuxLine = 0;
+
+        iMuxReply = MUX_CHANNEL_CONSOLE;
+        EmuCommand(iMuxPty, szMuxLine);
+        iMuxReply = -1;
+      }
+    }
+    else if(cbMuxLine < (int)sizeof(szMuxLine) - 1)
+    {
+      szMuxLine[cbMuxLine++] = pData[i1];
+    }
+  }
+}
+
+// the 'stream' lines and the credit refresh that are due, then the output.  Returns the msecs to the next one
+static int EmuMuxTick(int iPty)
+{
+char tbuf[MAX_LINE], szSample[32];
+unsigned long long qwNow, qwNext;
+
+  qwNow = EmuMsec();
+
+  if(sScript.iStreamPeriod > 0 && qwNow >= qwMuxSample)
+  {
+    snprintf(szSample, sizeof(szSample), "%lu", ulMuxSample++);
+    snprintf(tbuf, sizeof(tbuf) - 2, sScript.pszStream, szSample, szSample, szSample);
+    strcat(tbuf, sScript.pszEOL);
+
+    if(mux_space(&sMux, MUX_CHANNEL_TELEMETRY) >= (int)strlen(tbuf))
+    {
+      mux_write(&sMux, MUX_CHANNEL_TELEMETRY, tbuf, strlen(tbuf));
+    }
+    else if(iVerbosity > 1) // the host isn't taking them, like a device that can't wait
+    {
+      fprintf(stderr, "%s: sample %s dropped\n", pApp, szSample);
+    }
+
+    qwMuxSample += sScript.iStreamPeriod;
+
+    if(qwMuxSample <= qwNow) // fell behind, so the next one is a whole period from now
+    {
+      qwMuxSample = qwNow + sScript.iStreamPeriod;
+    }
+  }
+
+  if(qwNow >= qwMuxRefresh)
+  {
+    mux_refresh(&sMux);
+    qwMuxRefresh = qwNow + 500;
+  }
+
+  EmuMuxFlush(iPty);
+
+  qwNext = sScript.iStreamPeriod > 0 && qwMuxSample < qwMuxRefresh ? qwMuxSample : qwMuxRefresh;
+
+  return qwNext > qwNow ? (int)(qwNext - qwNow) : 1;
+}
+
+// input in framed mode:  each COMMAND frame is run like a line, and ends with an END frame
+static void EmuFrames(int iPty, const char *pBuf, int cbBuf)
+{
+char szLine[MAX_LINE];
+FRAME_VIEW sV;
+uint8_t *p1;
+int cb1;
+
+  while(cbBuf > 0 && bFramed)
+  {
+    p1 = frame_reader_space(&sFrames, &cb1);
+
+    if(cb1 > cbBuf)
+    {
+      cb1 = cbBuf;
+    }
+
+    memcpy(p1, pBuf, cb1);
+    frame_reader_fill(&sFrames, cb1);
+
+    pBuf += cb1;
+    cbBuf -= cb1;
+
+    while(bFramed && frame_reader_next(&sFrames, &sV) > 0)
+    {
+      if(sV.bType == FRAME_TYPE_TEXT)
+      {
+        if(iVerbosity > 0)
+        {
+          fprintf(stderr, "%s: text lines again\n", pApp);
+        }
+
+        bFramed = 0;
+        EmuMuxStop();
+      }
+      else if(sV.bType == FRAME_TYPE_CHANNEL || sV.bType == FRAME_TYPE_CREDIT)
+      {
+        if(!bMux && iVerbosity > 0)
+        {
+          fprintf(stderr, "%s: virtual channels\n", pApp);
+        }
+
+        bMux = 1;
+        mux_input(&sMux, &sV);
+      }
+      else if(sV.bType == FRAME_TYPE_COMMAND && sV.cbData < sizeof(szLine))
+      {
+        memcpy(szLine, sV.pData, sV.cbData);
+        szLine[sV.cbData] = 0;
+
+        bFrameSeq = sV.bSeq;
+        EmuCommand(iPty, szLine);
+        EmuFrame(iPty, FRAME_TYPE_END, NULL, 0);
+      }
+    }
+  }
+
+  if(bMux)
+  {
+    EmuMuxFlush(iPty);
+  }
+
+  if(iVerbosity > 0 && sFrames.dwErrors)
+  {
+    fprintf(stderr, "%s: %lu bad frames so far\n", pApp, (unsigned long)sFrames.dwErrors);
+    sFrames.dwErrors = 0;
+  }
+}
+
+// discard whatever the last session left in both directions.  Data that is
+// already queued for the slave side survives a close, and flushing it from
+// the master side does not reach it, so the slave gets opened briefly.
+static void EmuDiscard(int iPty)
+{
+int iSlave;
+
+  tcflush(iPty, TCIFLUSH);
+
+  iSlave = open(pszSlaveName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(iSlave != -1)
+  {
+    tcflush(iSlave, TCIFLUSH);
+    close(iSlave);
+  }
+}
+
+static int EmuOpen(void)
+{
+struct termios sIOS;
+int iPty, iSlave;
+char *pszSlave;
+
+  iPty = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if(iPty == -1 || grantpt(iPty) || unlockpt(iPty) || !(pszSlave = ptsname(iPty)))
+  {
+    fprintf(stderr, "%s: unable to create pty, errno=%d\n", pApp, errno);
+    return -1;
+  }
+
+  pszSlaveName = strdup(pszSlave);
+
+  // raw mode on the slave side, so nothing is echoed or translated before the
+  // application configures it.  the settings remain after the slave is closed.
+
+  iSlave = open(pszSlave, O_RDWR | O_NOCTTY);
+  if(iSlave != -1)
+  {
+    if(!tcgetattr(iSlave, &sIOS))
+    {
+      sIOS.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+      sIOS.c_oflag &= ~OPOST;
+      sIOS.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+      sIOS.c_cflag &= ~(CSIZE | PARENB);
+      sIOS.c_cflag |= CS8;
+
+      tcsetattr(iSlave, TCSANOW, &sIOS);
+    }
+
+    close(iSlave);
+  }
+
+  if(pszLinkName)
+  {
+    unlink(pszLinkName);
+
+    if(symlink(pszSlave, pszLinkName))
+    {
+      fprintf(stderr, "%s: unable to create link \"%s\", errno=%d\n", pApp, pszLinkName, errno);
+    }
+  }
+
+  fprintf(stdout, "%s\n", pszSlave);
+  fflush(stdout);
+
+  return iPty;
+}
+
+// 'BAUD rate' switches once the reply is out, and goes back if it isn't confirmed in time
+static void EmuBaud(int iPty)
+{
+  if(sScript.nRates && baud_device_poll(&sBaud, (uint32_t)EmuMsec()))
+  {
+    if(iVerbosity > 0)
+    {
+      fprintf(stderr, "%s: %s %lu baud\n", pApp, baud_device_probing(&sBaud) ? "trying" : "back to",
+              (unsigned long)sBaud.dwRate);
+    }
+
+    frame_reader_init(&sProbe);
+  }
+}
+
+// while a new rate is tried:  PROBE frames go right back, until CONFIRM
+static void EmuProbe(int iPty, const char *pBuf, int cbBuf)
+{
+uint8_t aOut[FRAME_ENCODED_MAX(FRAME_MAX_DATA)], *p1;
+FRAME_VIEW sV;
+int cb1;
+
+  while(cbBuf > 0 && baud_device_probing(&sBaud))
+  {
+    p1 = frame_reader_space(&sProbe, &cb1);
+
+    if(cb1 > cbBuf)
+    {
+      cb1 = cbBuf;
+    }
+
+    memcpy(p1, pBuf, cb1);
+    frame_reader_fill(&sProbe, cb1);
+
+    pBuf += cb1;
+    cbBuf -= cb1;
+
+    while(baud_device_probing(&sBaud) && frame_reader_next(&sProbe, &sV) > 0)
+    {
+      EmuWrite(iPty, (const char *)aOut, baud_device_frame(&sBaud, &sV, aOut, sizeof(aOut)), 1);
+
+      if(!baud_device_probing(&sBaud) && iVerbosity > 0)
+      {
+        fprintf(stderr, "%s: %lu baud confirmed (%u probes)\n", pApp, (unsigned long)sBaud.dwRate, sBaud.wProbes);
+      }
+    }
+  }
+}
+
+static void EmuLoop(int iPty)
+{
+struct pollfd sFD;
+char buf[256], szLine[MAX_LINE];
+int i1, i2, cbLine = 0, bOpen = 0;
+
+  while(!bQuitFlag)
+  {
+    sFD.fd = iPty;
+    sFD.events = POLLIN;
+    sFD.revents = 0;
+
+    EmuBaud(iPty);
+
+    i1 = poll(&sFD, 1, baud_device_probing(&sBaud) ? 20 : bMux ? EmuMuxTick(iPty) : 100);
+
+    if(i1 < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+
+      fprintf(stderr, "%s: poll error %d\n", pApp, errno);
+      break;
+    }
+
+    if(sFD.revents & POLLHUP) // nobody has the slave side open
+    {
+      if(bOpen)
+      {
+        if(iVerbosity > 0)
+        {
+          fprintf(stderr, "%s: port closed\n", pApp);
+        }
+
+        bOpen = 0;
+        cbLine = 0;
+
+        EmuDiscard(iPty);
+      }
+
+      usleep(20000); // POLLHUP does not block, so don't spin
+      continue;
+    }
+
+    if(!bOpen) // the slave side was just opened - that's a 'reset'
+    {
+      if(iVerbosity > 0)
+      {
+        fprintf(stderr, "%s: port opened (reset)\n", pApp);
+      }
+
+      bOpen = 1;
+      EmuReset(iPty);
+      continue;
+    }
+
+    if(!(sFD.revents & POLLIN))
+    {
+      continue;
+    }
+
+    i1 = read(iPty, buf, sizeof(buf));
+
+    if(i1 <= 0)
+    {
+      continue;
+    }
+
+    EmuGarble(buf, i1, EmuCableNoise(iPty));
+
+    if(baud_device_probing(&sBaud))
+    {
+      EmuProbe(iPty, buf, i1);
+      continue;
+    }
+
+    if(bFramed)
+    {
+      EmuFrames(iPty, buf, i1);
+      continue;
+    }
+
+    for(i2=0; i2 < i1 && !bFramed; i2++)
+    {
+      if(bEcho)
+      {
+        EmuWrite(iPty, buf + i2, 1, 0);
+      }
+
+      if(buf[i2] == '\r' || buf[i2] == '\n') // either one ends a line, CRLF gives a blank line
+      {
+        if(cbLine > 0)
+        {
+          szLine[cbLine] = 0;
+          cbLine = 0;
+
+          EmuCommand(iPty, szLine);
+        }
+      }
+      else if(cbLine < (int)sizeof(szLine) - 1)
+      {
+        szLine[cbLine++] = buf[i2];
+      }
+    }
+
+    if(bFramed && i2 < i1) // 'FRAME', and the first frames right behind it
+    {
+      EmuFrames(iPty, buf + i2, i1 - i2);
+    }
+  }
+}
+
+
+void usage()
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-D]|[-v[v]][-l linkname][-x directory][script]\n"
+          " where\t'script' describes the device (default is built in)\n"
+          " and\t-D prints the built-in script, which documents the format\n"
+          " and\t-l creates a symbolic link to the pty (removed on exit)\n"
+          " and\t-x enables XMODEM ('XSfile' and 'XRfile') using 'directory'\n"
+          " and\t-v increases verbosity of debug info sent to stderr\n"
+          "\n"
+          "-and-\t-h prints this message\n\n"
+          "The name of the pty is written to stdout\n\n", pApp, pApp);
+}
+
+int main(int argc, char *argv[])
+{
+int i1, iPty;
+const char *pszXModemDir = NULL;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hDvl:x:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'h':
+        usage();
+        return 0;
+
+      case 'D':
+        fputs(szDefaultScript, stdout);
+        return 0;
+
+      case 'v':
+        iVerbosity++;
+        break;
+
+      case 'l':
+        pszLinkName = optarg;
+        break;
+
+      case 'x':
+        pszXModemDir = optarg;
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  if(ScriptLoad(&sScript, optind < argc ? argv[optind] : NULL))
+  {
+    return 1;
+  }
+
+  if(pszXModemDir)
+  {
+    sScript.pszXModemDir = strdup(pszXModemDir);
+  }
+
+  srand48((long)getpid());
+
+  signal(SIGINT, signalproc);
+  signal(SIGTERM, signalproc);
+  signal(SIGHUP, signalproc);
+  signal(SIGPIPE, SIG_IGN);
+
+  iPty = EmuOpen();
+  if(iPty == -1)
+  {
+    return 2;
+  }
+
+  EmuLoop(iPty);
+
+  close(iPty);
+
+  if(pszLinkName)
+  {
+    unlink(pszLinkName);
+  }
+
+  return 0;
+}
+
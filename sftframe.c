@@ -0,0 +1,251 @@
+// sftframe.c - binary frames ('sftardcal -f'), for the host and for ARDUINO
+//
+// See 'sftframe.h' for the frame layout and the session.  The reader keeps
+// the bytes where they were read to, and a frame is COBS decoded in place
+// (the decoded bytes are never more than the encoded ones), so a frame is
+// handed back as a pointer into the buffer, not a copy.  The buffer is only
+// moved down when there's no room left at the end for the next read.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include "sftframe.h"
+
+
+// 4 bits at a time - small enough for an AVR, and the table is 32 bytes
+static const uint16_t awFrameCRC[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+  0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+uint16_t frame_crc16(uint16_t wCRC, const uint8_t *pData, int cbData)
+{
+  while(cbData-- > 0)
+  {
+    wCRC = (uint16_t)((wCRC << 4) ^ awFrameCRC[(wCRC >> 12) ^ (*pData >> 4)]);
+    wCRC = (uint16_t)((wCRC << 4) ^ awFrameCRC[(wCRC >> 12) ^ (*pData & 0xf)]);
+    pData++;
+  }
+
+  return wCRC;
+}
+
+
+// ------
+// WRITER
+// ------
+
+typedef struct _FRAME_COBS_
+{
+  uint8_t *pOut;
+  int iCode;    // where the current block's length goes
+  int iOut;
+  uint8_t bCode;
+} FRAME_COBS;
+
+static void frame_cobs_put(FRAME_COBS *pC, const uint8_t *pData, int cbData)
+{
+  for(; cbData > 0; pData++, cbData--)
+  {
+    if(*pData)
+    {
+      pC->pOut[pC->iOut++] = *pData;
+      pC->bCode++;
+    }
+
+    if(!*pData || pC->bCode == 0xff) // the end of a block
+    {
+      pC->pOut[pC->iCode] = pC->bCode;
+      pC->iCode = pC->iOut++;
+      pC->bCode = 1;
+    }
+  }
+}
+
+int frame_encode(uint8_t *pOut, int cbOut, uint8_t bType, uint8_t bSeq, const void *pData, int cbData)
+{
+FRAME_COBS sC;
+uint8_t aHdr[FRAME_HEADER_SIZE], aCRC[FRAME_CRC_SIZE];
+uint16_t wCRC;
+
+  if(cbData < 0 || cbData > FRAME_MAX_DATA || cbOut < FRAME_ENCODED_MAX(cbData))
+  {
+    return 0;
+  }
+
+  aHdr[0] = bType;
+  aHdr[1] = bSeq;
+  aHdr[2] = (uint8_t)(cbData >> 8);
+  aHdr[3] = (uint8_t)cbData;
+
+  wCRC = frame_crc16(0xffff, aHdr, sizeof(aHdr));
+  wCRC = frame_crc16(wCRC, (const uint8_t *)pData, cbData);
+
+  aCRC[0] = (uint8_t)(wCRC >> 8);
+  aCRC[1] = (uint8_t)wCRC;
+
+  pOut[0] = 0; // ends whatever came before it
+
+  sC.pOut = pOut;
+  sC.iCode = 1;
+  sC.iOut = 2;
+  sC.bCode = 1;
+
+  frame_cobs_put(&sC, aHdr, sizeof(aHdr));
+  frame_cobs_put(&sC, (const uint8_t *)pData, cbData);
+  frame_cobs_put(&sC, aCRC, sizeof(aCRC));
+
+  pOut[sC.iCode] = sC.bCode;
+  pOut[sC.iOut++] = 0;
+
+  return sC.iOut;
+}
+
+
+// ------
+// READER
+// ------
+
+void frame_reader_init(FRAME_READER *pR)
+{
+  pR->cbBuf = pR->iStart = pR->iScan = 0;
+  pR->bSkip = 1; // the middle of something, until the first 0
+  pR->dwFrames = pR->dwErrors = 0;
+}
+
+uint8_t *frame_reader_space(FRAME_READER *pR, int *pcbSpace)
+{
+  if(pR->iStart == pR->cbBuf) // all used up, so the next read can start at the beginning
+  {
+    pR->cbBuf = pR->iStart = pR->iScan = 0;
+  }
+  else if(pR->iStart && pR->cbBuf == sizeof(pR->aBuf)) // what's been used up makes room
+  {
+    memmove(pR->aBuf, pR->aBuf + pR->iStart, pR->cbBuf - pR->iStart);
+
+    pR->cbBuf -= pR->iStart;
+    pR->iScan -= pR->iStart;
+    pR->iStart = 0;
+  }
+
+  if(pR->cbBuf == sizeof(pR->aBuf)) // one frame that fills the buffer is too long to be one
+  {
+    if(!pR->bSkip)
+    {
+      pR->dwErrors++;
+    }
+
+    pR->cbBuf = pR->iStart = pR->iScan = 0;
+    pR->bSkip = 1;
+  }
+
+  *pcbSpace = (int)sizeof(pR->aBuf) - pR->cbBuf;
+
+  return pR->aBuf + pR->cbBuf;
+}
+
+void frame_reader_fill(FRAME_READER *pR, int cbData)
+{
+  if(cbData > 0)
+  {
+    pR->cbBuf += (uint16_t)cbData;
+  }
+}
+
+// COBS decodes 'pBuf' in place.  Returns the decoded length, or -1 if it isn't valid COBS
+static int frame_cobs_decode(uint8_t *pBuf, int cbBuf)
+{
+int iIn, iOut, i1;
+uint8_t bCode;
+
+  for(iIn=0, iOut=0; iIn < cbBuf; )
+  {
+    bCode = pBuf[iIn++];
+
+    if(iIn + bCode - 1 > cbBuf)
+    {
+      return -1;
+    }
+
+    for(i1=1; i1 < bCode; i1++)
+    {
+      pBuf[iOut++] = pBuf[iIn++];
+    }
+
+    if(bCode < 0xff && iIn < cbBuf) // the 0 that ended the block
+    {
+      pBuf[iOut++] = 0;
+    }
+  }
+
+  return iOut;
+}
+
+int frame_reader_next(FRAME_READER *pR, FRAME_VIEW *pV)
+{
+uint8_t *pFrame;
+int cbFrame, cbData;
+uint16_t wCRC;
+
+  for(;;)
+  {
+    pFrame = (uint8_t *)memchr(pR->aBuf + pR->iScan, 0, pR->cbBuf - pR->iScan);
+
+    if(!pFrame)
+    {
+      pR->iScan = pR->cbBuf;
+      return 0;
+    }
+
+    cbFrame = (int)(pFrame - pR->aBuf) - pR->iStart;
+    pFrame = pR->aBuf + pR->iStart;
+
+    pR->iStart += (uint16_t)(cbFrame + 1); // past the 0, whatever this one turns out to be
+    pR->iScan = pR->iStart;
+
+    if(pR->bSkip)
+    {
+      pR->bSkip = 0;
+      continue;
+    }
+
+    if(!cbFrame) // the 0 before a frame, right after the one that ended the last one
+    {
+      continue;
+    }
+
+    cbFrame = frame_cobs_decode(pFrame, cbFrame);
+
+    if(cbFrame < FRAME_HEADER_SIZE + FRAME_CRC_SIZE)
+    {
+      pR->dwErrors++;
+      continue;
+    }
+
+    cbData = (pFrame[2] << 8) | pFrame[3];
+    wCRC = frame_crc16(0xffff, pFrame, cbFrame - FRAME_CRC_SIZE);
+
+    if(cbData != cbFrame - FRAME_HEADER_SIZE - FRAME_CRC_SIZE ||
+       wCRC != ((pFrame[cbFrame - 2] << 8) | pFrame[cbFrame - 1]))
+    {
+      pR->dwErrors++;
+      continue;
+    }
+
+    pR->dwFrames++;
+
+    pV->bType = pFrame[0];
+    pV->bSeq = pFrame[1];
+    pV->cbData = (uint16_t)cbData;
+    pV->pData = pFrame + FRAME_HEADER_SIZE;
+
+    return 1;
+  }
+}
@@ -0,0 +1,152 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftframe.h - binary frames, an alternative to text lines ('sftardcal -f')
+//
+// Text lines can't carry binary data, and formatting and parsing them costs
+// more than the data is worth at high rates.  In framed mode every message
+// is one frame:
+//
+//   type (1)  sequence (1)  length (2)  data (length)  CRC (2)
+//
+// CRC-16-CCITT (0x1021, starting with 0xFFFF) over everything before it, the
+// length and CRC high byte first.  The frame is COBS encoded, so that it has
+// no 0 bytes in it, and has a 0 before and after it.  A receiver that sees
+// garbage (noise, a bad CRC, a frame that's too long) throws away only what's
+// up to the next 0, and the frame after that is fine.
+//
+// The same code builds for the host and for ARDUINO (like 'xmodem.c'), as C
+// or C++.  It does no I/O, so each side reads and writes the bytes its own way.
+//
+// SESSION
+//
+//   The host sends the text command FRAME_HELLO_COMMAND ("FRAME"), with its
+//   usual line ending.  A device that knows framed mode answers with a
+//   FRAME_TYPE_HELLO frame (version, the most data it takes in one frame in
+//   2 bytes, then FRAME_HELLO_xxx flags), and from then on, both sides only
+//   send frames.  Anything else means text lines, as before.  A
+//   FRAME_TYPE_TEXT frame from the host (or a reset) goes back to text lines.
+//
+//   Each FRAME_TYPE_COMMAND frame has the command (without a line ending) and
+//   the host's next sequence number.  The reply is any number of
+//   FRAME_TYPE_REPLY frames with the same sequence number, then a
+//   FRAME_TYPE_END frame.  The data in them is the reply as is, including any
+//   line endings:  text, binary, or both.  FRAME_TYPE_DATA frames are for
+//   data the device sends on its own, and have their own sequence.
+//
+//   A device with FRAME_HELLO_CHANNELS also takes FRAME_TYPE_CHANNEL and
+//   FRAME_TYPE_CREDIT frames, several streams at once (see 'sftmux.h').
+//
+// READING FRAMES
+//
+//   FRAME_READER sR;
+//   FRAME_VIEW sV;
+//
+//   frame_reader_init(&sR);
+//   ...
+//   p1 = frame_reader_space(&sR, &cb1);  // read up to 'cb1' bytes into 'p1'
+//   frame_reader_fill(&sR, read(iFile, p1, cb1));
+//
+//   while(frame_reader_next(&sR, &sV) > 0)
+//   {
+//     // 'sV.pData' points into 'sR' (no copy), until the next frame_reader_*() call
+//   }
+//
+// and for writing one, 'frame_encode()' into a buffer of FRAME_ENCODED_MAX(cbData).
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTFRAME_H_INCLUDED_
+#define _SFTFRAME_H_INCLUDED_
+
+#if defined(__AVR__) || defined(AVR) || defined(__AVR) || defined(__AVR_ARCH__)
+#ifndef ARDUINO
+#define ARDUINO /* same test as 'xmodem.h' */
+#endif // ARDUINO
+#endif // __AVR__
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define FRAME_HELLO_COMMAND "FRAME"
+#define FRAME_VERSION       1
+
+#define FRAME_TYPE_HELLO    1 /* device -> host, the answer to FRAME_HELLO_COMMAND */
+#define FRAME_TYPE_COMMAND  2 /* host -> device */
+#define FRAME_TYPE_REPLY    3 /* device -> host, part of the reply to the command with this sequence */
+#define FRAME_TYPE_END      4 /* device -> host, the reply is complete (may have data too) */
+#define FRAME_TYPE_DATA     5 /* device -> host, not a reply */
+#define FRAME_TYPE_TEXT     6 /* host -> device, back to text lines */
+#define FRAME_TYPE_CHANNEL  7 /* either way, part of a virtual channel's stream ('sftmux.h') */
+#define FRAME_TYPE_CREDIT   8 /* either way, how much more of a channel's stream can be sent */
+#define FRAME_TYPE_PROBE    9 /* host -> device, sent right back while trying a baud rate ('sftbaud.h') */
+#define FRAME_TYPE_CONFIRM  10 /* host -> device, keep the new baud rate (and back, with the rate) */
+
+#define FRAME_HELLO_CHANNELS 1 /* in the HELLO flags:  FRAME_TYPE_CHANNEL and FRAME_TYPE_CREDIT work */
+
+#define FRAME_HEADER_SIZE   4 /* type, sequence, length */
+#define FRAME_CRC_SIZE      2
+
+#ifndef FRAME_MAX_DATA
+#define FRAME_MAX_DATA      240 /* header, data and CRC in one COBS block */
+#endif // FRAME_MAX_DATA
+
+// the most bytes 'cbData' can take on the wire:  COBS adds one per 254, and the 0 on each side
+#define FRAME_ENCODED_MAX(cbData) ((cbData) + FRAME_HEADER_SIZE + FRAME_CRC_SIZE + \
+                                   ((cbData) + FRAME_HEADER_SIZE + FRAME_CRC_SIZE) / 254 + 3)
+
+#ifndef FRAME_BUFSIZE
+#ifdef ARDUINO
+#define FRAME_BUFSIZE       FRAME_ENCODED_MAX(FRAME_MAX_DATA) /* one frame */
+#else // ARDUINO
+#define FRAME_BUFSIZE       4096
+#endif // ARDUINO
+#endif // FRAME_BUFSIZE
+
+
+// one frame that was received
+typedef struct _FRAME_VIEW_
+{
+  uint8_t bType;          // FRAME_TYPE_xxx
+  uint8_t bSeq;
+  uint16_t cbData;
+  const uint8_t *pData;   // in the reader's buffer, valid until the next 'frame_reader_*' call
+} FRAME_VIEW;
+
+typedef struct _FRAME_READER_
+{
+  uint16_t cbBuf;         // bytes in 'aBuf'
+  uint16_t iStart;        // where the next frame starts
+  uint16_t iScan;         // where the search for its closing 0 goes on
+  uint8_t bSkip;          // the bytes up to the next 0 aren't a frame (the start, or one that was too long)
+  uint8_t bReserved;
+  uint32_t dwFrames;      // good ones
+  uint32_t dwErrors;      // thrown away for a bad CRC, length or encoding
+  uint8_t aBuf[FRAME_BUFSIZE];
+} FRAME_READER;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+uint16_t frame_crc16(uint16_t wCRC, const uint8_t *pData, int cbData); // start with 0xFFFF
+
+// 'cbData' up to FRAME_MAX_DATA.  Returns the bytes written to 'pOut', 0 if they don't fit in 'cbOut'
+int frame_encode(uint8_t *pOut, int cbOut, uint8_t bType, uint8_t bSeq, const void *pData, int cbData);
+
+void frame_reader_init(FRAME_READER *pR);                  // anything before the first 0 is ignored
+uint8_t *frame_reader_space(FRAME_READER *pR, int *pcbSpace); // where the next bytes go, and how many fit
+void frame_reader_fill(FRAME_READER *pR, int cbData);      // that many were put there (< 0 is ignored)
+int frame_reader_next(FRAME_READER *pR, FRAME_VIEW *pV);   // 1 for a frame, 0 when it needs more bytes
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // _SFTFRAME_H_INCLUDED_
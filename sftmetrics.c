@@ -0,0 +1,661 @@
+// sftmetrics.c - always-on I/O and protocol counters for sftardcal
+//
+// See 'sftmetrics.h'.  The '-S path' socket answers each connection with the
+// counters and closes it.  If the request starts with 'GET ' the answer is a
+// minimal HTTP/1.0 response, so Prometheus (or 'curl --unix-socket path
+// http://localhost/metrics') can read it.  Anything else, including nothing at
+// all (i.e. 'nc -U path'), gets the plain text.
+//
+// The latency histograms keep 32 buckets for each power of 2 (values under 64
+// have a bucket each), so a percentile is within about 3% of the real value
+// whatever its size.  The table is sorted by the total reply time, so the
+// commands that take up the most of a run come first.
+//
+// SIGUSR1 is blocked in every thread and taken by a thread of its own with
+// 'sigwait()', so it never interrupts a 'poll()' or 'read()' in the middle of
+// a transfer.  'metrics_format()' doesn't use stdio or allocate memory anyway.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sftmetrics.h"
+
+
+#define METRICS_TEXT_SIZE 8192 /* plenty for all of the counters */
+
+#define LATENCY_SUB_BITS 5 /* 32 buckets for each power of 2 */
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT) /* enough for any 64-bit value */
+#define LATENCY_MAX_COMMANDS 64 /* different first words - any more are counted as '(other)' */
+
+typedef struct _METRIC_INFO_
+{
+  const char *pszName;
+  const char *pszLabels;  // NULL for none
+  const char *pszHelp;    // NULL when it's the same name as the one before
+} METRIC_INFO;
+
+// same order as the METRIC_xxx values in sftmetrics.h
+static const METRIC_INFO aMetricInfo[METRIC_COUNT] =
+{
+  { "sftardcal_serial_bytes_total", "direction=\"rx\"", "Bytes read from and written to the serial port" },
+  { "sftardcal_serial_bytes_total", "direction=\"tx\"", NULL },
+  { "sftardcal_serial_syscalls_total", "direction=\"rx\"", "read(), write() and splice() calls on the serial port" },
+  { "sftardcal_serial_syscalls_total", "direction=\"tx\"", NULL },
+  { "sftardcal_poll_wakeups_total", NULL, "poll() calls in the I/O loops that returned with something to do" },
+  { "sftardcal_commands_total", NULL, "Commands sent to the device" },
+  { "sftardcal_command_repeats_total", NULL, "Commands sent again because the device did not answer" },
+  { "sftardcal_command_timeouts_total", NULL, "Commands that never got an answer" },
+  { "sftardcal_xmodem_blocks_total", "direction=\"sent\"", "XMODEM blocks acknowledged by the other end, or accepted from it" },
+  { "sftardcal_xmodem_blocks_total", "direction=\"received\"", NULL },
+  { "sftardcal_xmodem_naks_total", "direction=\"sent\"", "XMODEM NAKs" },
+  { "sftardcal_xmodem_naks_total", "direction=\"received\"", NULL },
+  { "sftardcal_xmodem_retransmits_total", NULL, "XMODEM blocks sent again after a NAK or a timeout" },
+  { "sftardcal_dropped_bytes_total", "reason=\"fanout\"", "Bytes that were not delivered or not recorded" },
+  { "sftardcal_dropped_bytes_total", "reason=\"capture\"", NULL },
+  { "sftardcal_serial_ring_full_total", NULL, "Times the serial input ring was full (see '-Z')" },
+  { "sftardcal_telemetry_samples_total", NULL, "Telemetry lines that had at least one of the fields (see '-T')" },
+  { "sftardcal_telemetry_skipped_total", NULL, "Telemetry lines that had none of the fields" },
+  { "sftardcal_telemetry_waits_total", NULL, "Times telemetry input waited for the file writes to catch up" },
+  { "sftardcal_poll_overruns_total", NULL, "Polls that finished after their deadline (see '-s')" },
+  { "sftardcal_poll_missed_total", NULL, "Poll periods that were skipped because it was already too late" },
+  { "sftardcal_frames_total", "direction=\"sent\"", "Binary frames sent and received (see '-f')" },
+  { "sftardcal_frames_total", "direction=\"received\"", NULL },
+  { "sftardcal_frame_errors_total", NULL, "Frames thrown away for a bad CRC, length or encoding" },
+  { "sftardcal_frame_stale_total", NULL, "Reply frames for a command that had already timed out" },
+  { "sftardcal_baud_changes_total", "direction=\"up\"", "Baud rate steps that passed the loopback burst (see '-A')" },
+  { "sftardcal_baud_changes_total", "direction=\"down\"", NULL },
+};
+
+typedef struct _LATENCY_HISTOGRAM_
+{
+  unsigned int adwCount[LATENCY_BUCKETS];
+  unsigned long long qwCount, qwSum, qwMax;
+} LATENCY_HISTOGRAM;
+
+typedef struct _LATENCY_COMMAND_
+{
+  char szVerb[16];
+  unsigned long long qwTimeouts;
+  LATENCY_HISTOGRAM sFirstByte, sReply, sRepeats;
+} LATENCY_COMMAND;
+
+__thread METRICS_BLOCK *pMetricsThread = NULL;
+
+static METRICS_BLOCK *pMetricsBlocks = NULL; // every thread's block, newest first
+
+static int iMetricsSocket = -1;
+static char szMetricsPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t hMetricsThread;
+static volatile int bMetricsStop = 0;
+static int iMetricsSignal = 0;
+
+static LATENCY_COMMAND *apLatency[LATENCY_MAX_COMMANDS];
+static int nLatency = 0;
+static pthread_mutex_t mtxLatency = PTHREAD_MUTEX_INITIALIZER;
+
+
+METRICS_BLOCK *metrics_register(void)
+{
+METRICS_BLOCK *pB;
+void *p1;
+
+  if(posix_memalign(&p1, 64, sizeof(METRICS_BLOCK)))
+  {
+    static METRICS_BLOCK sLost; // out of memory - count it somewhere, it just won't show up
+
+    pMetricsThread = &sLost;
+    return pMetricsThread;
+  }
+
+  pB = (METRICS_BLOCK *)p1;
+  memset(pB, 0, sizeof(*pB));
+
+  pB->pNext = __atomic_load_n(&pMetricsBlocks, __ATOMIC_RELAXED);
+
+  while(!__atomic_compare_exchange_n(&pMetricsBlocks, &(pB->pNext), pB, 1,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+  { } // another thread registered at the same time, 'pNext' was updated
+
+  pMetricsThread = pB;
+
+  return pB;
+}
+
+unsigned long long metrics_total(int iMetric)
+{
+METRICS_BLOCK *pB;
+unsigned long long qwRval = 0;
+
+  for(pB = __atomic_load_n(&pMetricsBlocks, __ATOMIC_ACQUIRE); pB; pB = pB->pNext)
+  {
+    qwRval += __atomic_load_n(&(pB->aqwCount[iMetric]), __ATOMIC_RELAXED);
+  }
+
+  return qwRval;
+}
+
+// append a string, stopping at the end of the buffer
+static char *metrics_put(char *p1, char *pEnd, const char *pszText)
+{
+  while(*pszText && p1 < pEnd)
+  {
+    *(p1++) = *(pszText++);
+  }
+
+  return p1;
+}
+
+static char *metrics_put_number(char *p1, char *pEnd, unsigned long long qwValue)
+{
+char tbuf[24];
+int i1 = sizeof(tbuf) - 1;
+
+  tbuf[i1] = 0;
+
+  do
+  {
+    tbuf[--i1] = '0' + (char)(qwValue % 10);
+    qwValue /= 10;
+  } while(qwValue);
+
+  return metrics_put(p1, pEnd, tbuf + i1);
+}
+
+int metrics_format(char *pBuf, int cbBuf)
+{
+char *p1 = pBuf, *pEnd = pBuf + cbBuf;
+int i1;
+
+  for(i1=0; i1 < METRIC_COUNT; i1++)
+  {
+    if(aMetricInfo[i1].pszHelp)
+    {
+      p1 = metrics_put(p1, pEnd, "# HELP ");
+      p1 = metrics_put(p1, pEnd, aMetricInfo[i1].pszName);
+      p1 = metrics_put(p1, pEnd, " ");
+      p1 = metrics_put(p1, pEnd, aMetricInfo[i1].pszHelp);
+      p1 = metrics_put(p1, pEnd, "\n# TYPE ");
+      p1 = metrics_put(p1, pEnd, aMetricInfo[i1].pszName);
+      p1 = metrics_put(p1, pEnd, " counter\n");
+    }
+
+    p1 = metrics_put(p1, pEnd, aMetricInfo[i1].pszName);
+
+    if(aMetricInfo[i1].pszLabels)
+    {
+      p1 = metrics_put(p1, pEnd, "{");
+      p1 = metrics_put(p1, pEnd, aMetricInfo[i1].pszLabels);
+      p1 = metrics_put(p1, pEnd, "}");
+    }
+
+    p1 = metrics_put(p1, pEnd, " ");
+    p1 = metrics_put_number(p1, pEnd, metrics_total(i1));
+    p1 = metrics_put(p1, pEnd, "\n");
+  }
+
+  return p1 - pBuf;
+}
+
+static void metrics_write_all(int iFile, const char *pBuf, int cbBuf)
+{
+int i1;
+
+  while(cbBuf > 0)
+  {
+    i1 = write(iFile, pBuf, cbBuf);
+
+    if(i1 <= 0)
+    {
+      if(i1 < 0 && errno == EINTR)
+      {
+        continue;
+      }
+
+      break;
+    }
+
+    pBuf += i1;
+    cbBuf -= i1;
+  }
+}
+
+void metrics_dump(int iFile)
+{
+char aText[METRICS_TEXT_SIZE];
+
+  metrics_write_all(iFile, aText, metrics_format(aText, sizeof(aText)));
+}
+
+// one connection - the request (if any) only decides between HTTP and plain text
+static void metrics_answer(int iClient)
+{
+struct pollfd sFD;
+struct timeval tv;
+char aReq[512], aText[METRICS_TEXT_SIZE], aHeader[128], *p1;
+int cbReq = 0, cbText;
+
+  tv.tv_sec = 1; // a client that doesn't read can't hold things up for long
+  tv.tv_usec = 0;
+  setsockopt(iClient, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  sFD.fd = iClient;
+  sFD.events = POLLIN;
+  sFD.revents = 0;
+
+  if(poll(&sFD, 1, 200) > 0)
+  {
+    cbReq = read(iClient, aReq, sizeof(aReq));
+  }
+
+  cbText = metrics_format(aText, sizeof(aText));
+
+  if(cbReq >= 4 && !memcmp(aReq, "GET ", 4))
+  {
+    p1 = metrics_put(aHeader, aHeader + sizeof(aHeader),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ");
+    p1 = metrics_put_number(p1, aHeader + sizeof(aHeader), (unsigned long long)cbText);
+    p1 = metrics_put(p1, aHeader + sizeof(aHeader), "\r\n\r\n");
+
+    metrics_write_all(iClient, aHeader, p1 - aHeader);
+  }
+
+  metrics_write_all(iClient, aText, cbText);
+}
+
+static void *metrics_thread(void *pParam)
+{
+struct pollfd sFD;
+int iClient;
+
+  while(!bMetricsStop)
+  {
+    sFD.fd = iMetricsSocket;
+    sFD.events = POLLIN;
+    sFD.revents = 0;
+
+    if(poll(&sFD, 1, 250) <= 0) // timeout, so 'bMetricsStop' is checked
+    {
+      continue;
+    }
+
+    iClient = accept(iMetricsSocket, NULL, NULL);
+
+    if(iClient >= 0)
+    {
+      metrics_answer(iClient);
+      close(iClient);
+    }
+  }
+
+  return NULL;
+}
+
+static void *metrics_signal_thread(void *pParam)
+{
+sigset_t sSet;
+int iSig;
+
+  sigemptyset(&sSet);
+  sigaddset(&sSet, iMetricsSignal);
+
+  while(1)
+  {
+    if(!sigwait(&sSet, &iSig))
+    {
+      metrics_dump(2);
+    }
+  }
+
+  return NULL;
+}
+
+static void metrics_signal_start(void)
+{
+pthread_t hThread;
+
+  if(!pthread_create(&hThread, NULL, metrics_signal_thread, NULL))
+  {
+    pthread_detach(hThread);
+  }
+}
+
+int metrics_signal(int iSig)
+{
+sigset_t sSet;
+
+  sigemptyset(&sSet);
+  sigaddset(&sSet, iSig);
+
+  // every thread created after this inherits the blocked signal
+  if(pthread_sigmask(SIG_BLOCK, &sSet, NULL))
+  {
+    return -1;
+  }
+
+  if(!iMetricsSignal)
+  {
+    pthread_atfork(NULL, NULL, metrics_signal_start); // a forked child only has the thread that forked
+  }
+
+  iMetricsSignal = iSig;
+  metrics_signal_start();
+
+  return 0;
+}
+
+int metrics_serve(const char *szPath)
+{
+struct sockaddr_un sAddr;
+int i1;
+
+  if(strlen(szPath) >= sizeof(sAddr.sun_path))
+  {
+    fprintf(stderr, "Metrics socket name \"%s\" is too long\n", szPath);
+    return -1;
+  }
+
+  memset(&sAddr, 0, sizeof(sAddr));
+  sAddr.sun_family = AF_UNIX;
+  strcpy(sAddr.sun_path, szPath);
+
+  iMetricsSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if(iMetricsSocket < 0)
+  {
+    fprintf(stderr, "Unable to create metrics socket, errno=%d\n", errno);
+    return -1;
+  }
+
+  unlink(szPath); // left over from last time
+
+  if(bind(iMetricsSocket, (struct sockaddr *)&sAddr, sizeof(sAddr)) ||
+     listen(iMetricsSocket, 4))
+  {
+    fprintf(stderr, "Unable to listen on metrics socket %s, errno=%d\n", szPath, errno);
+    goto error_exit;
+  }
+
+  strcpy(szMetricsPath, szPath);
+  bMetricsStop = 0;
+
+  i1 = pthread_create(&hMetricsThread, NULL, metrics_thread, NULL);
+
+  if(i1)
+  {
+    fprintf(stderr, "Unable to start metrics thread, error %d\n", i1);
+    unlink(szPath);
+    goto error_exit;
+  }
+
+  return 0;
+
+error_exit:
+  close(iMetricsSocket);
+  iMetricsSocket = -1;
+
+  return -1;
+}
+
+void metrics_stop(void)
+{
+  if(iMetricsSocket < 0)
+  {
+    return;
+  }
+
+  bMetricsStop = 1;
+  pthread_join(hMetricsThread, NULL);
+
+  close(iMetricsSocket);
+  iMetricsSocket = -1;
+
+  unlink(szMetricsPath);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// LATENCY HISTOGRAMS
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned long long metrics_usecs(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)(ts.tv_nsec / 1000);
+}
+
+static int latency_bucket(unsigned long long qwValue)
+{
+int iShift;
+
+  if(qwValue < 2 * LATENCY_SUB_COUNT)
+  {
+    return (int)qwValue;
+  }
+
+  iShift = 63 - __builtin_clzll(qwValue) - LATENCY_SUB_BITS; // leaves 'LATENCY_SUB_BITS + 1' bits
+
+  return iShift * LATENCY_SUB_COUNT + (int)(qwValue >> iShift);
+}
+
+// the highest value that goes in bucket 'iBucket'
+static unsigned long long latency_bucket_value(int iBucket)
+{
+int iShift;
+
+  if(iBucket < 2 * LATENCY_SUB_COUNT)
+  {
+    return (unsigned long long)iBucket;
+  }
+
+  iShift = iBucket / LATENCY_SUB_COUNT - 1;
+
+  return ((unsigned long long)(iBucket % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT) << iShift)
+         + (1ULL << iShift) - 1;
+}
+
+static void latency_add(LATENCY_HISTOGRAM *pH, unsigned long long qwValue)
+{
+  pH->adwCount[latency_bucket(qwValue)]++;
+  pH->qwCount++;
+  pH->qwSum += qwValue;
+
+  if(qwValue > pH->qwMax)
+  {
+    pH->qwMax = qwValue;
+  }
+}
+
+static unsigned long long latency_percentile(const LATENCY_HISTOGRAM *pH, int iPercent)
+{
+unsigned long long qwWant, qwSeen = 0, qwRval;
+int i1;
+
+  if(!pH->qwCount)
+  {
+    return 0;
+  }
+
+  qwWant = (pH->qwCount * iPercent + 99) / 100; // rounded up, so p99 of 10 samples is the highest
+
+  for(i1=0; i1 < LATENCY_BUCKETS; i1++)
+  {
+    qwSeen += pH->adwCount[i1];
+
+    if(qwSeen >= qwWant)
+    {
+      break;
+    }
+  }
+
+  qwRval = latency_bucket_value(i1);
+
+  return qwRval > pH->qwMax ? pH->qwMax : qwRval;
+}
+
+static LATENCY_COMMAND *latency_find(const char *szVerb)
+{
+int i1;
+
+  for(i1=0; i1 < nLatency; i1++)
+  {
+    if(!strcmp(apLatency[i1]->szVerb, szVerb))
+    {
+      return apLatency[i1];
+    }
+  }
+
+  if(nLatency >= LATENCY_MAX_COMMANDS - 1 && strcmp(szVerb, "(other)"))
+  {
+    return latency_find("(other)"); // the last one is for everything else
+  }
+
+  apLatency[nLatency] = (LATENCY_COMMAND *)calloc(1, sizeof(LATENCY_COMMAND));
+
+  if(!apLatency[nLatency])
+  {
+    return NULL;
+  }
+
+  strcpy(apLatency[nLatency]->szVerb, szVerb);
+
+  return apLatency[nLatency++];
+}
+
+void metrics_latency(const char *szCommand, unsigned long long qwFirstByte, unsigned long long qwReply, int nRepeats)
+{
+LATENCY_COMMAND *pL;
+char szVerb[sizeof(pL->szVerb)];
+int i1;
+
+  if(!szCommand)
+  {
+    strcpy(szVerb, "<ESC>");
+  }
+  else
+  {
+    while(*szCommand == ' ' || *szCommand == '\t')
+    {
+      szCommand++;
+    }
+
+    for(i1=0; i1 < (int)sizeof(szVerb) - 1 && (unsigned char)szCommand[i1] > ' '; i1++)
+    {
+      szVerb[i1] = szCommand[i1];
+    }
+
+    szVerb[i1] = 0;
+  }
+
+  pthread_mutex_lock(&mtxLatency);
+
+  pL = latency_find(szVerb);
+
+  if(pL)
+  {
+    if(qwFirstByte != METRICS_NO_TIME)
+    {
+      latency_add(&(pL->sFirstByte), qwFirstByte);
+    }
+
+    if(qwReply != METRICS_NO_TIME)
+    {
+      latency_add(&(pL->sReply), qwReply);
+    }
+    else
+    {
+      pL->qwTimeouts++;
+    }
+
+    latency_add(&(pL->sRepeats), (unsigned long long)nRepeats);
+  }
+
+  pthread_mutex_unlock(&mtxLatency);
+}
+
+static int latency_compare(const void *p1, const void *p2)
+{
+const LATENCY_COMMAND *pL1 = *(const LATENCY_COMMAND * const *)p1;
+const LATENCY_COMMAND *pL2 = *(const LATENCY_COMMAND * const *)p2;
+
+  if(pL1->sReply.qwSum != pL2->sReply.qwSum)
+  {
+    return pL1->sReply.qwSum > pL2->sReply.qwSum ? -1 : 1;
+  }
+
+  return strcmp(pL1->szVerb, pL2->szVerb);
+}
+
+static void latency_report_times(const LATENCY_HISTOGRAM *pH)
+{
+static const int aiPercent[3] = { 50, 90, 99 };
+int i1;
+
+  for(i1=0; i1 < 3; i1++)
+  {
+    fprintf(stderr, " %8.3f", latency_percentile(pH, aiPercent[i1]) / 1000.0);
+  }
+
+  fprintf(stderr, " %8.3f ", pH->qwMax / 1000.0);
+}
+
+void metrics_latency_report(void)
+{
+LATENCY_COMMAND *pL;
+int i1;
+
+  pthread_mutex_lock(&mtxLatency);
+
+  if(!nLatency)
+  {
+    pthread_mutex_unlock(&mtxLatency);
+    return;
+  }
+
+  qsort(apLatency, nLatency, sizeof(apLatency[0]), latency_compare);
+
+  fprintf(stderr, "\n%-15s %6s %6s  %-36s %-36s %8s  %s\n",
+          "command", "count", "t/out", "time to first byte (msecs)", "time to reply (msecs)",
+          "total", "repeats");
+  fprintf(stderr, "%-15s %6s %6s  %8s %8s %8s %8s  %8s %8s %8s %8s   %8s  %4s %4s\n",
+          "", "", "", "p50", "p90", "p99", "max", "p50", "p90", "p99", "max", "(secs)", "avg", "max");
+
+  for(i1=0; i1 < nLatency; i1++)
+  {
+    pL = apLatency[i1];
+
+    fprintf(stderr, "%-15s %6llu %6llu ", pL->szVerb, pL->sRepeats.qwCount, pL->qwTimeouts);
+
+    latency_report_times(&(pL->sFirstByte));
+    latency_report_times(&(pL->sReply));
+
+    fprintf(stderr, " %8.3f  %4.1f %4llu\n", pL->sReply.qwSum / 1000000.0,
+            pL->sRepeats.qwCount ? (double)pL->sRepeats.qwSum / pL->sRepeats.qwCount : 0.0,
+            pL->sRepeats.qwMax);
+  }
+
+  pthread_mutex_unlock(&mtxLatency);
+}
@@ -0,0 +1,124 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftmetrics.h - always-on I/O and protocol counters for sftardcal
+//
+// Each thread that counts something gets its own block of counters (on its
+// own cache lines), so 'metrics_add()' is a plain add with no lock and no
+// shared cache line.  The blocks are only ever added to a list, never removed,
+// and a reader adds them all up.  A counter may be a little behind while it's
+// being read, but it never goes backwards.
+//
+// The totals are available in Prometheus text format on a local socket
+// ('-S path') and are written to stderr on SIGUSR1 (see 'metrics_signal()').
+//
+// Each command/reply exchange also goes into log-bucketed (HDR style)
+// histograms for its first word: time to the first byte of the reply, time
+// to the reply itself, and the number of repeats.  '-H' prints a table of
+// the percentiles at exit.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTMETRICS_H_INCLUDED_
+#define _SFTMETRICS_H_INCLUDED_
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+
+// keep this in the same order as 'aMetricInfo' in sftmetrics.c
+enum
+{
+  METRIC_SERIAL_RX_BYTES,
+  METRIC_SERIAL_TX_BYTES,
+  METRIC_SERIAL_RX_SYSCALLS,
+  METRIC_SERIAL_TX_SYSCALLS,
+  METRIC_POLL_WAKEUPS,
+  METRIC_COMMANDS,
+  METRIC_COMMAND_REPEATS,
+  METRIC_COMMAND_TIMEOUTS,
+  METRIC_XMODEM_BLOCK_SENT,
+  METRIC_XMODEM_BLOCK_RECEIVED,
+  METRIC_XMODEM_NAK_SENT,
+  METRIC_XMODEM_NAK_RECEIVED,
+  METRIC_XMODEM_RETRANSMIT,
+  METRIC_DROPPED_FANOUT,
+  METRIC_DROPPED_CAPTURE,
+  METRIC_SERIAL_RING_FULL,
+  METRIC_TELEMETRY_SAMPLES,
+  METRIC_TELEMETRY_SKIPPED,
+  METRIC_TELEMETRY_WAITS,
+  METRIC_POLL_OVERRUNS,
+  METRIC_POLL_MISSED,
+  METRIC_FRAMES_SENT,
+  METRIC_FRAMES_RECEIVED,
+  METRIC_FRAME_ERRORS,
+  METRIC_FRAME_STALE,
+  METRIC_BAUD_UP,
+  METRIC_BAUD_DOWN,
+  METRIC_COUNT
+};
+
+
+#ifndef WIN32
+
+typedef struct _METRICS_BLOCK_
+{
+  unsigned long long aqwCount[METRIC_COUNT];
+  struct _METRICS_BLOCK_ *pNext;
+} __attribute__((aligned(64))) METRICS_BLOCK;
+
+extern __thread METRICS_BLOCK *pMetricsThread; // this thread's block, NULL until it counts something
+
+METRICS_BLOCK *metrics_register(void);         // allocates this thread's block
+
+static inline void metrics_add(int iMetric, unsigned long long qwCount)
+{
+METRICS_BLOCK *pB = pMetricsThread;
+
+  if(!pB)
+  {
+    pB = metrics_register();
+  }
+
+  // only this thread writes it.  the atomic store keeps a reader from seeing half of it
+  __atomic_store_n(&(pB->aqwCount[iMetric]), pB->aqwCount[iMetric] + qwCount, __ATOMIC_RELAXED);
+}
+
+unsigned long long metrics_total(int iMetric);
+
+int metrics_format(char *pBuf, int cbBuf);  // Prometheus text format, returns the length.  no stdio or malloc
+void metrics_dump(int iFile);               // 'metrics_format' to a file
+
+int metrics_signal(int iSig);               // 'iSig' dumps to stderr.  call before any other thread starts
+int metrics_serve(const char *szPath);      // starts a thread that answers on a Unix socket
+void metrics_stop(void);                    // stops it, removes the socket
+
+#define METRICS_NO_TIME (~0ULL) /* for 'metrics_latency', it didn't happen */
+
+unsigned long long metrics_usecs(void);     // monotonic clock
+void metrics_latency(const char *szCommand, unsigned long long qwFirstByte, unsigned long long qwReply, int nRepeats);
+                                            // usecs since the command was sent.  'qwReply' is METRICS_NO_TIME for a timeout
+void metrics_latency_report(void);          // percentile table on stderr
+
+#else // WIN32
+
+#define metrics_add(X,Y)
+#define METRICS_NO_TIME (~0ULL)
+#define metrics_usecs() 0ULL
+#define metrics_latency(W,X,Y,Z)
+#define metrics_latency_report()
+
+#endif // WIN32
+
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // _SFTMETRICS_H_INCLUDED_
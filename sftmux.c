@@ -0,0 +1,249 @@
+// sftmux.c - virtual channels over one serial link ('sftardcal -V'), for the host and for ARDUINO
+//
+// See 'sftmux.h'.  Sequence numbers are 8 bits and compared modulo 256, so a
+// window is never more than 127 frames.  A frame "behind" the one expected is
+// a duplicate, and one ahead of it means the ones in between were lost (the
+// stream goes on without them, and 'dwLost' counts them).
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include "sftmux.h"
+
+
+void mux_init(MUX *pM, MUX_DATA_PROC pfnData, void *pCtx)
+{
+int i1;
+
+  memset(pM, 0, sizeof(*pM));
+
+  for(i1=0; i1 < MUX_CHANNELS; i1++)
+  {
+    pM->aCh[i1].bWeight = 1;
+    pM->aCh[i1].bWindow = MUX_WINDOW; // nothing is sent until the peer's first CREDIT frame
+  }
+
+  pM->pfnData = pfnData;
+  pM->pCtx = pCtx;
+}
+
+void mux_weight(MUX *pM, int iChannel, int iWeight)
+{
+  pM->aCh[iChannel].bWeight = (uint8_t)(iWeight < 0 ? 0 : iWeight > 255 ? 255 : iWeight);
+}
+
+void mux_window(MUX *pM, int iChannel, int iWindow)
+{
+  pM->aCh[iChannel].bWindow = (uint8_t)(iWindow < 1 ? 1 : iWindow > 127 ? 127 : iWindow);
+  pM->aCh[iChannel].bCreditDue = 1;
+}
+
+int mux_space(const MUX *pM, int iChannel)
+{
+  if(pM->aCh[iChannel].bEnd)
+  {
+    return 0;
+  }
+
+  return MUX_QUEUE_SIZE - pM->aCh[iChannel].cbQueue;
+}
+
+int mux_pending(const MUX *pM, int iChannel)
+{
+  return pM->aCh[iChannel].cbQueue + (pM->aCh[iChannel].bEnd == 1 ? 1 : 0);
+}
+
+int mux_write(MUX *pM, int iChannel, const void *pData, int cbData)
+{
+MUX_CHANNEL *pC = pM->aCh + iChannel;
+int i1, iTail;
+
+  if(cbData > mux_space(pM, iChannel))
+  {
+    cbData = mux_space(pM, iChannel);
+  }
+
+  for(i1=0, iTail=(pC->iHead + pC->cbQueue) % MUX_QUEUE_SIZE; i1 < cbData; i1++)
+  {
+    pC->aQueue[iTail] = ((const uint8_t *)pData)[i1];
+    iTail = (iTail + 1) % MUX_QUEUE_SIZE;
+  }
+
+  pC->cbQueue += (uint16_t)cbData;
+
+  return cbData;
+}
+
+void mux_close(MUX *pM, int iChannel)
+{
+  if(!pM->aCh[iChannel].bEnd)
+  {
+    pM->aCh[iChannel].bEnd = 1;
+  }
+}
+
+void mux_refresh(MUX *pM)
+{
+int i1;
+
+  for(i1=0; i1 < MUX_CHANNELS; i1++)
+  {
+    pM->aCh[i1].bCreditDue = 1;
+  }
+}
+
+int mux_input(MUX *pM, const FRAME_VIEW *pV)
+{
+MUX_CHANNEL *pC;
+uint8_t bDiff;
+
+  if((pV->bType != FRAME_TYPE_CHANNEL && pV->bType != FRAME_TYPE_CREDIT) || !pV->cbData ||
+     (pV->pData[0] & MUX_CHANNEL_MASK) >= MUX_CHANNELS)
+  {
+    return 0;
+  }
+
+  pC = pM->aCh + (pV->pData[0] & MUX_CHANNEL_MASK);
+
+  if(pV->bType == FRAME_TYPE_CREDIT)
+  {
+    // newer than what it had (an old one that arrived late would take some back)
+    if(pV->cbData >= 2 && (uint8_t)(pV->pData[1] - pC->bSendLimit) < 128)
+    {
+      pC->bSendLimit = pV->pData[1];
+    }
+
+    return 1;
+  }
+
+  bDiff = (uint8_t)(pV->bSeq - pC->bRecvSeq);
+
+  if(bDiff >= 128) // already had it
+  {
+    pC->bCreditDue = 1; // it may not have had the last credit
+    return 1;
+  }
+
+  pC->dwLost += bDiff;
+  pC->dwFrames++;
+  pC->bRecvSeq = (uint8_t)(pV->bSeq + 1);
+
+  if(pM->pfnData)
+  {
+    pM->pfnData(pM->pCtx, pV->pData[0] & MUX_CHANNEL_MASK, pV->pData + 1, pV->cbData - 1,
+                (pV->pData[0] & MUX_FLAG_END) != 0);
+  }
+
+  // the window moves along once half of it is used
+  if((uint8_t)(pC->bRecvSeq + pC->bWindow - pC->bGrant) >= (pC->bWindow + 1) / 2)
+  {
+    pC->bCreditDue = 1;
+  }
+
+  return 1;
+}
+
+// can it send a frame now?
+static int mux_ready(const MUX_CHANNEL *pC)
+{
+uint8_t bLeft = (uint8_t)(pC->bSendLimit - pC->bSendSeq); // frames the peer still takes
+
+  if(!pC->bWeight || (!pC->cbQueue && pC->bEnd != 1))
+  {
+    return 0;
+  }
+
+  return bLeft >= 1 && bLeft <= 127;
+}
+
+int mux_output(MUX *pM, uint8_t *pOut, int cbOut)
+{
+uint8_t aData[FRAME_MAX_DATA];
+MUX_CHANNEL *pC;
+int i1, i2, cb1;
+
+  // credit first, it's small and the other side may be waiting for it
+  for(i1=0; i1 < MUX_CHANNELS; i1++)
+  {
+    pC = pM->aCh + i1;
+
+    if(pC->bCreditDue)
+    {
+      pC->bCreditDue = 0;
+      pC->bGrant = (uint8_t)(pC->bRecvSeq + pC->bWindow);
+
+      aData[0] = (uint8_t)i1;
+      aData[1] = pC->bGrant;
+
+      return frame_encode(pOut, cbOut, FRAME_TYPE_CREDIT, 0, aData, 2);
+    }
+  }
+
+  // then the channels, round robin.  Each one that's ready gets 'bWeight' full frames
+  // of deficit when its turn comes, and keeps the turn while that lasts
+  for(i1=0; i1 <= MUX_CHANNELS; i1++)
+  {
+    pC = pM->aCh + pM->iNext;
+
+    if(mux_ready(pC))
+    {
+      cb1 = pC->cbQueue < MUX_QUANTUM ? pC->cbQueue : MUX_QUANTUM;
+
+      if(pC->lDeficit >= cb1)
+      {
+        pC->lDeficit -= cb1;
+
+        aData[0] = pM->iNext;
+
+        for(i2=0; i2 < cb1; i2++)
+        {
+          aData[i2 + 1] = pC->aQueue[(pC->iHead + i2) % MUX_QUEUE_SIZE];
+        }
+
+        if(pC->bEnd == 1 && cb1 == pC->cbQueue) // the last of it
+        {
+          aData[0] |= MUX_FLAG_END;
+        }
+
+        i2 = frame_encode(pOut, cbOut, FRAME_TYPE_CHANNEL, pC->bSendSeq, aData, cb1 + 1);
+
+        if(!i2) // 'pOut' is too small
+        {
+          return 0;
+        }
+
+        pC->iHead = (uint16_t)((pC->iHead + cb1) % MUX_QUEUE_SIZE);
+        pC->cbQueue -= (uint16_t)cb1;
+        pC->bSendSeq++;
+
+        if(aData[0] & MUX_FLAG_END)
+        {
+          pC->bEnd = 2;
+        }
+
+        return i2;
+      }
+    }
+    else
+    {
+      pC->lDeficit = 0; // nothing to send (or no credit) doesn't save up for later
+    }
+
+    pM->iNext = (uint8_t)((pM->iNext + 1) % MUX_CHANNELS);
+
+    pC = pM->aCh + pM->iNext;
+
+    if(mux_ready(pC))
+    {
+      pC->lDeficit += (int32_t)pC->bWeight * MUX_QUANTUM;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftmux.h - virtual channels over one serial link ('sftardcal -V')
+//
+// With XMODEM, or anything else that has the whole link, the console and
+// telemetry stop until it's done.  Instead, in framed mode ('sftframe.h'),
+// each side can keep several streams going at once, one per channel:
+//
+//   MUX_CHANNEL_CONSOLE    what's typed, and what the device says back
+//   MUX_CHANNEL_TELEMETRY  measurements the device streams ('-T', '-G')
+//   MUX_CHANNEL_FILE       a file sent to the device ('-U')
+//   MUX_CHANNEL_CONTROL    anything else
+//
+// A FRAME_TYPE_CHANNEL frame carries the channel number (with MUX_FLAG_END
+// on the last frame of a stream), then the next part of its stream.  The
+// frame's sequence number counts that channel's frames, so the receiver knows
+// when one was lost.
+//
+// Flow control is by credit:  a receiver grants each channel a window of
+// frames (FRAME_TYPE_CREDIT, the channel and the sequence number the sender
+// may go up to but not including), and moves it along as frames arrive.  A
+// sender with nothing granted waits, so a device with little RAM sets a small
+// window, and a slow channel never fills the link for the others.  A lost
+// CREDIT frame is fixed by the next one ('mux_refresh()' now and then).
+//
+// The link is shared by weighted round robin (deficit round robin, in bytes):
+// each channel that has something to send gets 'weight' full frames per round.
+// A channel that's mostly idle (the console) waits for one frame of each of the
+// others at most, while bulk data fills in the rest.
+//
+// Like 'sftframe.c', this builds for the host and for ARDUINO and does no I/O.
+// i.e.
+//
+//   mux_init(&sM, data_callback, pCtx);
+//   mux_weight(&sM, MUX_CHANNEL_FILE, 1);
+//   mux_refresh(&sM);                           // the first credits
+//   ...
+//   mux_write(&sM, MUX_CHANNEL_CONSOLE, "V\n", 2);
+//   while((cb1 = mux_output(&sM, aBuf, sizeof(aBuf))) > 0)
+//     write(iFile, aBuf, cb1);
+//   ...
+//   mux_input(&sM, &sView);                     // each frame that arrives
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTMUX_H_INCLUDED_
+#define _SFTMUX_H_INCLUDED_
+
+#include "sftframe.h"
+
+
+#define MUX_CHANNELS          4
+#define MUX_CHANNEL_CONSOLE   0
+#define MUX_CHANNEL_TELEMETRY 1
+#define MUX_CHANNEL_FILE      2
+#define MUX_CHANNEL_CONTROL   3
+
+#define MUX_FLAG_END          0x80 /* with the channel number:  the last frame of the stream */
+#define MUX_CHANNEL_MASK      0x0f
+
+#define MUX_QUANTUM           (FRAME_MAX_DATA - 1) /* stream bytes in a full frame */
+
+#ifdef ARDUINO
+#ifndef MUX_QUEUE_SIZE
+#define MUX_QUEUE_SIZE        64   /* bytes waiting to be sent, per channel */
+#endif // MUX_QUEUE_SIZE
+#ifndef MUX_WINDOW
+#define MUX_WINDOW            2    /* frames granted ahead, per channel */
+#endif // MUX_WINDOW
+#else // ARDUINO
+#ifndef MUX_QUEUE_SIZE
+#define MUX_QUEUE_SIZE        4096
+#endif // MUX_QUEUE_SIZE
+#ifndef MUX_WINDOW
+#define MUX_WINDOW            16
+#endif // MUX_WINDOW
+#endif // ARDUINO
+
+
+typedef struct _MUX_CHANNEL_
+{
+  // sending
+  uint8_t aQueue[MUX_QUEUE_SIZE];
+  uint16_t iHead, cbQueue;  // a ring
+  uint8_t bWeight;          // full frames per round, 0 for none at all
+  uint8_t bEnd;             // 1 after 'mux_close()', 2 once the END frame is sent
+  uint8_t bSendSeq;         // the next frame's sequence number
+  uint8_t bSendLimit;       // the peer takes frames up to this one (not including it)
+  int32_t lDeficit;         // bytes it can still send this round
+
+  // receiving
+  uint8_t bRecvSeq;         // the sequence number expected next
+  uint8_t bGrant;           // the limit last sent to the peer
+  uint8_t bWindow;          // frames granted ahead, 1 to 127
+  uint8_t bCreditDue;       // a CREDIT frame needs to go out
+  uint32_t dwFrames;        // received
+  uint32_t dwLost;          // missing from the sequence
+} MUX_CHANNEL;
+
+// called for each part of a channel's stream as it arrives.  'pData' is in the frame reader's buffer
+typedef void (*MUX_DATA_PROC)(void *pCtx, int iChannel, const uint8_t *pData, int cbData, int bEnd);
+
+typedef struct _MUX_
+{
+  MUX_CHANNEL aCh[MUX_CHANNELS];
+  uint8_t iNext;            // the round robin's position
+  MUX_DATA_PROC pfnData;
+  void *pCtx;
+} MUX;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+void mux_init(MUX *pM, MUX_DATA_PROC pfnData, void *pCtx); // weight 1 and MUX_WINDOW for every channel
+void mux_weight(MUX *pM, int iChannel, int iWeight);
+void mux_window(MUX *pM, int iChannel, int iWindow);       // frames the peer may send ahead (1 to 127)
+
+int mux_space(const MUX *pM, int iChannel);                // bytes 'mux_write()' takes now
+int mux_pending(const MUX *pM, int iChannel);              // queued and not sent yet (the END frame counts as 1)
+int mux_write(MUX *pM, int iChannel, const void *pData, int cbData); // how many it took
+void mux_close(MUX *pM, int iChannel);                     // MUX_FLAG_END after the rest is sent
+
+int mux_input(MUX *pM, const FRAME_VIEW *pV);              // 1 if it was a CHANNEL or CREDIT frame
+int mux_output(MUX *pM, uint8_t *pOut, int cbOut);         // the next frame, encoded.  0 for nothing to send
+void mux_refresh(MUX *pM);                                 // sends every channel's credit again
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // _SFTMUX_H_INCLUDED_
@@ -0,0 +1,194 @@
+// sftpeek.c - reads the samples that 'sftardcal -G /name' publishes in shared memory
+//
+// Without '-f' it prints the newest value of each field (and how old it is),
+// once, or every '-i' msecs.  With '-f' it follows the ring and writes every
+// sample as CSV until sftardcal exits, the way a logger would.  It is also the
+// example for using 'sftshm.h' in another program.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sftshm.h"
+
+
+static const char *pApp;
+static SHM_READER sShm;
+
+
+static void peek_usage(void)
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-f][-i msecs] /name\n"
+          " where\t'/name' is the shared memory from 'sftardcal -G /name'\n"
+          " and\t-f follows the samples as they arrive (CSV on stdout) until\n"
+          "\t   sftardcal exits.  Samples that were missed are counted on stderr\n"
+          " and\t-i prints the newest values every 'msecs' instead of once\n"
+          "\n"
+          "-and-\t-h prints this message\n\n", pApp, pApp);
+}
+
+static uint64_t peek_now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void peek_latest(void)
+{
+SHM_LATEST sL;
+uint64_t qwNow;
+unsigned int dw1;
+
+  shm_reader_latest(&sShm, &sL);
+  qwNow = peek_now() - sShm.pH->qwStartMonotonic;
+
+  printf("%llu samples%s\n", (unsigned long long)sL.qwSamples,
+         (sShm.pH->dwFlags & SHM_FLAG_CLOSED) ? " (closed)" : "");
+
+  for(dw1=0; dw1 < sShm.pH->nFields; dw1++)
+  {
+    if(isnan(sL.aValue[dw1]))
+    {
+      printf("  %-16.16s  -\n", sShm.pH->aszField[dw1]);
+    }
+    else
+    {
+      printf("  %-16.16s  %-14.7g %.3f msecs ago\n", sShm.pH->aszField[dw1], sL.aValue[dw1],
+             (qwNow - sL.aqwTime[dw1]) / 1e6);
+    }
+  }
+
+  fflush(stdout);
+}
+
+static void peek_follow(void)
+{
+SHM_SLOT sSlot;
+unsigned int dw1;
+
+  fputs("time", stdout);
+
+  for(dw1=0; dw1 < sShm.pH->nFields; dw1++)
+  {
+    printf(",%.*s", TELEMETRY_NAME_SIZE, sShm.pH->aszField[dw1]);
+  }
+
+  putchar('\n');
+
+  for(;;)
+  {
+    if(!shm_reader_next(&sShm, &sSlot))
+    {
+      if(sShm.pH->dwFlags & SHM_FLAG_CLOSED)
+      {
+        break;
+      }
+
+      fflush(stdout);
+      usleep(1000); // polling, there's nothing to wait on
+
+      continue;
+    }
+
+    printf("%u.%06u", (unsigned int)(sSlot.qwTime / 1000000000ULL),
+           (unsigned int)(sSlot.qwTime % 1000000000ULL / 1000));
+
+    for(dw1=0; dw1 < sShm.pH->nFields; dw1++)
+    {
+      if(isnan(sSlot.aValue[dw1]))
+      {
+        putchar(',');
+      }
+      else
+      {
+        printf(",%.7g", sSlot.aValue[dw1]);
+      }
+    }
+
+    putchar('\n');
+  }
+
+  fflush(stdout);
+
+  if(sShm.qwLost)
+  {
+    fprintf(stderr, "%llu samples were overwritten before they were read\n", (unsigned long long)sShm.qwLost);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+int i1, bFollow = 0, iInterval = 0;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hfi:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'f':
+        bFollow = 1;
+        break;
+      case 'i':
+        iInterval = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Illegal or unrecognized option\n");
+      case 'h':
+      case '?':
+        peek_usage();
+        return 1;
+    }
+  }
+
+  if(optind != argc - 1)
+  {
+    peek_usage();
+    return 1;
+  }
+
+  if(shm_reader_open(&sShm, argv[optind]))
+  {
+    fprintf(stderr, "No samples in \"%s\" - is 'sftardcal -G %s' running?\n", argv[optind], argv[optind]);
+    return 1;
+  }
+
+  if(bFollow)
+  {
+    peek_follow();
+  }
+  else
+  {
+    do
+    {
+      peek_latest();
+
+      if(iInterval > 0)
+      {
+        usleep(iInterval * 1000);
+      }
+
+    } while(iInterval > 0 && !(sShm.pH->dwFlags & SHM_FLAG_CLOSED));
+  }
+
+  shm_reader_close(&sShm);
+
+  return 0;
+}
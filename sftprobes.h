@@ -0,0 +1,71 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftprobes.h - USDT (static tracepoint) probes for sftardcal
+//
+// On Linux, when <sys/sdt.h> is available (the 'systemtap-sdt-dev' package on
+// Debian and Ubuntu, 'systemtap-sdt-devel' on Fedora), each SFT_PROBEn() is a
+// single 'nop' plus a note in the ELF file.  That costs nothing unless a
+// tracer attaches to it.  To list them:
+//
+//   bpftrace -l 'usdt:./sftardcal:*'
+//   perf buildid-cache --add ./sftardcal && perf list sdt
+//
+// Without <sys/sdt.h> (or with 'make USDT=0', which defines NO_USDT) the
+// probes are left out completely.
+//
+// Probes (provider 'sftardcal') and their arguments:
+//
+//   serial__read    fd, result, bytes asked for        my_read() returned
+//   serial__write   fd, result, bytes asked for        my_write() returned
+//   line            fd, text, length                   my_gets2() has a line
+//   command__send   command (NULL for ESC), repeat     sent (repeat is 0 the first time)
+//   command__reply  command, reply, usecs, repeats     first non-echo reply
+//   command__timeout command, usecs, repeats           no reply
+//   reset__start    fd                                 RTS/DTR reset begins
+//   reset__end      fd, msecs                          device had time to start
+//   xmodem__send__packet  block, bytes                 sender wrote a block
+//   xmodem__recv__ack     block                        sender got an ACK for it
+//   xmodem__recv__nak     block, errors                sender got NAK or 'C'
+//   xmodem__recv__packet  block, bytes                 receiver accepted a block
+//   xmodem__send__nak     block, errors                receiver rejected a block
+//
+// i.e. time each command by its text:
+//
+//   bpftrace -e 'usdt:./sftardcal:command__reply { @[str(arg0)] = hist(arg2); }'
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTPROBES_H_INCLUDED_
+#define _SFTPROBES_H_INCLUDED_
+
+// FreeBSD has a <sys/sdt.h> too, but it's the kernel one
+#if defined(__linux__) && !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SFT_USDT
+#endif // __has_include(<sys/sdt.h>)
+#endif // __linux__
+
+#ifdef SFT_USDT
+
+#define SFT_PROBE1(X,A)       DTRACE_PROBE1(sftardcal, X, A)
+#define SFT_PROBE2(X,A,B)     DTRACE_PROBE2(sftardcal, X, A, B)
+#define SFT_PROBE3(X,A,B,C)   DTRACE_PROBE3(sftardcal, X, A, B, C)
+#define SFT_PROBE4(X,A,B,C,D) DTRACE_PROBE4(sftardcal, X, A, B, C, D)
+
+#else // SFT_USDT
+
+// never run, but the arguments are still checked (and count as used)
+#define SFT_PROBE1(X,A)       do { if(0) { (void)(A); } } while(0)
+#define SFT_PROBE2(X,A,B)     do { if(0) { (void)(A); (void)(B); } } while(0)
+#define SFT_PROBE3(X,A,B,C)   do { if(0) { (void)(A); (void)(B); (void)(C); } } while(0)
+#define SFT_PROBE4(X,A,B,C,D) do { if(0) { (void)(A); (void)(B); (void)(C); (void)(D); } } while(0)
+
+#endif // SFT_USDT
+
+#endif // _SFTPROBES_H_INCLUDED_
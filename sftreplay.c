@@ -0,0 +1,604 @@
+// sftreplay.c - plays a capture file back as the device, on a pty
+//
+// 'sftardcal -C file' records a session.  sftreplay creates a pseudo-terminal
+// and acts as the device end of that session:  whatever the device sent (RX)
+// is written to the pty with the recorded timing, and whatever the tool sent
+// (TX) is expected back from the pty, byte for byte.  Point a new build of
+// sftardcal at the pty with the same command line, and a field failure plays
+// out the same way every time, without the hardware.  The name of the pty is
+// written to stdout, the same as 'sftemu'.
+//
+// Timing is causal.  Each record is scheduled relative to the one before it,
+// so device data is written once the recorded gap has passed since the
+// previous event, and never before the tool data that preceded it in the
+// recording has arrived.  '-x factor' divides every gap ('-x 10' is ten times
+// as fast, '-x 0' does not wait at all).  The capture keeps the data in the
+// chunks that were actually read or written, so that's the resolution of the
+// inter-byte timing.
+//
+// The session is split into exchanges at each command boundary in the capture
+// (if there are none, at each point where the tool starts sending after the
+// device did).  Once the tool closes the pty, a table compares how long each
+// exchange took in the recording (divided by the factor) with the replay.
+//
+// Builds 'sftardcal.c' into the same translation unit (SFTARDCAL_LIBRARY leaves
+// out its 'main') so that the hex dump is the same code.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#define SFTARDCAL_LIBRARY
+#include "sftardcal.c"
+
+#include <time.h>
+
+
+typedef struct _REPLAY_EXCHANGE_
+{
+  char szName[32];          // the command, or the start of what the tool sent
+  uint64_t qwRecStart;      // recorded, nsecs since the capture started
+  uint64_t qwRecEnd;
+  uint64_t qwStart;         // replay, CLOCK_MONOTONIC nsecs
+  uint64_t qwEnd;
+  unsigned long cbSent;     // by the tool
+  unsigned long cbReceived; // by the tool, i.e. written to the pty
+  unsigned long cbDiff;     // bytes from the tool that did not match
+} REPLAY_EXCHANGE;
+
+static CAPTURE_READER sCap;
+static volatile int bReplayQuit = 0;
+static double dFactor = 1.0;
+static int iTimeout = 5000;  // msecs to wait for data from the tool
+static char *pszLinkName = NULL;
+
+static REPLAY_EXCHANGE *pExch = NULL;
+static int nExch = 0, nExchMax = 0;
+
+static unsigned char aIn[65536]; // received from the tool, not compared yet
+static int cbIn = 0;
+static unsigned long long qwInPos = 0; // offset into everything the tool sent
+
+// the last event, as recorded and as replayed.  the next one is scheduled from here
+static uint64_t qwAnchorRec = 0, qwAnchorNow = 0;
+
+
+static void replay_usage(void)
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-v][-l linkname][-x factor][-t msecs] capture_file\n"
+          " where\t'capture_file' was written by 'sftardcal -C'\n"
+          " and\t-l creates a symbolic link to the pty (removed on exit)\n"
+          " and\t-x divides the recorded timing by 'factor' (default 1, 0 for no delays)\n"
+          " and\t-t is how long to wait for the tool's data once it's due (default\n"
+          "\t   5000 msecs).  Fixed delays in the tool itself aren't divided by '-x'\n"
+          " and\t-v shows each mismatch as a hex dump\n"
+          "\n"
+          "-and-\t-h prints this message\n\n"
+          "The name of the pty is written to stdout.  The exit code is 1 if the\n"
+          "data from the tool did not match the recording\n\n", pApp, pApp);
+}
+
+static void replay_signal(int iSig)
+{
+  bReplayQuit = 1;
+}
+
+static uint64_t replay_now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// when the record at 'qwRec' is due, in replay time
+static uint64_t replay_due(uint64_t qwRec)
+{
+  if(dFactor <= 0.0 || qwRec <= qwAnchorRec)
+  {
+    return qwAnchorNow;
+  }
+
+  return qwAnchorNow + (uint64_t)((double)(qwRec - qwAnchorRec) / dFactor);
+}
+
+// same as sftemu - the slave side is raw until the application sets it up
+static int replay_open_pty(void)
+{
+struct termios sIOS;
+int iPty, iSlave;
+char *pszSlave;
+
+  iPty = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if(iPty == -1 || grantpt(iPty) || unlockpt(iPty) || !(pszSlave = ptsname(iPty)))
+  {
+    fprintf(stderr, "%s: unable to create pty, errno=%d\n", pApp, errno);
+    return -1;
+  }
+
+  iSlave = open(pszSlave, O_RDWR | O_NOCTTY);
+  if(iSlave != -1)
+  {
+    if(!tcgetattr(iSlave, &sIOS))
+    {
+      cfmakeraw(&sIOS);
+      tcsetattr(iSlave, TCSANOW, &sIOS);
+    }
+
+    close(iSlave);
+  }
+
+  if(pszLinkName)
+  {
+    unlink(pszLinkName);
+
+    if(symlink(pszSlave, pszLinkName))
+    {
+      fprintf(stderr, "%s: unable to create link \"%s\", errno=%d\n", pApp, pszLinkName, errno);
+    }
+  }
+
+  fcntl(iPty, F_SETFL, fcntl(iPty, F_GETFL) | O_NONBLOCK);
+
+  fprintf(stdout, "%s\n", pszSlave);
+  fflush(stdout);
+
+  return iPty;
+}
+
+// wait until 'qwUntil', keeping whatever the tool sends in 'aIn'.  returns 0 when
+// the time is up, 1 as soon as something is read if 'bAny' is set, -1 if the
+// tool closed the pty (or ^C)
+static int replay_wait(int iPty, uint64_t qwUntil, int bAny)
+{
+struct pollfd sFD;
+struct timespec ts;
+uint64_t qwNow;
+int i1;
+
+  while(!bReplayQuit)
+  {
+    qwNow = replay_now();
+
+    if(qwNow >= qwUntil)
+    {
+      return 0;
+    }
+
+    ts.tv_sec = (qwUntil - qwNow) / 1000000000ULL;
+    ts.tv_nsec = (qwUntil - qwNow) % 1000000000ULL;
+
+    sFD.fd = iPty;
+    sFD.events = cbIn < (int)sizeof(aIn) ? POLLIN : 0;
+    sFD.revents = 0;
+
+    if(ppoll(&sFD, 1, &ts, NULL) <= 0)
+    {
+      continue;
+    }
+
+    if(sFD.revents & POLLIN)
+    {
+      i1 = read(iPty, aIn + cbIn, sizeof(aIn) - cbIn);
+
+      if(i1 > 0)
+      {
+        cbIn += i1;
+
+        if(bAny)
+        {
+          return 1;
+        }
+
+        continue;
+      }
+    }
+
+    if(sFD.revents & (POLLHUP | POLLERR))
+    {
+      return -1;
+    }
+
+    if(!sFD.events) // nowhere to put it - the tool is way ahead of the recording
+    {
+      usleep(1000);
+    }
+  }
+
+  return -1;
+}
+
+static void replay_exchange(const char *pName, int cbName)
+{
+REPLAY_EXCHANGE *pE;
+int i1;
+
+  if(nExch >= nExchMax)
+  {
+    nExchMax = nExchMax ? nExchMax * 2 : 256;
+    pExch = realloc(pExch, nExchMax * sizeof(*pExch));
+
+    if(!pExch)
+    {
+      fputs("Not enough memory\n", stderr);
+      exit(2);
+    }
+  }
+
+  pE = pExch + nExch++;
+  memset(pE, 0, sizeof(*pE));
+
+  for(i1=0; i1 < cbName && i1 < (int)sizeof(pE->szName) - 1; i1++)
+  {
+    pE->szName[i1] = (pName[i1] >= 32 && pName[i1] < 127) ? pName[i1] : '.';
+  }
+
+  pE->qwRecStart = pE->qwRecEnd = qwAnchorRec;
+  pE->qwStart = pE->qwEnd = qwAnchorNow;
+}
+
+static void replay_event(uint64_t qwRec, uint64_t qwNow)
+{
+  qwAnchorRec = qwRec;
+  qwAnchorNow = qwNow;
+
+  pExch[nExch - 1].qwRecEnd = qwRec;
+  pExch[nExch - 1].qwEnd = qwNow;
+}
+
+// the device's data, once it's due.  returns non-zero if the tool closed the pty
+static int replay_send(int iPty, const unsigned char *pData, int cbData, uint64_t qwRec)
+{
+struct pollfd sFD;
+uint64_t qwDue;
+int i1, bBlocked = 0;
+
+  qwDue = replay_due(qwRec);
+
+  if(replay_wait(iPty, qwDue, 0) < 0)
+  {
+    return 1;
+  }
+
+  while(cbData > 0)
+  {
+    i1 = write(iPty, pData, cbData);
+
+    if(i1 > 0)
+    {
+      pData += i1;
+      cbData -= i1;
+      pExch[nExch - 1].cbReceived += i1;
+      continue;
+    }
+
+    if(i1 < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      return 1;
+    }
+
+    // the tool isn't reading.  keep reading from it, so it can't block us both
+    bBlocked = 1;
+
+    sFD.fd = iPty;
+    sFD.events = POLLOUT | (cbIn < (int)sizeof(aIn) ? POLLIN : 0);
+    sFD.revents = 0;
+
+    if(bReplayQuit || poll(&sFD, 1, iTimeout) <= 0 || (sFD.revents & (POLLHUP | POLLERR)))
+    {
+      return 1;
+    }
+
+    if(sFD.revents & POLLIN)
+    {
+      i1 = read(iPty, aIn + cbIn, sizeof(aIn) - cbIn);
+      cbIn += i1 > 0 ? i1 : 0;
+    }
+  }
+
+  // keep to the schedule, unless flow control held things up
+  replay_event(qwRec, bBlocked ? replay_now() : qwDue);
+
+  return 0;
+}
+
+// the tool's data, compared with the recording.  returns non-zero if it stopped sending
+static int replay_expect(int iPty, const unsigned char *pData, int cbData, uint64_t qwRec)
+{
+REPLAY_EXCHANGE *pE = pExch + nExch - 1;
+uint64_t qwDeadline;
+int i1, i2, cb1;
+
+  qwDeadline = replay_due(qwRec);
+
+  if(qwDeadline < replay_now())
+  {
+    qwDeadline = replay_now();
+  }
+
+  qwDeadline += (uint64_t)iTimeout * 1000000ULL;
+
+  for(i1=0; i1 < cbData; )
+  {
+    if(!cbIn)
+    {
+      i2 = replay_wait(iPty, qwDeadline, 1);
+
+      if(i2 <= 0)
+      {
+        fprintf(stderr, "exchange %d (%s):  %s with %d bytes still expected\n",
+                nExch, pE->szName, i2 < 0 ? "the tool closed the port" : "timed out", cbData - i1);
+        return 1;
+      }
+
+      continue;
+    }
+
+    cb1 = cbIn < cbData - i1 ? cbIn : cbData - i1;
+
+    if(memcmp(aIn, pData + i1, cb1))
+    {
+      for(i2=0; aIn[i2] == pData[i1 + i2]; i2++) { }
+
+      if(!pE->cbDiff) // the first one in each exchange
+      {
+        fprintf(stderr, "exchange %d (%s):  the tool sent different data at offset %llu\n",
+                nExch, pE->szName, qwInPos + i2);
+
+        if(iVerbosity > 0)
+        {
+          fputs("expected:\n", stderr);
+          sftardcal_debug_dump_file(stderr, 1, pData + i1 + i2, cb1 - i2 > 64 ? 64 : cb1 - i2);
+          fputs("received:\n", stderr);
+          sftardcal_debug_dump_file(stderr, 1, aIn + i2, cb1 - i2 > 64 ? 64 : cb1 - i2);
+        }
+      }
+
+      for( ; i2 < cb1; i2++)
+      {
+        pE->cbDiff += aIn[i2] != pData[i1 + i2];
+      }
+    }
+
+    cbIn -= cb1;
+    memmove(aIn, aIn + cb1, cbIn);
+
+    i1 += cb1;
+    qwInPos += cb1;
+    pE->cbSent += cb1;
+  }
+
+  replay_event(qwRec, replay_now());
+
+  return 0;
+}
+
+static void replay_report(void)
+{
+REPLAY_EXCHANGE *pE;
+double dRec, dReplay, dRecTotal = 0.0, dReplayTotal = 0.0;
+unsigned long cbSent = 0, cbReceived = 0, cbDiff = 0;
+int i1;
+
+  printf("\n%8s  %-24s  %8s  %8s  %12s  %12s  %10s\n",
+         "exchange", "command", "sent", "received", "recorded ms", "replay ms", "diff ms");
+
+  for(i1=0; i1 < nExch; i1++)
+  {
+    pE = pExch + i1;
+
+    if(!pE->cbSent && !pE->cbReceived && !pE->cbDiff)
+    {
+      continue; // i.e. '(open)' when the tool sends first
+    }
+
+    dRec = (double)(pE->qwRecEnd - pE->qwRecStart) / 1e6;
+    dRec = dFactor > 0.0 ? dRec / dFactor : 0.0;
+    dReplay = (double)(pE->qwEnd - pE->qwStart) / 1e6;
+
+    printf("%8d  %-24s  %8lu  %8lu  %12.3f  %12.3f  %+10.3f%s\n", i1 + 1, pE->szName,
+           pE->cbSent, pE->cbReceived, dRec, dReplay, dReplay - dRec,
+           pE->cbDiff ? "  DIFFERENT" : "");
+
+    dRecTotal += dRec;
+    dReplayTotal += dReplay;
+    cbSent += pE->cbSent;
+    cbReceived += pE->cbReceived;
+    cbDiff += pE->cbDiff;
+  }
+
+  printf("%8s  %-24s  %8lu  %8lu  %12.3f  %12.3f  %+10.3f\n", "", "total",
+         cbSent, cbReceived, dRecTotal, dReplayTotal, dReplayTotal - dRecTotal);
+
+  if(cbDiff)
+  {
+    printf("\n%lu bytes from the tool did not match the recording\n", cbDiff);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+CAPTURE_RECORD sRec;
+const unsigned char *pData;
+uint64_t qwTime;
+uint32_t dw1;
+unsigned long ulLost = 0;
+int i1, iPty, iRval = 0, bCommands = 0, iLast = 0;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hvl:x:t:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'v':
+        iVerbosity++;
+        break;
+      case 'l':
+        pszLinkName = optarg;
+        break;
+      case 'x':
+        dFactor = atof(optarg);
+        if(dFactor < 0.0)
+        {
+          fprintf(stderr, "Invalid factor %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 't':
+        iTimeout = atoi(optarg);
+        if(iTimeout <= 0)
+        {
+          fprintf(stderr, "Invalid timeout %s\n", optarg);
+          return 2;
+        }
+        break;
+      default:
+        fprintf(stderr, "Illegal or unrecognized option\n");
+      case 'h':
+      case '?':
+        replay_usage();
+        return 2;
+    }
+  }
+
+  if(optind != argc - 1)
+  {
+    replay_usage();
+    return 2;
+  }
+
+  if(capture_reader_open(&sCap, argv[optind]))
+  {
+    return 2;
+  }
+
+  // if there are command boundaries, those split up the exchanges
+  while((i1 = capture_reader_next(&sCap, &sRec, &pData, &qwTime)) > 0)
+  {
+    if(sRec.bType == CAPTURE_COMMAND)
+    {
+      bCommands = 1;
+    }
+    else if(sRec.bType == CAPTURE_LOST)
+    {
+      memcpy(&dw1, pData, sizeof(dw1));
+      ulLost += dw1;
+    }
+  }
+
+  if(i1 < 0)
+  {
+    return 2;
+  }
+
+  if(ulLost)
+  {
+    fprintf(stderr, "WARNING:  %lu bytes are missing from the capture, expect differences\n", ulLost);
+  }
+
+  capture_reader_seek(&sCap, 0);
+
+  signal(SIGINT, replay_signal);
+  signal(SIGTERM, replay_signal);
+  signal(SIGHUP, replay_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  iPty = replay_open_pty();
+  if(iPty == -1)
+  {
+    return 2;
+  }
+
+  // nothing happens until the tool opens the port (no more POLLHUP)
+  while(!bReplayQuit)
+  {
+    struct pollfd sFD = { iPty, POLLIN, 0 };
+
+    if(poll(&sFD, 1, 10) >= 0 && !(sFD.revents & POLLHUP))
+    {
+      break;
+    }
+
+    usleep(10000); // POLLHUP does not block, so don't spin
+  }
+
+  qwAnchorNow = replay_now();
+  replay_exchange("(open)", 6);
+
+  while(!iRval && !bReplayQuit &&
+        (i1 = capture_reader_next(&sCap, &sRec, &pData, &qwTime)) > 0)
+  {
+    switch(sRec.bType)
+    {
+      case CAPTURE_COMMAND:
+        replay_exchange((const char *)pData, sRec.wLength);
+        break;
+
+      case CAPTURE_TX:
+        if(!bCommands && iLast == CAPTURE_RX)
+        {
+          replay_exchange((const char *)pData, sRec.wLength);
+        }
+
+        iRval = replay_expect(iPty, pData, sRec.wLength, qwTime);
+        break;
+
+      case CAPTURE_RX:
+        iRval = replay_send(iPty, pData, sRec.wLength, qwTime);
+        break;
+    }
+
+    if(sRec.bType == CAPTURE_TX || sRec.bType == CAPTURE_RX)
+    {
+      iLast = sRec.bType;
+    }
+  }
+
+  if(!iRval && !bReplayQuit) // anything more from the tool is a difference too
+  {
+    while(replay_wait(iPty, replay_now() + (uint64_t)iTimeout * 1000000ULL, 1) > 0)
+    {
+      if(!pExch[nExch - 1].cbDiff)
+      {
+        fprintf(stderr, "exchange %d (%s):  the tool sent more than the recording\n",
+                nExch, pExch[nExch - 1].szName);
+      }
+
+      pExch[nExch - 1].cbDiff += cbIn;
+      qwInPos += cbIn;
+      cbIn = 0;
+    }
+  }
+
+  replay_report();
+
+  for(i1=0; i1 < nExch; i1++)
+  {
+    if(pExch[i1].cbDiff)
+    {
+      iRval = 1;
+    }
+  }
+
+  close(iPty);
+
+  if(pszLinkName)
+  {
+    unlink(pszLinkName);
+  }
+
+  capture_reader_close(&sCap);
+  free(pExch);
+
+  return iRval;
+}
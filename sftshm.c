@@ -0,0 +1,175 @@
+// sftshm.c - the latest telemetry samples in POSIX shared memory ('-G name[,n]')
+//
+// See 'sftshm.h' for the layout and the reading side.  'shm_publish()' runs
+// on the thread that parses the lines ('telemetry_line()'), and is the only
+// thing that writes to the segment, so the writer needs no lock:  a slot or
+// 'sLatest' is marked as changing, written, then marked complete, with the
+// barriers the readers' checks rely on.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sftshm.h"
+
+
+static SHM_HEADER *pShm = NULL;
+static size_t cbShm = 0;
+static char *pszShmName = NULL;
+
+
+int shm_publish_open(const char *szName, int nRing, const char *szDevice,
+                     int nFields, const char (*paszField)[TELEMETRY_NAME_SIZE],
+                     uint64_t qwStartMonotonic, uint64_t qwStartRealtime)
+{
+int i1, iFile;
+
+  if(nRing <= 0)
+  {
+    nRing = SHM_RING_DEFAULT;
+  }
+
+  for(i1=1; i1 < nRing; i1 <<= 1)
+  { } // round up to a power of 2
+
+  nRing = i1;
+
+  if(nRing > SHM_RING_MAX)
+  {
+    fprintf(stderr, "The shared memory ring can hold up to %d samples\n", SHM_RING_MAX);
+    return -1;
+  }
+
+  if(szName[0] != '/' || strchr(szName + 1, '/'))
+  {
+    fprintf(stderr, "Shared memory name \"%s\" must be '/name'\n", szName);
+    return -1;
+  }
+
+  cbShm = sizeof(SHM_HEADER) + (size_t)nRing * sizeof(SHM_SLOT);
+
+  shm_unlink(szName); // one left behind by a crash (readers of it see no more samples)
+
+  iFile = shm_open(szName, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+  if(iFile < 0)
+  {
+    fprintf(stderr, "Unable to create shared memory \"%s\", errno=%d\n", szName, errno);
+    return -1;
+  }
+
+  if(ftruncate(iFile, (off_t)cbShm))
+  {
+    fprintf(stderr, "Unable to size shared memory \"%s\", errno=%d\n", szName, errno);
+    close(iFile);
+    shm_unlink(szName);
+    return -1;
+  }
+
+  pShm = (SHM_HEADER *)mmap(NULL, cbShm, PROT_READ | PROT_WRITE, MAP_SHARED, iFile, 0);
+  close(iFile);
+
+  if(pShm == MAP_FAILED)
+  {
+    fprintf(stderr, "Unable to map shared memory \"%s\", errno=%d\n", szName, errno);
+    pShm = NULL;
+    shm_unlink(szName);
+    return -1;
+  }
+
+  // ftruncate() zeroed it, so the ring's sequence numbers and 'qwHead' are already 0
+  pShm->cbHeader = sizeof(SHM_HEADER);
+  pShm->cbSlot = sizeof(SHM_SLOT);
+  pShm->nRing = nRing;
+  pShm->nFields = nFields;
+  pShm->dwPid = (uint32_t)getpid();
+  pShm->qwStartMonotonic = qwStartMonotonic;
+  pShm->qwStartRealtime = qwStartRealtime;
+  strncpy(pShm->szDevice, szDevice ? szDevice : "", sizeof(pShm->szDevice) - 1);
+  memcpy(pShm->aszField, paszField, sizeof(pShm->aszField[0]) * nFields);
+
+  for(i1=0; i1 < TELEMETRY_MAX_FIELDS; i1++)
+  {
+    pShm->sLatest.aValue[i1] = NAN;
+  }
+
+  // the magic number last, a reader that finds it finds the rest
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(pShm->szMagic, SHM_MAGIC, sizeof(pShm->szMagic));
+
+  pszShmName = strdup(szName);
+
+  return 0;
+}
+
+void shm_publish(const TELEMETRY_SAMPLE *pS)
+{
+SHM_SLOT *pSlot;
+uint64_t qwHead;
+int i1;
+
+  if(!pShm)
+  {
+    return;
+  }
+
+  qwHead = pShm->qwHead; // only written here
+
+  // the ring slot:  incomplete, the data, then complete and counted
+  pSlot = SHM_RING(pShm) + (qwHead & (pShm->nRing - 1));
+
+  __atomic_store_n(&pSlot->qwSeq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  pSlot->qwTime = pS->qwTime;
+  memcpy(pSlot->aValue, pS->aValue, sizeof(pSlot->aValue[0]) * pShm->nFields);
+
+  __atomic_store_n(&pSlot->qwSeq, qwHead + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&pShm->qwHead, qwHead + 1, __ATOMIC_RELEASE);
+
+  // the newest values (a field the line didn't have keeps its old one)
+  __atomic_store_n(&pShm->dwLatestSeq, pShm->dwLatestSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  pShm->sLatest.qwSamples = qwHead + 1;
+  pShm->sLatest.qwTime = pS->qwTime;
+
+  for(i1=0; i1 < (int)pShm->nFields; i1++)
+  {
+    if(!isnan(pS->aValue[i1]))
+    {
+      pShm->sLatest.aValue[i1] = pS->aValue[i1];
+      pShm->sLatest.aqwTime[i1] = pS->qwTime;
+    }
+  }
+
+  __atomic_store_n(&pShm->dwLatestSeq, pShm->dwLatestSeq + 1, __ATOMIC_RELEASE);
+}
+
+void shm_publish_close(void)
+{
+  if(!pShm)
+  {
+    return;
+  }
+
+  __atomic_or_fetch(&pShm->dwFlags, SHM_FLAG_CLOSED, __ATOMIC_RELEASE);
+
+  munmap(pShm, cbShm);
+  pShm = NULL;
+
+  shm_unlink(pszShmName); // readers that have it mapped keep it until they're done
+  free(pszShmName);
+  pszShmName = NULL;
+}
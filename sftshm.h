@@ -0,0 +1,250 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sftshm.h - the latest telemetry samples in POSIX shared memory ('-G name[,n]')
+//
+// While sftardcal has the serial port open, other programs on the same machine
+// (a dashboard, an interlock, a logger) can read the samples that '-Y' parses
+// without touching the port and without a single system call per read.  The
+// segment (shm_open() 'name', i.e. "/sftardcal") has:
+//
+//   SHM_HEADER   field names, clocks, and the 'latest' values under a seqlock
+//   SHM_SLOT[n]  a ring of the last 'n' samples, each with its own sequence
+//
+// There is one writer.  Any number of readers can follow the ring, each with
+// its own position, and a reader that falls more than 'n' samples behind
+// skips ahead and is told how many it lost.  Nothing a reader does can slow
+// down the writer.
+//
+// A reader only needs this file - the reading functions are 'static inline',
+// below the writer's.  Link with '-lrt' on older glibc.  i.e.
+//
+//   SHM_READER sR;
+//   SHM_LATEST sL;
+//
+//   if(!shm_reader_open(&sR, "/sftardcal"))
+//   {
+//     shm_reader_latest(&sR, &sL);  // newest value of every field
+//     ...
+//     while(shm_reader_next(&sR, &sSlot) > 0) // every sample since the last call
+//     ...
+//     shm_reader_close(&sR);
+//   }
+//
+// The writer unlinks the name when it exits, and sets SHM_FLAG_CLOSED for the
+// readers that still have it mapped.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTSHM_H_INCLUDED_
+#define _SFTSHM_H_INCLUDED_
+
+#ifndef WIN32
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sfttelemetry.h"
+
+
+#define SHM_MAGIC         "SFTSHM01"
+#define SHM_RING_DEFAULT  4096 /* samples, a power of 2 */
+#define SHM_RING_MAX      (1 << 20)
+
+#define SHM_FLAG_CLOSED   1 /* the writer has exited, nothing more will arrive */
+
+// one sample in the ring.  'qwSeq' is the sample's number + 1 once it's complete,
+// 0 while it's being written
+typedef struct _SHM_SLOT_
+{
+  uint64_t qwSeq;
+  uint64_t qwTime;                      // nsecs since 'qwStartMonotonic'
+  float aValue[TELEMETRY_MAX_FIELDS];   // in field order, NaN if the line didn't have it
+} SHM_SLOT;
+
+// the newest value of each field, even if the last line didn't have all of them
+typedef struct _SHM_LATEST_
+{
+  uint64_t qwSamples;                   // samples so far
+  uint64_t qwTime;                      // time of the newest sample
+  uint64_t aqwTime[TELEMETRY_MAX_FIELDS]; // when each field was last seen (0 for never)
+  float aValue[TELEMETRY_MAX_FIELDS];   // NaN for never
+} SHM_LATEST;
+
+typedef struct _SHM_HEADER_
+{
+  char szMagic[8];            // SHM_MAGIC, not terminated
+  uint32_t cbHeader;          // sizeof(SHM_HEADER), the ring starts here
+  uint32_t cbSlot;            // sizeof(SHM_SLOT)
+  uint32_t nRing;             // slots, a power of 2
+  uint32_t nFields;
+  uint32_t dwPid;             // the writer
+  volatile uint32_t dwFlags;  // SHM_FLAG_xxx
+  uint64_t qwStartMonotonic;  // CLOCK_MONOTONIC nsecs for a time of 0
+  uint64_t qwStartRealtime;   // and the wall clock at the same moment
+  char szDevice[64];
+  char aszField[TELEMETRY_MAX_FIELDS][TELEMETRY_NAME_SIZE];
+
+  char aPad1[64];             // the writer's lines stay away from the read-only ones
+  volatile uint32_t dwLatestSeq; // seqlock - odd while 'sLatest' changes
+  uint32_t dwReserved;
+  SHM_LATEST sLatest;
+
+  char aPad2[64];
+  volatile uint64_t qwHead;   // samples written, the next one goes in slot 'qwHead & (nRing - 1)'
+  char aPad3[56];
+} SHM_HEADER;
+
+#define SHM_RING(pH) ((SHM_SLOT *)((char *)(pH) + (pH)->cbHeader))
+
+
+// writer (sftardcal) - see 'sftshm.c'
+int shm_publish_open(const char *szName, int nRing, const char *szDevice,
+                     int nFields, const char (*paszField)[TELEMETRY_NAME_SIZE],
+                     uint64_t qwStartMonotonic, uint64_t qwStartRealtime); // non-zero on error (message on stderr)
+void shm_publish(const TELEMETRY_SAMPLE *pS); // one sample, in the ring and in 'sLatest'
+void shm_publish_close(void);                 // sets SHM_FLAG_CLOSED and unlinks the name
+
+
+// ------
+// READER
+// ------
+//
+// The copies are checked against the sequence numbers afterwards, and made
+// again if the writer was in the middle of them, so nothing ever blocks.
+
+typedef struct _SHM_READER_
+{
+  SHM_HEADER *pH;
+  size_t cbMap;
+  uint64_t qwNext;   // next sample number for 'shm_reader_next()'
+  uint64_t qwLost;   // samples that were overwritten before they were read
+} SHM_READER;
+
+// maps the segment.  Non-zero if it isn't there (yet) or isn't one of these.
+// Reading starts with the newest sample
+static inline int shm_reader_open(SHM_READER *pR, const char *szName)
+{
+struct stat sSt;
+SHM_HEADER *pH;
+int iFile;
+
+  memset(pR, 0, sizeof(*pR));
+
+  iFile = shm_open(szName, O_RDONLY, 0);
+
+  if(iFile < 0)
+  {
+    return -1;
+  }
+
+  if(fstat(iFile, &sSt) || (size_t)sSt.st_size < sizeof(SHM_HEADER))
+  {
+    close(iFile);
+    return -1;
+  }
+
+  pH = (SHM_HEADER *)mmap(NULL, (size_t)sSt.st_size, PROT_READ, MAP_SHARED, iFile, 0);
+  close(iFile); // the mapping stays
+
+  if(pH == MAP_FAILED)
+  {
+    return -1;
+  }
+
+  if(memcmp(pH->szMagic, SHM_MAGIC, sizeof(pH->szMagic)) || pH->cbHeader != sizeof(SHM_HEADER) ||
+     pH->cbSlot != sizeof(SHM_SLOT) || (size_t)sSt.st_size < sizeof(SHM_HEADER) + (size_t)pH->nRing * sizeof(SHM_SLOT))
+  {
+    munmap(pH, (size_t)sSt.st_size);
+    return -1;
+  }
+
+  pR->pH = pH;
+  pR->cbMap = (size_t)sSt.st_size;
+  pR->qwNext = __atomic_load_n(&pH->qwHead, __ATOMIC_ACQUIRE);
+
+  if(pR->qwNext)
+  {
+    pR->qwNext--;
+  }
+
+  return 0;
+}
+
+static inline void shm_reader_close(SHM_READER *pR)
+{
+  if(pR->pH)
+  {
+    munmap(pR->pH, pR->cbMap);
+    pR->pH = NULL;
+  }
+}
+
+// a consistent copy of the newest values
+static inline void shm_reader_latest(const SHM_READER *pR, SHM_LATEST *pL)
+{
+uint32_t dw1;
+
+  do
+  {
+    while((dw1 = __atomic_load_n(&pR->pH->dwLatestSeq, __ATOMIC_ACQUIRE)) & 1)
+    { } // the writer holds it for a few nanoseconds
+
+    memcpy(pL, (const void *)&pR->pH->sLatest, sizeof(*pL));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  } while(__atomic_load_n(&pR->pH->dwLatestSeq, __ATOMIC_RELAXED) != dw1);
+}
+
+// the next sample:  1 if there is one, 0 if there's nothing new.
+// 'qwLost' grows when the reader was too slow
+static inline int shm_reader_next(SHM_READER *pR, SHM_SLOT *pSlot)
+{
+const SHM_SLOT *pS;
+uint64_t qwHead, qwSeq;
+
+  for(;;)
+  {
+    qwHead = __atomic_load_n(&pR->pH->qwHead, __ATOMIC_ACQUIRE);
+
+    if(pR->qwNext >= qwHead)
+    {
+      return 0;
+    }
+
+    if(qwHead - pR->qwNext > pR->pH->nRing) // overwritten already
+    {
+      pR->qwLost += qwHead - pR->pH->nRing - pR->qwNext;
+      pR->qwNext = qwHead - pR->pH->nRing;
+    }
+
+    pS = SHM_RING(pR->pH) + (pR->qwNext & (pR->pH->nRing - 1));
+    qwSeq = __atomic_load_n(&pS->qwSeq, __ATOMIC_ACQUIRE);
+
+    if(qwSeq == pR->qwNext + 1)
+    {
+      memcpy(pSlot, (const void *)pS, sizeof(*pSlot));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if(__atomic_load_n(&pS->qwSeq, __ATOMIC_RELAXED) == qwSeq)
+      {
+        pR->qwNext++;
+        return 1;
+      }
+    }
+
+    // the writer lapped it while it was being read - try again from the new head
+  }
+}
+
+#endif // WIN32
+
+#endif // _SFTSHM_H_INCLUDED_
@@ -0,0 +1,218 @@
+// sfttelem.c - reader for the telemetry files written by 'sftardcal -T file[,z]'
+//
+// Writes the samples as CSV on stdout:  a header line with the column names,
+// then one line per row, the time first (seconds since the start, or the wall
+// clock time with '-t').  A field that wasn't in a line is left empty.
+//
+// '-s' and '-e' limit the output to part of the file, '-i' shows what's in
+// the header instead.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sfttelemetry.h"
+
+
+static const char *pApp;
+static TELEMETRY_READER sTel;
+static uint64_t qwFrom = 0, qwTo = ~0ULL; // '-s' and '-e', in nsecs
+static int bWallClock = 0;
+
+
+static void telem_usage(void)
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-i][-t][-s seconds][-e seconds] telemetry_file\n"
+          " where\t'telemetry_file' was written by 'sftardcal -T'\n"
+          " and\t-i describes the file instead of writing the samples\n"
+          " and\t-t writes the time of day instead of the time since the start\n"
+          " and\t-s starts at this many seconds into the file (i.e. 12.5)\n"
+          " and\t-e ends at this many seconds into the file\n"
+          "\n"
+          "-and-\t-h prints this message\n\n", pApp, pApp);
+}
+
+static void telem_time(uint64_t qwTime)
+{
+time_t tNow;
+uint64_t qw1;
+char tbuf[64];
+
+  if(bWallClock)
+  {
+    qw1 = sTel.sHdr.qwStartRealtime + qwTime;
+    tNow = (time_t)(qw1 / 1000000000ULL);
+
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tNow));
+    printf("%s.%06u", tbuf, (unsigned int)(qw1 % 1000000000ULL / 1000));
+  }
+  else
+  {
+    printf("%u.%06u", (unsigned int)(qwTime / 1000000000ULL),
+           (unsigned int)(qwTime % 1000000000ULL / 1000));
+  }
+}
+
+static int telem_csv(void)
+{
+float afValues[TELEMETRY_MAX_COLUMNS];
+uint64_t qwTime;
+unsigned int dw1;
+int i1;
+
+  fputs("time", stdout);
+
+  for(dw1=0; dw1 < sTel.sHdr.nColumns; dw1++)
+  {
+    printf(",%.*s", TELEMETRY_NAME_SIZE, sTel.sHdr.aszColumn[dw1]);
+  }
+
+  putchar('\n');
+
+  while((i1 = telemetry_reader_next(&sTel, &qwTime, afValues)) > 0)
+  {
+    if(qwTime > qwTo)
+    {
+      return 0;
+    }
+
+    if(qwTime < qwFrom)
+    {
+      continue;
+    }
+
+    telem_time(qwTime);
+
+    for(dw1=0; dw1 < sTel.sHdr.nColumns; dw1++)
+    {
+      if(isnan(afValues[dw1]))
+      {
+        putchar(',');
+      }
+      else
+      {
+        printf(",%.7g", afValues[dw1]); // all of a float's digits
+      }
+    }
+
+    putchar('\n');
+  }
+
+  return i1 < 0 ? 1 : 0;
+}
+
+static int telem_info(void)
+{
+float afValues[TELEMETRY_MAX_COLUMNS];
+uint64_t qwTime, qwFirst = 0, qwLast = 0, qwRows = 0;
+unsigned int dw1;
+int i1;
+
+  printf("columns:  %u\n", sTel.sHdr.nColumns);
+
+  for(dw1=0; dw1 < sTel.sHdr.nColumns; dw1++)
+  {
+    printf("  %.*s\n", TELEMETRY_NAME_SIZE, sTel.sHdr.aszColumn[dw1]);
+  }
+
+  if(sTel.sHdr.dwFlags & TELEMETRY_FLAG_DECIMATE)
+  {
+    printf("samples per row:  %u (min, max, mean)\n", sTel.sHdr.dwWindow);
+  }
+
+  while((i1 = telemetry_reader_next(&sTel, &qwTime, afValues)) > 0)
+  {
+    if(!qwRows++)
+    {
+      qwFirst = qwTime;
+    }
+
+    qwLast = qwTime;
+  }
+
+  printf("rows:  %llu", (unsigned long long)qwRows);
+
+  if(qwRows > 1 && qwLast > qwFirst)
+  {
+    printf(" over %.3f seconds (%.1f per second)", (qwLast - qwFirst) / 1e9,
+           (qwRows - 1) / ((qwLast - qwFirst) / 1e9));
+  }
+
+  putchar('\n');
+
+  return i1 < 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+time_t tStart;
+char tbuf[64];
+int i1, bInfo = 0;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hits:e:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'i':
+        bInfo = 1;
+        break;
+      case 't':
+        bWallClock = 1;
+        break;
+      case 's':
+        qwFrom = (uint64_t)(atof(optarg) * 1e9);
+        break;
+      case 'e':
+        qwTo = (uint64_t)(atof(optarg) * 1e9);
+        break;
+      default:
+        fprintf(stderr, "Illegal or unrecognized option\n");
+      case 'h':
+      case '?':
+        telem_usage();
+        return 1;
+    }
+  }
+
+  if(optind != argc - 1)
+  {
+    telem_usage();
+    return 1;
+  }
+
+  if(telemetry_reader_open(&sTel, argv[optind]))
+  {
+    return 1;
+  }
+
+  if(bInfo)
+  {
+    tStart = (time_t)(sTel.sHdr.qwStartRealtime / 1000000000ULL);
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&tStart));
+
+    printf("telemetry from %s, started %s%s\n", sTel.sHdr.szDevice, tbuf,
+           (sTel.sHdr.dwFlags & TELEMETRY_FLAG_DEFLATE) ? " (compressed)" : "");
+  }
+
+  i1 = bInfo ? telem_info() : telem_csv();
+
+  telemetry_reader_close(&sTel);
+
+  return i1;
+}
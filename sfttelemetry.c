@@ -0,0 +1,932 @@
+// sfttelemetry.c - telemetry samples from a device that streams measurements
+//
+// See 'sfttelemetry.h' for the file format.  Only the thread that reads the
+// serial port ('telemetry_loop' in sftardcal.c) parses lines and fills
+// 'aTelemetryBuf[iTelemetryFill]', so adding a sample takes no lock.  A full
+// block (or one that's a second old) is passed to the writer thread, which
+// compresses it and writes it out.  There are TELEMETRY_BUFFERS blocks, so the
+// writer can fall behind for a while (a slow SD card) without losing anything.
+// If all of them are full, the reading thread waits for one, and the serial
+// input ring ('-Z') holds what arrives in the meantime.  Shared memory ('-G')
+// gets each sample as it's parsed, before any '-D' decimation.
+//
+// The numbers are parsed by hand instead of with 'strtod()':  no locale, and
+// the digits are collected in an integer that's scaled once by an exact power
+// of 10, which is correctly rounded for up to 15 or so significant digits.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif // WITH_ZLIB
+
+#include "sfttelemetry.h"
+#include "sftmetrics.h"
+#include "sftshm.h"
+
+
+#define TELEMETRY_BUFFERS    4     /* blocks, the one being filled and the ones waiting to be written */
+#define TELEMETRY_FLUSH_MSEC 1000  /* a partly filled block is written when it's this old */
+#define TELEMETRY_MAX_DELTA  4000000000000ULL /* nsecs, the times in usecs must fit in 32 bits */
+
+typedef struct _TELEMETRY_BUFFER_
+{
+  unsigned char *pData;  // TELEMETRY_BLOCK_ROWS times, then TELEMETRY_BLOCK_ROWS floats per column
+  int nRows;
+  uint64_t qwTime;       // time of the first row
+} TELEMETRY_BUFFER;
+
+static pthread_mutex_t mtxTelemetry = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t condTelemetryFull = PTHREAD_COND_INITIALIZER; // for the writer thread
+static pthread_cond_t condTelemetryFree = PTHREAD_COND_INITIALIZER; // for the reading thread
+static pthread_t hTelemetryThread;
+
+static TELEMETRY_BUFFER aTelemetryBuf[TELEMETRY_BUFFERS];
+static int iTelemetryFill = 0;   // reading thread only
+static int iTelemetryWrite = 0;  // writer thread only
+static int nTelemetryFull = 0;   // blocks waiting for the writer, 'mtxTelemetry'
+static int bTelemetryStop = 0;
+
+// fields and columns, set up by 'telemetry_open'
+static int nTelemetryFields = 0, nTelemetryColumns = 0, nTelemetryWindow = 1;
+static char aszTelemetryField[TELEMETRY_MAX_FIELDS][TELEMETRY_NAME_SIZE];
+static int acbTelemetryField[TELEMETRY_MAX_FIELDS];
+
+// '-D' - the window so far
+static int nWindowSamples = 0;
+static uint64_t qwWindowTime;
+static float afWindowMin[TELEMETRY_MAX_FIELDS], afWindowMax[TELEMETRY_MAX_FIELDS];
+static double adWindowSum[TELEMETRY_MAX_FIELDS];
+static int anWindowCount[TELEMETRY_MAX_FIELDS];
+
+// totals, for 'telemetry_close'
+static unsigned long long qwTelemetrySamples = 0, qwTelemetrySkipped = 0, qwTelemetryText = 0, qwTelemetryWaits = 0;
+
+// these belong to the writer thread once it's running
+static int bTelemetryOpen = 0; // a file, shared memory, or both
+static int iTelemetryFile = -1, bTelemetryDeflate = 0, bTelemetryError = 0;
+static uint64_t qwTelemetryStart;   // CLOCK_MONOTONIC, nsecs
+static unsigned long long qwTelemetryOffset = 0;
+static unsigned char *pTelemetryZ = NULL; // compressed block
+static unsigned long cbTelemetryZ = 0;
+
+// exact powers of 10 as doubles
+static const double adPow10[] =
+{
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static uint64_t telemetry_clock(int iClock)
+{
+struct timespec ts;
+
+  clock_gettime(iClock, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t telemetry_now(void)
+{
+  return telemetry_clock(CLOCK_MONOTONIC) - qwTelemetryStart;
+}
+
+float telemetry_parse_float(const char **ppStr)
+{
+const char *p1 = *ppStr, *p2;
+uint64_t qwDigits = 0;
+int iExp = 0, iExp2, nDigits = 0, bNeg = 0, bNegExp;
+double d1;
+
+  if(*p1 == '-' || *p1 == '+')
+  {
+    bNeg = *(p1++) == '-';
+  }
+
+  for(; *p1 >= '0' && *p1 <= '9'; p1++, nDigits++)
+  {
+    if(qwDigits < 100000000000000000ULL)
+    {
+      qwDigits = qwDigits * 10 + (*p1 - '0');
+    }
+    else
+    {
+      iExp++; // too many digits to matter
+    }
+  }
+
+  if(*p1 == '.')
+  {
+    for(p1++; *p1 >= '0' && *p1 <= '9'; p1++, nDigits++)
+    {
+      if(qwDigits < 100000000000000000ULL)
+      {
+        qwDigits = qwDigits * 10 + (*p1 - '0');
+        iExp--;
+      }
+    }
+  }
+
+  if(!nDigits)
+  {
+    return NAN; // '*ppStr' stays where it was
+  }
+
+  if(*p1 == 'e' || *p1 == 'E')
+  {
+    p2 = p1 + 1;
+    bNegExp = 0;
+
+    if(*p2 == '-' || *p2 == '+')
+    {
+      bNegExp = *(p2++) == '-';
+    }
+
+    if(*p2 >= '0' && *p2 <= '9')
+    {
+      for(iExp2=0; *p2 >= '0' && *p2 <= '9'; p2++)
+      {
+        if(iExp2 < 1000)
+        {
+          iExp2 = iExp2 * 10 + (*p2 - '0');
+        }
+      }
+
+      iExp += bNegExp ? -iExp2 : iExp2;
+      p1 = p2;
+    }
+  }
+
+  *ppStr = p1;
+
+  d1 = (double)qwDigits;
+
+  for(; iExp > 22; iExp -= 22)
+  {
+    d1 *= 1e22;
+  }
+
+  for(; iExp < -22; iExp += 22)
+  {
+    d1 /= 1e22;
+  }
+
+  d1 = iExp < 0 ? d1 / adPow10[-iExp] : d1 * adPow10[iExp];
+
+  return (float)(bNeg ? -d1 : d1);
+}
+
+static int telemetry_write_all(const void *pBuf, size_t cbBuf)
+{
+const char *p1 = (const char *)pBuf;
+ssize_t i1;
+
+  while(cbBuf > 0)
+  {
+    i1 = write(iTelemetryFile, p1, cbBuf);
+
+    if(i1 < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(i1 <= 0)
+    {
+      if(!bTelemetryError)
+      {
+        fprintf(stderr, "WARNING - telemetry file write error, errno=%d (telemetry stopped)\n", errno);
+        bTelemetryError = 1;
+      }
+
+      return -1;
+    }
+
+    p1 += i1;
+    cbBuf -= i1;
+    qwTelemetryOffset += i1;
+  }
+
+  return 0;
+}
+
+// writer thread - one block.  a partly filled one has its columns moved down first
+static void telemetry_write_block(TELEMETRY_BUFFER *pB)
+{
+TELEMETRY_BLOCK_HEADER sHdr;
+const void *pData = pB->pData;
+int i1;
+
+  if(bTelemetryError || !pB->nRows)
+  {
+    return;
+  }
+
+  if(pB->nRows < TELEMETRY_BLOCK_ROWS)
+  {
+    for(i1=0; i1 < nTelemetryColumns; i1++) // each one moves down, so they never overlap one that's still to go
+    {
+      memmove(pB->pData + sizeof(float) * (pB->nRows + (size_t)i1 * pB->nRows),
+              pB->pData + sizeof(float) * (TELEMETRY_BLOCK_ROWS + (size_t)i1 * TELEMETRY_BLOCK_ROWS),
+              sizeof(float) * pB->nRows);
+    }
+  }
+
+  sHdr.dwMagic = TELEMETRY_BLOCK_MAGIC;
+  sHdr.cbData = sHdr.cbStored = sizeof(uint32_t) * pB->nRows * (1 + nTelemetryColumns);
+  sHdr.nRows = pB->nRows;
+  sHdr.qwTime = pB->qwTime;
+
+#ifdef WITH_ZLIB
+  if(bTelemetryDeflate)
+  {
+    uLongf cbZ = cbTelemetryZ;
+
+    if(compress2(pTelemetryZ, &cbZ, (const Bytef *)pB->pData, sHdr.cbData, Z_BEST_SPEED) == Z_OK)
+    {
+      pData = pTelemetryZ;
+      sHdr.cbStored = cbZ;
+    }
+    else // can't happen with a big enough buffer, but the block must still be readable
+    {
+      fputs("WARNING - telemetry block compression failed\n", stderr);
+      bTelemetryError = 1;
+      return;
+    }
+  }
+#endif // WITH_ZLIB
+
+  if(!telemetry_write_all(&sHdr, sizeof(sHdr)))
+  {
+    telemetry_write_all(pData, sHdr.cbStored);
+  }
+}
+
+static void *telemetry_thread(void *pParam)
+{
+TELEMETRY_BUFFER *pB;
+
+  while(1)
+  {
+    pthread_mutex_lock(&mtxTelemetry);
+
+    while(!nTelemetryFull && !bTelemetryStop)
+    {
+      pthread_cond_wait(&condTelemetryFull, &mtxTelemetry);
+    }
+
+    if(!nTelemetryFull) // and stopping
+    {
+      pthread_mutex_unlock(&mtxTelemetry);
+      break;
+    }
+
+    pB = aTelemetryBuf + iTelemetryWrite;
+
+    pthread_mutex_unlock(&mtxTelemetry);
+
+    telemetry_write_block(pB);
+
+    iTelemetryWrite = (iTelemetryWrite + 1) % TELEMETRY_BUFFERS;
+
+    pthread_mutex_lock(&mtxTelemetry);
+    nTelemetryFull--;
+    pthread_cond_signal(&condTelemetryFree);
+    pthread_mutex_unlock(&mtxTelemetry);
+  }
+
+  return NULL;
+}
+
+// pass the block being filled to the writer thread, waiting if all of the others are still waiting too
+static void telemetry_hand_off(void)
+{
+  pthread_mutex_lock(&mtxTelemetry);
+
+  while(nTelemetryFull >= TELEMETRY_BUFFERS - 1)
+  {
+    qwTelemetryWaits++;
+    metrics_add(METRIC_TELEMETRY_WAITS, 1);
+
+    pthread_cond_wait(&condTelemetryFree, &mtxTelemetry);
+  }
+
+  nTelemetryFull++;
+  pthread_cond_signal(&condTelemetryFull);
+
+  pthread_mutex_unlock(&mtxTelemetry);
+
+  iTelemetryFill = (iTelemetryFill + 1) % TELEMETRY_BUFFERS;
+  aTelemetryBuf[iTelemetryFill].nRows = 0; // the writer is done with it
+}
+
+static void telemetry_row(uint64_t qwTime, const float *pValues)
+{
+TELEMETRY_BUFFER *pB = aTelemetryBuf + iTelemetryFill;
+float *pColumn;
+int i1;
+
+  if(pB->nRows && qwTime - pB->qwTime >= TELEMETRY_MAX_DELTA)
+  {
+    telemetry_hand_off();
+    pB = aTelemetryBuf + iTelemetryFill;
+  }
+
+  if(!pB->nRows)
+  {
+    pB->qwTime = qwTime;
+  }
+
+  ((uint32_t *)pB->pData)[pB->nRows] = (uint32_t)((qwTime - pB->qwTime) / 1000);
+
+  pColumn = (float *)(pB->pData + sizeof(uint32_t) * TELEMETRY_BLOCK_ROWS) + pB->nRows;
+
+  for(i1=0; i1 < nTelemetryColumns; i1++, pColumn += TELEMETRY_BLOCK_ROWS)
+  {
+    *pColumn = pValues[i1];
+  }
+
+  if(++(pB->nRows) >= TELEMETRY_BLOCK_ROWS ||
+     qwTime - pB->qwTime >= TELEMETRY_FLUSH_MSEC * 1000000ULL)
+  {
+    telemetry_hand_off();
+  }
+}
+
+// '-D' - the min, max and mean of each field over the window become one row
+static void telemetry_window_row(void)
+{
+float afRow[TELEMETRY_MAX_COLUMNS];
+int i1;
+
+  for(i1=0; i1 < nTelemetryFields; i1++)
+  {
+    if(anWindowCount[i1])
+    {
+      afRow[i1 * 3] = afWindowMin[i1];
+      afRow[i1 * 3 + 1] = afWindowMax[i1];
+      afRow[i1 * 3 + 2] = (float)(adWindowSum[i1] / anWindowCount[i1]);
+    }
+    else
+    {
+      afRow[i1 * 3] = afRow[i1 * 3 + 1] = afRow[i1 * 3 + 2] = NAN;
+    }
+
+    anWindowCount[i1] = 0;
+    adWindowSum[i1] = 0.0;
+  }
+
+  telemetry_row(qwWindowTime, afRow);
+
+  nWindowSamples = 0;
+}
+
+static void telemetry_window_add(const TELEMETRY_SAMPLE *pS)
+{
+int i1;
+
+  if(!nWindowSamples)
+  {
+    qwWindowTime = pS->qwTime; // a row has the time of its first sample
+  }
+
+  for(i1=0; i1 < nTelemetryFields; i1++)
+  {
+    if(isnan(pS->aValue[i1]))
+    {
+      continue;
+    }
+
+    if(!anWindowCount[i1]++)
+    {
+      afWindowMin[i1] = afWindowMax[i1] = pS->aValue[i1];
+    }
+    else if(pS->aValue[i1] < afWindowMin[i1])
+    {
+      afWindowMin[i1] = pS->aValue[i1];
+    }
+    else if(pS->aValue[i1] > afWindowMax[i1])
+    {
+      afWindowMax[i1] = pS->aValue[i1];
+    }
+
+    adWindowSum[i1] += pS->aValue[i1];
+  }
+
+  if(++nWindowSamples >= nTelemetryWindow)
+  {
+    telemetry_window_row();
+  }
+}
+
+static int telemetry_field(const char *pName, int cbName)
+{
+int i1;
+
+  for(i1=0; i1 < nTelemetryFields; i1++)
+  {
+    if(cbName == acbTelemetryField[i1] && !memcmp(pName, aszTelemetryField[i1], cbName))
+    {
+      return i1;
+    }
+  }
+
+  return -1;
+}
+
+#define TELEMETRY_SEPARATOR(X) ((X) == ' ' || (X) == '\t' || (X) == ',' || (X) == ';')
+
+int telemetry_line(const char *pszLine, uint64_t qwTime)
+{
+TELEMETRY_SAMPLE sS;
+const char *p1 = pszLine, *pName;
+int i1, nFound = 0;
+
+  if(!bTelemetryOpen)
+  {
+    return 0;
+  }
+
+  sS.qwTime = qwTime;
+
+  for(i1=0; i1 < nTelemetryFields; i1++)
+  {
+    sS.aValue[i1] = NAN;
+  }
+
+  // 'name=value' or 'name:value', separated by spaces, tabs, commas or semicolons.
+  // anything after the number (i.e. a unit) is ignored, and so is anything that isn't a field
+  while(*p1)
+  {
+    while(TELEMETRY_SEPARATOR(*p1))
+    {
+      p1++;
+    }
+
+    for(pName=p1; *p1 && *p1 != '=' && *p1 != ':' && !TELEMETRY_SEPARATOR(*p1); p1++)
+    { }
+
+    if(*p1 == '=' || *p1 == ':')
+    {
+      i1 = telemetry_field(pName, (int)(p1 - pName));
+      p1++;
+
+      if(i1 >= 0)
+      {
+        sS.aValue[i1] = telemetry_parse_float(&p1);
+
+        if(!isnan(sS.aValue[i1]))
+        {
+          nFound++;
+        }
+      }
+
+      while(*p1 && !TELEMETRY_SEPARATOR(*p1))
+      {
+        p1++;
+      }
+    }
+  }
+
+  qwTelemetryText += (p1 - pszLine) + 1; // with at least a 1 byte line ending
+
+  if(!nFound)
+  {
+    qwTelemetrySkipped++;
+    metrics_add(METRIC_TELEMETRY_SKIPPED, 1);
+
+    return 0;
+  }
+
+  qwTelemetrySamples++;
+  metrics_add(METRIC_TELEMETRY_SAMPLES, 1);
+
+  shm_publish(&sS); // every sample, '-D' or not
+
+  if(iTelemetryFile < 0)
+  {
+    return 1;
+  }
+
+  if(nTelemetryWindow > 1)
+  {
+    telemetry_window_add(&sS);
+  }
+  else
+  {
+    telemetry_row(sS.qwTime, sS.aValue);
+  }
+
+  return 1;
+}
+
+void telemetry_idle(void)
+{
+  if(iTelemetryFile >= 0 && aTelemetryBuf[iTelemetryFill].nRows &&
+     telemetry_now() - aTelemetryBuf[iTelemetryFill].qwTime >= TELEMETRY_FLUSH_MSEC * 1000000ULL)
+  {
+    telemetry_hand_off();
+  }
+}
+
+// a column name, the field name plus 'pszSuffix' (the length was checked by 'telemetry_open')
+static void telemetry_column(char *pOut, int iField, const char *pszSuffix)
+{
+  memcpy(pOut, aszTelemetryField[iField], acbTelemetryField[iField]);
+  memcpy(pOut + acbTelemetryField[iField], pszSuffix, strlen(pszSuffix) + 1);
+}
+
+int telemetry_open(const char *szFile, int bDeflate, const char *szDevice, const char *szFields, int nWindow,
+                   const char *szShm, int nShmRing)
+{
+TELEMETRY_FILE_HEADER sHdr;
+const char *p1, *p2;
+int i1, cbMax;
+
+  nTelemetryWindow = nWindow > 1 ? nWindow : 1;
+  cbMax = TELEMETRY_NAME_SIZE - 1 - (nTelemetryWindow > 1 ? 5 : 0); // room for '.mean'
+
+  for(p1=szFields, nTelemetryFields=0; p1 && *p1; p1 = *p2 ? p2 + 1 : p2)
+  {
+    p2 = strchr(p1, ',');
+
+    if(!p2)
+    {
+      p2 = p1 + strlen(p1);
+    }
+
+    if(p2 == p1 || p2 - p1 > cbMax || nTelemetryFields >= TELEMETRY_MAX_FIELDS ||
+       telemetry_field(p1, (int)(p2 - p1)) >= 0)
+    {
+      fprintf(stderr, "Telemetry fields must be up to %d different names of 1 to %d characters\n",
+              TELEMETRY_MAX_FIELDS, cbMax);
+      return -1;
+    }
+
+    memcpy(aszTelemetryField[nTelemetryFields], p1, p2 - p1);
+    aszTelemetryField[nTelemetryFields][p2 - p1] = 0;
+    acbTelemetryField[nTelemetryFields++] = (int)(p2 - p1);
+  }
+
+  if(!nTelemetryFields)
+  {
+    fputs("Telemetry needs at least one field ('-Y')\n", stderr);
+    return -1;
+  }
+
+  memset(&sHdr, 0, sizeof(sHdr));
+  memcpy(sHdr.szMagic, TELEMETRY_FILE_MAGIC, sizeof(sHdr.szMagic));
+
+  for(i1=0, nTelemetryColumns=0; i1 < nTelemetryFields; i1++)
+  {
+    if(nTelemetryWindow > 1)
+    {
+      telemetry_column(sHdr.aszColumn[nTelemetryColumns++], i1, ".min");
+      telemetry_column(sHdr.aszColumn[nTelemetryColumns++], i1, ".max");
+      telemetry_column(sHdr.aszColumn[nTelemetryColumns++], i1, ".mean");
+    }
+    else
+    {
+      telemetry_column(sHdr.aszColumn[nTelemetryColumns++], i1, "");
+    }
+  }
+
+  sHdr.qwStartRealtime = telemetry_clock(CLOCK_REALTIME);
+  qwTelemetryStart = telemetry_clock(CLOCK_MONOTONIC);
+  qwTelemetryOffset = 0;
+  bTelemetryError = 0;
+  bTelemetryStop = 0;
+  iTelemetryFill = iTelemetryWrite = nTelemetryFull = 0;
+  nWindowSamples = 0;
+  memset(anWindowCount, 0, sizeof(anWindowCount));
+  memset(adWindowSum, 0, sizeof(adWindowSum));
+  qwTelemetrySamples = qwTelemetrySkipped = qwTelemetryText = qwTelemetryWaits = 0;
+
+  if(szShm && shm_publish_open(szShm, nShmRing, szDevice, nTelemetryFields,
+                               (const char (*)[TELEMETRY_NAME_SIZE])aszTelemetryField,
+                               qwTelemetryStart, sHdr.qwStartRealtime))
+  {
+    return -1;
+  }
+
+  if(!szFile) // shared memory only
+  {
+    bTelemetryOpen = 1;
+    return 0;
+  }
+
+  for(i1=0; i1 < TELEMETRY_BUFFERS; i1++)
+  {
+    aTelemetryBuf[i1].pData = malloc(sizeof(uint32_t) * TELEMETRY_BLOCK_ROWS * (1 + nTelemetryColumns));
+    aTelemetryBuf[i1].nRows = 0;
+
+    if(!aTelemetryBuf[i1].pData)
+    {
+      fputs("Not enough memory for telemetry\n", stderr);
+      goto error_exit;
+    }
+  }
+
+  iTelemetryFile = open(szFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if(iTelemetryFile < 0)
+  {
+    fprintf(stderr, "Unable to create telemetry file \"%s\", errno=%d\n", szFile, errno);
+    goto error_exit;
+  }
+
+#ifdef WITH_ZLIB
+  if(bDeflate)
+  {
+    cbTelemetryZ = compressBound(sizeof(uint32_t) * TELEMETRY_BLOCK_ROWS * (1 + nTelemetryColumns));
+    pTelemetryZ = malloc(cbTelemetryZ);
+
+    if(!pTelemetryZ)
+    {
+      bDeflate = 0;
+    }
+  }
+#else // WITH_ZLIB
+  if(bDeflate)
+  {
+    fputs("WARNING - built without zlib, the telemetry file will not be compressed\n", stderr);
+    bDeflate = 0;
+  }
+#endif // WITH_ZLIB
+
+  sHdr.dwFlags = (bDeflate ? TELEMETRY_FLAG_DEFLATE : 0) | (nTelemetryWindow > 1 ? TELEMETRY_FLAG_DECIMATE : 0);
+  sHdr.nColumns = nTelemetryColumns;
+  sHdr.dwWindow = nTelemetryWindow;
+  strncpy(sHdr.szDevice, szDevice ? szDevice : "", sizeof(sHdr.szDevice) - 1);
+
+  bTelemetryDeflate = bDeflate;
+
+  if(telemetry_write_all(&sHdr, sizeof(sHdr)))
+  {
+    goto error_exit;
+  }
+
+  i1 = pthread_create(&hTelemetryThread, NULL, telemetry_thread, NULL);
+
+  if(i1)
+  {
+    fprintf(stderr, "Unable to start the telemetry thread, error %d\n", i1);
+    goto error_exit;
+  }
+
+  bTelemetryOpen = 1;
+
+  return 0;
+
+error_exit:
+  shm_publish_close();
+
+  if(iTelemetryFile >= 0)
+  {
+    close(iTelemetryFile);
+    iTelemetryFile = -1;
+  }
+
+  for(i1=0; i1 < TELEMETRY_BUFFERS; i1++)
+  {
+    free(aTelemetryBuf[i1].pData);
+    aTelemetryBuf[i1].pData = NULL;
+  }
+
+  free(pTelemetryZ);
+  pTelemetryZ = NULL;
+
+  return -1;
+}
+
+void telemetry_close(void)
+{
+int i1;
+
+  if(!bTelemetryOpen)
+  {
+    return;
+  }
+
+  bTelemetryOpen = 0;
+
+  shm_publish_close();
+
+  if(iTelemetryFile < 0) // shared memory only
+  {
+    fprintf(stderr, "Telemetry:  %llu samples, %llu lines without any fields\n",
+            qwTelemetrySamples, qwTelemetrySkipped);
+    return;
+  }
+
+  if(nWindowSamples) // a partial window is still a row
+  {
+    telemetry_window_row();
+  }
+
+  if(aTelemetryBuf[iTelemetryFill].nRows)
+  {
+    telemetry_hand_off();
+  }
+
+  pthread_mutex_lock(&mtxTelemetry);
+  bTelemetryStop = 1;
+  pthread_cond_signal(&condTelemetryFull);
+  pthread_mutex_unlock(&mtxTelemetry);
+
+  pthread_join(hTelemetryThread, NULL); // writes the rest
+
+  close(iTelemetryFile);
+  iTelemetryFile = -1;
+
+  fprintf(stderr, "Telemetry:  %llu samples, %llu lines without any fields, %llu bytes written (%llu bytes of text)\n",
+          qwTelemetrySamples, qwTelemetrySkipped, qwTelemetryOffset, qwTelemetryText);
+
+  if(qwTelemetryWaits)
+  {
+    fprintf(stderr, "WARNING - waited %llu times for the telemetry file writes\n", qwTelemetryWaits);
+  }
+
+  for(i1=0; i1 < TELEMETRY_BUFFERS; i1++)
+  {
+    free(aTelemetryBuf[i1].pData);
+    aTelemetryBuf[i1].pData = NULL;
+  }
+
+  free(pTelemetryZ);
+  pTelemetryZ = NULL;
+}
+
+
+
+// -------
+// READING
+// -------
+
+#define TELEMETRY_DATA_MAX   (sizeof(uint32_t) * TELEMETRY_BLOCK_ROWS * (1 + TELEMETRY_MAX_COLUMNS))
+#define TELEMETRY_STORED_MAX (TELEMETRY_DATA_MAX + TELEMETRY_DATA_MAX / 8 + 64) /* compressed can be a little bigger */
+
+int telemetry_reader_open(TELEMETRY_READER *pR, const char *szFile)
+{
+  memset(pR, 0, sizeof(*pR));
+
+  pR->iFile = open(szFile, O_RDONLY);
+
+  if(pR->iFile < 0)
+  {
+    fprintf(stderr, "Unable to open %s, errno=%d\n", szFile, errno);
+    return -1;
+  }
+
+  if(read(pR->iFile, &pR->sHdr, sizeof(pR->sHdr)) != sizeof(pR->sHdr) ||
+     memcmp(pR->sHdr.szMagic, TELEMETRY_FILE_MAGIC, sizeof(pR->sHdr.szMagic)) ||
+     !pR->sHdr.nColumns || pR->sHdr.nColumns > TELEMETRY_MAX_COLUMNS)
+  {
+    fprintf(stderr, "%s is not a telemetry file\n", szFile);
+    telemetry_reader_close(pR);
+    return -1;
+  }
+
+#ifndef WITH_ZLIB
+  if(pR->sHdr.dwFlags & TELEMETRY_FLAG_DEFLATE)
+  {
+    fprintf(stderr, "%s is compressed, and this was built without zlib\n", szFile);
+    telemetry_reader_close(pR);
+    return -1;
+  }
+#endif // WITH_ZLIB
+
+  pR->sHdr.szDevice[sizeof(pR->sHdr.szDevice) - 1] = 0;
+
+  pR->pStored = malloc(TELEMETRY_STORED_MAX);
+  pR->pData = malloc(TELEMETRY_DATA_MAX);
+
+  if(!pR->pStored || !pR->pData)
+  {
+    fputs("Not enough memory\n", stderr);
+    telemetry_reader_close(pR);
+    return -1;
+  }
+
+  pR->qwNext = sizeof(pR->sHdr);
+
+  return 0;
+}
+
+void telemetry_reader_close(TELEMETRY_READER *pR)
+{
+  if(pR->iFile >= 0)
+  {
+    close(pR->iFile);
+  }
+
+  free(pR->pStored);
+  free(pR->pData);
+
+  memset(pR, 0, sizeof(*pR));
+  pR->iFile = -1;
+}
+
+// read the block at 'qwNext' into 'pData'.  returns 1 if there is one, 0 at the end, -1 on error
+static int telemetry_reader_block(TELEMETRY_READER *pR)
+{
+uint64_t qwOffset = pR->qwNext;
+TELEMETRY_BLOCK_HEADER *pHdr = &pR->sBlock;
+
+  pR->qwNext = 0;
+  pR->dwRow = 0;
+
+  if(!qwOffset || pread(pR->iFile, pHdr, sizeof(*pHdr), qwOffset) != sizeof(*pHdr))
+  {
+    pHdr->nRows = 0;
+    return 0; // the end
+  }
+
+  if(pHdr->dwMagic != TELEMETRY_BLOCK_MAGIC || pHdr->nRows > TELEMETRY_BLOCK_ROWS ||
+     pHdr->cbData != sizeof(uint32_t) * pHdr->nRows * (1 + pR->sHdr.nColumns) ||
+     pHdr->cbStored > TELEMETRY_STORED_MAX)
+  {
+    fprintf(stderr, "ERROR:  bad block at offset %llu\n", (unsigned long long)qwOffset);
+    pHdr->nRows = 0;
+    return -1;
+  }
+
+  if(pread(pR->iFile, pR->pStored, pHdr->cbStored, qwOffset + sizeof(*pHdr)) != (ssize_t)pHdr->cbStored)
+  {
+    fprintf(stderr, "NOTE:  last block (offset %llu) is incomplete\n", (unsigned long long)qwOffset);
+    pHdr->nRows = 0;
+    return 0;
+  }
+
+  if(pR->sHdr.dwFlags & TELEMETRY_FLAG_DEFLATE)
+  {
+#ifdef WITH_ZLIB
+    uLongf cb1 = TELEMETRY_DATA_MAX;
+
+    if(uncompress((Bytef *)pR->pData, &cb1, (const Bytef *)pR->pStored, pHdr->cbStored) != Z_OK ||
+       cb1 != pHdr->cbData)
+    {
+      fprintf(stderr, "ERROR:  unable to decompress block at offset %llu\n", (unsigned long long)qwOffset);
+      pHdr->nRows = 0;
+      return -1;
+    }
+#endif // WITH_ZLIB
+  }
+  else
+  {
+    memcpy(pR->pData, pR->pStored, pHdr->cbData);
+  }
+
+  pR->qwNext = qwOffset + sizeof(*pHdr) + pHdr->cbStored;
+
+  return 1;
+}
+
+int telemetry_reader_next(TELEMETRY_READER *pR, uint64_t *pqwTime, float *pValues)
+{
+const float *pColumn;
+uint32_t dwDelta;
+unsigned int dw1;
+int i1;
+
+  while(pR->dwRow >= pR->sBlock.nRows) // next block
+  {
+    i1 = telemetry_reader_block(pR);
+
+    if(i1 <= 0)
+    {
+      return i1;
+    }
+  }
+
+  memcpy(&dwDelta, pR->pData + sizeof(uint32_t) * pR->dwRow, sizeof(dwDelta));
+  *pqwTime = pR->sBlock.qwTime + (uint64_t)dwDelta * 1000;
+
+  pColumn = (const float *)(pR->pData + sizeof(uint32_t) * pR->sBlock.nRows) + pR->dwRow;
+
+  for(dw1=0; dw1 < pR->sHdr.nColumns; dw1++, pColumn += pR->sBlock.nRows)
+  {
+    pValues[dw1] = *pColumn;
+  }
+
+  pR->dwRow++;
+
+  return 1;
+}
@@ -0,0 +1,116 @@
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// sfttelemetry.h - telemetry samples from a device that streams measurements
+//                  ('-T file[,z]', '-Y fields', '-D window')
+//
+// Each line from the device, i.e. "V=1.2345 I=0.0213", is parsed against the
+// declared fields ('-Y V,I') and becomes one sample:  the time it arrived and
+// a 32-bit float for each field (NaN if the line didn't have it).  Samples are
+// collected in blocks of columns (the times, then all of the first field, and
+// so on) and a background thread writes the full blocks, optionally 'deflate'
+// compressed, while the next one fills up.  With '-D n' each row is instead
+// the min, max and mean of each field over 'n' samples.  Use 'sfttelem' to
+// read the file (CSV).  With '-G' the samples also go to shared memory, for
+// other programs to read while it runs (see 'sftshm.h').
+//
+// FILE FORMAT (values are in the byte order of the machine that wrote it):
+//
+//   TELEMETRY_FILE_HEADER
+//   TELEMETRY_BLOCK_HEADER + data   (repeated)
+//
+// The data in a block is 'nRows' uint32_t times (usecs since the block's
+// 'qwTime') followed by 'nRows' floats for each of the 'nColumns' columns.
+// Each block can be decoded by itself (a compressed block is a complete zlib
+// stream).
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+#ifndef _SFTTELEMETRY_H_INCLUDED_
+#define _SFTTELEMETRY_H_INCLUDED_
+
+#include <stdint.h>
+
+
+#define TELEMETRY_FILE_MAGIC   "SFTTEL01"
+#define TELEMETRY_BLOCK_MAGIC  0x4b4c4254 /* 'TBLK' */
+
+#define TELEMETRY_MAX_FIELDS   16
+#define TELEMETRY_MAX_COLUMNS  (TELEMETRY_MAX_FIELDS * 3) /* min, max and mean with '-D' */
+#define TELEMETRY_NAME_SIZE    16  /* a field or column name, terminated */
+#define TELEMETRY_BLOCK_ROWS   4096
+
+// flags in TELEMETRY_FILE_HEADER
+#define TELEMETRY_FLAG_DEFLATE  1 /* blocks are zlib streams */
+#define TELEMETRY_FLAG_DECIMATE 2 /* 'dwWindow' samples per row, 3 columns per field */
+
+#pragma pack(push, 1)
+typedef struct _TELEMETRY_FILE_HEADER_
+{
+  char szMagic[8];          // TELEMETRY_FILE_MAGIC, not terminated
+  uint32_t dwFlags;         // TELEMETRY_FLAG_xxx
+  uint32_t nColumns;        // not counting the time
+  uint32_t dwWindow;        // samples per row, 1 without '-D'
+  uint32_t dwReserved;
+  uint64_t qwStartRealtime; // wall clock when it started, in nsecs since 1970
+  char szDevice[64];        // the serial device, terminated
+  char aszColumn[TELEMETRY_MAX_COLUMNS][TELEMETRY_NAME_SIZE]; // i.e. "V", or "V.min" "V.max" "V.mean"
+} TELEMETRY_FILE_HEADER;
+
+typedef struct _TELEMETRY_BLOCK_HEADER_
+{
+  uint32_t dwMagic;   // TELEMETRY_BLOCK_MAGIC
+  uint32_t cbStored;  // size of the data that follows
+  uint32_t cbData;    // size of the data once it's decompressed
+  uint32_t nRows;
+  uint64_t qwTime;    // nsecs since the start, for the times in the block
+} TELEMETRY_BLOCK_HEADER;
+#pragma pack(pop)
+
+
+#ifndef WIN32
+
+// one parsed line
+typedef struct _TELEMETRY_SAMPLE_
+{
+  uint64_t qwTime;                      // nsecs since 'telemetry_open', when it arrived
+  float aValue[TELEMETRY_MAX_FIELDS];   // in '-Y' order, NaN if it wasn't there
+} TELEMETRY_SAMPLE;
+
+int telemetry_open(const char *szFile, int bDeflate, const char *szDevice, const char *szFields, int nWindow,
+                   const char *szShm, int nShmRing);
+                                   // starts the writer thread.  'szFields' is "name,name,...", 'nWindow' is 0 or 1 for every sample.
+                                   // 'szShm' also publishes each sample in shared memory ('sftshm.h').  Either name can be NULL
+void telemetry_close(void);        // writes what's left, and the totals to stderr
+
+uint64_t telemetry_now(void);      // the 'qwTime' for data that just arrived
+int telemetry_line(const char *pszLine, uint64_t qwTime);
+                                   // one line, without its line ending.  1 if it was a sample, 0 if it had none of the fields
+void telemetry_idle(void);         // nothing arrived for a while - writes a partly filled block once it's a second old
+
+float telemetry_parse_float(const char **ppStr); // decimal only ([-+]digits[.digits][e[-+]digits]), NaN if there isn't one
+
+
+// reading a telemetry file, one row at a time (sfttelem)
+typedef struct _TELEMETRY_READER_
+{
+  int iFile;
+  TELEMETRY_FILE_HEADER sHdr;
+  uint64_t qwNext;                // file position of the next block, 0 at the end
+  TELEMETRY_BLOCK_HEADER sBlock;  // the current block
+  unsigned int dwRow;             // next row in 'pData'
+  unsigned char *pStored, *pData;
+} TELEMETRY_READER;
+
+int telemetry_reader_open(TELEMETRY_READER *pR, const char *szFile); // non-zero on error (message on stderr)
+void telemetry_reader_close(TELEMETRY_READER *pR);
+int telemetry_reader_next(TELEMETRY_READER *pR, uint64_t *pqwTime, float *pValues);
+                                   // 1 for a row ('nColumns' values), 0 at the end, -1 on error
+
+#endif // WIN32
+
+#endif // _SFTTELEMETRY_H_INCLUDED_
@@ -0,0 +1,821 @@
+// xmbench.c - In-process loopback benchmark for the XMODEM transfer engine
+//
+// The sender ('XSendSub') and receiver ('XReceiveSub', or 'ReceiveXmodem' for
+// CHECKSUM mode) run in their own threads, connected through a third 'link'
+// thread by a pair of socketpairs.  The link thread emulates the serial line:
+// baud rate (10 bits per byte, i.e. 8,n,1), one-way latency, and a random bit
+// error rate.  Each combination of file size and CRC/CHECKSUM mode is timed,
+// and the results (bytes/s, blocks/s, retransmits, bit errors, CPU time per MB)
+// are written to stdout, one line per run.  The received data is checked against
+// the source.  No hardware is needed.
+//
+// xmodem.c is included exactly the way 'sftardcal.c' includes it (SFTARDCAL mode)
+// and this file supplies the 'my_read' etc. functions it calls.
+//
+// The host build ships 'XSend' and 'XReceive' from the template engine instead
+// ('xmodem_engine.o', see 'xmodem.hpp'), so that one is linked in too, and each
+// run is done with both ('-e'), over the same emulated line.  The engine works
+// with files, so the source is written to a temporary file first (not timed),
+// its retransmits, NAKs and blocks come from the XMODEM metrics, and its stderr
+// progress line goes to /dev/null.  It only starts a receive with 'C' polls, so
+// a CHECKSUM run has the engine sending and 'ReceiveXmodem' receiving.
+//
+// Company web site:  http://mrp3.com/   e-mail:  bobf@mrp3.com
+//
+// COPYRIGHT:
+//
+// Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved
+//
+// for licensing and distribution, see 'sftardcal.c'
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+
+// the I/O functions that xmodem.c calls in SFTARDCAL mode (see 'sftardcal.h')
+int my_pollin(int iFile);
+void my_flush(int iFile);
+void MySleep(unsigned int dwMsec);
+void MyGetsEchoOff(void);
+int QuitFlag(void);
+
+#define SFTARDCAL
+#include "xmodem.c"   // XMODEM_ENGINE is defined, so 'XSend' and 'XReceive' are the engine's
+#include "sftmetrics.h"
+
+
+#define LINK_BUF_SIZE 65536 /* bytes 'on the wire' in each direction, must be a power of 2 */
+#define MAX_SIZES 32
+
+// one direction of the emulated serial line
+typedef struct _LINK_DIR_
+{
+  int iFrom, iTo;                     // read from 'iFrom', deliver to 'iTo'
+  unsigned int iHead, iTail;          // ring buffer indices (free-running, masked on use)
+  unsigned long long qwLineFree;      // time (usec) when the line has finished the last byte
+  long lBitErrors;                    // number of bits flipped in this direction
+  unsigned char aBuf[LINK_BUF_SIZE];  // bytes in flight
+  unsigned long long aDue[LINK_BUF_SIZE]; // delivery time (usec) for each byte
+} LINK_DIR;
+
+// shared state for the link thread
+typedef struct _LINK_
+{
+  LINK_DIR aDir[2];          // [0] is sender to receiver, [1] is receiver to sender
+  unsigned long ulByteTime;  // usec per byte, 0 for 'unlimited'
+  unsigned long ulLatency;   // one-way latency, usec
+  double dBER;               // bit error rate, 0 for none
+  double dNextError;         // bits remaining until the next bit error
+  volatile int bStop;
+} LINK;
+
+// per-thread state for sender and receiver
+typedef struct _XMBENCH_SIDE_
+{
+  XMODEM xx;
+  int bCRC;          // for the receiver, non-zero to poll with 'C' (else NAK)
+  int bEngine;       // 'XSend' or 'XReceive' from 'xmodem_engine.o' with 'pszFile'
+  const char *pszFile;
+  int iRval;         // XSendSub/XReceiveSub return value
+  long lBlocks;      // from the progress callback
+  long lErrors;      // total errors (retransmits, timeouts) from the progress callback
+  unsigned long long qwEnd; // completion time (usec)
+} XMBENCH_SIDE;
+
+
+static volatile int bQuitFlag = 0;
+static volatile int bRunAbort = 0; // set when the receiver is done and the sender is still waiting
+static int iRepeat = 1;
+static const char *pApp;
+
+
+
+// ----------------------------------------------------------
+// functions that xmodem.c needs, same behavior as sftardcal.c
+// ----------------------------------------------------------
+
+int QuitFlag(void)
+{
+  return bQuitFlag || bRunAbort;
+}
+
+void MyGetsEchoOff(void)
+{
+  // nothing is echoed here anyway
+}
+
+void MySleep(unsigned int dwMsec)
+{
+  usleep(dwMsec * 1000);
+}
+
+int my_pollin(int iFile)
+{
+struct pollfd sFD;
+int i1;
+
+  sFD.fd = iFile;
+  sFD.events = POLLIN | POLLERR;
+  sFD.revents = 0;
+
+  i1 = poll(&sFD, 1, 100);
+
+  if(i1 < 0 || (sFD.revents & POLLERR))
+  {
+    return -1;
+  }
+
+  return i1 > 0 ? 1 : 0;
+}
+
+int my_poll_handle(int iFile)
+{
+  return iFile; // no serial input ring here
+}
+
+void my_flush(int iFile)
+{
+char buf[256];
+
+  while(my_pollin(iFile) > 0) // until 100 msec of silence
+  {
+    if(read(iFile, buf, sizeof(buf)) <= 0)
+    {
+      break;
+    }
+  }
+}
+
+int my_write(int iFile, const void *pBuf, int cbBuf)
+{
+  return write(iFile, pBuf, cbBuf);
+}
+
+int my_read(int iFile, void *pBuf, int cbBuf)
+{
+  return read(iFile, pBuf, cbBuf);
+}
+
+
+
+// ---------
+// UTILITIES
+// ---------
+
+static unsigned long long MicroTime(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+static double CPUSeconds(void)
+{
+struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru); // all threads, including the link emulator
+
+  return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000.0
+         + (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1000000.0;
+}
+
+// geometric distribution - how many good bits before the next bad one
+static double NextBitError(double dBER)
+{
+double dR;
+
+  do
+  {
+    dR = drand48();
+  } while(dR <= 0.0);
+
+  return -log(dR) / dBER;
+}
+
+// size with optional 'k' or 'M' suffix
+static long ParseSize(const char *pszVal)
+{
+char *p1;
+long lRval;
+
+  lRval = strtol(pszVal, &p1, 0);
+
+  if(*p1 == 'k' || *p1 == 'K')
+  {
+    lRval *= 1024L;
+  }
+  else if(*p1 == 'm' || *p1 == 'M')
+  {
+    lRval *= 1024L * 1024L;
+  }
+
+  return lRval;
+}
+
+static void signalproc(int iSig)
+{
+  bQuitFlag = 1; // transfers see this via 'QuitFlag()' and bail out
+}
+
+
+
+// ------------------
+// LINK EMULATOR THREAD
+// ------------------
+
+// read whatever is waiting on 'iFrom', schedule it for delivery, flip bits as needed
+static void LinkReceive(LINK *pL, LINK_DIR *pD, unsigned long long qwNow)
+{
+unsigned char buf[4096];
+unsigned long long qwDue;
+unsigned int cbFree;
+int i1, i2, cb1;
+
+  cbFree = LINK_BUF_SIZE - (pD->iTail - pD->iHead);
+  if(!cbFree)
+  {
+    return; // line is full, leave it in the socket until I catch up
+  }
+
+  cb1 = read(pD->iFrom, buf, cbFree < sizeof(buf) ? cbFree : sizeof(buf));
+  if(cb1 <= 0)
+  {
+    return;
+  }
+
+  for(i1=0; i1 < cb1; i1++)
+  {
+    if(pL->dBER > 0.0)
+    {
+      pL->dNextError -= 8.0;
+
+      while(pL->dNextError < 0.0) // one or more bits in this byte are hit
+      {
+        i2 = (int)(pL->dNextError + 8.0); // which bit (0-7)
+        buf[i1] ^= (unsigned char)(1 << (i2 & 7));
+        pD->lBitErrors++;
+
+        pL->dNextError += NextBitError(pL->dBER);
+      }
+    }
+
+    // the byte finishes 'ulByteTime' after the line is free, then arrives 'ulLatency' later
+    qwDue = (pD->qwLineFree > qwNow ? pD->qwLineFree : qwNow) + pL->ulByteTime;
+    pD->qwLineFree = qwDue;
+
+    pD->aBuf[pD->iTail & (LINK_BUF_SIZE - 1)] = buf[i1];
+    pD->aDue[pD->iTail & (LINK_BUF_SIZE - 1)] = qwDue + pL->ulLatency;
+    pD->iTail++;
+  }
+}
+
+// write everything that is due, in as few 'write' calls as possible
+static void LinkDeliver(LINK_DIR *pD, unsigned long long qwNow)
+{
+unsigned int iIndex, cb1;
+int i1;
+
+  while(pD->iHead != pD->iTail)
+  {
+    iIndex = pD->iHead & (LINK_BUF_SIZE - 1);
+    cb1 = 0;
+
+    // contiguous run of due bytes, stopping at the end of the ring
+    while(pD->iHead + cb1 != pD->iTail &&
+          iIndex + cb1 < LINK_BUF_SIZE &&
+          pD->aDue[iIndex + cb1] <= qwNow)
+    {
+      cb1++;
+    }
+
+    if(!cb1)
+    {
+      return;
+    }
+
+    i1 = write(pD->iTo, pD->aBuf + iIndex, cb1);
+    if(i1 <= 0)
+    {
+      return; // socket is full (non-blocking), try again later
+    }
+
+    pD->iHead += i1;
+  }
+}
+
+static void *LinkThread(void *pParam)
+{
+LINK *pL = (LINK *)pParam;
+LINK_DIR *pD;
+struct pollfd aFD[2];
+unsigned long long qwNow, qwNext;
+int i1, iTimeout;
+
+  while(!pL->bStop)
+  {
+    qwNow = MicroTime();
+    qwNext = qwNow + 50000; // wake up at least every 50 msec to check 'bStop'
+
+    for(i1=0; i1 < 2; i1++)
+    {
+      pD = &(pL->aDir[i1]);
+
+      aFD[i1].fd = pD->iFrom;
+      aFD[i1].events = (pD->iTail - pD->iHead) < LINK_BUF_SIZE ? POLLIN : 0;
+      aFD[i1].revents = 0;
+
+      if(pD->iHead != pD->iTail && pD->aDue[pD->iHead & (LINK_BUF_SIZE - 1)] < qwNext)
+      {
+        qwNext = pD->aDue[pD->iHead & (LINK_BUF_SIZE - 1)];
+      }
+    }
+
+    iTimeout = qwNext > qwNow ? (int)((qwNext - qwNow + 999) / 1000) : 0;
+
+    i1 = poll(aFD, 2, iTimeout);
+
+    qwNow = MicroTime();
+
+    for(i1=0; i1 < 2; i1++)
+    {
+      if(aFD[i1].revents & POLLIN)
+      {
+        LinkReceive(pL, &(pL->aDir[i1]), qwNow);
+      }
+
+      LinkDeliver(&(pL->aDir[i1]), qwNow);
+    }
+  }
+
+  return NULL;
+}
+
+
+
+// ----------------------
+// SENDER, RECEIVER THREADS
+// ----------------------
+
+static void bench_progress(XMODEM *pX, long block, long filepos, long filesize, int ecount, long etotal)
+{
+XMBENCH_SIDE *pS = (XMBENCH_SIDE *)pX->pUser;
+
+  pS->lBlocks = block;
+  pS->lErrors = etotal;
+}
+
+static void *SendThread(void *pParam)
+{
+XMBENCH_SIDE *pS = (XMBENCH_SIDE *)pParam;
+
+  if(pS->bEngine)
+  {
+    pS->iRval = XSend(pS->xx.ser, pS->pszFile);
+  }
+  else
+  {
+    pS->iRval = XSendSub(&(pS->xx));
+  }
+
+  pS->qwEnd = MicroTime();
+
+  return NULL;
+}
+
+static void *ReceiveThread(void *pParam)
+{
+XMBENCH_SIDE *pS = (XMBENCH_SIDE *)pParam;
+int i1;
+
+  if(pS->bCRC && pS->bEngine)
+  {
+    pS->iRval = XReceive(pS->xx.ser, pS->pszFile, 0600);
+  }
+  else if(pS->bCRC)
+  {
+    pS->iRval = XReceiveSub(&(pS->xx)); // always tries CRC first
+  }
+  else
+  {
+    // 'XReceiveSub' only falls back to CHECKSUM after 8 'C' polls, so poll with NAK directly
+    pS->iRval = -3;
+    pS->xx.bCRC = 0;
+
+    for(i1=0; i1 < 8 && !QuitFlag(); i1++)
+    {
+      WriteXmodemChar(pS->xx.ser, _NAK_);
+
+      if(GetXmodemBlock(pS->xx.ser, &(pS->xx.buf.xbuf.cSOH), 1) == 1 &&
+         pS->xx.buf.xbuf.cSOH == _SOH_)
+      {
+        pS->iRval = ReceiveXmodem(&(pS->xx));
+        break;
+      }
+    }
+  }
+
+  pS->qwEnd = MicroTime();
+
+  return NULL;
+}
+
+
+
+// --------------
+// ONE BENCHMARK RUN
+// --------------
+
+// 'iOutFile' is 'pszOutFile', unless the engine replaced it.  'pszSrcFile' is only for the engine
+static int RunOne(const char *pSrc, long cbSize, int bCRC, int bEngine, int iOutFile, const char *pszOutFile,
+                  const char *pszSrcFile, unsigned long ulBaud, unsigned long ulLatency, double dBER)
+{
+static LINK lnk; // too big for the stack
+XMBENCH_SIDE xs, xr;
+pthread_t thL, thS, thR;
+int aSend[2], aRecv[2];
+int i1, iRval, bMatch, iCheck, iStdErr = -1, iNull;
+unsigned long long qwStart, qwRetransmit, qwNakSent, qwBlocks;
+double dCPU, dSec;
+char buf[4096];
+long lPos;
+
+  if(bEngine) // the engine sends a file, so that's written first
+  {
+    iCheck = open(pszSrcFile, O_WRONLY | O_TRUNC);
+
+    for(lPos=0, i1=0; iCheck != -1 && lPos < cbSize && i1 >= 0; lPos += i1)
+    {
+      i1 = write(iCheck, pSrc + lPos, cbSize - lPos);
+    }
+
+    if(iCheck == -1 || i1 < 0)
+    {
+      fprintf(stderr, "%s: unable to write \"%s\", errno=%d\n", pApp, pszSrcFile, errno);
+      return -1;
+    }
+
+    close(iCheck);
+  }
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, aSend) || socketpair(AF_UNIX, SOCK_STREAM, 0, aRecv))
+  {
+    fprintf(stderr, "%s: socketpair error %d\n", pApp, errno);
+    return -1;
+  }
+
+  // the link side of each pair is non-blocking so it never stalls on a full socket
+  fcntl(aSend[1], F_SETFL, O_NONBLOCK);
+  fcntl(aRecv[1], F_SETFL, O_NONBLOCK);
+
+  memset(&lnk, 0, sizeof(lnk));
+  lnk.aDir[0].iFrom = aSend[1]; // sender writes, link reads
+  lnk.aDir[0].iTo = aRecv[1];   // link writes, receiver reads
+  lnk.aDir[1].iFrom = aRecv[1];
+  lnk.aDir[1].iTo = aSend[1];
+  lnk.ulByteTime = ulBaud ? (10000000UL + ulBaud / 2) / ulBaud : 0; // 10 bits per byte
+  lnk.ulLatency = ulLatency * 1000UL;
+  lnk.dBER = dBER;
+  lnk.dNextError = dBER > 0.0 ? NextBitError(dBER) : 0.0;
+
+  memset(&xs, 0, sizeof(xs));
+  xs.xx.ser = aSend[0];
+  xs.xx.file = -1;
+  xs.xx.pMem = pSrc;
+  xs.xx.cbMem = cbSize;
+  xs.xx.pProgress = bench_progress;
+  xs.xx.pUser = &xs;
+  xs.bEngine = bEngine;
+  xs.pszFile = pszSrcFile;
+
+  memset(&xr, 0, sizeof(xr));
+  xr.xx.ser = aRecv[0];
+  xr.xx.file = iOutFile;
+  xr.xx.pProgress = bench_progress;
+  xr.xx.pUser = &xr;
+  xr.bCRC = bCRC;
+  xr.bEngine = bEngine && bCRC; // see above, a CHECKSUM receive is always 'ReceiveXmodem'
+  xr.pszFile = pszOutFile;
+
+  lseek(iOutFile, 0, SEEK_SET);
+  if(ftruncate(iOutFile, 0))
+  {
+    fprintf(stderr, "%s: ftruncate error %d\n", pApp, errno);
+  }
+
+  qwRetransmit = metrics_total(METRIC_XMODEM_RETRANSMIT);
+  qwNakSent = metrics_total(METRIC_XMODEM_NAK_SENT);
+  qwBlocks = metrics_total(METRIC_XMODEM_BLOCK_RECEIVED);
+
+  if(bEngine) // its progress line
+  {
+    fflush(stderr);
+    iStdErr = dup(2);
+    iNull = open("/dev/null", O_WRONLY);
+
+    if(iNull != -1)
+    {
+      dup2(iNull, 2);
+      close(iNull);
+    }
+  }
+
+  dCPU = CPUSeconds();
+  qwStart = MicroTime();
+
+  pthread_create(&thL, NULL, LinkThread, &lnk);
+  pthread_create(&thR, NULL, ReceiveThread, &xr);
+  pthread_create(&thS, NULL, SendThread, &xs);
+
+  pthread_join(thR, NULL);
+
+  // if the receiver's final ACK was lost, the sender keeps re-sending EOT for up
+  // to 40 seconds.  the data is already there, so give it 2 seconds, then stop it.
+  for(i1=0; i1 < 200 && !xs.qwEnd; i1++)
+  {
+    usleep(10000);
+  }
+
+  bRunAbort = 1;
+  pthread_join(thS, NULL);
+  bRunAbort = 0;
+
+  lnk.bStop = 1;
+  pthread_join(thL, NULL);
+
+  dCPU = CPUSeconds() - dCPU;
+  dSec = (double)(xr.qwEnd - qwStart) / 1000000.0; // the receiver has all of the data at this point
+
+  if(iStdErr != -1)
+  {
+    fflush(stderr);
+    dup2(iStdErr, 2);
+    close(iStdErr);
+  }
+
+  if(xs.bEngine) // no progress callback, so the metrics are the counts
+  {
+    xs.lErrors = (long)(metrics_total(METRIC_XMODEM_RETRANSMIT) - qwRetransmit);
+  }
+
+  if(xr.bEngine)
+  {
+    xr.lErrors = (long)(metrics_total(METRIC_XMODEM_NAK_SENT) - qwNakSent);
+    xr.lBlocks = (long)(metrics_total(METRIC_XMODEM_BLOCK_RECEIVED) - qwBlocks);
+  }
+
+  close(aSend[0]);
+  close(aSend[1]);
+  close(aRecv[0]);
+  close(aRecv[1]);
+
+  // verify what was received (the last block is padded with ctrl+z).  'XReceive' makes a new file
+  iCheck = xr.bEngine ? open(pszOutFile, O_RDONLY) : iOutFile;
+  bMatch = !xr.iRval && iCheck != -1;
+
+  for(lPos=0; bMatch && lPos < cbSize; lPos += i1)
+  {
+    i1 = pread(iCheck, buf, (cbSize - lPos) > (long)sizeof(buf) ? (int)sizeof(buf) : (int)(cbSize - lPos), lPos);
+
+    if(i1 <= 0 || memcmp(buf, pSrc + lPos, i1))
+    {
+      bMatch = 0;
+    }
+  }
+
+  if(iCheck != -1 && iCheck != iOutFile)
+  {
+    close(iCheck);
+  }
+
+  iRval = bMatch ? 0 : 1;
+
+  printf("%9ld  %-5s %-6s %7lu %5lu %8.1e %9.3f %11.0f %9.1f %6ld %6ld %6ld %9.1f  %s\n",
+         cbSize, bCRC ? "CRC" : "CSUM", bEngine ? "engine" : "C", ulBaud, ulLatency, dBER, dSec,
+         dSec > 0.0 ? (double)cbSize / dSec : 0.0,
+         dSec > 0.0 ? (double)xr.lBlocks / dSec : 0.0,
+         xs.lErrors, xr.lErrors,
+         lnk.aDir[0].lBitErrors + lnk.aDir[1].lBitErrors,
+         cbSize > 0 ? dCPU * 1000.0 / ((double)cbSize / (1024.0 * 1024.0)) : 0.0,
+         iRval ? "FAIL" : "ok");
+  fflush(stdout);
+
+  return iRval;
+}
+
+
+
+void usage()
+{
+  fprintf(stderr,
+          "%s - Copyright (c) 2011-2015 S.F.T. Inc. - all rights reserved\n\n"
+          "usage:\t%s [-h]|[-s sizes][-m modes][-e engines][-B baud][-L msec][-E ber][-n count]\n"
+          " where\t-s is a comma-separated list of file sizes, 'k' and 'M' suffixes\n"
+              "\t   are allowed (default 1k,64k,1M)\n"
+          " and\t-m is 'crc', 'csum', or 'crc,csum' (the default)\n"
+          " and\t-e is 'c' ('XSendSub' etc. in xmodem.c), 'engine' (the template\n"
+              "\t   engine in 'xmodem_engine.o', what sftardcal ships), or 'c,engine'\n"
+              "\t   (the default), to compare them run for run\n"
+          " and\t-B is the emulated baud rate, 8,n,1 (default 0, unlimited)\n"
+          " and\t-L is the one-way latency in milliseconds (default 0)\n"
+          " and\t-E is the bit error rate, for example 1e-5 (default 0)\n"
+          " and\t-n repeats each run 'count' times (default 1)\n"
+          "\n"
+          "-and-\t-h prints this message\n\n", pApp, pApp);
+}
+
+int main(int argc, char *argv[])
+{
+long aSizes[MAX_SIZES];
+int nSizes = 0, bDoCRC = 1, bDoCSUM = 1, bDoC = 1, bDoEngine = 1;
+unsigned long ulBaud = 0, ulLatency = 0;
+double dBER = 0.0;
+long cbMax, l1;
+char *pSrc, *p1, *p2, szTemp[] = "/tmp/xmbenchXXXXXX", szSrcTemp[] = "/tmp/xmbenchXXXXXX";
+int i1, i2, i3, i4, iOutFile, iSrcFile, nFail = 0;
+
+  pApp = argv[0];
+
+  while((i1 = getopt(argc, argv, "hs:m:e:B:L:E:n:")) != -1)
+  {
+    switch(i1)
+    {
+      case 'h':
+        usage();
+        return 0;
+
+      case 's':
+        for(p1 = optarg; p1 && *p1 && nSizes < MAX_SIZES; p1 = p2)
+        {
+          p2 = strchr(p1, ',');
+          if(p2)
+          {
+            *(p2++) = 0;
+          }
+
+          aSizes[nSizes] = ParseSize(p1);
+          if(aSizes[nSizes] <= 0)
+          {
+            fprintf(stderr, "%s: invalid size \"%s\"\n", pApp, p1);
+            return 1;
+          }
+
+          nSizes++;
+        }
+        break;
+
+      case 'm':
+        bDoCRC = strstr(optarg, "crc") != NULL;
+        bDoCSUM = strstr(optarg, "csum") != NULL;
+
+        if(!bDoCRC && !bDoCSUM)
+        {
+          fprintf(stderr, "%s: invalid mode \"%s\"\n", pApp, optarg);
+          return 1;
+        }
+        break;
+
+      case 'e':
+        bDoC = !strcmp(optarg, "c") || !strncmp(optarg, "c,", 2) || strstr(optarg, ",c") != NULL;
+        bDoEngine = strstr(optarg, "engine") != NULL;
+
+        if(!bDoC && !bDoEngine)
+        {
+          fprintf(stderr, "%s: invalid engine \"%s\"\n", pApp, optarg);
+          return 1;
+        }
+        break;
+
+      case 'B':
+        ulBaud = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'L':
+        ulLatency = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'E':
+        dBER = atof(optarg);
+        if(dBER < 0.0 || dBER >= 0.5)
+        {
+          fprintf(stderr, "%s: invalid bit error rate \"%s\"\n", pApp, optarg);
+          return 1;
+        }
+        break;
+
+      case 'n':
+        iRepeat = atoi(optarg);
+        if(iRepeat < 1)
+        {
+          iRepeat = 1;
+        }
+        break;
+
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  if(!nSizes)
+  {
+    aSizes[nSizes++] = 1024L;
+    aSizes[nSizes++] = 65536L;
+    aSizes[nSizes++] = 1024L * 1024L;
+  }
+
+  signal(SIGINT, signalproc);
+  signal(SIGTERM, signalproc);
+  signal(SIGPIPE, SIG_IGN);
+
+  for(i1=0, cbMax=0; i1 < nSizes; i1++)
+  {
+    if(aSizes[i1] > cbMax)
+    {
+      cbMax = aSizes[i1];
+    }
+  }
+
+  // random source data, the same for every run
+  pSrc = (char *)malloc(cbMax);
+  if(!pSrc)
+  {
+    fprintf(stderr, "%s: not enough memory\n", pApp);
+    return 2;
+  }
+
+  srand48(1);
+  for(l1=0; l1 < cbMax; l1++)
+  {
+    pSrc[l1] = (char)(lrand48() & 0xff);
+  }
+
+  // named, since the engine opens them itself.  both are removed at the end
+  iOutFile = mkstemp(szTemp);
+  iSrcFile = iOutFile == -1 ? -1 : mkstemp(szSrcTemp);
+
+  if(iSrcFile == -1)
+  {
+    fprintf(stderr, "%s: unable to create temporary file, errno=%d\n", pApp, errno);
+
+    if(iOutFile != -1)
+    {
+      close(iOutFile);
+      unlink(szTemp);
+    }
+
+    return 2;
+  }
+
+  close(iSrcFile);
+
+  printf("%9s  %-5s %-6s %7s %5s %8s %9s %11s %9s %6s %6s %6s %9s  %s\n",
+         "size", "mode", "xfer", "baud", "lat", "BER", "seconds", "bytes/s", "blocks/s",
+         "s-err", "r-err", "biterr", "cpu ms/MB", "result");
+
+  for(i1=0; i1 < nSizes && !bQuitFlag; i1++)
+  {
+    for(i2=0; i2 < 2 && !bQuitFlag; i2++)
+    {
+      if((!i2 && !bDoCRC) || (i2 && !bDoCSUM))
+      {
+        continue;
+      }
+
+      for(i3=0; i3 < 2 && !bQuitFlag; i3++)
+      {
+        if((!i3 && !bDoC) || (i3 && !bDoEngine))
+        {
+          continue;
+        }
+
+        for(i4=0; i4 < iRepeat && !bQuitFlag; i4++)
+        {
+          nFail += RunOne(pSrc, aSizes[i1], !i2, i3, iOutFile, szTemp, szSrcTemp, ulBaud, ulLatency, dBER) ? 1 : 0;
+        }
+      }
+    }
+  }
+
+  close(iOutFile);
+  unlink(szTemp);
+  unlink(szSrcTemp);
+  free(pSrc);
+
+  return nFail ? 1 : 0;
+}
+
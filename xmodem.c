@@ -25,8 +25,23 @@
 int my_read(SERIAL_TYPE iFile, void *pBuf, int cbBuf);
 int my_write(SERIAL_TYPE iFile, const void *pBuf, int cbBuf);
 void my_flush(SERIAL_TYPE iFile);
+void MyGetsEchoOff(void);
+#ifndef WIN32
+SERIAL_TYPE my_poll_handle(SERIAL_TYPE iFile); // what to 'poll()' for input, not always 'iFile'
+#endif // WIN32
 #endif // SFTARDCAL
 
+// protocol counters - 'sftardcal.c' defines this before including the file
+#ifndef XMODEM_METRIC
+#define XMODEM_METRIC(X) /* BLOCK_SENT, BLOCK_RECEIVED, NAK_SENT, NAK_RECEIVED, RETRANSMIT */
+#endif // XMODEM_METRIC
+
+// tracepoints (see 'sftprobes.h'), same idea
+#ifndef XMODEM_PROBE1
+#define XMODEM_PROBE1(X,A)
+#define XMODEM_PROBE2(X,A,B)
+#endif // XMODEM_PROBE1
+
 // internal structure definitions
 
 // Windows requires a different way of specifying structure packing
@@ -118,6 +133,14 @@ typedef struct _XMODEM_
 
   unsigned char bCRC;  // non-zero for CRC, zero for checksum
 
+#ifndef ARDUINO
+  const char *pMem;    // optional in-memory source for SendXmodem (NULL to read 'file')
+  long cbMem;          // size of the in-memory source, in bytes
+  void (*pProgress)(struct _XMODEM_ *pX, long block, long filepos, long filesize,
+                    int ecount, long etotal); // optional progress callback
+  void *pUser;         // caller-defined data for 'pProgress'
+#endif // ARDUINO
+
 } XMODEM;
 
 \endcode
@@ -136,6 +159,14 @@ typedef struct _XMODEM_
 
   unsigned char bCRC;  ///< non-zero for CRC, zero for checksum
 
+#ifndef ARDUINO
+  const char *pMem;    ///< optional in-memory source for SendXmodem (NULL to read 'file')
+  long cbMem;          ///< size of the in-memory source, in bytes
+  void (*pProgress)(struct _XMODEM_ *pX, long block, long filepos, long filesize,
+                    int ecount, long etotal); ///< optional progress callback, replaces the stderr progress line
+  void *pUser;         ///< caller-defined data for 'pProgress'
+#endif // ARDUINO
+
 } XMODEM;
 
 
@@ -503,7 +534,7 @@ unsigned long ulStart;
   do
   {
 #ifndef WIN32
-    aFD[0].fd = ser;
+    aFD[0].fd = my_poll_handle(ser);
     aFD[0].events = POLLIN | POLLERR;
     aFD[0].revents = 0;
 
@@ -770,6 +801,7 @@ unsigned long ulStart;
 
 #elif defined(SFTARDCAL)
 
+  MyGetsEchoOff(); // flushed protocol bytes must never be echoed to stdout
   my_flush(ser);
 
 #elif defined(WIN32)
@@ -953,6 +985,8 @@ short i1, i2, i3;
       XModemFlushInput(pX->ser);  // necessary to avoid problems
 
       cY = _NAK_; // send NAK (to get the checksum version)
+      XMODEM_METRIC(NAK_SENT);
+      XMODEM_PROBE2(xmodem__send__nak, block, ecount + 1);
       ecount ++; // for this packet
       etotal ++;
     }
@@ -982,6 +1016,8 @@ short i1, i2, i3;
       {
         cY = 'C'; // send 'CRC' NAK (the character 'C') (to get the CRC version)
       }
+      XMODEM_METRIC(NAK_SENT);
+      XMODEM_PROBE2(xmodem__send__nak, block, ecount + 1);
       ecount ++; // for this packet
       etotal ++;
     }
@@ -1009,12 +1045,23 @@ short i1, i2, i3;
       }
 #endif // ARDUINO
       cY = _ACK_; // send ACK
+      XMODEM_METRIC(BLOCK_RECEIVED);
+      XMODEM_PROBE2(xmodem__recv__packet, block, (int)sizeof(pX->buf.xbuf.aDataBuf));
       block ++;
       filesize += sizeof(pX->buf.xbuf.aDataBuf); // TODO:  need method to avoid extra crap at end of file
       ecount = 0; // zero out error count for next packet
     }
 
+#ifndef ARDUINO
+    if(pX->pProgress)
+    {
+      pX->pProgress(pX, block - 1, filesize, 0, ecount, etotal);
+    }
+#endif // ARDUINO
 #if defined(STAND_ALONE) || defined(SFTARDCAL)
+#ifndef ARDUINO
+    else
+#endif // ARDUINO
     fprintf(stderr, "block %ld  %ld bytes  %d errors\r"
 #ifndef SFTARDCAL
             "\n"
@@ -1122,11 +1169,19 @@ long etotal, filesize, filepos, block;
 
 #else // ARDUINO
 
+  if(pX->pMem) // in-memory source, the file handle is not used
+  {
+    filesize = pX->cbMem;
+  }
+  else
+  {
 #ifdef WIN32
-  filesize = (long)SetFilePointer(pX->file, 0, NULL, FILE_END);
+    filesize = (long)SetFilePointer(pX->file, 0, NULL, FILE_END);
 #else // WIN32
-  filesize = (long)lseek(pX->file, 0, SEEK_END);
+    filesize = (long)lseek(pX->file, 0, SEEK_END);
 #endif // WIN32
+  }
+
   if(filesize < 0) // not allowed
   {
 #ifdef STAND_ALONE
@@ -1135,11 +1190,14 @@ long etotal, filesize, filepos, block;
     return -1;
   }
 
+  if(!pX->pMem)
+  {
 #ifdef WIN32
-  SetFilePointer(pX->file, 0, NULL, FILE_BEGIN);
+    SetFilePointer(pX->file, 0, NULL, FILE_BEGIN);
 #else // WIN32
-  lseek(pX->file, 0, SEEK_SET); // position at beginning
+    lseek(pX->file, 0, SEEK_SET); // position at beginning
 #endif // WIN32
+  }
 
 #endif // ARDUINO
 
@@ -1179,7 +1237,16 @@ long etotal, filesize, filepos, block;
 //  TODO:  progress indicator [can be LCD for arduino, blinky lights, ???  and of course stderr for everyone else]
 //  If filesize& <> 0 Then Form2!Label1.FloodPercent = 100 * filepos& / filesize&
 
+#ifndef ARDUINO
+    if(pX->pProgress)
+    {
+      pX->pProgress(pX, block, filepos, filesize, ecount, etotal);
+    }
+#endif // ARDUINO
 #if defined(STAND_ALONE) || defined(SFTARDCAL)
+#ifndef ARDUINO
+    else
+#endif // ARDUINO
     fprintf(stderr, "block %ld  %ld of %ld bytes  %d errors\r"
 #ifndef SFTARDCAL
             "\n"
@@ -1196,64 +1263,76 @@ long etotal, filesize, filepos, block;
     }
 
 
+#ifndef ARDUINO
+    if(pX->pMem) // in-memory source - no seek or read, just copy the block
+    {
+      memset(pX->buf.xcbuf.aDataBuf, '\x1a', sizeof(pX->buf.xcbuf.aDataBuf)); // ctrl+z fill, as below
+      memcpy(pX->buf.xbuf.aDataBuf, pX->pMem + filepos,
+             (filesize - filepos) >= sizeof(pX->buf.xbuf.aDataBuf)
+             ? sizeof(pX->buf.xbuf.aDataBuf) : (size_t)(filesize - filepos));
+    }
+    else
+#endif // ARDUINO
+    {
 #ifdef ARDUINO
-    pX->file.seek(filepos); // in case I'm doing a 'retry' and I have to re-read part of the file
+      pX->file.seek(filepos); // in case I'm doing a 'retry' and I have to re-read part of the file
 #elif defined(WIN32)
-    SetFilePointer(pX->file, filepos, NULL, FILE_BEGIN);
+      SetFilePointer(pX->file, filepos, NULL, FILE_BEGIN);
 #else  // ARDUINO
-    lseek(pX->file, filepos, SEEK_SET); // same reason as above
+      lseek(pX->file, filepos, SEEK_SET); // same reason as above
 #endif // ARDUINO
 
-    // fortunately, xbuf and xcbuf are the same through the end of 'aDataBuf' so
-    // I can read the file NOW using 'xbuf' for both CRC and CHECKSUM versions
+      // fortunately, xbuf and xcbuf are the same through the end of 'aDataBuf' so
+      // I can read the file NOW using 'xbuf' for both CRC and CHECKSUM versions
 
-    if((filesize - filepos) >= sizeof(pX->buf.xbuf.aDataBuf))
-    {
+      if((filesize - filepos) >= sizeof(pX->buf.xbuf.aDataBuf))
+      {
 #ifdef ARDUINO
-      i1 = pX->file.read(pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xcbuf.aDataBuf));
+        i1 = pX->file.read(pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xcbuf.aDataBuf));
 #elif defined(WIN32)
-      cbRead = 0;
-      if(!ReadFile(pX->file, pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xbuf.aDataBuf),
-                    &cbRead, NULL))
-      {
-        i1 = -1;
-      }
-      else
-      {
-        i1 = (int)cbRead;
-      }
+        cbRead = 0;
+        if(!ReadFile(pX->file, pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xbuf.aDataBuf),
+                      &cbRead, NULL))
+        {
+          i1 = -1;
+        }
+        else
+        {
+          i1 = (int)cbRead;
+        }
 #else  // ARDUINO
-      i1 = read(pX->file, pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xcbuf.aDataBuf));
+        i1 = read(pX->file, pX->buf.xbuf.aDataBuf, sizeof(pX->buf.xcbuf.aDataBuf));
 #endif // ARDUINO
 
-      if(i1 != sizeof(pX->buf.xcbuf.aDataBuf))
-      {
-        // TODO:  read error - send a ctrl+x ?
-      }
-    }
-    else
-    {
-      memset(pX->buf.xcbuf.aDataBuf, '\x1a', sizeof(pX->buf.xcbuf.aDataBuf)); // fill with ctrl+z which is what the spec says
-#ifdef ARDUINO
-      i1 = pX->file.read(pX->buf.xbuf.aDataBuf, filesize - filepos);
-#elif defined(WIN32)
-      cbRead = 0;
-      if(!ReadFile(pX->file, pX->buf.xbuf.aDataBuf, filesize - filepos,
-                    &cbRead, NULL))
-      {
-        i1 = -1;
+        if(i1 != sizeof(pX->buf.xcbuf.aDataBuf))
+        {
+          // TODO:  read error - send a ctrl+x ?
+        }
       }
       else
       {
-        i1 = (int)cbRead;
-      }
+        memset(pX->buf.xcbuf.aDataBuf, '\x1a', sizeof(pX->buf.xcbuf.aDataBuf)); // fill with ctrl+z which is what the spec says
+#ifdef ARDUINO
+        i1 = pX->file.read(pX->buf.xbuf.aDataBuf, filesize - filepos);
+#elif defined(WIN32)
+        cbRead = 0;
+        if(!ReadFile(pX->file, pX->buf.xbuf.aDataBuf, filesize - filepos,
+                      &cbRead, NULL))
+        {
+          i1 = -1;
+        }
+        else
+        {
+          i1 = (int)cbRead;
+        }
 #else  // ARDUINO
-      i1 = read(pX->file, pX->buf.xbuf.aDataBuf, filesize - filepos);
+        i1 = read(pX->file, pX->buf.xbuf.aDataBuf, filesize - filepos);
 #endif // ARDUINO
 
-      if(i1 != (filesize - filepos))
-      {
-        // TODO:  read error - send a ctrl+x ?
+        if(i1 != (filesize - filepos))
+        {
+          // TODO:  read error - send a ctrl+x ?
+        }
       }
     }
 
@@ -1272,6 +1351,8 @@ long etotal, filesize, filepos, block;
       // send it
 
       i1 = WriteXmodemBlock(pX->ser, &(pX->buf.xcbuf), sizeof(pX->buf.xcbuf));
+      XMODEM_PROBE2(xmodem__send__packet, block, i1);
+
       if(i1 != sizeof(pX->buf.xcbuf)) // write error
       {
         // TODO:  handle write error (send ctrl+X ?)
@@ -1292,6 +1373,8 @@ long etotal, filesize, filepos, block;
       // send it
 
       i1 = WriteXmodemBlock(pX->ser, &(pX->buf.xbuf), sizeof(pX->buf.xbuf));
+      XMODEM_PROBE2(xmodem__send__packet, block, i1);
+
       if(i1 != sizeof(pX->buf.xbuf)) // write error
       {
         // TODO:  handle write error (send ctrl+X ?)
@@ -1313,12 +1396,18 @@ long etotal, filesize, filepos, block;
         else if(pX->buf.xbuf.cSOH == _NAK_ || // ** NACK
                 pX->buf.xbuf.cSOH == 'C') // ** CRC NACK
         {
+          etotal++; // the packet will be re-sent
+          XMODEM_METRIC(NAK_RECEIVED);
+          XMODEM_METRIC(RETRANSMIT);
+          XMODEM_PROBE2(xmodem__recv__nak, block, etotal);
           break;  // exit inner loop and re-send packet
         }
         else if(pX->buf.xbuf.cSOH == _ACK_) // ** ACK - sending next packet
         {
+          XMODEM_PROBE1(xmodem__recv__ack, block);
           filepos += sizeof(pX->buf.xbuf.aDataBuf);
           block++; // increment file position and block count
+          XMODEM_METRIC(BLOCK_SENT);
 
           break; // leave inner loop, send NEXT packet
         }
@@ -1331,6 +1420,8 @@ long etotal, filesize, filepos, block;
       else
       {
         ecount++; // increase total error count, then loop back and re-send packet
+        etotal++;
+        XMODEM_METRIC(RETRANSMIT);
         break;
       }
     }
@@ -1508,7 +1599,74 @@ unsigned long ulStart;
 //
 //}  __attribute__((__packed__)) XMODEM;
 
-#ifdef ARDUINO
+#if defined(ARDUINO) && defined(XMODEM_ENGINE)
+
+// thin instantiations of the template engine in 'xmodem.hpp', using the
+// bit-at-a-time CRC and no progress display to keep the footprint small
+
+#include "xmodem.hpp"
+
+typedef XModemEngine<XMArduinoSerial, XMSDFile, XMArduinoClock> XMArduinoEngine;
+
+short XReceive(SDClass *pSD, HardwareSerial *pSer, const char *szFilename)
+{
+short iRval;
+File file;
+
+  if(pSD->exists((char *)szFilename))
+  {
+    pSD->remove((char *)szFilename);
+  }
+
+  file = pSD->open((char *)szFilename, FILE_WRITE);
+  if(!file)
+  {
+    return -9; // can't create file
+  }
+
+  {
+    XMArduinoSerial xs(pSer);
+    XMSDFile xf(file);
+
+    iRval = XMArduinoEngine(xs, xf).Receive();
+  }
+
+  file.close();
+
+  if(iRval)
+  {
+    WriteXmodemChar(pSer, _CAN_); // cancel (make sure)
+
+    pSD->remove((char *)szFilename); // delete file on error
+  }
+
+  return iRval;
+}
+
+int XSend(SDClass *pSD, HardwareSerial *pSer, const char *szFilename)
+{
+short iRval;
+File file;
+
+  file = pSD->open(szFilename, FILE_READ);
+  if(!file)
+  {
+    return -9; // can't open file
+  }
+
+  {
+    XMArduinoSerial xs(pSer);
+    XMSDFile xf(file);
+
+    iRval = XMArduinoEngine(xs, xf).Send();
+  }
+
+  file.close();
+
+  return iRval;
+}
+
+#elif defined(ARDUINO)
 
 short XReceive(SDClass *pSD, HardwareSerial *pSer, const char *szFilename)
 {
@@ -1566,6 +1724,10 @@ XMODEM xx;
   return iRval;
 }
 
+#elif defined(XMODEM_ENGINE)
+
+// host 'XReceive' and 'XSend' are in 'xmodem_engine.cpp'
+
 #else // ARDUINO
 
 int XReceive(SERIAL_TYPE hSer, const char *szFilename, int nMode)
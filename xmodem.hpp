@@ -0,0 +1,1153 @@
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//                              _                      _                    //
+// __  __ _ __ ___    ___    __| |  ___  _ __ ___     | |__    _ __   _ __  //
+// \ \/ /| '_ ` _ \  / _ \  / _` | / _ \| '_ ` _ \    | '_ \  | '_ \ | '_ \ //
+//  >  < | | | | | || (_) || (_| ||  __/| | | | | | _ | | | | | |_) || |_) |//
+// /_/\_\|_| |_| |_| \___/  \__,_| \___||_| |_| |_|(_)|_| |_| | .__/ | .__/ //
+//                                                            |_|    |_|    //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//          Copyright (c) 2012 by S.F.T. Inc. - All rights reserved         //
+//  Use, copying, and distribution of this software are licensed according  //
+//   to the LGPLv2.1, or a BSD-like license, as appropriate (see xmodem.h)  //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+
+/** \file xmodem.hpp
+  * \brief header-only C++ template engine for the S.F.T. XMODEM library
+  *
+  * The same protocol as 'xmodem.c', except that the serial transport, the file
+  * source/sink, the clock, the block size, the CRC method, and the progress display
+  * are all template parameters ('policies').  Every I/O and CRC call resolves at
+  * compile time, so there are no per-byte '#ifdef' paths and the compiler is free to
+  * inline all of it.  The 'XSend' and 'XReceive' entry points for ARDUINO (see
+  * 'xmodem.c') and for the host (see 'xmodem_engine.cpp') are thin instantiations
+  * of \ref XModemEngine when XMODEM_ENGINE is defined.
+**/
+
+/** \defgroup xmodem_engine XModem Template Engine
+  * C++ template engine and its policy classes
+*/
+
+#ifndef _XMODEM_HPP_INCLUDED_
+#define _XMODEM_HPP_INCLUDED_
+
+#include "xmodem.h"
+
+#ifndef ARDUINO
+#include <string.h>
+#ifndef WIN32
+#include <poll.h>
+#endif // WIN32
+#endif // ARDUINO
+
+
+// special I/O when linked into 'SFTARDCAL' application (these are C functions)
+#ifdef SFTARDCAL
+extern "C"
+{
+int my_read(SERIAL_TYPE iFile, void *pBuf, int cbBuf);
+int my_write(SERIAL_TYPE iFile, const void *pBuf, int cbBuf);
+int my_pollin(SERIAL_TYPE iFile);
+void my_flush(SERIAL_TYPE iFile);
+void MyGetsEchoOff(void);
+void MySleep(unsigned int dwMsec);
+int QuitFlag(void);
+#ifndef WIN32
+SERIAL_TYPE my_poll_handle(SERIAL_TYPE iFile);
+#endif // WIN32
+}
+#endif // SFTARDCAL
+
+// protocol counters, same as in 'xmodem.c' ('xmodem_engine.cpp' defines this for sftardcal)
+#ifndef XMODEM_METRIC
+#define XMODEM_METRIC(X) /* BLOCK_SENT, BLOCK_RECEIVED, NAK_SENT, NAK_RECEIVED, RETRANSMIT */
+#endif // XMODEM_METRIC
+
+// tracepoints, also the same as in 'xmodem.c' (see 'sftprobes.h')
+#ifndef XMODEM_PROBE1
+#define XMODEM_PROBE1(X,A)
+#define XMODEM_PROBE2(X,A,B)
+#endif // XMODEM_PROBE1
+
+
+// protocol characters, same values as the '_SOH_' etc. in 'xmodem.c'
+enum
+{
+  XM_SOH = 1,   // start of 128 byte packet
+  XM_STX = 2,   // start of 1024 byte packet (XMODEM-1K)
+  XM_EOT = 4,
+  XM_ENQ = 5,
+  XM_ACK = 6,
+  XM_NAK = 21,
+  XM_CAN = 24,  // CTRL+X
+  XM_CRC_NAK = 'C'
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+//                         CHECK VALUE POLICIES                           //
+////////////////////////////////////////////////////////////////////////////
+
+/** \ingroup xmodem_engine
+  * \brief CRC implementation using the 'long way' (bit at a time)
+  *
+  * Smallest code, and no table, so this is what the ARDUINO build uses.  The math is
+  * the same as 'CalcCRC()' in 'xmodem.c' (CRC-16-CCITT, polynomial 1021H).
+**/
+struct XMCRC16Bitwise
+{
+  static inline unsigned short Update(unsigned short wCRC, unsigned char bVal)
+  {
+    unsigned char i1;
+
+    wCRC ^= (unsigned short)bVal << 8;
+
+    for(i1=0; i1 < 8; i1++)
+    {
+      if(wCRC & 0x8000)
+      {
+        wCRC = (wCRC << 1) ^ 0x1021;
+      }
+      else
+      {
+        wCRC <<= 1;
+      }
+    }
+
+    return wCRC;
+  }
+};
+
+/** \ingroup xmodem_engine
+  * \brief CRC implementation using 'the table lookup' method
+  *
+  * One lookup per byte instead of 8 shift/test operations.  The table is 512 bytes, which
+  * is fine for the host but too much RAM for an AVR.  It is a template so that the table
+  * can live in this header without violating the one-definition rule.
+**/
+template<int N>
+struct XMCRC16TableT
+{
+  static const unsigned short aTable[256];
+
+  static inline unsigned short Update(unsigned short wCRC, unsigned char bVal)
+  {
+    return (unsigned short)(wCRC << 8) ^ aTable[(unsigned char)(wCRC >> 8) ^ bVal];
+  }
+};
+
+template<int N>
+const unsigned short XMCRC16TableT<N>::aTable[256] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+  0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+  0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+  0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+  0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+  0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+  0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+  0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+  0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+  0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+  0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+  0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+  0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+  0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+  0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+  0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+  0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+  0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+  0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+  0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+  0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+  0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+  0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+typedef XMCRC16TableT<0> XMCRC16Table;
+
+
+/** \ingroup xmodem_engine
+  * \brief Check value policy for XMODEM CHECKSUM (1 byte, receiver polls with NAK)
+**/
+struct XMCheckSum
+{
+  enum { cbTrailer = 1, cPoll = XM_NAK };
+
+  static inline void Calc(const unsigned char *pBuf, int cbBuf, unsigned char *pTrailer)
+  {
+    unsigned char bSum = 0;
+    int i1;
+
+    for(i1=0; i1 < cbBuf; i1++)
+    {
+      bSum += pBuf[i1];
+    }
+
+    pTrailer[0] = bSum;
+  }
+
+  static inline int Verify(const unsigned char *pBuf, int cbBuf, const unsigned char *pTrailer)
+  {
+    unsigned char aCheck[2];
+
+    Calc(pBuf, cbBuf, aCheck);
+
+    return aCheck[0] == pTrailer[0];
+  }
+};
+
+/** \ingroup xmodem_engine
+  * \brief Check value policy for XMODEM CRC (2 bytes, high endian, receiver polls with 'C')
+  *
+  * 'Impl' is either \ref XMCRC16Bitwise or \ref XMCRC16Table
+**/
+template<class Impl>
+struct XMCRC
+{
+  enum { cbTrailer = 2, cPoll = XM_CRC_NAK };
+
+  static inline void Calc(const unsigned char *pBuf, int cbBuf, unsigned char *pTrailer)
+  {
+    unsigned short wCRC = 0;
+    int i1;
+
+    for(i1=0; i1 < cbBuf; i1++)
+    {
+      wCRC = Impl::Update(wCRC, pBuf[i1]);
+    }
+
+    pTrailer[0] = (unsigned char)(wCRC >> 8); // high endian, no 'my_htons' needed
+    pTrailer[1] = (unsigned char)(wCRC & 0xff);
+  }
+
+  static inline int Verify(const unsigned char *pBuf, int cbBuf, const unsigned char *pTrailer)
+  {
+    unsigned char aCheck[2];
+
+    Calc(pBuf, cbBuf, aCheck);
+
+    return aCheck[0] == pTrailer[0] && aCheck[1] == pTrailer[1];
+  }
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+//                       PROGRESS DISPLAY POLICIES                        //
+////////////////////////////////////////////////////////////////////////////
+
+/** \ingroup xmodem_engine
+  * \brief Progress policy that does nothing (ARDUINO, or a caller with its own display)
+**/
+struct XMNoProgress
+{
+  static inline void Report(long /*block*/, long /*filepos*/, long /*filesize*/, int /*ecount*/, long /*etotal*/)
+  {
+  }
+};
+
+#ifndef ARDUINO
+/** \ingroup xmodem_engine
+  * \brief Progress policy that writes the same stderr progress line as 'xmodem.c'
+  *
+  * A 'filesize' of zero indicates a receive, for which the size is not known.
+**/
+struct XMStderrProgress
+{
+  static inline void Report(long block, long filepos, long filesize, int ecount, long /*etotal*/)
+  {
+    if(filesize > 0)
+    {
+      fprintf(stderr, "block %ld  %ld of %ld bytes  %d errors\r", block, filepos, filesize, ecount);
+    }
+    else
+    {
+      fprintf(stderr, "block %ld  %ld bytes  %d errors\r", block, filepos, ecount);
+    }
+
+#ifndef SFTARDCAL
+    fputc('\n', stderr);
+#endif // SFTARDCAL
+  }
+};
+#endif // ARDUINO
+
+
+////////////////////////////////////////////////////////////////////////////
+//                            CLOCK POLICIES                              //
+////////////////////////////////////////////////////////////////////////////
+
+// A clock policy has one static function, 'Millis()', returning milliseconds as an
+// unsigned long.  Only differences are used, so wraparound is harmless.
+
+#ifdef ARDUINO
+
+/** \ingroup xmodem_engine
+  * \brief Clock policy for ARDUINO, the 'millis()' function
+**/
+struct XMArduinoClock
+{
+  static inline unsigned long Millis(void)
+  {
+    return millis();
+  }
+};
+
+#else // ARDUINO
+
+/** \ingroup xmodem_engine
+  * \brief Clock policy for POSIX and WIN32 hosts
+**/
+struct XMHostClock
+{
+  static inline unsigned long Millis(void)
+  {
+#ifdef WIN32
+    return GetTickCount();
+#else // WIN32
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (unsigned long)tv.tv_sec * 1000L + (unsigned long)tv.tv_usec / 1000L;
+#endif // WIN32
+  }
+};
+
+#endif // ARDUINO
+
+
+////////////////////////////////////////////////////////////////////////////
+//                          TRANSPORT POLICIES                            //
+////////////////////////////////////////////////////////////////////////////
+
+// A transport policy is an object (it holds the serial handle) with these members:
+//
+//   int WaitInput(unsigned int dwMsec)   > 0 if input is waiting, 0 on timeout, < 0 on error
+//   int Read(void *pBuf, int cbBuf)      read what's waiting, up to 'cbBuf', without blocking
+//   int Write(const void *pBuf, int cbBuf)
+//   void FlushInput(void)                discard input until 1 second of silence (see 'XModemFlushInput')
+//   int Abort(void)                      non-zero to give up (application is shutting down)
+
+#ifdef ARDUINO
+
+/** \ingroup xmodem_engine
+  * \brief Transport policy for an ARDUINO 'HardwareSerial' object
+**/
+class XMArduinoSerial
+{
+public:
+  XMArduinoSerial(HardwareSerial *pSer) : m_pSer(pSer) { }
+
+  inline int WaitInput(unsigned int dwMsec)
+  {
+    unsigned long ulStart = millis();
+
+    while(!m_pSer->available())
+    {
+      if((millis() - ulStart) >= dwMsec)
+      {
+        return 0;
+      }
+    }
+
+    return 1;
+  }
+
+  inline int Read(void *pBuf, int cbBuf)
+  {
+    int cb1 = m_pSer->available();
+
+    if(cb1 > cbBuf)
+    {
+      cb1 = cbBuf;
+    }
+
+    return m_pSer->readBytes((char *)pBuf, cb1);
+  }
+
+  inline int Write(const void *pBuf, int cbBuf)
+  {
+    return m_pSer->write((const uint8_t *)pBuf, cbBuf);
+  }
+
+  void FlushInput(void)
+  {
+    unsigned long ulStart = millis();
+
+    do
+    {
+      if(m_pSer->available())
+      {
+        m_pSer->read(); // don't care about the data
+        ulStart = millis(); // reset time
+      }
+      else
+      {
+        delay(1);
+      }
+    } while((millis() - ulStart) < 1000);
+  }
+
+  inline int Abort(void)
+  {
+    return 0;
+  }
+
+protected:
+  HardwareSerial *m_pSer;
+};
+
+#elif defined(SFTARDCAL)
+
+/** \ingroup xmodem_engine
+  * \brief Transport policy for the 'my_read' etc. functions in 'sftardcal.c'
+**/
+class XMSftTransport
+{
+public:
+  XMSftTransport(SERIAL_TYPE hSer) : m_hSer(hSer) { }
+
+  inline int WaitInput(unsigned int dwMsec)
+  {
+#ifdef WIN32
+    if(my_pollin(m_hSer) > 0)
+    {
+      return 1;
+    }
+
+    MySleep(1);
+    return 0;
+#else // WIN32
+    struct pollfd aFD[1];
+    int i1;
+
+    aFD[0].fd = my_poll_handle(m_hSer); // serial input may be coming from a ring buffer
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+
+    i1 = poll(aFD, 1, dwMsec);
+
+    if(i1 < 0)
+    {
+      fprintf(stderr, "poll error %d\n", errno);
+      return -1;
+    }
+
+    return i1 > 0 && (aFD[0].revents & POLLIN);
+#endif // WIN32
+  }
+
+  inline int Read(void *pBuf, int cbBuf)
+  {
+    return my_read(m_hSer, pBuf, cbBuf);
+  }
+
+  inline int Write(const void *pBuf, int cbBuf)
+  {
+    return my_write(m_hSer, pBuf, cbBuf);
+  }
+
+  inline void FlushInput(void)
+  {
+    MyGetsEchoOff(); // flushed protocol bytes must never be echoed to stdout
+    my_flush(m_hSer);
+  }
+
+  inline int Abort(void)
+  {
+    return QuitFlag();
+  }
+
+protected:
+  SERIAL_TYPE m_hSer;
+};
+
+#elif !defined(WIN32)
+
+/** \ingroup xmodem_engine
+  * \brief Transport policy for a POSIX file descriptor (stand-alone 'xmodem.c' build)
+  *
+  * The descriptor must be in non-blocking mode, as 'ttyconfig' in 'xmodem.c' leaves it.
+**/
+class XMFdTransport
+{
+public:
+  XMFdTransport(int iSer) : m_iSer(iSer) { }
+
+  inline int WaitInput(unsigned int dwMsec)
+  {
+    struct pollfd aFD[1];
+    int i1;
+
+    aFD[0].fd = m_iSer;
+    aFD[0].events = POLLIN | POLLERR;
+    aFD[0].revents = 0;
+
+    i1 = poll(aFD, 1, dwMsec);
+
+    if(i1 < 0)
+    {
+      return errno == EINTR ? 0 : -1;
+    }
+
+    return i1 > 0 && (aFD[0].revents & POLLIN);
+  }
+
+  inline int Read(void *pBuf, int cbBuf)
+  {
+    int i1 = read(m_iSer, pBuf, cbBuf);
+
+    return (i1 < 0 && errno == EAGAIN) ? 0 : i1;
+  }
+
+  inline int Write(const void *pBuf, int cbBuf)
+  {
+    const char *p1 = (const char *)pBuf;
+    int i1, cb1 = 0;
+
+    while(cb1 < cbBuf) // non-blocking descriptor, so a partial write is possible
+    {
+      i1 = write(m_iSer, p1 + cb1, cbBuf - cb1);
+
+      if(i1 > 0)
+      {
+        cb1 += i1;
+      }
+      else if(i1 < 0 && errno != EAGAIN)
+      {
+        return cb1 ? cb1 : -1;
+      }
+      else
+      {
+        struct pollfd aFD[1];
+
+        aFD[0].fd = m_iSer;
+        aFD[0].events = POLLOUT;
+        aFD[0].revents = 0;
+
+        poll(aFD, 1, 100);
+      }
+    }
+
+    return cb1;
+  }
+
+  void FlushInput(void)
+  {
+    char buf[64];
+
+    while(WaitInput(1000) > 0) // until 1 second of silence
+    {
+      if(Read(buf, sizeof(buf)) < 0)
+      {
+        break;
+      }
+    }
+  }
+
+  inline int Abort(void)
+  {
+    return 0;
+  }
+
+protected:
+  int m_iSer;
+};
+
+#endif // ARDUINO, SFTARDCAL, POSIX
+
+
+////////////////////////////////////////////////////////////////////////////
+//                       FILE SOURCE/SINK POLICIES                        //
+////////////////////////////////////////////////////////////////////////////
+
+// A storage policy is an object with these members:
+//
+//   long Size(void)                               total size for sending, < 0 on error
+//   int ReadAt(long lPos, void *pBuf, int cbBuf)  bytes read, can be short at end of file
+//   int Write(const void *pBuf, int cbBuf)        bytes written (receive appends sequentially)
+
+#ifdef ARDUINO
+
+/** \ingroup xmodem_engine
+  * \brief Storage policy for an SD library 'File' object
+**/
+class XMSDFile
+{
+public:
+  XMSDFile(File &rFile) : m_rFile(rFile) { }
+
+  inline long Size(void)
+  {
+    return m_rFile.size();
+  }
+
+  inline int ReadAt(long lPos, void *pBuf, int cbBuf)
+  {
+    m_rFile.seek(lPos);
+    return m_rFile.read(pBuf, cbBuf);
+  }
+
+  inline int Write(const void *pBuf, int cbBuf)
+  {
+    return m_rFile.write((const uint8_t *)pBuf, cbBuf);
+  }
+
+protected:
+  File &m_rFile;
+};
+
+#else // ARDUINO
+
+/** \ingroup xmodem_engine
+  * \brief Storage policy for an open POSIX file descriptor or WIN32 file HANDLE
+**/
+class XMHostFile
+{
+public:
+  XMHostFile(FILE_TYPE hFile) : m_hFile(hFile) { }
+
+  inline long Size(void)
+  {
+#ifdef WIN32
+    return (long)GetFileSize(m_hFile, NULL);
+#else // WIN32
+    return (long)lseek(m_hFile, 0, SEEK_END);
+#endif // WIN32
+  }
+
+  inline int ReadAt(long lPos, void *pBuf, int cbBuf)
+  {
+#ifdef WIN32
+    DWORD cbRead = 0;
+
+    SetFilePointer(m_hFile, lPos, NULL, FILE_BEGIN);
+
+    if(!ReadFile(m_hFile, pBuf, cbBuf, &cbRead, NULL))
+    {
+      return -1;
+    }
+
+    return (int)cbRead;
+#else // WIN32
+    return (int)pread(m_hFile, pBuf, cbBuf, (off_t)lPos); // one system call instead of 'lseek' + 'read'
+#endif // WIN32
+  }
+
+  inline int Write(const void *pBuf, int cbBuf)
+  {
+#ifdef WIN32
+    DWORD cbWrote = 0;
+
+    if(!WriteFile(m_hFile, pBuf, cbBuf, &cbWrote, NULL))
+    {
+      return -1;
+    }
+
+    return (int)cbWrote;
+#else // WIN32
+    return (int)write(m_hFile, pBuf, cbBuf);
+#endif // WIN32
+  }
+
+protected:
+  FILE_TYPE m_hFile;
+};
+
+/** \ingroup xmodem_engine
+  * \brief Storage policy for sending from memory (such as a mapped file)
+**/
+class XMMemSource
+{
+public:
+  XMMemSource(const char *pMem, long cbMem) : m_pMem(pMem), m_cbMem(cbMem) { }
+
+  inline long Size(void)
+  {
+    return m_cbMem;
+  }
+
+  inline int ReadAt(long lPos, void *pBuf, int cbBuf)
+  {
+    if(lPos + cbBuf > m_cbMem)
+    {
+      cbBuf = (int)(m_cbMem - lPos);
+    }
+
+    memcpy(pBuf, m_pMem + lPos, cbBuf);
+    return cbBuf;
+  }
+
+  inline int Write(const void * /*pBuf*/, int /*cbBuf*/)
+  {
+    return -1; // read-only
+  }
+
+protected:
+  const char *m_pMem;
+  long m_cbMem;
+};
+
+#endif // ARDUINO
+
+
+////////////////////////////////////////////////////////////////////////////
+//                          THE ENGINE ITSELF                             //
+////////////////////////////////////////////////////////////////////////////
+
+/** \ingroup xmodem_engine
+  * \brief XMODEM protocol engine, parameterized by policy classes
+  *
+  * \param Transport serial connection policy (see \ref XMSftTransport for the members)
+  * \param Storage file source/sink policy (see \ref XMHostFile for the members)
+  * \param Clock clock policy, a static 'Millis()' function
+  * \param BlockSize 128 for XMODEM, 1024 for XMODEM-1K (CRC mode only, checksum mode always uses 128)
+  * \param CRC the CRC implementation, \ref XMCRC16Bitwise or \ref XMCRC16Table
+  * \param Progress progress display policy, a static 'Report()' function
+  *
+  * The protocol, timeouts, and error counts are the same as 'XSendSub()' and 'XReceiveSub()'
+  * in 'xmodem.c'.  CRC vs CHECKSUM is still negotiated at run time (the receiver's 'C' or NAK),
+  * but only once per transfer - each mode then runs its own instantiation of the transfer loop,
+  * with the check value calculation inlined and no mode tests inside of it.
+**/
+template<class Transport, class Storage, class Clock, int BlockSize = 128,
+         class CRC = XMCRC16Bitwise, class Progress = XMNoProgress>
+class XModemEngine
+{
+public:
+  XModemEngine(Transport &rT, Storage &rS) : m_rT(rT), m_rS(rS) { }
+
+  int Send(void);    // same return values as 'XSendSub'
+  int Receive(void); // same return values as 'XReceiveSub'
+
+protected:
+  // compile-time error if the block size isn't one the protocol allows
+  typedef char BlockSizeMustBe128or1024[(BlockSize == 128 || BlockSize == 1024) ? 1 : -1];
+
+  Transport &m_rT;
+  Storage &m_rS;
+  unsigned char m_aBuf[3 + BlockSize + 2]; // SOH, SEQ, ~SEQ, data, CRC or checksum
+
+  short GetBlock(void *pBuf, short cbSize);
+
+  inline int GetChar(unsigned char &bVal)
+  {
+    return GetBlock(&bVal, 1) == 1;
+  }
+
+  inline void PutChar(unsigned char bVal)
+  {
+    m_rT.Write(&bVal, 1);
+  }
+
+  template<class Check> int SendLoop(void);
+  template<class Check> int ReceiveLoop(unsigned char bHeader);
+};
+
+
+/** \ingroup xmodem_engine
+  * \brief Read 'cbSize' bytes, with the same silence and total timeouts as 'GetXmodemBlock()'
+**/
+template<class Transport, class Storage, class Clock, int BlockSize, class CRC, class Progress>
+short XModemEngine<Transport, Storage, Clock, BlockSize, CRC, Progress>::GetBlock(void *pBuf, short cbSize)
+{
+unsigned long ulStart, ulCur;
+short cb1;
+int i1;
+
+  ulStart = ulCur = Clock::Millis();
+  cb1 = 0;
+
+  do
+  {
+    i1 = m_rT.WaitInput(100);
+
+    if(i1 < 0)
+    {
+      return -1;
+    }
+    else if(i1 > 0)
+    {
+      i1 = m_rT.Read((char *)pBuf + cb1, cbSize - cb1);
+
+      if(i1 > 0)
+      {
+        cb1 += i1;
+        ulCur = Clock::Millis();
+      }
+    }
+  } while(cb1 < cbSize &&
+          !m_rT.Abort() &&
+          (Clock::Millis() - ulCur) < SILENCE_TIMEOUT &&
+          (Clock::Millis() - ulStart) < 10UL * SILENCE_TIMEOUT);
+
+  return cb1;
+}
+
+
+/** \ingroup xmodem_engine
+  * \brief Wait up to 30 seconds for the receiver's 'C' or NAK, then send the file
+**/
+template<class Transport, class Storage, class Clock, int BlockSize, class CRC, class Progress>
+int XModemEngine<Transport, Storage, Clock, BlockSize, CRC, Progress>::Send(void)
+{
+unsigned long ulStart;
+unsigned char bVal;
+
+  ulStart = Clock::Millis();
+
+  do
+  {
+    if(GetChar(bVal))
+    {
+      if(bVal == XM_CRC_NAK)
+      {
+        return SendLoop< XMCRC<CRC> >();
+      }
+      else if(bVal == XM_NAK)
+      {
+        return SendLoop<XMCheckSum>();
+      }
+      else if(bVal == XM_CAN) // cancel
+      {
+#if defined(STAND_ALONE) && !defined(ARDUINO)
+        fputs("XSendSub fail (cancel)\n", stderr);
+#endif // STAND_ALONE
+        return 1; // canceled
+      }
+    }
+  } while((Clock::Millis() - ulStart) < 30000 && !m_rT.Abort());
+
+  m_rT.FlushInput();
+
+#if defined(STAND_ALONE) && !defined(ARDUINO)
+  fputs("XSendSub fail (timeout)\n", stderr);
+#endif // STAND_ALONE
+  return -3; // fail
+}
+
+
+/** \ingroup xmodem_engine
+  * \brief The send loop, one instantiation for CHECKSUM and one for CRC (see 'SendXmodem()')
+  *
+  * The block is read and its check value calculated only when the file position changes,
+  * so a re-send after a NAK is just the write.
+**/
+template<class Transport, class Storage, class Clock, int BlockSize, class CRC, class Progress>
+template<class Check>
+int XModemEngine<Transport, Storage, Clock, BlockSize, CRC, Progress>::SendLoop(void)
+{
+enum { cbBlock = Check::cbTrailer > 1 ? BlockSize : 128, // XMODEM-1K requires CRC
+       cbPacket = 3 + cbBlock + Check::cbTrailer };
+long filesize, filepos, lastpos, block, etotal;
+int ecount, ec2, i1;
+unsigned char bVal;
+
+  filesize = m_rS.Size();
+
+  if(filesize < 0) // not allowed
+  {
+#if defined(STAND_ALONE) && !defined(ARDUINO)
+    fputs("SendXmodem fail (file size)\n", stderr);
+#endif // STAND_ALONE
+    return -1;
+  }
+
+  ecount = 0;
+  etotal = 0;
+  filepos = 0;
+  lastpos = -1; // nothing in the buffer yet
+  block = 1;
+
+  do
+  {
+    if(filepos >= filesize) // end of transfer
+    {
+      for(i1=0; i1 < 8; i1++)
+      {
+        PutChar(XM_EOT); // ** send an EOT marking end of transfer
+
+        if(GetChar(bVal) &&
+           (bVal == XM_ENQ || bVal == XM_ACK || bVal == XM_CAN)) // normal and 'abnormal' termination
+        {
+          break;
+        }
+      }
+
+      m_rT.FlushInput();
+
+      return i1 >= 8 ? 1 : 0; // return 1 if receiver choked on the 'EOT' marker, else 0 for 'success'
+    }
+
+    Progress::Report(block, filepos, filesize, ecount, etotal);
+
+    if(filepos != lastpos) // new block - read it and build the packet
+    {
+      i1 = m_rS.ReadAt(filepos, m_aBuf + 3,
+                       (filesize - filepos) >= cbBlock ? (int)cbBlock : (int)(filesize - filepos));
+      if(i1 < 0)
+      {
+        i1 = 0; // TODO:  read error - send a ctrl+x ?
+      }
+
+      if(i1 < cbBlock)
+      {
+        memset(m_aBuf + 3 + i1, '\x1a', cbBlock - i1); // fill with ctrl+z which is what the spec says
+      }
+
+      m_aBuf[0] = cbBlock > 128 ? XM_STX : XM_SOH;
+      m_aBuf[1] = (unsigned char)block;
+      m_aBuf[2] = (unsigned char)~block;
+
+      Check::Calc(m_aBuf + 3, cbBlock, m_aBuf + 3 + cbBlock);
+
+      lastpos = filepos;
+    }
+
+    if(m_rT.Write(m_aBuf, cbPacket) != cbPacket)
+    {
+      // TODO:  handle write error (send ctrl+X ?)
+    }
+
+    XMODEM_PROBE2(xmodem__send__packet, block, cbPacket);
+
+    ec2 = 0;
+
+    while(ecount < TOTAL_ERROR_COUNT && ec2 < ACK_ERROR_COUNT) // loop to get ACK or NACK
+    {
+      if(GetChar(bVal))
+      {
+        if(bVal == XM_CAN) // ** CTRL-X - terminate
+        {
+          m_rT.FlushInput();
+          return 1; // terminated
+        }
+        else if(bVal == XM_NAK || bVal == XM_CRC_NAK)
+        {
+          etotal++; // the packet will be re-sent
+          XMODEM_METRIC(NAK_RECEIVED);
+          XMODEM_METRIC(RETRANSMIT);
+          XMODEM_PROBE2(xmodem__recv__nak, block, etotal);
+          break;
+        }
+        else if(bVal == XM_ACK) // ** ACK - sending next packet
+        {
+          XMODEM_PROBE1(xmodem__recv__ack, block);
+          filepos += cbBlock;
+          block++;
+          XMODEM_METRIC(BLOCK_SENT);
+          break;
+        }
+        else
+        {
+          m_rT.FlushInput();
+          ec2++;
+        }
+      }
+      else
+      {
+        ecount++; // increase total error count, then loop back and re-send packet
+        etotal++;
+        XMODEM_METRIC(RETRANSMIT);
+        break;
+      }
+    }
+
+    if(ec2 >= ACK_ERROR_COUNT)
+    {
+      break; // that's it, I'm done with this
+    }
+
+  } while(ecount < TOTAL_ERROR_COUNT);
+
+  m_rT.FlushInput();
+
+#if defined(STAND_ALONE) && !defined(ARDUINO)
+  fputs("SendXmodem fail (total error count)\n", stderr);
+#endif // STAND_ALONE
+  return -2; // exit on error
+}
+
+
+/** \ingroup xmodem_engine
+  * \brief Poll with 'C' (8 times) then NAK (8 times) until the sender starts, then receive
+**/
+template<class Transport, class Storage, class Clock, int BlockSize, class CRC, class Progress>
+int XModemEngine<Transport, Storage, Clock, BlockSize, CRC, Progress>::Receive(void)
+{
+int i1;
+unsigned char bVal;
+
+  for(i1=0; i1 < 8; i1++) // start with CRC mode
+  {
+    PutChar(XM_CRC_NAK);
+
+    if(GetChar(bVal))
+    {
+      if(bVal == XM_SOH || (BlockSize > 128 && bVal == XM_STX)) // packet is on its way
+      {
+        return ReceiveLoop< XMCRC<CRC> >(bVal);
+      }
+      else if(bVal == XM_EOT) // an EOT [blank file?  allow this?]
+      {
+        return 0;
+      }
+      else if(bVal == XM_CAN) // cancel
+      {
+        return 1; // canceled
+      }
+    }
+  }
+
+  for(i1=0; i1 < 8; i1++) // try again, this time using XMODEM CHECKSUM
+  {
+    PutChar(XM_NAK);
+
+    if(GetChar(bVal))
+    {
+      if(bVal == XM_SOH)
+      {
+        return ReceiveLoop<XMCheckSum>(bVal);
+      }
+      else if(bVal == XM_EOT)
+      {
+        return 0;
+      }
+      else if(bVal == XM_CAN)
+      {
+        return 1;
+      }
+    }
+  }
+
+  m_rT.FlushInput();
+
+  return -3; // fail
+}
+
+
+/** \ingroup xmodem_engine
+  * \brief The receive loop, one instantiation for CHECKSUM and one for CRC (see 'ReceiveXmodem()')
+  *
+  * \param bHeader The SOH (or STX, for XMODEM-1K) that was already received
+**/
+template<class Transport, class Storage, class Clock, int BlockSize, class CRC, class Progress>
+template<class Check>
+int XModemEngine<Transport, Storage, Clock, BlockSize, CRC, Progress>::ReceiveLoop(unsigned char bHeader)
+{
+long filesize, block, etotal;
+int ecount, ec2, cbBlock, cbPacket;
+unsigned char bVal, cY;
+
+  ecount = 0;
+  etotal = 0;
+  filesize = 0;
+  block = 1;
+
+  do
+  {
+    cbBlock = (BlockSize > 128 && bHeader == XM_STX) ? BlockSize : 128;
+    cbPacket = 2 + cbBlock + Check::cbTrailer; // everything after the SOH
+
+    if(GetBlock(m_aBuf + 1, cbPacket) != cbPacket ||
+       m_aBuf[1] != (unsigned char)block ||
+       m_aBuf[2] != (unsigned char)~m_aBuf[1] ||
+       !Check::Verify(m_aBuf + 3, cbBlock, m_aBuf + 3 + cbBlock))
+    {
+      // did not receive properly
+      // TODO:  deal with repeated packet, sequence number for previous packet
+
+      m_rT.FlushInput(); // necessary to avoid problems
+
+      cY = block > 1 ? (unsigned char)XM_NAK : (unsigned char)Check::cPoll; // 'C' again for the first CRC block
+      XMODEM_METRIC(NAK_SENT);
+      XMODEM_PROBE2(xmodem__send__nak, block, ecount + 1);
+      ecount++; // for this packet
+      etotal++;
+    }
+    else
+    {
+      if(m_rS.Write(m_aBuf + 3, cbBlock) != cbBlock)
+      {
+        m_rT.FlushInput();
+        return -2; // write error on output file
+      }
+
+      cY = XM_ACK;
+      XMODEM_METRIC(BLOCK_RECEIVED);
+      XMODEM_PROBE2(xmodem__recv__packet, block, cbBlock);
+      block++;
+      filesize += cbBlock; // TODO:  need method to avoid extra crap at end of file
+      ecount = 0; // zero out error count for next packet
+    }
+
+    Progress::Report(block - 1, filesize, 0, ecount, etotal);
+
+    ec2 = 0; // error count #2
+
+    while(ecount < TOTAL_ERROR_COUNT && ec2 < ACK_ERROR_COUNT) // ** loop to get SOH or EOT character **
+    {
+      PutChar(cY); // ** output appropriate command char **
+
+      if(GetChar(bVal))
+      {
+        if(bVal == XM_CAN) // ** CTRL-X 'CAN' - terminate
+        {
+          m_rT.FlushInput();
+          return 1; // terminated
+        }
+        else if(bVal == XM_EOT) // ** EOT - end
+        {
+          PutChar(XM_ACK); // ** send an ACK (most XMODEM protocols expect THIS)
+          return 0; // I am done
+        }
+        else if(bVal == XM_SOH || (BlockSize > 128 && bVal == XM_STX)) // ** sending next packet
+        {
+          bHeader = bVal;
+          break; // leave this loop
+        }
+        else
+        {
+          m_rT.FlushInput(); // the character was unexpected
+
+          if(cY == XM_ACK) // if I was asking for the next block, NAK it, else repeat what I did last time
+          {
+            cY = XM_NAK;
+          }
+
+          ec2++;
+        }
+      }
+      else
+      {
+        ecount++; // increase total error count, and try writing the 'ACK' or 'NACK' again
+      }
+    }
+
+    if(ec2 >= ACK_ERROR_COUNT) // wasn't able to get a packet
+    {
+      break;
+    }
+
+  } while(ecount < TOTAL_ERROR_COUNT);
+
+  m_rT.FlushInput();
+  return 1; // terminated
+}
+
+
+#endif // _XMODEM_HPP_INCLUDED_
+
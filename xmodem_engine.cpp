@@ -0,0 +1,149 @@
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//  xmodem_engine.cpp - 'XSend' and 'XReceive' for sftardcal, instantiated  //
+//                      from the template engine in 'xmodem.hpp'            //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//          Copyright (c) 2012 by S.F.T. Inc. - All rights reserved         //
+//  Use, copying, and distribution of this software are licensed according  //
+//   to the LGPLv2.1, or a BSD-like license, as appropriate (see xmodem.h)  //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+
+// Built only when XMODEM_ENGINE is defined (see Makefile).  'xmodem.c' then leaves
+// out its own host versions of 'XSend' and 'XReceive', and these are linked instead.
+// Everything else in 'xmodem.c' (XSendSub, used by the fleet send) is unchanged.
+//
+// This file must not need the C++ runtime library, since the application is linked
+// with the C compiler.  So no 'new', no exceptions, and no function-level statics.
+
+#define SFTARDCAL /* same as 'sftardcal.c' does before including 'xmodem.c' */
+#include "sftmetrics.h"
+#include "sftprobes.h"
+#define XMODEM_METRIC(X) metrics_add(METRIC_XMODEM_##X, 1)
+#define XMODEM_PROBE1(X,A) SFT_PROBE1(X,A)
+#define XMODEM_PROBE2(X,A,B) SFT_PROBE2(X,A,B)
+#include "xmodem.hpp"
+
+#ifndef XMODEM_ENGINE_BLOCK_SIZE
+#define XMODEM_ENGINE_BLOCK_SIZE 128 /* 1024 for XMODEM-1K, but the ARDUINO end only does 128 */
+#endif // XMODEM_ENGINE_BLOCK_SIZE
+
+typedef XModemEngine<XMSftTransport, XMHostFile, XMHostClock, XMODEM_ENGINE_BLOCK_SIZE,
+                     XMCRC16Table, XMStderrProgress> XMHostEngine;
+
+
+extern "C" int XReceive(SERIAL_TYPE hSer, const char *szFilename, int nMode)
+{
+int iRval;
+FILE_TYPE hFile;
+#ifndef WIN32
+int iFlags;
+#endif // WIN32
+
+#ifdef WIN32
+  DeleteFile(szFilename);
+
+  nMode = nMode; // to avoid unused parameter warnings
+  hFile = CreateFile(szFilename, GENERIC_READ | GENERIC_WRITE,
+                     0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if(hFile == INVALID_HANDLE_VALUE)
+#else // WIN32
+  unlink(szFilename); // make sure it does not exist, first
+  hFile = open(szFilename, O_CREAT | O_TRUNC | O_WRONLY, nMode);
+
+  if(hFile == -1) // bad file handle on POSIX systems
+#endif // WIN32
+  {
+    fprintf(stderr, "XReceive fail \"%s\"  errno=%d\n", szFilename, errno);
+    return -9; // can't create file
+  }
+
+#ifndef WIN32
+  iFlags = fcntl(hSer, F_GETFL);
+#endif // WIN32
+
+  {
+    XMSftTransport xt(hSer);
+    XMHostFile xf(hFile);
+
+    iRval = XMHostEngine(xt, xf).Receive();
+  }
+
+#ifndef WIN32
+  if(iFlags == -1 || fcntl(hSer, F_SETFL, iFlags) == -1)
+  {
+    fprintf(stderr, "Warning:  'fcntl' call to restore flags failed, errno=%d\n", errno);
+  }
+#endif // WIN32
+
+#ifdef WIN32
+  CloseHandle(hFile);
+#else // WIN32
+  close(hFile);
+#endif // WIN32
+
+  if(iRval)
+  {
+#ifdef WIN32
+    DeleteFile(szFilename);
+#else // WIN32
+    unlink(szFilename); // delete file on error
+#endif // WIN32
+  }
+
+  return iRval;
+}
+
+extern "C" int XSend(SERIAL_TYPE hSer, const char *szFilename)
+{
+int iRval;
+FILE_TYPE hFile;
+#ifndef WIN32
+int iFlags;
+#endif // WIN32
+
+#ifdef WIN32
+  hFile = CreateFile(szFilename, GENERIC_READ,
+                     0, NULL, OPEN_EXISTING, 0, NULL);
+
+  if(hFile == INVALID_HANDLE_VALUE)
+#else // WIN32
+  hFile = open(szFilename, O_RDONLY, 0);
+
+  if(hFile == -1) // bad file handle on POSIX systems
+#endif // WIN32
+  {
+    fprintf(stderr, "XSend fail \"%s\"  errno=%d\n", szFilename, errno);
+    return -9; // can't open file
+  }
+
+#ifndef WIN32
+  iFlags = fcntl(hSer, F_GETFL);
+#endif // WIN32
+
+  {
+    XMSftTransport xt(hSer);
+    XMHostFile xf(hFile);
+
+    iRval = XMHostEngine(xt, xf).Send();
+  }
+
+#ifndef WIN32
+  if(iFlags == -1 || fcntl(hSer, F_SETFL, iFlags) == -1)
+  {
+    fprintf(stderr, "Warning:  'fcntl' call to restore flags failed, errno=%d\n", errno);
+  }
+#endif // WIN32
+
+#ifdef WIN32
+  CloseHandle(hFile);
+#else // WIN32
+  close(hFile);
+#endif // WIN32
+
+  return iRval;
+}
+